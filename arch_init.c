@@ -117,6 +117,10 @@ static int is_dup_page(uint8_t *page)
     VECTYPE val = SPLAT(page);
     int i;
 
+    if (*page == 0) {
+        return buffer_is_zero(page, TARGET_PAGE_SIZE);
+    }
+
     for (i = 0; i < TARGET_PAGE_SIZE / sizeof(VECTYPE); i++) {
         if (!ALL_EQ(val, p[i])) {
             return 0;
@@ -25,6 +25,7 @@
 #include "qemu-common.h"
 #include "qemu-aio.h"
 #include "main-loop.h"
+#include "replay.h"
 
 /* Anchor of the list of Bottom Halves belonging to the context */
 static struct QEMUBH *first_bh;
@@ -38,6 +39,7 @@ struct QEMUBH {
     int scheduled;
     int idle;
     int deleted;
+    int io;
     QEMUBH *next;
 };
 
@@ -52,7 +54,21 @@ QEMUBH *qemu_bh_new(QEMUBHFunc *cb, void *opaque)
     return bh;
 }
 
-int qemu_bh_poll(void)
+QEMUBH *qemu_bh_new_io(QEMUBHFunc *cb, void *opaque)
+{
+    QEMUBH *bh = qemu_bh_new(cb, opaque);
+    bh->io = 1;
+    return bh;
+}
+
+/* Under record/replay, guest bottom halves are run by replay_checkpoint()
+   rather than by the main loop.  */
+static bool qemu_bh_is_deferred(QEMUBH *bh)
+{
+    return replay_mode != REPLAY_MODE_NONE && !bh->io;
+}
+
+static int qemu_bh_poll_list(bool deferred, bool count_idle)
 {
     QEMUBH *bh, **bhp, *next;
     int ret;
@@ -63,9 +79,10 @@ int qemu_bh_poll(void)
     ret = 0;
     for (bh = first_bh; bh; bh = next) {
         next = bh->next;
-        if (!bh->deleted && bh->scheduled) {
+        if (!bh->deleted && bh->scheduled &&
+            qemu_bh_is_deferred(bh) == deferred) {
             bh->scheduled = 0;
-            if (!bh->idle)
+            if (!bh->idle || count_idle)
                 ret = 1;
             bh->idle = 0;
             bh->cb(bh->opaque);
@@ -91,6 +108,18 @@ int qemu_bh_poll(void)
     return ret;
 }
 
+int qemu_bh_poll(void)
+{
+    return qemu_bh_poll_list(false, false);
+}
+
+/* Run the guest bottom halves that record/replay holds back, including
+   idle ones.  Returns whether any ran.  */
+int qemu_bh_poll_guest(void)
+{
+    return qemu_bh_poll_list(true, true);
+}
+
 void qemu_bh_schedule_idle(QEMUBH *bh)
 {
     if (bh->scheduled)
@@ -125,7 +154,7 @@ void qemu_bh_update_timeout(int *timeout)
     QEMUBH *bh;
 
     for (bh = first_bh; bh; bh = bh->next) {
-        if (!bh->deleted && bh->scheduled) {
+        if (!bh->deleted && bh->scheduled && !qemu_bh_is_deferred(bh)) {
             if (bh->idle) {
                 /* idle bottom halves will be polled at least
                  * every 10ms */
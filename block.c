@@ -31,6 +31,8 @@
 #include "qemu-coroutine.h"
 #include "qmp-commands.h"
 #include "qemu-timer.h"
+#include "host-utils.h"
+#include "replay.h"
 
 #ifdef CONFIG_BSD
 #include <sys/types.h>
@@ -78,6 +80,7 @@ static BlockDriverAIOCB *bdrv_co_aio_rw_vector(BlockDriverState *bs,
                                                void *opaque,
                                                bool is_write);
 static void coroutine_fn bdrv_co_do_rw(void *opaque);
+static void bdrv_resize_dirty_bitmaps(BlockDriverState *bs);
 
 static bool bdrv_exceed_bps_limits(BlockDriverState *bs, int nb_sectors,
         bool is_write, double elapsed_time, uint64_t *wait);
@@ -819,6 +822,9 @@ void bdrv_close(BlockDriverState *bs)
             bs->backing_hd = NULL;
         }
         bs->drv->bdrv_close(bs);
+        while (!QLIST_EMPTY(&bs->dirty_bitmaps)) {
+            bdrv_release_dirty_bitmap(bs, QLIST_FIRST(&bs->dirty_bitmaps));
+        }
         g_free(bs->opaque);
 #ifdef _WIN32
         if (bs->is_temporary) {
@@ -988,16 +994,17 @@ bool bdrv_dev_is_medium_locked(BlockDriverState *bs)
  *
  * Returns 0 if the check could be completed (it doesn't mean that the image is
  * free of errors) or -errno when an internal error occurred. The results of the
- * check are stored in res.
+ * check are stored in res.  fix selects the kinds of errors that the driver
+ * repairs if it can.
  */
-int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res)
+int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix)
 {
     if (bs->drv->bdrv_check == NULL) {
         return -ENOTSUP;
     }
 
     memset(res, 0, sizeof(*res));
-    return bs->drv->bdrv_check(bs, res);
+    return bs->drv->bdrv_check(bs, res, fix);
 }
 
 #define COMMIT_BUF_SECTORS 2048
@@ -1375,6 +1382,52 @@ static void set_dirty_bitmap(BlockDriverState *bs, int64_t sector_num,
     }
 }
 
+static void dirty_bitmap_update(BdrvDirtyBitmap *bitmap, int64_t sector_num,
+                                int nb_sectors, int dirty)
+{
+    int64_t sectors_per_chunk = bitmap->granularity >> BDRV_SECTOR_BITS;
+    int64_t start, end;
+    unsigned long val, idx, bit;
+
+    if (nb_sectors <= 0) {
+        return;
+    }
+    start = sector_num / sectors_per_chunk;
+    end = MIN((sector_num + nb_sectors - 1) / sectors_per_chunk,
+              bitmap->nb_chunks - 1);
+
+    for (; start <= end; start++) {
+        idx = start / (sizeof(unsigned long) * 8);
+        bit = start % (sizeof(unsigned long) * 8);
+        val = bitmap->bitmap[idx];
+        if (dirty) {
+            if (!(val & (1UL << bit))) {
+                bitmap->count++;
+                val |= 1UL << bit;
+            }
+        } else {
+            if (val & (1UL << bit)) {
+                bitmap->count--;
+                val &= ~(1UL << bit);
+            }
+        }
+        bitmap->bitmap[idx] = val;
+    }
+}
+
+static void bdrv_set_dirty(BlockDriverState *bs, int64_t sector_num,
+                           int nb_sectors)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    if (bs->dirty_bitmap) {
+        set_dirty_bitmap(bs, sector_num, nb_sectors, 1);
+    }
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        dirty_bitmap_update(bitmap, sector_num, nb_sectors, 1);
+    }
+}
+
 /* Return < 0 if error. Important errors are:
   -EIO         generic I/O error (may happen for all errors)
   -ENOMEDIUM   No media inserted.
@@ -1642,6 +1695,49 @@ int coroutine_fn bdrv_co_copy_on_readv(BlockDriverState *bs,
 /*
  * Handle a write request in coroutine context
  */
+/*
+ * Handle an all-zero write for detect_zeroes.  Only called for images whose
+ * unallocated sectors read as zeroes, so the write can be dropped wherever
+ * the image is not allocated yet.  With detect_zeroes=unmap the range is
+ * discarded first; whatever the driver could not discard is written.
+ */
+static int coroutine_fn bdrv_co_do_write_zeroes(BlockDriverState *bs,
+    int64_t sector_num, int nb_sectors, QEMUIOVector *qiov)
+{
+    QEMUIOVector part;
+    int64_t skip = 0;
+    int ret = 0, n;
+
+    if (bs->detect_zeroes == BDRV_DETECT_ZEROES_UNMAP) {
+        bdrv_co_discard(bs, sector_num, nb_sectors);
+    }
+
+    qemu_iovec_init(&part, qiov->niov);
+    while (nb_sectors > 0) {
+        ret = bdrv_co_is_allocated(bs, sector_num, nb_sectors, &n);
+        if (ret < 0 || n == 0) {
+            /* don't know, so write it */
+            n = nb_sectors;
+            ret = 1;
+        }
+        if (ret) {
+            qemu_iovec_reset(&part);
+            qemu_iovec_copy(&part, qiov, skip << BDRV_SECTOR_BITS,
+                            n << BDRV_SECTOR_BITS);
+            ret = bs->drv->bdrv_co_writev(bs, sector_num, n, &part);
+            if (ret < 0) {
+                break;
+            }
+        }
+        sector_num += n;
+        nb_sectors -= n;
+        skip += n;
+        ret = 0;
+    }
+    qemu_iovec_destroy(&part);
+    return ret;
+}
+
 static int coroutine_fn bdrv_co_do_writev(BlockDriverState *bs,
     int64_t sector_num, int nb_sectors, QEMUIOVector *qiov)
 {
@@ -1664,18 +1760,26 @@ static int coroutine_fn bdrv_co_do_writev(BlockDriverState *bs,
         bdrv_io_limits_intercept(bs, true, nb_sectors);
     }
 
+    if (bs->job && bs->job->job_type->before_write) {
+        bs->job->job_type->before_write(bs->job, sector_num, nb_sectors);
+    }
+
     if (bs->copy_on_read_in_flight) {
         wait_for_overlapping_requests(bs, sector_num, nb_sectors);
     }
 
     tracked_request_begin(&req, bs, sector_num, nb_sectors, true);
 
-    ret = drv->bdrv_co_writev(bs, sector_num, nb_sectors, qiov);
-
-    if (bs->dirty_bitmap) {
-        set_dirty_bitmap(bs, sector_num, nb_sectors, 1);
+    if (bs->detect_zeroes != BDRV_DETECT_ZEROES_OFF &&
+        !bs->backing_hd && bdrv_has_zero_init(bs) &&
+        qemu_iovec_is_zero(qiov)) {
+        ret = bdrv_co_do_write_zeroes(bs, sector_num, nb_sectors, qiov);
+    } else {
+        ret = drv->bdrv_co_writev(bs, sector_num, nb_sectors, qiov);
     }
 
+    bdrv_set_dirty(bs, sector_num, nb_sectors);
+
     if (bs->wr_highest_sector < sector_num + nb_sectors - 1) {
         bs->wr_highest_sector = sector_num + nb_sectors - 1;
     }
@@ -1711,6 +1815,7 @@ int bdrv_truncate(BlockDriverState *bs, int64_t offset)
     ret = drv->bdrv_truncate(bs, offset);
     if (ret == 0) {
         ret = refresh_total_sectors(bs, offset >> BDRV_SECTOR_BITS);
+        bdrv_resize_dirty_bitmaps(bs);
         bdrv_dev_resize_cb(bs);
     }
     return ret;
@@ -2024,6 +2129,20 @@ void bdrv_set_on_error(BlockDriverState *bs, BlockErrorAction on_read_error,
     bs->on_write_error = on_write_error;
 }
 
+void bdrv_set_detect_zeroes(BlockDriverState *bs, BdrvDetectZeroes mode)
+{
+    bs->detect_zeroes = mode;
+}
+
+/* Takes effect when the image is opened */
+void bdrv_set_metadata_cache(BlockDriverState *bs, int64_t l2_cache_size,
+                             int64_t refcount_cache_size, int clean_interval)
+{
+    bs->l2_cache_size = l2_cache_size;
+    bs->refcount_cache_size = refcount_cache_size;
+    bs->cache_clean_interval = clean_interval;
+}
+
 BlockErrorAction bdrv_get_on_error(BlockDriverState *bs, int is_read)
 {
     return is_read ? bs->on_read_error : bs->on_write_error;
@@ -2297,6 +2416,24 @@ BlockInfoList *qmp_query_block(Error **errp)
             info->value->io_status = bs->iostatus;
         }
 
+        if (!QLIST_EMPTY(&bs->dirty_bitmaps)) {
+            BlockDirtyInfoList **plist = &info->value->dirty_bitmaps;
+            BdrvDirtyBitmap *bitmap;
+
+            QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+                BlockDirtyInfoList *entry = g_malloc0(sizeof(*entry));
+
+                entry->value = g_malloc0(sizeof(*entry->value));
+                entry->value->name = g_strdup(bitmap->name);
+                entry->value->granularity = bitmap->granularity;
+                entry->value->count = bitmap->count * bitmap->granularity;
+                entry->value->persistent = bitmap->persistent;
+                *plist = entry;
+                plist = &entry->next;
+            }
+            info->value->has_dirty_bitmaps = true;
+        }
+
         if (bs->drv) {
             info->value->has_inserted = true;
             info->value->inserted = g_malloc0(sizeof(*info->value->inserted));
@@ -2337,10 +2474,29 @@ BlockInfoList *qmp_query_block(Error **errp)
     return head;
 }
 
+static BlockHistogramBucketList *bdrv_histogram(const uint64_t *counts,
+                                                int nb_buckets)
+{
+    BlockHistogramBucketList *head = NULL, **tail = &head;
+    int i;
+
+    for (i = 0; i < nb_buckets; i++) {
+        BlockHistogramBucketList *item = g_malloc0(sizeof(*item));
+
+        item->value = g_malloc0(sizeof(*item->value));
+        item->value->max = (i < nb_buckets - 1) ? (1LL << i) : -1;
+        item->value->count = counts[i];
+        *tail = item;
+        tail = &item->next;
+    }
+    return head;
+}
+
 /* Consider exposing this as a full fledged QMP command */
 static BlockStats *qmp_query_blockstat(const BlockDriverState *bs, Error **errp)
 {
     BlockStats *s;
+    BlockDriverInfo bdi;
 
     s = g_malloc0(sizeof(*s));
 
@@ -2360,6 +2516,28 @@ static BlockStats *qmp_query_blockstat(const BlockDriverState *bs, Error **errp)
     s->stats->rd_total_time_ns = bs->total_time_ns[BDRV_ACCT_READ];
     s->stats->flush_total_time_ns = bs->total_time_ns[BDRV_ACCT_FLUSH];
 
+    if (bdrv_get_info((BlockDriverState *)bs, &bdi) < 0) {
+        memset(&bdi, 0, sizeof(bdi));
+    }
+    if (bdi.has_cache_stats) {
+        s->stats->has_l2_cache_hits = true;
+        s->stats->l2_cache_hits = bdi.l2_cache_hits;
+        s->stats->has_l2_cache_misses = true;
+        s->stats->l2_cache_misses = bdi.l2_cache_misses;
+        s->stats->has_refcount_cache_hits = true;
+        s->stats->refcount_cache_hits = bdi.refcount_cache_hits;
+        s->stats->has_refcount_cache_misses = true;
+        s->stats->refcount_cache_misses = bdi.refcount_cache_misses;
+    }
+    if (bdi.has_queue_stats) {
+        s->stats->has_queue_depth = true;
+        s->stats->queue_depth = bdrv_histogram(bdi.queue_depth_hist,
+                                               BDRV_QUEUE_DEPTH_BUCKETS);
+        s->stats->has_latency_us = true;
+        s->stats->latency_us = bdrv_histogram(bdi.latency_hist,
+                                              BDRV_LATENCY_BUCKETS);
+    }
+
     if (bs->file) {
         s->has_parent = true;
         s->parent = qmp_query_blockstat(bs->file, NULL);
@@ -2416,13 +2594,53 @@ int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
     if (bdrv_check_request(bs, sector_num, nb_sectors))
         return -EIO;
 
-    if (bs->dirty_bitmap) {
-        set_dirty_bitmap(bs, sector_num, nb_sectors, 1);
-    }
+    bdrv_set_dirty(bs, sector_num, nb_sectors);
 
     return drv->bdrv_write_compressed(bs, sector_num, buf, nb_sectors);
 }
 
+/*
+ * Compress one cluster of @buf into @out_buf, which must be at least one
+ * cluster large, using zlib level @level (or Z_DEFAULT_COMPRESSION, -1).
+ * Does not access the image, so it may be called from any thread.
+ *
+ * Returns the compressed size, 0 if the cluster does not compress and must
+ * be stored as is, or -errno.
+ */
+int bdrv_compress_cluster(BlockDriverState *bs, const uint8_t *buf,
+                          uint8_t *out_buf, int level)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return -ENOMEDIUM;
+    if (!drv->bdrv_compress_cluster)
+        return -ENOTSUP;
+
+    return drv->bdrv_compress_cluster(bs, buf, out_buf, level);
+}
+
+/*
+ * Store a cluster compressed by bdrv_compress_cluster().  @buf is the
+ * uncompressed data, which is written instead if @out_len is 0.
+ */
+int bdrv_write_compressed_data(BlockDriverState *bs, int64_t sector_num,
+                               const uint8_t *buf, int nb_sectors,
+                               const uint8_t *out_buf, int out_len)
+{
+    BlockDriver *drv = bs->drv;
+    if (!drv)
+        return -ENOMEDIUM;
+    if (!drv->bdrv_write_compressed_data)
+        return -ENOTSUP;
+    if (bdrv_check_request(bs, sector_num, nb_sectors))
+        return -EIO;
+
+    bdrv_set_dirty(bs, sector_num, nb_sectors);
+
+    return drv->bdrv_write_compressed_data(bs, sector_num, buf,
+                                           out_buf, out_len);
+}
+
 int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
 {
     BlockDriver *drv = bs->drv;
@@ -2536,10 +2754,9 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
 
     if (!drv)
         return -ENOMEDIUM;
-    if (drv->bdrv_snapshot_goto)
-        return drv->bdrv_snapshot_goto(bs, snapshot_id);
-
-    if (bs->file) {
+    if (drv->bdrv_snapshot_goto) {
+        ret = drv->bdrv_snapshot_goto(bs, snapshot_id);
+    } else if (bs->file) {
         drv->bdrv_close(bs);
         ret = bdrv_snapshot_goto(bs->file, snapshot_id);
         open_ret = drv->bdrv_open(bs, bs->open_flags);
@@ -2548,10 +2765,19 @@ int bdrv_snapshot_goto(BlockDriverState *bs,
             bs->drv = NULL;
             return open_ret;
         }
-        return ret;
+    } else {
+        return -ENOTSUP;
     }
 
-    return -ENOTSUP;
+    /* Any part of the disk may have changed */
+    if (ret >= 0) {
+        BdrvDirtyBitmap *bitmap;
+
+        QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+            bdrv_dirty_bitmap_set_all(bitmap);
+        }
+    }
+    return ret;
 }
 
 int bdrv_snapshot_delete(BlockDriverState *bs, const char *snapshot_id)
@@ -2906,6 +3132,34 @@ void bdrv_aio_cancel(BlockDriverAIOCB *acb)
     acb->pool->cancel(acb);
 }
 
+/*
+ * Requests submitted between bdrv_io_plug() and bdrv_io_unplug() may be
+ * queued and handed to the host together.  Calls nest; the queue is
+ * submitted when the outermost bdrv_io_unplug() is reached.  Format
+ * drivers pass the hint on to the protocol they sit on.
+ */
+void bdrv_io_plug(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (drv && drv->bdrv_io_plug) {
+        drv->bdrv_io_plug(bs);
+    } else if (bs->file) {
+        bdrv_io_plug(bs->file);
+    }
+}
+
+void bdrv_io_unplug(BlockDriverState *bs)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (drv && drv->bdrv_io_unplug) {
+        drv->bdrv_io_unplug(bs);
+    } else if (bs->file) {
+        bdrv_io_unplug(bs->file);
+    }
+}
+
 /* block I/O throttling */
 static bool bdrv_exceed_bps_limits(BlockDriverState *bs, int nb_sectors,
                  bool is_write, double elapsed_time, uint64_t *wait)
@@ -3126,7 +3380,7 @@ static BlockDriverAIOCB *bdrv_aio_rw_vector(BlockDriverState *bs,
     acb->is_write = is_write;
     acb->qiov = qiov;
     acb->bounce = qemu_blockalign(bs, qiov->size);
-    acb->bh = qemu_bh_new(bdrv_aio_bh_cb, acb);
+    acb->bh = qemu_bh_new_io(bdrv_aio_bh_cb, acb);
 
     if (is_write) {
         qemu_iovec_to_buffer(acb->qiov, acb->bounce);
@@ -3160,11 +3414,13 @@ typedef struct BlockDriverAIOCBCoroutine {
     BlockRequest req;
     bool is_write;
     QEMUBH* bh;
+    uint64_t replay_id;
 } BlockDriverAIOCBCoroutine;
 
 static void bdrv_aio_co_cancel_em(BlockDriverAIOCB *blockacb)
 {
     qemu_aio_flush();
+    replay_block_flush();
 }
 
 static AIOPool bdrv_em_co_aio_pool = {
@@ -3176,7 +3432,12 @@ static void bdrv_co_em_bh(void *opaque)
 {
     BlockDriverAIOCBCoroutine *acb = opaque;
 
-    acb->common.cb(acb->common.opaque, acb->req.error);
+    if (acb->replay_id) {
+        replay_block_complete(acb->replay_id, acb->common.cb,
+                              acb->common.opaque, acb->req.error);
+    } else {
+        acb->common.cb(acb->common.opaque, acb->req.error);
+    }
     qemu_bh_delete(acb->bh);
     qemu_aio_release(acb);
 }
@@ -3195,7 +3456,7 @@ static void coroutine_fn bdrv_co_do_rw(void *opaque)
             acb->req.nb_sectors, acb->req.qiov);
     }
 
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = qemu_bh_new_io(bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3215,6 +3476,7 @@ static BlockDriverAIOCB *bdrv_co_aio_rw_vector(BlockDriverState *bs,
     acb->req.nb_sectors = nb_sectors;
     acb->req.qiov = qiov;
     acb->is_write = is_write;
+    acb->replay_id = bs->dev ? replay_block_request() : 0;
 
     co = qemu_coroutine_create(bdrv_co_do_rw);
     qemu_coroutine_enter(co, acb);
@@ -3228,7 +3490,7 @@ static void coroutine_fn bdrv_aio_flush_co_entry(void *opaque)
     BlockDriverState *bs = acb->common.bs;
 
     acb->req.error = bdrv_co_flush(bs);
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = qemu_bh_new_io(bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3241,6 +3503,7 @@ BlockDriverAIOCB *bdrv_aio_flush(BlockDriverState *bs,
     BlockDriverAIOCBCoroutine *acb;
 
     acb = qemu_aio_get(&bdrv_em_co_aio_pool, bs, cb, opaque);
+    acb->replay_id = bs->dev ? replay_block_request() : 0;
     co = qemu_coroutine_create(bdrv_aio_flush_co_entry);
     qemu_coroutine_enter(co, acb);
 
@@ -3253,7 +3516,7 @@ static void coroutine_fn bdrv_aio_discard_co_entry(void *opaque)
     BlockDriverState *bs = acb->common.bs;
 
     acb->req.error = bdrv_co_discard(bs, acb->req.sector, acb->req.nb_sectors);
-    acb->bh = qemu_bh_new(bdrv_co_em_bh, acb);
+    acb->bh = qemu_bh_new_io(bdrv_co_em_bh, acb);
     qemu_bh_schedule(acb->bh);
 }
 
@@ -3269,6 +3532,7 @@ BlockDriverAIOCB *bdrv_aio_discard(BlockDriverState *bs,
     acb = qemu_aio_get(&bdrv_em_co_aio_pool, bs, cb, opaque);
     acb->req.sector = sector_num;
     acb->req.nb_sectors = nb_sectors;
+    acb->replay_id = bs->dev ? replay_block_request() : 0;
     co = qemu_coroutine_create(bdrv_aio_discard_co_entry);
     qemu_coroutine_enter(co, acb);
 
@@ -3481,7 +3745,14 @@ int coroutine_fn bdrv_co_discard(BlockDriverState *bs, int64_t sector_num,
         return -EIO;
     } else if (bs->read_only) {
         return -EROFS;
-    } else if (bs->drv->bdrv_co_discard) {
+    }
+
+    if (bs->job && bs->job->job_type->before_write) {
+        bs->job->job_type->before_write(bs->job, sector_num, nb_sectors);
+    }
+    bdrv_set_dirty(bs, sector_num, nb_sectors);
+
+    if (bs->drv->bdrv_co_discard) {
         return bs->drv->bdrv_co_discard(bs, sector_num, nb_sectors);
     } else if (bs->drv->bdrv_aio_discard) {
         BlockDriverAIOCB *acb;
@@ -3661,6 +3932,241 @@ int64_t bdrv_get_dirty_count(BlockDriverState *bs)
     return bs->dirty_count;
 }
 
+static int64_t dirty_bitmap_chunks(BlockDriverState *bs, int granularity)
+{
+    return DIV_ROUND_UP(bdrv_getlength(bs), granularity);
+}
+
+static unsigned long *dirty_bitmap_alloc(int64_t nb_chunks)
+{
+    int64_t bits = sizeof(unsigned long) * 8;
+
+    return g_malloc0(DIV_ROUND_UP(nb_chunks, bits) * sizeof(unsigned long));
+}
+
+/*
+ * Creates a dirty bitmap that is updated on every write to @bs.
+ * @granularity is the number of bytes covered by one bit, a power of two
+ * of at least BDRV_SECTOR_SIZE.  The bitmap starts out clean.
+ */
+BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
+                                          const char *name, int granularity)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    assert(granularity >= BDRV_SECTOR_SIZE &&
+           (granularity & (granularity - 1)) == 0);
+
+    bitmap = g_malloc0(sizeof(*bitmap));
+    bitmap->name = g_strdup(name);
+    bitmap->granularity = granularity;
+    bitmap->nb_chunks = dirty_bitmap_chunks(bs, granularity);
+    bitmap->bitmap = dirty_bitmap_alloc(bitmap->nb_chunks);
+    QLIST_INSERT_HEAD(&bs->dirty_bitmaps, bitmap, list);
+    return bitmap;
+}
+
+BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        if (!strcmp(bitmap->name, name)) {
+            return bitmap;
+        }
+    }
+    return NULL;
+}
+
+void bdrv_release_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
+{
+    QLIST_REMOVE(bitmap, list);
+    bdrv_free_dirty_bitmap(bitmap);
+}
+
+/* Frees a bitmap returned by bdrv_dirty_bitmap_copy() */
+void bdrv_free_dirty_bitmap(BdrvDirtyBitmap *bitmap)
+{
+    g_free(bitmap->name);
+    g_free(bitmap->bitmap);
+    g_free(bitmap);
+}
+
+/*
+ * Returns 0 if a new dirty bitmap called name can be made persistent,
+ * -ENOTSUP if the format can't store dirty bitmaps, -ENAMETOOLONG if it can't
+ * store this name or -ENOSPC if there is no room left for another bitmap.
+ */
+int bdrv_check_persistent_dirty_bitmap(BlockDriverState *bs, const char *name)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (!drv || !drv->bdrv_check_persistent_dirty_bitmap) {
+        return -ENOTSUP;
+    }
+    return drv->bdrv_check_persistent_dirty_bitmap(bs, name);
+}
+
+/* New chunks after a resize are dirty, they have never been backed up */
+static void bdrv_resize_dirty_bitmaps(BlockDriverState *bs)
+{
+    BdrvDirtyBitmap *bitmap;
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        int64_t old_chunks = bitmap->nb_chunks;
+        unsigned long *old = bitmap->bitmap;
+        int64_t i, bits = sizeof(unsigned long) * 8;
+
+        bitmap->nb_chunks = dirty_bitmap_chunks(bs, bitmap->granularity);
+        bitmap->bitmap = dirty_bitmap_alloc(bitmap->nb_chunks);
+        bitmap->count = 0;
+        for (i = 0; i < bitmap->nb_chunks; i++) {
+            if (i >= old_chunks || (old[i / bits] & (1UL << (i % bits)))) {
+                bitmap->bitmap[i / bits] |= 1UL << (i % bits);
+                bitmap->count++;
+            }
+        }
+        g_free(old);
+    }
+}
+
+int bdrv_dirty_bitmap_get(BdrvDirtyBitmap *bitmap, int64_t sector)
+{
+    int64_t chunk = (sector << BDRV_SECTOR_BITS) / bitmap->granularity;
+    int64_t bits = sizeof(unsigned long) * 8;
+
+    if (chunk >= bitmap->nb_chunks) {
+        return 0;
+    }
+    return !!(bitmap->bitmap[chunk / bits] & (1UL << (chunk % bits)));
+}
+
+/*
+ * Returns the first sector of the first dirty chunk that contains or
+ * follows @sector, or -1 if there is none.
+ */
+int64_t bdrv_dirty_bitmap_next(BdrvDirtyBitmap *bitmap, int64_t sector)
+{
+    int64_t chunk = (sector << BDRV_SECTOR_BITS) / bitmap->granularity;
+    int64_t bits = sizeof(unsigned long) * 8;
+
+    while (chunk < bitmap->nb_chunks) {
+        unsigned long val = bitmap->bitmap[chunk / bits] >> (chunk % bits);
+
+        if (val) {
+            chunk += ctz64(val);
+            if (chunk >= bitmap->nb_chunks) {
+                break;
+            }
+            return chunk * (bitmap->granularity >> BDRV_SECTOR_BITS);
+        }
+        chunk += bits - chunk % bits;
+    }
+    return -1;
+}
+
+void bdrv_dirty_bitmap_set(BdrvDirtyBitmap *bitmap, int64_t sector_num,
+                           int nb_sectors)
+{
+    dirty_bitmap_update(bitmap, sector_num, nb_sectors, 1);
+}
+
+void bdrv_dirty_bitmap_reset(BdrvDirtyBitmap *bitmap, int64_t sector_num,
+                             int nb_sectors)
+{
+    dirty_bitmap_update(bitmap, sector_num, nb_sectors, 0);
+}
+
+void bdrv_dirty_bitmap_set_all(BdrvDirtyBitmap *bitmap)
+{
+    int64_t i, bits = sizeof(unsigned long) * 8;
+
+    for (i = 0; i < bitmap->nb_chunks; i++) {
+        bitmap->bitmap[i / bits] |= 1UL << (i % bits);
+    }
+    bitmap->count = bitmap->nb_chunks;
+}
+
+/*
+ * Returns an anonymous copy of @bitmap, which is not updated by writes and
+ * must be freed with bdrv_free_dirty_bitmap().
+ */
+BdrvDirtyBitmap *bdrv_dirty_bitmap_copy(BdrvDirtyBitmap *bitmap)
+{
+    BdrvDirtyBitmap *copy = g_malloc0(sizeof(*copy));
+    int64_t bits = sizeof(unsigned long) * 8;
+
+    copy->granularity = bitmap->granularity;
+    copy->nb_chunks = bitmap->nb_chunks;
+    copy->count = bitmap->count;
+    copy->bitmap = g_memdup(bitmap->bitmap,
+                            DIV_ROUND_UP(bitmap->nb_chunks, bits) *
+                            sizeof(unsigned long));
+    return copy;
+}
+
+void bdrv_dirty_bitmap_clear(BdrvDirtyBitmap *bitmap)
+{
+    int64_t bits = sizeof(unsigned long) * 8;
+
+    memset(bitmap->bitmap, 0,
+           DIV_ROUND_UP(bitmap->nb_chunks, bits) * sizeof(unsigned long));
+    bitmap->count = 0;
+}
+
+/* Marks the chunks that are dirty in @src dirty in @bitmap as well */
+void bdrv_dirty_bitmap_merge(BdrvDirtyBitmap *bitmap, BdrvDirtyBitmap *src)
+{
+    int64_t i, bits = sizeof(unsigned long) * 8;
+
+    assert(bitmap->granularity == src->granularity);
+    for (i = 0; i < MIN(bitmap->nb_chunks, src->nb_chunks); i++) {
+        unsigned long mask = 1UL << (i % bits);
+
+        if ((src->bitmap[i / bits] & mask) &&
+            !(bitmap->bitmap[i / bits] & mask)) {
+            bitmap->bitmap[i / bits] |= mask;
+            bitmap->count++;
+        }
+    }
+}
+
+/*
+ * The serialized form stores chunk i in bit (i % 8) of byte (i / 8),
+ * independent of the host word size and endianness.
+ */
+size_t bdrv_dirty_bitmap_serialized_size(BdrvDirtyBitmap *bitmap)
+{
+    return DIV_ROUND_UP(bitmap->nb_chunks, 8);
+}
+
+void bdrv_dirty_bitmap_serialize(BdrvDirtyBitmap *bitmap, uint8_t *buf)
+{
+    int64_t i, bits = sizeof(unsigned long) * 8;
+
+    memset(buf, 0, bdrv_dirty_bitmap_serialized_size(bitmap));
+    for (i = 0; i < bitmap->nb_chunks; i++) {
+        if (bitmap->bitmap[i / bits] & (1UL << (i % bits))) {
+            buf[i / 8] |= 1 << (i % 8);
+        }
+    }
+}
+
+void bdrv_dirty_bitmap_deserialize(BdrvDirtyBitmap *bitmap,
+                                   const uint8_t *buf)
+{
+    int64_t i, bits = sizeof(unsigned long) * 8;
+
+    bdrv_dirty_bitmap_clear(bitmap);
+    for (i = 0; i < bitmap->nb_chunks; i++) {
+        if (buf[i / 8] & (1 << (i % 8))) {
+            bitmap->bitmap[i / bits] |= 1UL << (i % bits);
+            bitmap->count++;
+        }
+    }
+}
+
 void bdrv_set_in_use(BlockDriverState *bs, int in_use)
 {
     assert(bs->in_use != in_use);
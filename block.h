@@ -10,11 +10,26 @@
 /* block.c */
 typedef struct BlockDriver BlockDriver;
 
+/* Bucket i of the histograms counts values up to 2^i, the last one the rest */
+#define BDRV_QUEUE_DEPTH_BUCKETS 9     /* 1 .. 128 requests */
+#define BDRV_LATENCY_BUCKETS     22    /* 1 us .. 1 s */
+
 typedef struct BlockDriverInfo {
     /* in bytes, 0 if irrelevant */
     int cluster_size;
     /* offset at which the VM state can be saved (0 if not possible) */
     int64_t vm_state_offset;
+    /* lookups in the metadata caches of the format, if it has them */
+    bool has_cache_stats;
+    uint64_t l2_cache_hits;
+    uint64_t l2_cache_misses;
+    uint64_t refcount_cache_hits;
+    uint64_t refcount_cache_misses;
+    /* requests in flight at submission and their latency in microseconds,
+       for drivers that queue requests on the host */
+    bool has_queue_stats;
+    uint64_t queue_depth_hist[BDRV_QUEUE_DEPTH_BUCKETS];
+    uint64_t latency_hist[BDRV_LATENCY_BUCKETS];
 } BlockDriverInfo;
 
 typedef struct QEMUSnapshotInfo {
@@ -83,6 +98,10 @@ typedef enum {
     BLOCK_ERR_STOP_ANY
 } BlockErrorAction;
 
+typedef enum {
+    BDRV_DETECT_ZEROES_OFF, BDRV_DETECT_ZEROES_ON, BDRV_DETECT_ZEROES_UNMAP
+} BdrvDetectZeroes;
+
 typedef enum {
     BDRV_ACTION_REPORT, BDRV_ACTION_IGNORE, BDRV_ACTION_STOP
 } BlockMonEventAction;
@@ -166,9 +185,16 @@ typedef struct BdrvCheckResult {
     int corruptions;
     int leaks;
     int check_errors;
+    int corruptions_fixed;
+    int leaks_fixed;
 } BdrvCheckResult;
 
-int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res);
+typedef enum {
+    BDRV_FIX_LEAKS    = 1,
+    BDRV_FIX_ERRORS   = 2,
+} BdrvCheckMode;
+
+int bdrv_check(BlockDriverState *bs, BdrvCheckResult *res, BdrvCheckMode fix);
 
 /* async block I/O */
 typedef struct BlockDriverAIOCB BlockDriverAIOCB;
@@ -203,6 +229,9 @@ typedef struct BlockRequest {
 int bdrv_aio_multiwrite(BlockDriverState *bs, BlockRequest *reqs,
     int num_reqs);
 
+void bdrv_io_plug(BlockDriverState *bs);
+void bdrv_io_unplug(BlockDriverState *bs);
+
 /* sg packet commands */
 int bdrv_ioctl(BlockDriverState *bs, unsigned long int req, void *buf);
 BlockDriverAIOCB *bdrv_aio_ioctl(BlockDriverState *bs,
@@ -251,6 +280,10 @@ int bdrv_get_translation_hint(BlockDriverState *bs);
 void bdrv_set_on_error(BlockDriverState *bs, BlockErrorAction on_read_error,
                        BlockErrorAction on_write_error);
 BlockErrorAction bdrv_get_on_error(BlockDriverState *bs, int is_read);
+void bdrv_set_detect_zeroes(BlockDriverState *bs, BdrvDetectZeroes mode);
+#define BDRV_CACHE_SIZE_MAX -1
+void bdrv_set_metadata_cache(BlockDriverState *bs, int64_t l2_cache_size,
+                             int64_t refcount_cache_size, int clean_interval);
 int bdrv_is_read_only(BlockDriverState *bs);
 int bdrv_is_sg(BlockDriverState *bs);
 int bdrv_enable_write_cache(BlockDriverState *bs);
@@ -272,6 +305,11 @@ void bdrv_iterate_format(void (*it)(void *opaque, const char *name),
 const char *bdrv_get_device_name(BlockDriverState *bs);
 int bdrv_write_compressed(BlockDriverState *bs, int64_t sector_num,
                           const uint8_t *buf, int nb_sectors);
+int bdrv_compress_cluster(BlockDriverState *bs, const uint8_t *buf,
+                          uint8_t *out_buf, int level);
+int bdrv_write_compressed_data(BlockDriverState *bs, int64_t sector_num,
+                               const uint8_t *buf, int nb_sectors,
+                               const uint8_t *out_buf, int out_len);
 int bdrv_get_info(BlockDriverState *bs, BlockDriverInfo *bdi);
 
 const char *bdrv_get_encrypted_filename(BlockDriverState *bs);
@@ -318,6 +356,32 @@ void bdrv_reset_dirty(BlockDriverState *bs, int64_t cur_sector,
                       int nr_sectors);
 int64_t bdrv_get_dirty_count(BlockDriverState *bs);
 
+/* Named dirty bitmaps, tracking guest writes for incremental backup */
+typedef struct BdrvDirtyBitmap BdrvDirtyBitmap;
+
+BdrvDirtyBitmap *bdrv_create_dirty_bitmap(BlockDriverState *bs,
+                                          const char *name, int granularity);
+BdrvDirtyBitmap *bdrv_find_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name);
+void bdrv_release_dirty_bitmap(BlockDriverState *bs, BdrvDirtyBitmap *bitmap);
+void bdrv_free_dirty_bitmap(BdrvDirtyBitmap *bitmap);
+int bdrv_check_persistent_dirty_bitmap(BlockDriverState *bs,
+                                       const char *name);
+int bdrv_dirty_bitmap_get(BdrvDirtyBitmap *bitmap, int64_t sector);
+int64_t bdrv_dirty_bitmap_next(BdrvDirtyBitmap *bitmap, int64_t sector);
+void bdrv_dirty_bitmap_set(BdrvDirtyBitmap *bitmap, int64_t sector_num,
+                           int nb_sectors);
+void bdrv_dirty_bitmap_reset(BdrvDirtyBitmap *bitmap, int64_t sector_num,
+                             int nb_sectors);
+void bdrv_dirty_bitmap_set_all(BdrvDirtyBitmap *bitmap);
+void bdrv_dirty_bitmap_clear(BdrvDirtyBitmap *bitmap);
+BdrvDirtyBitmap *bdrv_dirty_bitmap_copy(BdrvDirtyBitmap *bitmap);
+void bdrv_dirty_bitmap_merge(BdrvDirtyBitmap *bitmap, BdrvDirtyBitmap *src);
+size_t bdrv_dirty_bitmap_serialized_size(BdrvDirtyBitmap *bitmap);
+void bdrv_dirty_bitmap_serialize(BdrvDirtyBitmap *bitmap, uint8_t *buf);
+void bdrv_dirty_bitmap_deserialize(BdrvDirtyBitmap *bitmap,
+                                   const uint8_t *buf);
+
 void bdrv_enable_copy_on_read(BlockDriverState *bs);
 void bdrv_disable_copy_on_read(BlockDriverState *bs);
 
@@ -0,0 +1,295 @@
+/*
+ * Incremental backup
+ *
+ * Copies the chunks that are dirty in a dirty bitmap to a target image.  The
+ * target gets the contents the device had when the backup started: guest
+ * writes to chunks that have not been copied yet first copy the old data.
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "trace.h"
+#include "block_int.h"
+#include "ratelimit.h"
+
+enum {
+    /*
+     * Largest amount of data copied with a single request, unless the
+     * bitmap granularity is larger.
+     */
+    BACKUP_BUFFER_SIZE = 1024 * 1024, /* in bytes */
+};
+
+#define SLICE_TIME 100000000ULL /* ns */
+
+/* Range of chunks that is being copied */
+typedef struct CowRequest {
+    int64_t start;
+    int64_t end;
+    CoQueue wait_queue;
+    QLIST_ENTRY(CowRequest) list;
+} CowRequest;
+
+typedef struct BackupBlockJob {
+    BlockJob common;
+    RateLimit limit;
+    BlockDriverState *target;
+    BdrvDirtyBitmap *bitmap;    /* keeps tracking writes for the next backup */
+    BdrvDirtyBitmap *snapshot;  /* dirty chunks when the backup started */
+    BdrvDirtyBitmap *todo;      /* chunks that have not been copied yet */
+    int64_t sectors_per_chunk;
+    int max_chunks;
+    bool stopped;
+    int ret;                    /* first error of a copy for a guest write */
+    QLIST_HEAD(, CowRequest) inflight_reqs;
+} BackupBlockJob;
+
+static void coroutine_fn wait_for_overlapping_requests(BackupBlockJob *s,
+                                                       int64_t start,
+                                                       int64_t end)
+{
+    CowRequest *req;
+    bool retry;
+
+    do {
+        retry = false;
+        QLIST_FOREACH(req, &s->inflight_reqs, list) {
+            if (end > req->start && start < req->end) {
+                qemu_co_queue_wait(&req->wait_queue);
+                retry = true;
+                break;
+            }
+        }
+    } while (retry);
+}
+
+static void cow_request_begin(CowRequest *req, BackupBlockJob *s,
+                              int64_t start, int64_t end)
+{
+    req->start = start;
+    req->end = end;
+    qemu_co_queue_init(&req->wait_queue);
+    QLIST_INSERT_HEAD(&s->inflight_reqs, req, list);
+}
+
+static void cow_request_end(CowRequest *req)
+{
+    QLIST_REMOVE(req, list);
+    qemu_co_queue_restart_all(&req->wait_queue);
+}
+
+static int coroutine_fn backup_copy(BackupBlockJob *s, int64_t sector_num,
+                                    int nb_sectors, void *buf)
+{
+    struct iovec iov = {
+        .iov_base = buf,
+        .iov_len  = nb_sectors * BDRV_SECTOR_SIZE,
+    };
+    QEMUIOVector qiov;
+    int ret;
+
+    qemu_iovec_init_external(&qiov, &iov, 1);
+
+    ret = bdrv_co_readv(s->common.bs, sector_num, nb_sectors, &qiov);
+    if (ret < 0) {
+        return ret;
+    }
+    return bdrv_co_writev(s->target, sector_num, nb_sectors, &qiov);
+}
+
+/*
+ * Copies the chunks in [sector_num, sector_num + nb_sectors) that have not
+ * been copied yet.  Ranges that are being copied by another coroutine are
+ * waited for, so that a guest write never overtakes the copy of the data it
+ * overwrites.
+ */
+static int coroutine_fn backup_do_cow(BackupBlockJob *s, int64_t sector_num,
+                                      int nb_sectors)
+{
+    BlockDriverState *bs = s->common.bs;
+    int64_t total_sectors = bdrv_getlength(bs) >> BDRV_SECTOR_BITS;
+    int64_t start, end, chunk;
+    CowRequest req;
+    void *buf = NULL;
+    int ret = 0;
+    int n;
+
+    start = sector_num / s->sectors_per_chunk;
+    end = DIV_ROUND_UP(sector_num + nb_sectors, s->sectors_per_chunk);
+
+    wait_for_overlapping_requests(s, start, end);
+    cow_request_begin(&req, s, start, end);
+
+    for (chunk = start; chunk < end; chunk += n) {
+        int64_t first = chunk * s->sectors_per_chunk;
+        int copy_sectors;
+
+        n = 1;
+        if (!bdrv_dirty_bitmap_get(s->todo, first)) {
+            continue;
+        }
+        while (chunk + n < end && n < s->max_chunks &&
+               bdrv_dirty_bitmap_get(s->todo,
+                                     (chunk + n) * s->sectors_per_chunk)) {
+            n++;
+        }
+
+        copy_sectors = MIN(n * s->sectors_per_chunk, total_sectors - first);
+        if (!buf) {
+            buf = qemu_blockalign(bs, s->max_chunks * s->sectors_per_chunk *
+                                      BDRV_SECTOR_SIZE);
+        }
+        ret = backup_copy(s, first, copy_sectors, buf);
+        trace_backup_do_cow(s, first, copy_sectors, ret);
+        if (ret < 0) {
+            break;
+        }
+
+        bdrv_dirty_bitmap_reset(s->todo, first, n * s->sectors_per_chunk);
+        s->common.offset += (int64_t)n * s->sectors_per_chunk *
+                            BDRV_SECTOR_SIZE;
+    }
+
+    cow_request_end(&req);
+    qemu_vfree(buf);
+    return ret;
+}
+
+static void coroutine_fn backup_before_write(BlockJob *job,
+                                             int64_t sector_num,
+                                             int nb_sectors)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+    int ret;
+
+    if (s->stopped) {
+        return;
+    }
+
+    /* A failed copy fails the backup, not the guest write */
+    ret = backup_do_cow(s, sector_num, nb_sectors);
+    if (ret < 0 && s->ret == 0) {
+        s->ret = ret;
+    }
+}
+
+static void coroutine_fn backup_run(void *opaque)
+{
+    BackupBlockJob *s = opaque;
+    int64_t sector_num = 0;
+    int ret = 0;
+
+    s->common.len = s->snapshot->count * s->snapshot->granularity;
+
+    for (;;) {
+        int nb_sectors;
+
+        if (block_job_is_cancelled(&s->common) || s->ret < 0) {
+            break;
+        }
+
+        sector_num = bdrv_dirty_bitmap_next(s->todo, sector_num);
+        if (sector_num < 0) {
+            break;
+        }
+        nb_sectors = s->max_chunks * s->sectors_per_chunk;
+
+        if (s->common.speed) {
+            uint64_t delay_ns = ratelimit_calculate_delay(&s->limit,
+                                                          nb_sectors);
+            if (delay_ns > 0) {
+                co_sleep_ns(rt_clock, delay_ns);
+                continue;
+            }
+        }
+
+        ret = backup_do_cow(s, sector_num, nb_sectors);
+        if (ret < 0) {
+            break;
+        }
+
+        /* Yield with no pending I/O so that qemu_aio_flush() returns */
+        co_sleep_ns(rt_clock, 0);
+    }
+
+    /* Let guest writes that are copying old data finish */
+    s->stopped = true;
+    wait_for_overlapping_requests(s, 0, INT64_MAX);
+
+    if (ret == 0) {
+        ret = s->ret;
+    }
+    if (ret == 0 && !block_job_is_cancelled(&s->common)) {
+        ret = bdrv_co_flush(s->target);
+    }
+
+    /* The target is incomplete, the next backup must copy everything again */
+    if (ret < 0 || block_job_is_cancelled(&s->common)) {
+        bdrv_dirty_bitmap_merge(s->bitmap, s->snapshot);
+    }
+    s->bitmap->busy = false;
+    bdrv_free_dirty_bitmap(s->snapshot);
+    bdrv_free_dirty_bitmap(s->todo);
+    bdrv_delete(s->target);
+
+    block_job_complete(&s->common, ret);
+}
+
+static int backup_set_speed(BlockJob *job, int64_t value)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+
+    if (value < 0) {
+        return -EINVAL;
+    }
+    job->speed = value;
+    ratelimit_set_speed(&s->limit, value / BDRV_SECTOR_SIZE, SLICE_TIME);
+    return 0;
+}
+
+static BlockJobType backup_job_type = {
+    .instance_size = sizeof(BackupBlockJob),
+    .job_type      = "backup",
+    .set_speed     = backup_set_speed,
+    .before_write  = backup_before_write,
+};
+
+/*
+ * Starts copying the chunks that are dirty in @bitmap to @target, which
+ * must have the size of @bs.  @bitmap is cleared and keeps tracking writes
+ * for the next backup.  The job takes ownership of @target.
+ */
+int backup_start(BlockDriverState *bs, BlockDriverState *target,
+                 BdrvDirtyBitmap *bitmap, BlockDriverCompletionFunc *cb,
+                 void *opaque)
+{
+    BackupBlockJob *s;
+    Coroutine *co;
+
+    if (bitmap->busy) {
+        return -EBUSY;
+    }
+
+    s = block_job_create(&backup_job_type, bs, cb, opaque);
+    if (!s) {
+        return -EBUSY; /* bs must already be in use */
+    }
+
+    s->target = target;
+    s->bitmap = bitmap;
+    s->snapshot = bdrv_dirty_bitmap_copy(bitmap);
+    s->todo = bdrv_dirty_bitmap_copy(bitmap);
+    s->sectors_per_chunk = bitmap->granularity >> BDRV_SECTOR_BITS;
+    s->max_chunks = MAX(1, BACKUP_BUFFER_SIZE / bitmap->granularity);
+    QLIST_INIT(&s->inflight_reqs);
+
+    bdrv_dirty_bitmap_clear(bitmap);
+    bitmap->busy = true;
+
+    co = qemu_coroutine_create(backup_run);
+    trace_backup_start(bs, target, s, co, opaque);
+    qemu_coroutine_enter(co, s);
+    return 0;
+}
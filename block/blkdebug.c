@@ -346,7 +346,7 @@ static BlockDriverAIOCB *inject_error(BlockDriverState *bs,
     acb = qemu_aio_get(&blkdebug_aio_pool, bs, cb, opaque);
     acb->ret = -error;
 
-    bh = qemu_bh_new(error_callback_bh, acb);
+    bh = qemu_bh_new_io(error_callback_bh, acb);
     acb->bh = bh;
     qemu_bh_schedule(bh);
 
@@ -282,7 +282,7 @@ static void blkverify_aio_cb(void *opaque, int ret)
             acb->verify(acb);
         }
 
-        acb->bh = qemu_bh_new(blkverify_aio_bh, acb);
+        acb->bh = qemu_bh_new_io(blkverify_aio_bh, acb);
         qemu_bh_schedule(acb->bh);
         break;
     }
@@ -513,7 +513,7 @@ static BlockDriverAIOCB *curl_aio_readv(BlockDriverState *bs,
     acb->sector_num = sector_num;
     acb->nb_sectors = nb_sectors;
 
-    acb->bh = qemu_bh_new(curl_readv_bh_cb, acb);
+    acb->bh = qemu_bh_new_io(curl_readv_bh_cb, acb);
 
     if (!acb->bh) {
         DPRINTF("CURL: qemu_bh_new failed\n");
@@ -135,7 +135,7 @@ iscsi_process_write(void *arg)
 static int
 iscsi_schedule_bh(QEMUBHFunc *cb, IscsiAIOCB *acb)
 {
-    acb->bh = qemu_bh_new(cb, acb);
+    acb->bh = qemu_bh_new_io(cb, acb);
     if (!acb->bh) {
         error_report("oom: could not create iscsi bh");
         return -EIO;
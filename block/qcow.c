@@ -767,30 +767,20 @@ static int qcow_make_empty(BlockDriverState *bs)
     return 0;
 }
 
-/* XXX: put compressed sectors first, then all the cluster aligned
-   tables to avoid losing bytes in alignment */
-static int qcow_write_compressed(BlockDriverState *bs, int64_t sector_num,
-                                 const uint8_t *buf, int nb_sectors)
+static int qcow_compress_cluster(BlockDriverState *bs, const uint8_t *buf,
+                                 uint8_t *out_buf, int level)
 {
     BDRVQcowState *s = bs->opaque;
     z_stream strm;
     int ret, out_len;
-    uint8_t *out_buf;
-    uint64_t cluster_offset;
 
-    if (nb_sectors != s->cluster_sectors)
-        return -EINVAL;
-
-    out_buf = g_malloc(s->cluster_size + (s->cluster_size / 1000) + 128);
-
-    /* best compression, small window, no zlib header */
+    /* small window, no zlib header */
     memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
+    ret = deflateInit2(&strm, level,
                        Z_DEFLATED, -12,
                        9, Z_DEFAULT_STRATEGY);
     if (ret != 0) {
-        ret = -EINVAL;
-        goto fail;
+        return -EINVAL;
     }
 
     strm.avail_in = s->cluster_size;
@@ -801,36 +791,68 @@ static int qcow_write_compressed(BlockDriverState *bs, int64_t sector_num,
     ret = deflate(&strm, Z_FINISH);
     if (ret != Z_STREAM_END && ret != Z_OK) {
         deflateEnd(&strm);
-        ret = -EINVAL;
-        goto fail;
+        return -EINVAL;
     }
     out_len = strm.next_out - out_buf;
 
     deflateEnd(&strm);
 
     if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
+        return 0;
+    }
+    return out_len;
+}
+
+/* XXX: put compressed sectors first, then all the cluster aligned
+   tables to avoid losing bytes in alignment */
+static int qcow_write_compressed_data(BlockDriverState *bs,
+                                      int64_t sector_num, const uint8_t *buf,
+                                      const uint8_t *out_buf, int out_len)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t cluster_offset;
+    int ret;
+
+    if (out_len == 0) {
         /* could not compress: write normal cluster */
         ret = bdrv_write(bs, sector_num, buf, s->cluster_sectors);
         if (ret < 0) {
-            goto fail;
+            return ret;
         }
     } else {
         cluster_offset = get_cluster_offset(bs, sector_num << 9, 2,
                                             out_len, 0, 0);
         if (cluster_offset == 0) {
-            ret = -EIO;
-            goto fail;
+            return -EIO;
         }
 
         cluster_offset &= s->cluster_offset_mask;
         ret = bdrv_pwrite(bs->file, cluster_offset, out_buf, out_len);
         if (ret < 0) {
-            goto fail;
+            return ret;
         }
     }
 
-    ret = 0;
-fail:
+    return 0;
+}
+
+static int qcow_write_compressed(BlockDriverState *bs, int64_t sector_num,
+                                 const uint8_t *buf, int nb_sectors)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+    uint8_t *out_buf;
+
+    if (nb_sectors != s->cluster_sectors)
+        return -EINVAL;
+
+    out_buf = g_malloc(s->cluster_size + (s->cluster_size / 1000) + 128);
+
+    ret = qcow_compress_cluster(bs, buf, out_buf, Z_DEFAULT_COMPRESSION);
+    if (ret >= 0) {
+        ret = qcow_write_compressed_data(bs, sector_num, buf, out_buf, ret);
+    }
+
     g_free(out_buf);
     return ret;
 }
@@ -883,6 +905,8 @@ static BlockDriver bdrv_qcow = {
     .bdrv_set_key           = qcow_set_key,
     .bdrv_make_empty        = qcow_make_empty,
     .bdrv_write_compressed  = qcow_write_compressed,
+    .bdrv_compress_cluster  = qcow_compress_cluster,
+    .bdrv_write_compressed_data = qcow_write_compressed_data,
     .bdrv_get_info          = qcow_get_info,
 
     .create_options = qcow_create_options,
@@ -0,0 +1,388 @@
+/*
+ * Block driver for the QCOW version 2 format
+ *
+ * Persistent dirty bitmaps
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu-common.h"
+#include "block_int.h"
+#include "block/qcow2.h"
+
+/*
+ * The dirty bitmap header extension lists the persistent bitmaps of the
+ * image.  While the image is open read-write, the bitmaps live in memory and
+ * the entries have no data (offset 0); they are written to free clusters on
+ * close.  A bitmap without data, e.g. after a crash, is loaded with all bits
+ * set.
+ */
+typedef struct QEMU_PACKED Qcow2BitmapExtHeader {
+    uint32_t nb_bitmaps;
+    uint32_t reserved;
+} Qcow2BitmapExtHeader;
+
+typedef struct QEMU_PACKED Qcow2BitmapEntry {
+    /* entries are 8 byte aligned */
+    uint64_t offset;
+    uint64_t size;
+    uint32_t granularity_bits;
+    uint32_t name_size;
+    /* name follows, padded to 8 bytes */
+} Qcow2BitmapEntry;
+
+#define QCOW2_MAX_BITMAP_NAME 1023
+
+void qcow2_free_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int i;
+
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        g_free(s->bitmaps[i].name);
+    }
+    g_free(s->bitmaps);
+    s->bitmaps = NULL;
+    s->nb_bitmaps = 0;
+}
+
+int qcow2_read_bitmap_ext(BlockDriverState *bs, uint64_t offset,
+                          uint32_t len)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2BitmapExtHeader h;
+    Qcow2BitmapEntry e;
+    uint8_t *buf;
+    size_t pos;
+    int i, ret;
+
+    if (len < sizeof(h)) {
+        return -EINVAL;
+    }
+    buf = g_malloc(len);
+    ret = bdrv_pread(bs->file, offset, buf, len);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    memcpy(&h, buf, sizeof(h));
+    qcow2_free_bitmaps(bs);
+    s->nb_bitmaps = be32_to_cpu(h.nb_bitmaps);
+    if (s->nb_bitmaps > len / sizeof(e)) {
+        s->nb_bitmaps = 0;
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->bitmaps = g_malloc0(s->nb_bitmaps * sizeof(Qcow2Bitmap));
+
+    pos = sizeof(h);
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        Qcow2Bitmap *bm = &s->bitmaps[i];
+
+        if (pos + sizeof(e) > len) {
+            ret = -EINVAL;
+            goto fail;
+        }
+        memcpy(&e, buf + pos, sizeof(e));
+        pos += sizeof(e);
+
+        bm->offset = be64_to_cpu(e.offset);
+        bm->size = be64_to_cpu(e.size);
+        bm->granularity_bits = be32_to_cpu(e.granularity_bits);
+        if (bm->granularity_bits < BDRV_SECTOR_BITS ||
+            bm->granularity_bits > 30 ||
+            (bm->offset & (s->cluster_size - 1))) {
+            ret = -EINVAL;
+            goto fail;
+        }
+
+        e.name_size = be32_to_cpu(e.name_size);
+        if (e.name_size == 0 || e.name_size > QCOW2_MAX_BITMAP_NAME ||
+            pos + e.name_size > len) {
+            ret = -EINVAL;
+            goto fail;
+        }
+        bm->name = g_malloc(e.name_size + 1);
+        memcpy(bm->name, buf + pos, e.name_size);
+        bm->name[e.name_size] = '\0';
+        pos = align_offset(pos + e.name_size, 8);
+    }
+
+    g_free(buf);
+    return 0;
+
+fail:
+    qcow2_free_bitmaps(bs);
+    g_free(buf);
+    return ret;
+}
+
+/* Size of the data of the dirty bitmap header extension, without padding */
+size_t qcow2_bitmap_ext_size(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    size_t size = sizeof(Qcow2BitmapExtHeader);
+    int i;
+
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        size = align_offset(size, 8);
+        size += sizeof(Qcow2BitmapEntry) + strlen(s->bitmaps[i].name);
+    }
+    return size;
+}
+
+void qcow2_write_bitmap_ext(BlockDriverState *bs, uint8_t *buf)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2BitmapExtHeader h;
+    Qcow2BitmapEntry e;
+    size_t pos;
+    int i;
+
+    memset(buf, 0, qcow2_bitmap_ext_size(bs));
+    h.nb_bitmaps = cpu_to_be32(s->nb_bitmaps);
+    h.reserved = 0;
+    memcpy(buf, &h, sizeof(h));
+
+    pos = sizeof(h);
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        Qcow2Bitmap *bm = &s->bitmaps[i];
+        size_t name_size = strlen(bm->name);
+
+        pos = align_offset(pos, 8);
+        e.offset = cpu_to_be64(bm->offset);
+        e.size = cpu_to_be64(bm->size);
+        e.granularity_bits = cpu_to_be32(bm->granularity_bits);
+        e.name_size = cpu_to_be32(name_size);
+        memcpy(buf + pos, &e, sizeof(e));
+        pos += sizeof(e);
+        memcpy(buf + pos, bm->name, name_size);
+        pos += name_size;
+    }
+}
+
+/*
+ * Checks that a new persistent bitmap called name can be stored on close:
+ * readers reject longer names, and the header extension listing it with the
+ * other persistent bitmaps must still fit into the first cluster.
+ */
+int qcow2_check_persistent_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name)
+{
+    BDRVQcowState *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap;
+    size_t size, name_size = strlen(name);
+
+    /* older versions drop the autoclear bit that validates the bitmaps */
+    if (s->qcow_version < 3 || bs->read_only) {
+        return -ENOTSUP;
+    }
+    if (name_size > QCOW2_MAX_BITMAP_NAME) {
+        return -ENAMETOOLONG;
+    }
+
+    size = sizeof(Qcow2BitmapExtHeader);
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        if (bitmap->persistent) {
+            size = align_offset(size, 8);
+            size += sizeof(Qcow2BitmapEntry) + strlen(bitmap->name);
+        }
+    }
+    size = align_offset(size, 8) + sizeof(Qcow2BitmapEntry) + name_size;
+
+    if (qcow2_ext_header_size(bs,
+            bs->backing_file[0] ? bs->backing_file : NULL,
+            bs->backing_format[0] ? bs->backing_format : NULL,
+            size) > s->cluster_size) {
+        return -ENOSPC;
+    }
+    return 0;
+}
+
+static int qcow2_write_bitmap_directory(BlockDriverState *bs)
+{
+    return qcow2_update_ext_header(bs,
+        bs->backing_file[0] ? bs->backing_file : NULL,
+        bs->backing_format[0] ? bs->backing_format : NULL);
+}
+
+/*
+ * Creates the dirty bitmaps listed in the header extension.  If the image is
+ * writable, the stored data is dropped because the guest is about to change
+ * the disk.
+ */
+int qcow2_load_dirty_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    bool valid = s->autoclear_features & QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+    uint64_t *stored;
+    int i, ret;
+
+    if (s->nb_bitmaps == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        Qcow2Bitmap *bm = &s->bitmaps[i];
+        BdrvDirtyBitmap *bitmap;
+        uint8_t *buf;
+
+        bitmap = bdrv_find_dirty_bitmap(bs, bm->name);
+        if (bitmap) {
+            bdrv_release_dirty_bitmap(bs, bitmap);
+        }
+        bitmap = bdrv_create_dirty_bitmap(bs, bm->name,
+                                          1 << bm->granularity_bits);
+        bitmap->persistent = true;
+
+        /* Without its data, or if another program wrote to the image, the
+         * bitmap can't be trusted */
+        if (!valid || !bm->offset ||
+            bm->size != bdrv_dirty_bitmap_serialized_size(bitmap)) {
+            bdrv_dirty_bitmap_set_all(bitmap);
+            continue;
+        }
+
+        buf = g_malloc(bm->size);
+        ret = bdrv_pread(bs->file, bm->offset, buf, bm->size);
+        if (ret < 0) {
+            bdrv_dirty_bitmap_set_all(bitmap);
+        } else {
+            bdrv_dirty_bitmap_deserialize(bitmap, buf);
+        }
+        g_free(buf);
+    }
+
+    if (bs->read_only) {
+        return 0;
+    }
+
+    /* Mark the bitmaps in use before their clusters can be reused */
+    stored = g_malloc0(s->nb_bitmaps * sizeof(uint64_t));
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        stored[i] = s->bitmaps[i].offset;
+        s->bitmaps[i].offset = 0;
+    }
+    ret = qcow2_write_bitmap_directory(bs);
+    if (ret < 0) {
+        for (i = 0; i < s->nb_bitmaps; i++) {
+            BdrvDirtyBitmap *bitmap;
+
+            bitmap = bdrv_find_dirty_bitmap(bs, s->bitmaps[i].name);
+            if (bitmap) {
+                bdrv_release_dirty_bitmap(bs, bitmap);
+            }
+        }
+        g_free(stored);
+        return ret;
+    }
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        if (stored[i]) {
+            qcow2_free_clusters(bs, stored[i], s->bitmaps[i].size);
+        }
+    }
+    g_free(stored);
+
+    return 0;
+}
+
+/*
+ * Writes the persistent dirty bitmaps to free clusters and points the header
+ * extension to them.  Called on close, with no requests in flight.
+ */
+int qcow2_store_dirty_bitmaps(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap;
+    Qcow2Bitmap *bitmaps;
+    int i, nb_bitmaps = 0;
+    int ret = 0;
+
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        if (bitmap->persistent) {
+            nb_bitmaps++;
+        }
+    }
+    if (nb_bitmaps == 0 && s->nb_bitmaps == 0) {
+        return 0;
+    }
+
+    bitmaps = g_malloc0(nb_bitmaps * sizeof(Qcow2Bitmap));
+    i = 0;
+    QLIST_FOREACH(bitmap, &bs->dirty_bitmaps, list) {
+        Qcow2Bitmap *bm;
+        int64_t offset;
+        uint8_t *buf;
+
+        if (!bitmap->persistent) {
+            continue;
+        }
+        bm = &bitmaps[i++];
+        bm->name = g_strdup(bitmap->name);
+        bm->granularity_bits = ffs(bitmap->granularity) - 1;
+        bm->size = bdrv_dirty_bitmap_serialized_size(bitmap);
+
+        /* A bitmap that can't be stored is loaded as all dirty */
+        offset = qcow2_alloc_clusters(bs, bm->size);
+        if (offset < 0) {
+            ret = offset;
+            continue;
+        }
+        buf = g_malloc(bm->size);
+        bdrv_dirty_bitmap_serialize(bitmap, buf);
+        ret = bdrv_pwrite(bs->file, offset, buf, bm->size);
+        g_free(buf);
+        if (ret < 0) {
+            qcow2_free_clusters(bs, offset, bm->size);
+            continue;
+        }
+        bm->offset = offset;
+    }
+
+    /* The data and its refcounts must be on disk before the directory */
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret == 0) {
+        ret = bdrv_flush(bs->file);
+    }
+    if (ret < 0) {
+        for (i = 0; i < nb_bitmaps; i++) {
+            bitmaps[i].offset = 0;
+        }
+    }
+
+    qcow2_free_bitmaps(bs);
+    s->bitmaps = bitmaps;
+    s->nb_bitmaps = nb_bitmaps;
+
+    ret = qcow2_write_bitmap_directory(bs);
+    if (ret < 0) {
+        for (i = 0; i < nb_bitmaps; i++) {
+            if (bitmaps[i].offset) {
+                qcow2_free_clusters(bs, bitmaps[i].offset, bitmaps[i].size);
+            }
+        }
+        return ret;
+    }
+
+    if (nb_bitmaps && !(s->autoclear_features & QCOW2_AUTOCLEAR_DIRTY_BITMAPS)) {
+        s->autoclear_features |= QCOW2_AUTOCLEAR_DIRTY_BITMAPS;
+        ret = qcow2_update_features(bs);
+    }
+    return ret;
+}
@@ -22,26 +22,84 @@
  * THE SOFTWARE.
  */
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
 #include "block_int.h"
 #include "qemu-common.h"
 #include "qcow2.h"
 
+/*
+ * The tables live in one contiguous buffer, so that an entry can be found
+ * from its table pointer by arithmetic.  Lookups by offset go through a hash
+ * table, and replacement takes the least recently used unreferenced entry.
+ */
+
+/* An update passed to qcow2_cache_put_write() that isn't on disk yet */
+typedef struct Qcow2CacheUpdate {
+    int         pos;
+    int         size;
+    const void* data;
+    bool        need_flush;     /* bs->file must be flushed before the write */
+    bool        done;
+    int         ret;
+    QSIMPLEQ_ENTRY(Qcow2CacheUpdate) next;
+} Qcow2CacheUpdate;
+
 typedef struct Qcow2CachedTable {
-    void*   table;
     int64_t offset;
     bool    dirty;
-    int     cache_hits;
+    bool    writing;        /* written back without s->lock held */
+    CoQueue write_queue;    /* waiting for writing to clear */
+    QSIMPLEQ_HEAD(, Qcow2CacheUpdate) updates; /* for the next write */
     int     ref;
+    uint64_t last_used;     /* value of lru_counter when last used */
+    QTAILQ_ENTRY(Qcow2CachedTable) lru;
+    QLIST_ENTRY(Qcow2CachedTable) hash;
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
     Qcow2CachedTable*       entries;
+    uint8_t*                tables;
     struct Qcow2Cache*      depends;
     int                     size;
+    int                     table_size;
     bool                    depends_on_flush;
     bool                    writethrough;
+
+    /* most recently used first */
+    QTAILQ_HEAD(Qcow2CacheLRU, Qcow2CachedTable) lru;
+    QLIST_HEAD(, Qcow2CachedTable) *buckets;
+    unsigned int            nb_buckets;
+    uint64_t                lru_counter;
+    uint64_t                cleaned_at;
+
+    uint64_t                hits;
+    uint64_t                misses;
 };
 
+static inline void *qcow2_cache_table(Qcow2Cache *c, int i)
+{
+    return c->tables + (size_t)i * c->table_size;
+}
+
+static inline int qcow2_cache_index(Qcow2Cache *c, void *table)
+{
+    ptrdiff_t off = (uint8_t *)table - c->tables;
+
+    if (off < 0 || off >= (ptrdiff_t)c->size * c->table_size) {
+        return -1;
+    }
+    assert(off % c->table_size == 0);
+    return off / c->table_size;
+}
+
+static inline unsigned int qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return (offset / c->table_size) & (c->nb_buckets - 1);
+}
+
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     bool writethrough)
 {
@@ -51,11 +109,22 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
 
     c = g_malloc0(sizeof(*c));
     c->size = num_tables;
+    c->table_size = s->cluster_size;
     c->entries = g_malloc0(sizeof(*c->entries) * num_tables);
+    /* page aligned, so that idle tables can be given back to the host */
+    c->tables = qemu_vmalloc((size_t)num_tables * s->cluster_size);
     c->writethrough = writethrough;
 
+    for (c->nb_buckets = 1; c->nb_buckets < num_tables; c->nb_buckets <<= 1) {
+        /* round up to a power of two */
+    }
+    c->buckets = g_malloc0(sizeof(*c->buckets) * c->nb_buckets);
+
+    QTAILQ_INIT(&c->lru);
     for (i = 0; i < c->size; i++) {
-        c->entries[i].table = qemu_blockalign(bs, s->cluster_size);
+        qemu_co_queue_init(&c->entries[i].write_queue);
+        QSIMPLEQ_INIT(&c->entries[i].updates);
+        QTAILQ_INSERT_TAIL(&c->lru, &c->entries[i], lru);
     }
 
     return c;
@@ -67,15 +136,53 @@ int qcow2_cache_destroy(BlockDriverState* bs, Qcow2Cache *c)
 
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
-        qemu_vfree(c->entries[i].table);
     }
 
+    qemu_vfree(c->tables);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
     return 0;
 }
 
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses)
+{
+    *hits = c->hits;
+    *misses = c->misses;
+}
+
+/*
+ * Drop the clean, unreferenced tables that have not been used since the
+ * last call, and give their memory back to the host.
+ */
+void qcow2_cache_clean_unused(Qcow2Cache *c)
+{
+    Qcow2CachedTable *e;
+    int i;
+
+    for (i = 0; i < c->size; i++) {
+        e = &c->entries[i];
+        if (!e->offset || e->ref || e->dirty || e->last_used > c->cleaned_at) {
+            continue;
+        }
+
+        QLIST_REMOVE(e, hash);
+        e->offset = 0;
+        QTAILQ_REMOVE(&c->lru, e, lru);
+        QTAILQ_INSERT_TAIL(&c->lru, e, lru);
+
+#ifndef _WIN32
+        /* madvise works on whole pages, don't drop the neighbours' data */
+        if (!(c->table_size & (getpagesize() - 1))) {
+            qemu_madvise(qcow2_cache_table(c, i), c->table_size,
+                         QEMU_MADV_DONTNEED);
+        }
+#endif
+    }
+    c->cleaned_at = c->lru_counter;
+}
+
 static int qcow2_cache_flush_dependency(BlockDriverState *bs, Qcow2Cache *c)
 {
     int ret;
@@ -91,11 +198,29 @@ static int qcow2_cache_flush_dependency(BlockDriverState *bs, Qcow2Cache *c)
     return 0;
 }
 
+/*
+ * Waits until a write of the entry that qcow2_cache_put_write() started has
+ * completed.  That write doesn't need s->lock to finish, so it is fine to
+ * keep holding it.
+ */
+static void qcow2_cache_wait_write(Qcow2CachedTable *e)
+{
+    while (e->writing) {
+        if (qemu_in_coroutine()) {
+            qemu_co_queue_wait(&e->write_queue);
+        } else {
+            qemu_aio_wait();
+        }
+    }
+}
+
 static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
 {
     BDRVQcowState *s = bs->opaque;
     int ret = 0;
 
+    qcow2_cache_wait_write(&c->entries[i]);
+
     if (!c->entries[i].dirty || !c->entries[i].offset) {
         return 0;
     }
@@ -119,7 +244,7 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
         BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
     }
 
-    ret = bdrv_pwrite(bs->file, c->entries[i].offset, c->entries[i].table,
+    ret = bdrv_pwrite(bs->file, c->entries[i].offset, qcow2_cache_table(c, i),
         s->cluster_size);
     if (ret < 0) {
         return ret;
@@ -130,7 +255,7 @@ static int qcow2_cache_entry_flush(BlockDriverState *bs, Qcow2Cache *c, int i)
     return 0;
 }
 
-int qcow2_cache_flush(BlockDriverState *bs, Qcow2Cache *c)
+static int qcow2_cache_write_dirty(BlockDriverState *bs, Qcow2Cache *c)
 {
     int result = 0;
     int ret;
@@ -143,6 +268,15 @@ int qcow2_cache_flush(BlockDriverState *bs, Qcow2Cache *c)
         }
     }
 
+    return result;
+}
+
+int qcow2_cache_flush(BlockDriverState *bs, Qcow2Cache *c)
+{
+    int result;
+    int ret;
+
+    result = qcow2_cache_write_dirty(bs, c);
     if (result == 0) {
         ret = bdrv_flush(bs->file);
         if (ret < 0) {
@@ -183,81 +317,72 @@ void qcow2_cache_depends_on_flush(Qcow2Cache *c)
 
 static int qcow2_cache_find_entry_to_replace(Qcow2Cache *c)
 {
-    int i;
-    int min_count = INT_MAX;
-    int min_index = -1;
+    Qcow2CachedTable *e;
 
-
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].ref) {
-            continue;
-        }
-
-        if (c->entries[i].cache_hits < min_count) {
-            min_index = i;
-            min_count = c->entries[i].cache_hits;
+    QTAILQ_FOREACH_REVERSE(e, &c->lru, Qcow2CacheLRU, lru) {
+        if (!e->ref) {
+            return e - c->entries;
         }
-
-        /* Give newer hits priority */
-        /* TODO Check how to optimize the replacement strategy */
-        c->entries[i].cache_hits /= 2;
     }
 
-    if (min_index == -1) {
-        /* This can't happen in current synchronous code, but leave the check
-         * here as a reminder for whoever starts using AIO with the cache */
-        abort();
-    }
-    return min_index;
+    /* This can't happen in current synchronous code, but leave the check
+     * here as a reminder for whoever starts using AIO with the cache */
+    abort();
 }
 
 static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcowState *s = bs->opaque;
+    Qcow2CachedTable *e;
     int i;
     int ret;
 
     /* Check if the table is already cached */
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].offset == offset) {
+    QLIST_FOREACH(e, &c->buckets[qcow2_cache_hash(c, offset)], hash) {
+        if (e->offset == offset) {
+            i = e - c->entries;
+            c->hits++;
             goto found;
         }
     }
+    c->misses++;
 
     /* If not, write a table back and replace it */
     i = qcow2_cache_find_entry_to_replace(c);
-    if (i < 0) {
-        return i;
-    }
+    e = &c->entries[i];
 
     ret = qcow2_cache_entry_flush(bs, c, i);
     if (ret < 0) {
         return ret;
     }
 
-    c->entries[i].offset = 0;
+    if (e->offset) {
+        QLIST_REMOVE(e, hash);
+        e->offset = 0;
+    }
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
         }
 
-        ret = bdrv_pread(bs->file, offset, c->entries[i].table, s->cluster_size);
+        ret = bdrv_pread(bs->file, offset, qcow2_cache_table(c, i),
+                         s->cluster_size);
         if (ret < 0) {
             return ret;
         }
     }
 
-    /* Give the table some hits for the start so that it won't be replaced
-     * immediately. The number 32 is completely arbitrary. */
-    c->entries[i].cache_hits = 32;
-    c->entries[i].offset = offset;
+    e->offset = offset;
+    QLIST_INSERT_HEAD(&c->buckets[qcow2_cache_hash(c, offset)], e, hash);
 
     /* And return the right table */
 found:
-    c->entries[i].cache_hits++;
-    c->entries[i].ref++;
-    *table = c->entries[i].table;
+    QTAILQ_REMOVE(&c->lru, e, lru);
+    QTAILQ_INSERT_HEAD(&c->lru, e, lru);
+    e->last_used = ++c->lru_counter;
+    e->ref++;
+    *table = qcow2_cache_table(c, i);
     return 0;
 }
 
@@ -275,16 +400,12 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 
 int qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
 {
-    int i;
+    int i = qcow2_cache_index(c, *table);
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].table == *table) {
-            goto found;
-        }
+    if (i < 0) {
+        return -ENOENT;
     }
-    return -ENOENT;
 
-found:
     c->entries[i].ref--;
     *table = NULL;
 
@@ -297,18 +418,148 @@ found:
     }
 }
 
-void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
+/*
+ * Writes a copy of table i with all updates queued for it applied, with
+ * s->lock dropped.  Once the write has completed, the updates are stored in
+ * the cached table and their callers are woken up.
+ */
+static void coroutine_fn qcow2_cache_write_updates(BlockDriverState *bs,
+    Qcow2Cache *c, int i)
 {
-    int i;
+    BDRVQcowState *s = bs->opaque;
+    Qcow2CachedTable *e = &c->entries[i];
+    QSIMPLEQ_HEAD(, Qcow2CacheUpdate) batch = QSIMPLEQ_HEAD_INITIALIZER(batch);
+    Qcow2CacheUpdate *u;
+    bool need_flush = false;
+    uint8_t *buf;
+    int ret;
 
-    for (i = 0; i < c->size; i++) {
-        if (c->entries[i].table == table) {
-            goto found;
+    QSIMPLEQ_CONCAT(&batch, &e->updates);
+
+    /* Others may change the table while it is written, so write a copy */
+    buf = qemu_blockalign(bs, c->table_size);
+    memcpy(buf, qcow2_cache_table(c, i), c->table_size);
+    QSIMPLEQ_FOREACH(u, &batch, next) {
+        memcpy(buf + u->pos, u->data, u->size);
+        need_flush |= u->need_flush;
+    }
+    e->dirty = false;
+    e->writing = true;
+
+    if (c == s->l2_table_cache) {
+        BLKDBG_EVENT(bs->file, BLKDBG_L2_UPDATE);
+    } else {
+        BLKDBG_EVENT(bs->file, BLKDBG_REFBLOCK_UPDATE_PART);
+    }
+
+    qemu_co_mutex_unlock(&s->lock);
+    ret = need_flush ? bdrv_flush(bs->file) : 0;
+    if (ret >= 0) {
+        ret = bdrv_pwrite(bs->file, e->offset, buf, c->table_size);
+    }
+    qemu_vfree(buf);
+
+    /* Publish the updates before anyone waiting for the entry can run.  This
+     * doesn't yield, so it is safe without s->lock. */
+    QSIMPLEQ_FOREACH(u, &batch, next) {
+        if (ret >= 0) {
+            memcpy((uint8_t *) qcow2_cache_table(c, i) + u->pos, u->data,
+                   u->size);
         }
+        u->ret = ret < 0 ? ret : 0;
+        u->done = true;
     }
-    abort();
+    if (ret < 0) {
+        e->dirty = true;
+    }
+    e->writing = false;
+    qemu_co_queue_restart_all(&e->write_queue);
+    qemu_co_mutex_lock(&s->lock);
+}
 
-found:
+/*
+ * Stores size bytes of data at byte offset pos of the table and puts the
+ * table like qcow2_cache_put().
+ *
+ * For a writethrough cache and a caller in coroutine context that holds
+ * s->lock, the table is written back with s->lock dropped, so that requests
+ * touching other tables can go on in the meantime.  The update only goes
+ * into the cached table once that write has completed: a mapping must not
+ * be found by other requests before it is on disk, or they could complete
+ * in place writes to the cluster before it is reachable.
+ *
+ * The writing flag serves as a per-table lock for these writes.  Updates
+ * that arrive while the table is being written are queued and go to disk
+ * together in the next write.
+ */
+int coroutine_fn qcow2_cache_put_write(BlockDriverState *bs, Qcow2Cache *c,
+    void **table, int pos, const void *data, int size)
+{
+    BDRVQcowState *s = bs->opaque;
+    Qcow2CachedTable *e;
+    Qcow2CacheUpdate update = {
+        .pos    = pos,
+        .size   = size,
+        .data   = data,
+    };
+    int i, ret;
+
+    assert(pos >= 0 && size >= 0 && pos + size <= c->table_size);
+
+    if (!c->writethrough || !qemu_in_coroutine()) {
+        memcpy((uint8_t *) *table + pos, data, size);
+        qcow2_cache_entry_mark_dirty(c, *table);
+        return qcow2_cache_put(bs, c, table);
+    }
+
+    i = qcow2_cache_index(c, *table);
+    if (i < 0) {
+        return -ENOENT;
+    }
+    e = &c->entries[i];
+    *table = NULL;
+
+    /* The dependencies are written now, but only flushed once s->lock has
+     * been dropped */
+    if (c->depends) {
+        ret = qcow2_cache_write_dirty(bs, c->depends);
+        if (ret < 0) {
+            goto out;
+        }
+        c->depends = NULL;
+        update.need_flush = true;
+    }
+    if (c->depends_on_flush) {
+        c->depends_on_flush = false;
+        update.need_flush = true;
+    }
+
+    /* We keep our reference, so the entry can't be replaced while s->lock
+     * is dropped */
+    QSIMPLEQ_INSERT_TAIL(&e->updates, &update, next);
+    while (!update.done) {
+        if (e->writing) {
+            qemu_co_mutex_unlock(&s->lock);
+            qemu_co_queue_wait(&e->write_queue);
+            qemu_co_mutex_lock(&s->lock);
+        } else {
+            qcow2_cache_write_updates(bs, c, i);
+        }
+    }
+    ret = update.ret;
+
+out:
+    e->ref--;
+    return ret;
+}
+
+void qcow2_cache_entry_mark_dirty(Qcow2Cache *c, void *table)
+{
+    int i = qcow2_cache_index(c, table);
+
+    if (i < 0) {
+        abort();
+    }
     c->entries[i].dirty = true;
 }
 
@@ -580,7 +580,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
 {
     BDRVQcowState *s = bs->opaque;
     int i, j = 0, l2_index, ret;
-    uint64_t *old_cluster, start_sect, l2_offset, *l2_table;
+    uint64_t *old_cluster, *new_entries, start_sect, l2_offset, *l2_table;
     uint64_t cluster_offset = m->cluster_offset;
     bool cow = false;
 
@@ -588,6 +588,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
         return 0;
 
     old_cluster = g_malloc(m->nb_clusters * sizeof(uint64_t));
+    new_entries = g_malloc(m->nb_clusters * sizeof(uint64_t));
 
     /* copy content of unmodified sectors */
     start_sect = (m->offset & ~(s->cluster_size - 1)) >> 9;
@@ -616,18 +617,21 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
      *
      * Before we update the L2 table to actually point to the new cluster, we
      * need to be sure that the refcounts have been increased and COW was
-     * handled.
+     * handled.  With lazy refcounts the image is marked dirty instead and
+     * the refcounts are written back whenever it suits the cache.
      */
     if (cow) {
         qcow2_cache_depends_on_flush(s->l2_table_cache);
     }
 
-    qcow2_cache_set_dependency(bs, s->l2_table_cache, s->refcount_block_cache);
+    if (!s->use_lazy_refcounts) {
+        qcow2_cache_set_dependency(bs, s->l2_table_cache,
+                                   s->refcount_block_cache);
+    }
     ret = get_cluster_table(bs, m->offset, &l2_table, &l2_offset, &l2_index);
     if (ret < 0) {
         goto err;
     }
-    qcow2_cache_entry_mark_dirty(s->l2_table_cache, l2_table);
 
     for (i = 0; i < m->nb_clusters; i++) {
         /* if two concurrent writes happen to the same unallocated cluster
@@ -639,12 +643,16 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
         if(l2_table[l2_index + i] != 0)
             old_cluster[j++] = l2_table[l2_index + i];
 
-        l2_table[l2_index + i] = cpu_to_be64((cluster_offset +
+        new_entries[i] = cpu_to_be64((cluster_offset +
                     (i << s->cluster_bits)) | QCOW_OFLAG_COPIED);
      }
 
 
-    ret = qcow2_cache_put(bs, s->l2_table_cache, (void**) &l2_table);
+    /* Writing back the L2 table doesn't hold up other requests.  The new
+     * entries only become visible once they are on disk. */
+    ret = qcow2_cache_put_write(bs, s->l2_table_cache, (void**) &l2_table,
+                                l2_index * sizeof(uint64_t), new_entries,
+                                m->nb_clusters * sizeof(uint64_t));
     if (ret < 0) {
         goto err;
     }
@@ -663,6 +671,7 @@ int qcow2_alloc_cluster_link_l2(BlockDriverState *bs, QCowL2Meta *m)
     ret = 0;
 err:
     g_free(old_cluster);
+    g_free(new_entries);
     return ret;
  }
 
@@ -760,7 +769,9 @@ again:
         uint64_t old_start = old_alloc->offset >> s->cluster_bits;
         uint64_t old_end = old_start + old_alloc->nb_clusters;
 
-        if (end < old_start || start > old_end) {
+        /* Both ranges are half-open, so that allocations of neighbouring
+         * clusters (e.g. sequential writes) don't wait for each other */
+        if (end <= old_start || start >= old_end) {
             /* No intersection */
         } else {
             if (start < old_start) {
@@ -431,6 +431,15 @@ static int QEMU_WARN_UNUSED_RESULT update_refcount(BlockDriverState *bs,
         return 0;
     }
 
+    /* Refcount blocks are written back lazily from here on, and the
+     * metadata that references the clusters may hit the disk first */
+    if (s->use_lazy_refcounts) {
+        ret = qcow2_mark_dirty(bs);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
     if (addend < 0) {
         qcow2_cache_set_dependency(bs, s->refcount_block_cache,
             s->l2_table_cache);
@@ -1063,12 +1072,47 @@ fail:
 }
 
 /*
- * Checks an image for refcount consistency.
+ * Sets the refcount of cluster i to the number of references found by the
+ * check, counting the result in res.
+ */
+static void repair_refcount(BlockDriverState *bs, BdrvCheckResult *res,
+                            int i, int refcount, int reference)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+
+    fprintf(stderr, "Repairing cluster %d refcount=%d reference=%d\n",
+            i, refcount, reference);
+
+    ret = update_refcount(bs, (int64_t)i << s->cluster_bits, 1,
+                          reference - refcount);
+    if (ret < 0) {
+        fprintf(stderr, "ERROR: Can't repair refcount of cluster %d: %s\n",
+                i, strerror(-ret));
+        if (refcount < reference) {
+            res->corruptions++;
+        } else {
+            res->leaks++;
+        }
+        return;
+    }
+
+    if (refcount < reference) {
+        res->corruptions_fixed++;
+    } else {
+        res->leaks_fixed++;
+    }
+}
+
+/*
+ * Checks an image for refcount consistency.  Refcounts that don't match the
+ * references found in the image are corrected if fix asks for it.
  *
  * Returns 0 if no errors are found, the number of errors in case the image is
  * detected as corrupted, and -errno when an internal error occurred.
  */
-int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res)
+int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
+                          BdrvCheckMode fix)
 {
     BDRVQcowState *s = bs->opaque;
     int64_t size;
@@ -1104,6 +1148,14 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res)
     inc_refcounts(bs, res, refcount_table, nb_clusters,
         s->snapshots_offset, s->snapshots_size);
 
+    /* dirty bitmaps */
+    for (i = 0; i < s->nb_bitmaps; i++) {
+        if (s->bitmaps[i].offset) {
+            inc_refcounts(bs, res, refcount_table, nb_clusters,
+                s->bitmaps[i].offset, s->bitmaps[i].size);
+        }
+    }
+
     /* refcount data */
     inc_refcounts(bs, res, refcount_table, nb_clusters,
         s->refcount_table_offset,
@@ -1139,6 +1191,15 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res)
         }
     }
 
+    /* Clusters that are in use may still have a refcount of 0 here.  Any
+     * refcount block that the repair needs must come from past the end of
+     * the image, where nothing can be referenced.  Leaks are only fixed once
+     * all refcounts that are too low have been raised, as freeing a cluster
+     * moves free_cluster_index back. */
+    if (fix) {
+        s->free_cluster_index = nb_clusters;
+    }
+
     /* compare ref counts */
     for(i = 0; i < nb_clusters; i++) {
         refcount1 = get_refcount(bs, i);
@@ -1150,7 +1211,11 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res)
         }
 
         refcount2 = refcount_table[i];
-        if (refcount1 != refcount2) {
+        if (refcount1 < refcount2 && (fix & BDRV_FIX_ERRORS)) {
+            repair_refcount(bs, res, i, refcount1, refcount2);
+        } else if (refcount1 > refcount2 && (fix & BDRV_FIX_LEAKS)) {
+            /* second pass */
+        } else if (refcount1 != refcount2) {
             fprintf(stderr, "%s cluster %d refcount=%d reference=%d\n",
                    refcount1 < refcount2 ? "ERROR" : "Leaked",
                    i, refcount1, refcount2);
@@ -1162,6 +1227,34 @@ int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res)
         }
     }
 
+    if (fix & BDRV_FIX_LEAKS) {
+        for(i = 0; i < nb_clusters; i++) {
+            refcount1 = get_refcount(bs, i);
+            if (refcount1 > refcount_table[i]) {
+                repair_refcount(bs, res, i, refcount1, refcount_table[i]);
+            }
+        }
+    }
+
+    if (res->corruptions_fixed || res->leaks_fixed) {
+        BdrvCheckResult fresh = {0};
+
+        ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+        if (ret < 0) {
+            res->check_errors++;
+            goto fail;
+        }
+
+        /* The QCOW_OFLAG_COPIED checks saw the old refcounts, so check the
+         * repaired image again */
+        g_free(refcount_table);
+        ret = qcow2_check_refcounts(bs, &fresh, 0);
+        res->corruptions = fresh.corruptions;
+        res->leaks = fresh.leaks;
+        res->check_errors = fresh.check_errors;
+        return ret;
+    }
+
     ret = 0;
 
 fail:
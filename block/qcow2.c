@@ -53,6 +53,7 @@ typedef struct {
 } QCowExtension;
 #define  QCOW2_EXT_MAGIC_END 0
 #define  QCOW2_EXT_MAGIC_BACKING_FORMAT 0xE2792ACA
+#define  QCOW2_EXT_MAGIC_DIRTY_BITMAPS 0x23852875
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -77,6 +78,7 @@ static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
                                  uint64_t end_offset)
 {
+    BDRVQcowState *s = bs->opaque;
     QCowExtension ext;
     uint64_t offset;
 
@@ -87,7 +89,6 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
     while (offset < end_offset) {
 
 #ifdef DEBUG_EXT
-        BDRVQcowState *s = bs->opaque;
         /* Sanity check */
         if (offset > s->cluster_size)
             printf("qcow2_read_extension: suspicious offset %lu\n", offset);
@@ -128,6 +129,15 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             offset = ((offset + ext.len + 7) & ~7);
             break;
 
+        case QCOW2_EXT_MAGIC_DIRTY_BITMAPS:
+            if (s->qcow_version >= 3 &&
+                qcow2_read_bitmap_ext(bs, offset, ext.len) < 0) {
+                fprintf(stderr, "ERROR: invalid dirty bitmap extension\n");
+                return 4;
+            }
+            offset = ((offset + ext.len + 7) & ~7);
+            break;
+
         default:
             /* unknown magic -- just skip it */
             offset = ((offset + ext.len + 7) & ~7);
@@ -139,6 +149,104 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
 }
 
 
+/*
+ * Writes the feature bits of a version 3 header and makes sure that they
+ * are on the disk.
+ */
+int qcow2_update_features(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t buf[3];
+    int ret;
+
+    assert(s->qcow_version >= 3);
+    buf[0] = cpu_to_be64(s->incompatible_features);
+    buf[1] = cpu_to_be64(s->compatible_features);
+    buf[2] = cpu_to_be64(s->autoclear_features);
+
+    ret = bdrv_pwrite_sync(bs->file,
+                           offsetof(QCowHeader, incompatible_features),
+                           buf, sizeof(buf));
+    return ret < 0 ? ret : 0;
+}
+
+/*
+ * Sets the dirty bit.  Must be called before the refcounts on the disk are
+ * allowed to fall behind the rest of the metadata.
+ */
+int qcow2_mark_dirty(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+
+    if (s->incompatible_features & QCOW2_INCOMPAT_DIRTY) {
+        return 0;
+    }
+
+    s->incompatible_features |= QCOW2_INCOMPAT_DIRTY;
+    ret = qcow2_update_features(bs);
+    if (ret < 0) {
+        s->incompatible_features &= ~QCOW2_INCOMPAT_DIRTY;
+    }
+    return ret;
+}
+
+/*
+ * Writes back the refcounts and clears the dirty bit.  There must be no
+ * requests in flight.
+ */
+static int qcow2_mark_clean(BlockDriverState *bs)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+
+    if (!(s->incompatible_features & QCOW2_INCOMPAT_DIRTY)) {
+        return 0;
+    }
+
+    ret = qcow2_cache_flush(bs, s->l2_table_cache);
+    if (ret < 0) {
+        return ret;
+    }
+    ret = qcow2_cache_flush(bs, s->refcount_block_cache);
+    if (ret < 0) {
+        return ret;
+    }
+
+    s->incompatible_features &= ~QCOW2_INCOMPAT_DIRTY;
+    return qcow2_update_features(bs);
+}
+
+/*
+ * Number of tables to cache for a user supplied size in bytes, where
+ * BDRV_CACHE_SIZE_MAX asks for all @max_tables tables of the image.
+ */
+static int qcow2_cache_tables(BDRVQcowState *s, int64_t size,
+                              int64_t max_tables, int def, int min)
+{
+    int64_t tables;
+
+    if (size == 0) {
+        return def;
+    } else if (size == BDRV_CACHE_SIZE_MAX) {
+        tables = max_tables;
+    } else {
+        tables = DIV_ROUND_UP(size, s->cluster_size);
+    }
+    return MAX(min, MIN(tables, INT_MAX / s->cluster_size));
+}
+
+static void qcow2_cache_clean_timer_cb(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcowState *s = bs->opaque;
+
+    qcow2_cache_clean_unused(s->l2_table_cache);
+    qcow2_cache_clean_unused(s->refcount_block_cache);
+    qemu_mod_timer(s->cache_clean_timer, qemu_get_clock_ms(rt_clock) +
+                   s->cache_clean_interval * 1000LL);
+}
+
 static int qcow2_open(BlockDriverState *bs, int flags)
 {
     BDRVQcowState *s = bs->opaque;
@@ -169,7 +277,7 @@ static int qcow2_open(BlockDriverState *bs, int flags)
         ret = -EINVAL;
         goto fail;
     }
-    if (header.version != QCOW_VERSION) {
+    if (header.version < QCOW_VERSION || header.version > QCOW_MAX_VERSION) {
         char version[64];
         snprintf(version, sizeof(version), "QCOW version %d", header.version);
         qerror_report(QERR_UNKNOWN_BLOCK_FORMAT_FEATURE,
@@ -177,6 +285,46 @@ static int qcow2_open(BlockDriverState *bs, int flags)
         ret = -ENOTSUP;
         goto fail;
     }
+    s->qcow_version = header.version;
+
+    if (header.version == 2) {
+        header.incompatible_features    = 0;
+        header.compatible_features      = 0;
+        header.autoclear_features       = 0;
+        header.refcount_order           = 4;
+        header.header_length            = QCOW2_V2_HEADER_LENGTH;
+    } else {
+        be64_to_cpus(&header.incompatible_features);
+        be64_to_cpus(&header.compatible_features);
+        be64_to_cpus(&header.autoclear_features);
+        be32_to_cpus(&header.refcount_order);
+        be32_to_cpus(&header.header_length);
+        if (header.header_length < sizeof(header)) {
+            ret = -EINVAL;
+            goto fail;
+        }
+    }
+    s->header_length = header.header_length;
+
+    if (header.incompatible_features & ~QCOW2_INCOMPAT_MASK) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%" PRIx64,
+                 header.incompatible_features & ~QCOW2_INCOMPAT_MASK);
+        qerror_report(QERR_UNKNOWN_BLOCK_FORMAT_FEATURE,
+            bs->device_name, "qcow2", buf);
+        ret = -ENOTSUP;
+        goto fail;
+    }
+    /* only 16 bit refcounts are supported */
+    if (header.refcount_order != 4) {
+        qerror_report(QERR_UNKNOWN_BLOCK_FORMAT_FEATURE,
+            bs->device_name, "qcow2", "refcount width");
+        ret = -ENOTSUP;
+        goto fail;
+    }
+    s->incompatible_features    = header.incompatible_features;
+    s->compatible_features      = header.compatible_features;
+    s->autoclear_features       = header.autoclear_features;
     if (header.cluster_bits < MIN_CLUSTER_BITS ||
         header.cluster_bits > MAX_CLUSTER_BITS) {
         ret = -EINVAL;
@@ -229,11 +377,34 @@ static int qcow2_open(BlockDriverState *bs, int flags)
         }
     }
 
-    /* alloc L2 table/refcount block cache */
+    s->use_lazy_refcounts =
+        !!(s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS);
+
+    /* alloc L2 table/refcount block cache; with lazy refcounts the refcount
+       blocks are only written back on eviction and flush */
     writethrough = ((flags & BDRV_O_CACHE_WB) == 0);
-    s->l2_table_cache = qcow2_cache_create(bs, L2_CACHE_SIZE, writethrough);
-    s->refcount_block_cache = qcow2_cache_create(bs, REFCOUNT_CACHE_SIZE,
+    s->l2_table_cache = qcow2_cache_create(bs,
+        qcow2_cache_tables(s, bs->l2_cache_size, s->l1_size,
+                           L2_CACHE_SIZE, MIN_L2_CACHE_SIZE),
         writethrough);
+    /* a refcount block covers cluster_size / 2 clusters; leave room for
+       the metadata on top of the guest data */
+    s->refcount_block_cache = qcow2_cache_create(bs,
+        qcow2_cache_tables(s, bs->refcount_cache_size,
+                           DIV_ROUND_UP(bs->total_sectors * 512 +
+                                        (int64_t)s->l1_size * s->cluster_size,
+                                        (int64_t)s->cluster_size *
+                                        (s->cluster_size >> REFCOUNT_SHIFT)) + 1,
+                           REFCOUNT_CACHE_SIZE, REFCOUNT_CACHE_SIZE),
+        writethrough && !s->use_lazy_refcounts);
+
+    s->cache_clean_interval = bs->cache_clean_interval;
+    if (s->cache_clean_interval > 0) {
+        s->cache_clean_timer = qemu_new_timer_ms(rt_clock,
+                                                 qcow2_cache_clean_timer_cb, bs);
+        qemu_mod_timer(s->cache_clean_timer, qemu_get_clock_ms(rt_clock) +
+                       s->cache_clean_interval * 1000LL);
+    }
 
     s->cluster_cache = g_malloc(s->cluster_size);
     /* one more sector for decompressed data alignment */
@@ -255,7 +426,7 @@ static int qcow2_open(BlockDriverState *bs, int flags)
     } else {
         ext_end = s->cluster_size;
     }
-    if (qcow2_read_extensions(bs, sizeof(header), ext_end)) {
+    if (qcow2_read_extensions(bs, s->header_length, ext_end)) {
         ret = -EINVAL;
         goto fail;
     }
@@ -282,21 +453,62 @@ static int qcow2_open(BlockDriverState *bs, int flags)
     /* Initialise locks */
     qemu_co_mutex_init(&s->lock);
 
+    /* Clear unknown autoclear feature bits */
+    if (!bs->read_only && (s->autoclear_features & ~QCOW2_AUTOCLEAR_MASK)) {
+        s->autoclear_features &= QCOW2_AUTOCLEAR_MASK;
+        ret = qcow2_update_features(bs);
+        if (ret < 0) {
+            goto fail;
+        }
+    }
+
+    /* Repair the refcounts if the image was not closed cleanly.  Like for
+     * QED, read-only images are left alone, they can't get any worse. */
+    if (!bs->read_only && (s->incompatible_features & QCOW2_INCOMPAT_DIRTY)) {
+        BdrvCheckResult result = {0};
+
+        ret = qcow2_check_refcounts(bs, &result,
+                                    BDRV_FIX_ERRORS | BDRV_FIX_LEAKS);
+        if (ret < 0) {
+            goto fail;
+        }
+        if (!result.corruptions && !result.check_errors) {
+            ret = qcow2_mark_clean(bs);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+    }
+
+    ret = qcow2_load_dirty_bitmaps(bs);
+    if (ret < 0) {
+        goto fail;
+    }
+
 #ifdef DEBUG_ALLOC
     {
         BdrvCheckResult result = {0};
-        qcow2_check_refcounts(bs, &result);
+        qcow2_check_refcounts(bs, &result, 0);
     }
 #endif
     return ret;
 
  fail:
+    qcow2_free_bitmaps(bs);
     qcow2_free_snapshots(bs);
     qcow2_refcount_close(bs);
     g_free(s->l1_table);
+    if (s->cache_clean_timer) {
+        qemu_del_timer(s->cache_clean_timer);
+        qemu_free_timer(s->cache_clean_timer);
+        s->cache_clean_timer = NULL;
+    }
     if (s->l2_table_cache) {
         qcow2_cache_destroy(bs, s->l2_table_cache);
     }
+    if (s->refcount_block_cache) {
+        qcow2_cache_destroy(bs, s->refcount_block_cache);
+    }
     g_free(s->cluster_cache);
     qemu_vfree(s->cluster_data);
     return ret;
@@ -624,11 +836,31 @@ fail:
 static void qcow2_close(BlockDriverState *bs)
 {
     BDRVQcowState *s = bs->opaque;
+    int ret;
+
+    if (!bs->read_only && s->qcow_version >= 3) {
+        ret = qcow2_store_dirty_bitmaps(bs);
+        if (ret < 0) {
+            error_report("Could not store the dirty bitmaps of '%s': %s",
+                         bs->filename, strerror(-ret));
+        }
+    }
+
     g_free(s->l1_table);
 
+    if (s->cache_clean_timer) {
+        qemu_del_timer(s->cache_clean_timer);
+        qemu_free_timer(s->cache_clean_timer);
+        s->cache_clean_timer = NULL;
+    }
+
     qcow2_cache_flush(bs, s->l2_table_cache);
     qcow2_cache_flush(bs, s->refcount_block_cache);
 
+    if (!bs->read_only) {
+        qcow2_mark_clean(bs);
+    }
+
     qcow2_cache_destroy(bs, s->l2_table_cache);
     qcow2_cache_destroy(bs, s->refcount_block_cache);
 
@@ -636,6 +868,7 @@ static void qcow2_close(BlockDriverState *bs)
     qemu_vfree(s->cluster_data);
     qcow2_refcount_close(bs);
     qcow2_free_snapshots(bs);
+    qcow2_free_bitmaps(bs);
 }
 
 static void qcow2_invalidate_cache(BlockDriverState *bs)
@@ -669,6 +902,29 @@ static void qcow2_invalidate_cache(BlockDriverState *bs)
     }
 }
 
+/*
+ * Size of the header up to the end of the backing file name, with a dirty
+ * bitmap extension of bitmaps_size bytes (none if 0).  It must fit into the
+ * first cluster.
+ */
+size_t qcow2_ext_header_size(BlockDriverState *bs, const char *backing_file,
+                             const char *backing_fmt, size_t bitmaps_size)
+{
+    BDRVQcowState *s = bs->opaque;
+    size_t size = s->header_length + sizeof(QCowExtension);
+
+    if (backing_file) {
+        size += strlen(backing_file);
+    }
+    if (backing_fmt) {
+        size += (sizeof(QCowExtension) + strlen(backing_fmt) + 7) & ~7;
+    }
+    if (bitmaps_size) {
+        size += (sizeof(QCowExtension) + bitmaps_size + 7) & ~7;
+    }
+    return size;
+}
+
 /*
  * Updates the variable length parts of the qcow2 header, i.e. the backing file
  * name and all extensions. qcow2 was not designed to allow such changes, so if
@@ -677,13 +933,15 @@ static void qcow2_invalidate_cache(BlockDriverState *bs)
  *
  * Returns 0 on success, -errno in error cases.
  */
-static int qcow2_update_ext_header(BlockDriverState *bs,
+int qcow2_update_ext_header(BlockDriverState *bs,
     const char *backing_file, const char *backing_fmt)
 {
     size_t backing_file_len = 0;
     size_t backing_fmt_len = 0;
+    size_t bitmaps_len = 0;
     BDRVQcowState *s = bs->opaque;
     QCowExtension ext_backing_fmt = {0, 0};
+    QCowExtension ext_bitmaps = {0, 0};
     int ret;
 
     /* Backing file format doesn't make sense without a backing file */
@@ -699,44 +957,56 @@ static int qcow2_update_ext_header(BlockDriverState *bs,
             + strlen(backing_fmt) + 7) & ~7);
     }
 
+    /* Prepare the dirty bitmap extension if needed */
+    if (s->nb_bitmaps) {
+        ext_bitmaps.len = cpu_to_be32(qcow2_bitmap_ext_size(bs));
+        ext_bitmaps.magic = cpu_to_be32(QCOW2_EXT_MAGIC_DIRTY_BITMAPS);
+        bitmaps_len = ((sizeof(ext_bitmaps)
+            + qcow2_bitmap_ext_size(bs) + 7) & ~7);
+    }
+
     /* Check if we can fit the new header into the first cluster */
     if (backing_file) {
         backing_file_len = strlen(backing_file);
     }
 
-    size_t header_size = sizeof(QCowHeader) + backing_file_len
-        + backing_fmt_len;
+    size_t header_size = qcow2_ext_header_size(bs, backing_file, backing_fmt,
+        s->nb_bitmaps ? qcow2_bitmap_ext_size(bs) : 0);
 
     if (header_size > s->cluster_size) {
         return -ENOSPC;
     }
 
     /* Rewrite backing file name and qcow2 extensions */
-    size_t ext_size = header_size - sizeof(QCowHeader);
+    size_t ext_size = header_size - s->header_length;
     uint8_t buf[ext_size];
     size_t offset = 0;
     size_t backing_file_offset = 0;
 
-    if (backing_file) {
-        if (backing_fmt) {
-            int padding = backing_fmt_len -
-                (sizeof(ext_backing_fmt) + strlen(backing_fmt));
+    memset(buf, 0, ext_size);
 
-            memcpy(buf + offset, &ext_backing_fmt, sizeof(ext_backing_fmt));
-            offset += sizeof(ext_backing_fmt);
+    if (bitmaps_len) {
+        memcpy(buf + offset, &ext_bitmaps, sizeof(ext_bitmaps));
+        qcow2_write_bitmap_ext(bs, buf + offset + sizeof(ext_bitmaps));
+        offset += bitmaps_len;
+    }
 
-            memcpy(buf + offset, backing_fmt, strlen(backing_fmt));
-            offset += strlen(backing_fmt);
+    if (backing_fmt) {
+        memcpy(buf + offset, &ext_backing_fmt, sizeof(ext_backing_fmt));
+        memcpy(buf + offset + sizeof(ext_backing_fmt), backing_fmt,
+               strlen(backing_fmt));
+        offset += backing_fmt_len;
+    }
 
-            memset(buf + offset, 0, padding);
-            offset += padding;
-        }
+    /* End of the extensions, already zeroed */
+    offset += sizeof(QCowExtension);
 
+    if (backing_file) {
         memcpy(buf + offset, backing_file, backing_file_len);
-        backing_file_offset = sizeof(QCowHeader) + offset;
+        backing_file_offset = s->header_length + offset;
     }
 
-    ret = bdrv_pwrite_sync(bs->file, sizeof(QCowHeader), buf, ext_size);
+    ret = bdrv_pwrite_sync(bs->file, s->header_length, buf, ext_size);
     if (ret < 0) {
         goto fail;
     }
@@ -824,7 +1094,7 @@ static int preallocate(BlockDriverState *bs)
 static int qcow2_create2(const char *filename, int64_t total_size,
                          const char *backing_file, const char *backing_format,
                          int flags, size_t cluster_size, int prealloc,
-                         QEMUOptionParameter *options)
+                         QEMUOptionParameter *options, int version)
 {
     /* Calculate cluster_bits */
     int cluster_bits;
@@ -868,7 +1138,7 @@ static int qcow2_create2(const char *filename, int64_t total_size,
     /* Write the header */
     memset(&header, 0, sizeof(header));
     header.magic = cpu_to_be32(QCOW_MAGIC);
-    header.version = cpu_to_be32(QCOW_VERSION);
+    header.version = cpu_to_be32(version);
     header.cluster_bits = cpu_to_be32(cluster_bits);
     header.size = cpu_to_be64(0);
     header.l1_table_offset = cpu_to_be64(0);
@@ -882,7 +1152,17 @@ static int qcow2_create2(const char *filename, int64_t total_size,
         header.crypt_method = cpu_to_be32(QCOW_CRYPT_NONE);
     }
 
-    ret = bdrv_pwrite(bs, 0, &header, sizeof(header));
+    if (version >= 3) {
+        if (flags & BLOCK_FLAG_LAZY_REFCOUNTS) {
+            header.compatible_features |=
+                cpu_to_be64(QCOW2_COMPAT_LAZY_REFCOUNTS);
+        }
+        header.refcount_order = cpu_to_be32(4);
+        header.header_length = cpu_to_be32(sizeof(header));
+        ret = bdrv_pwrite(bs, 0, &header, sizeof(header));
+    } else {
+        ret = bdrv_pwrite(bs, 0, &header, QCOW2_V2_HEADER_LENGTH);
+    }
     if (ret < 0) {
         goto out;
     }
@@ -956,6 +1236,7 @@ static int qcow2_create(const char *filename, QEMUOptionParameter *options)
     int flags = 0;
     size_t cluster_size = DEFAULT_CLUSTER_SIZE;
     int prealloc = 0;
+    int version = QCOW_VERSION;
 
     /* Read out options */
     while (options && options->name) {
@@ -981,6 +1262,18 @@ static int qcow2_create(const char *filename, QEMUOptionParameter *options)
                     options->value.s);
                 return -EINVAL;
             }
+        } else if (!strcmp(options->name, BLOCK_OPT_COMPAT_LEVEL)) {
+            if (!options->value.s || !strcmp(options->value.s, "0.10")) {
+                version = 2;
+            } else if (!strcmp(options->value.s, "1.1")) {
+                version = 3;
+            } else {
+                fprintf(stderr, "Invalid compatibility level: '%s'\n",
+                    options->value.s);
+                return -EINVAL;
+            }
+        } else if (!strcmp(options->name, BLOCK_OPT_LAZY_REFCOUNTS)) {
+            flags |= options->value.n ? BLOCK_FLAG_LAZY_REFCOUNTS : 0;
         }
         options++;
     }
@@ -991,8 +1284,14 @@ static int qcow2_create(const char *filename, QEMUOptionParameter *options)
         return -EINVAL;
     }
 
+    if (version < 3 && (flags & BLOCK_FLAG_LAZY_REFCOUNTS)) {
+        fprintf(stderr, "Lazy refcounts only supported with compatibility "
+                "level 1.1 and above (use compat=1.1 or greater)\n");
+        return -EINVAL;
+    }
+
     return qcow2_create2(filename, sectors, backing_file, backing_fmt, flags,
-                         cluster_size, prealloc, options);
+                         cluster_size, prealloc, options, version);
 }
 
 static int qcow2_make_empty(BlockDriverState *bs)
@@ -1065,39 +1364,20 @@ static int qcow2_truncate(BlockDriverState *bs, int64_t offset)
     return 0;
 }
 
-/* XXX: put compressed sectors first, then all the cluster aligned
-   tables to avoid losing bytes in alignment */
-static int qcow2_write_compressed(BlockDriverState *bs, int64_t sector_num,
-                                  const uint8_t *buf, int nb_sectors)
+static int qcow2_compress_cluster(BlockDriverState *bs, const uint8_t *buf,
+                                  uint8_t *out_buf, int level)
 {
     BDRVQcowState *s = bs->opaque;
     z_stream strm;
     int ret, out_len;
-    uint8_t *out_buf;
-    uint64_t cluster_offset;
 
-    if (nb_sectors == 0) {
-        /* align end of file to a sector boundary to ease reading with
-           sector based I/Os */
-        cluster_offset = bdrv_getlength(bs->file);
-        cluster_offset = (cluster_offset + 511) & ~511;
-        bdrv_truncate(bs->file, cluster_offset);
-        return 0;
-    }
-
-    if (nb_sectors != s->cluster_sectors)
-        return -EINVAL;
-
-    out_buf = g_malloc(s->cluster_size + (s->cluster_size / 1000) + 128);
-
-    /* best compression, small window, no zlib header */
+    /* small window, no zlib header */
     memset(&strm, 0, sizeof(strm));
-    ret = deflateInit2(&strm, Z_DEFAULT_COMPRESSION,
+    ret = deflateInit2(&strm, level,
                        Z_DEFLATED, -12,
                        9, Z_DEFAULT_STRATEGY);
     if (ret != 0) {
-        ret = -EINVAL;
-        goto fail;
+        return -EINVAL;
     }
 
     strm.avail_in = s->cluster_size;
@@ -1108,36 +1388,78 @@ static int qcow2_write_compressed(BlockDriverState *bs, int64_t sector_num,
     ret = deflate(&strm, Z_FINISH);
     if (ret != Z_STREAM_END && ret != Z_OK) {
         deflateEnd(&strm);
-        ret = -EINVAL;
-        goto fail;
+        return -EINVAL;
     }
     out_len = strm.next_out - out_buf;
 
     deflateEnd(&strm);
 
     if (ret != Z_STREAM_END || out_len >= s->cluster_size) {
+        return 0;
+    }
+    return out_len;
+}
+
+/* XXX: put compressed sectors first, then all the cluster aligned
+   tables to avoid losing bytes in alignment */
+static int qcow2_write_compressed_data(BlockDriverState *bs,
+                                       int64_t sector_num, const uint8_t *buf,
+                                       const uint8_t *out_buf, int out_len)
+{
+    BDRVQcowState *s = bs->opaque;
+    uint64_t cluster_offset;
+    int ret;
+
+    if (out_len == 0) {
         /* could not compress: write normal cluster */
         ret = bdrv_write(bs, sector_num, buf, s->cluster_sectors);
         if (ret < 0) {
-            goto fail;
+            return ret;
         }
     } else {
         cluster_offset = qcow2_alloc_compressed_cluster_offset(bs,
             sector_num << 9, out_len);
         if (!cluster_offset) {
-            ret = -EIO;
-            goto fail;
+            return -EIO;
         }
         cluster_offset &= s->cluster_offset_mask;
         BLKDBG_EVENT(bs->file, BLKDBG_WRITE_COMPRESSED);
         ret = bdrv_pwrite(bs->file, cluster_offset, out_buf, out_len);
         if (ret < 0) {
-            goto fail;
+            return ret;
         }
     }
 
-    ret = 0;
-fail:
+    return 0;
+}
+
+static int qcow2_write_compressed(BlockDriverState *bs, int64_t sector_num,
+                                  const uint8_t *buf, int nb_sectors)
+{
+    BDRVQcowState *s = bs->opaque;
+    int ret;
+    uint8_t *out_buf;
+    uint64_t cluster_offset;
+
+    if (nb_sectors == 0) {
+        /* align end of file to a sector boundary to ease reading with
+           sector based I/Os */
+        cluster_offset = bdrv_getlength(bs->file);
+        cluster_offset = (cluster_offset + 511) & ~511;
+        bdrv_truncate(bs->file, cluster_offset);
+        return 0;
+    }
+
+    if (nb_sectors != s->cluster_sectors)
+        return -EINVAL;
+
+    out_buf = g_malloc(s->cluster_size + (s->cluster_size / 1000) + 128);
+
+    ret = qcow2_compress_cluster(bs, buf, out_buf, Z_DEFAULT_COMPRESSION);
+    if (ret >= 0) {
+        ret = qcow2_write_compressed_data(bs, sector_num, buf, out_buf, ret);
+    }
+
     g_free(out_buf);
     return ret;
 }
@@ -1179,13 +1501,24 @@ static int qcow2_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     BDRVQcowState *s = bs->opaque;
     bdi->cluster_size = s->cluster_size;
     bdi->vm_state_offset = qcow2_vm_state_offset(s);
+    bdi->has_cache_stats = true;
+    qcow2_cache_get_stats(s->l2_table_cache, &bdi->l2_cache_hits,
+                          &bdi->l2_cache_misses);
+    qcow2_cache_get_stats(s->refcount_block_cache, &bdi->refcount_cache_hits,
+                          &bdi->refcount_cache_misses);
     return 0;
 }
 
 
-static int qcow2_check(BlockDriverState *bs, BdrvCheckResult *result)
+static int qcow2_check(BlockDriverState *bs, BdrvCheckResult *result,
+                       BdrvCheckMode fix)
 {
-    return qcow2_check_refcounts(bs, result);
+    int ret = qcow2_check_refcounts(bs, result, fix);
+
+    if (ret == 0 && fix && !result->corruptions && !result->check_errors) {
+        ret = qcow2_mark_clean(bs);
+    }
+    return ret;
 }
 
 #if 0
@@ -1271,6 +1604,16 @@ static QEMUOptionParameter qcow2_create_options[] = {
         .type = OPT_STRING,
         .help = "Preallocation mode (allowed values: off, metadata)"
     },
+    {
+        .name = BLOCK_OPT_COMPAT_LEVEL,
+        .type = OPT_STRING,
+        .help = "Compatibility level (0.10 or 1.1)"
+    },
+    {
+        .name = BLOCK_OPT_LAZY_REFCOUNTS,
+        .type = OPT_FLAG,
+        .help = "Postpone refcount updates (requires compat=1.1)"
+    },
     { NULL }
 };
 
@@ -1293,6 +1636,8 @@ static BlockDriver bdrv_qcow2 = {
     .bdrv_co_discard        = qcow2_co_discard,
     .bdrv_truncate          = qcow2_truncate,
     .bdrv_write_compressed  = qcow2_write_compressed,
+    .bdrv_compress_cluster  = qcow2_compress_cluster,
+    .bdrv_write_compressed_data = qcow2_write_compressed_data,
 
     .bdrv_snapshot_create   = qcow2_snapshot_create,
     .bdrv_snapshot_goto     = qcow2_snapshot_goto,
@@ -1300,6 +1645,7 @@ static BlockDriver bdrv_qcow2 = {
     .bdrv_snapshot_list     = qcow2_snapshot_list,
     .bdrv_snapshot_load_tmp     = qcow2_snapshot_load_tmp,
     .bdrv_get_info      = qcow2_get_info,
+    .bdrv_check_persistent_dirty_bitmap = qcow2_check_persistent_dirty_bitmap,
 
     .bdrv_save_vmstate    = qcow2_save_vmstate,
     .bdrv_load_vmstate    = qcow2_load_vmstate,
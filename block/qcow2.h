@@ -34,6 +34,7 @@
 
 #define QCOW_MAGIC (('Q' << 24) | ('F' << 16) | ('I' << 8) | 0xfb)
 #define QCOW_VERSION 2
+#define QCOW_MAX_VERSION 3
 
 #define QCOW_CRYPT_NONE 0
 #define QCOW_CRYPT_AES  1
@@ -51,6 +52,7 @@
 #define MAX_CLUSTER_BITS 21
 
 #define L2_CACHE_SIZE 16
+#define MIN_L2_CACHE_SIZE 2
 
 /* Must be at least 4 to cover all cases of refcount table growth */
 #define REFCOUNT_CACHE_SIZE 4
@@ -71,8 +73,48 @@ typedef struct QCowHeader {
     uint32_t refcount_table_clusters;
     uint32_t nb_snapshots;
     uint64_t snapshots_offset;
+
+    /* Version 3 only */
+    uint64_t incompatible_features;
+    uint64_t compatible_features;
+    uint64_t autoclear_features;
+    uint32_t refcount_order;
+    uint32_t header_length;
 } QCowHeader;
 
+/* Size of a version 2 header */
+#define QCOW2_V2_HEADER_LENGTH offsetof(QCowHeader, incompatible_features)
+
+/* Incompatible feature bits */
+enum {
+    /* refcounts may be inconsistent, the image must be repaired before
+       it is written to */
+    QCOW2_INCOMPAT_DIRTY        = 1 << 0,
+    QCOW2_INCOMPAT_MASK         = QCOW2_INCOMPAT_DIRTY,
+};
+
+/* Compatible feature bits */
+enum {
+    /* refcount updates may be delayed, protected by QCOW2_INCOMPAT_DIRTY */
+    QCOW2_COMPAT_LAZY_REFCOUNTS = 1 << 0,
+    QCOW2_COMPAT_MASK           = QCOW2_COMPAT_LAZY_REFCOUNTS,
+};
+
+/* Autoclear feature bits */
+enum {
+    /* the dirty bitmap extension is in sync with the guest data */
+    QCOW2_AUTOCLEAR_DIRTY_BITMAPS = 1 << 0,
+    QCOW2_AUTOCLEAR_MASK          = QCOW2_AUTOCLEAR_DIRTY_BITMAPS,
+};
+
+/* Entry of the dirty bitmap header extension */
+typedef struct Qcow2Bitmap {
+    char *name;
+    uint32_t granularity_bits;
+    uint64_t offset; /* 0 if the bitmap is in use and not stored */
+    uint64_t size;   /* in bytes */
+} Qcow2Bitmap;
+
 typedef struct QCowSnapshot {
     uint64_t l1_table_offset;
     uint32_t l1_size;
@@ -103,6 +145,8 @@ typedef struct BDRVQcowState {
 
     Qcow2Cache* l2_table_cache;
     Qcow2Cache* refcount_block_cache;
+    QEMUTimer *cache_clean_timer;
+    int cache_clean_interval;
 
     uint8_t *cluster_cache;
     uint8_t *cluster_data;
@@ -126,7 +170,16 @@ typedef struct BDRVQcowState {
     int nb_snapshots;
     QCowSnapshot *snapshots;
 
+    int nb_bitmaps;
+    Qcow2Bitmap *bitmaps;
+
     int flags;
+    int qcow_version;
+    int header_length;
+    bool use_lazy_refcounts;
+    uint64_t incompatible_features;
+    uint64_t compatible_features;
+    uint64_t autoclear_features;
 } BDRVQcowState;
 
 /* XXX: use std qcow open function ? */
@@ -176,6 +229,12 @@ static inline int64_t align_offset(int64_t offset, int n)
 // FIXME Need qcow2_ prefix to global functions
 
 /* qcow2.c functions */
+int qcow2_update_features(BlockDriverState *bs);
+int qcow2_mark_dirty(BlockDriverState *bs);
+size_t qcow2_ext_header_size(BlockDriverState *bs, const char *backing_file,
+                             const char *backing_fmt, size_t bitmaps_size);
+int qcow2_update_ext_header(BlockDriverState *bs,
+    const char *backing_file, const char *backing_fmt);
 int qcow2_backing_read1(BlockDriverState *bs, QEMUIOVector *qiov,
                   int64_t sector_num, int nb_sectors);
 
@@ -193,7 +252,8 @@ void qcow2_free_any_clusters(BlockDriverState *bs,
 int qcow2_update_snapshot_refcount(BlockDriverState *bs,
     int64_t l1_table_offset, int l1_size, int addend);
 
-int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res);
+int qcow2_check_refcounts(BlockDriverState *bs, BdrvCheckResult *res,
+                          BdrvCheckMode fix);
 
 /* qcow2-cluster.c functions */
 int qcow2_grow_l1_table(BlockDriverState *bs, int min_size, bool exact_size);
@@ -226,6 +286,17 @@ int qcow2_snapshot_load_tmp(BlockDriverState *bs, const char *snapshot_name);
 void qcow2_free_snapshots(BlockDriverState *bs);
 int qcow2_read_snapshots(BlockDriverState *bs);
 
+/* qcow2-bitmap.c functions */
+int qcow2_read_bitmap_ext(BlockDriverState *bs, uint64_t offset,
+                          uint32_t len);
+size_t qcow2_bitmap_ext_size(BlockDriverState *bs);
+void qcow2_write_bitmap_ext(BlockDriverState *bs, uint8_t *buf);
+int qcow2_load_dirty_bitmaps(BlockDriverState *bs);
+int qcow2_store_dirty_bitmaps(BlockDriverState *bs);
+int qcow2_check_persistent_dirty_bitmap(BlockDriverState *bs,
+                                        const char *name);
+void qcow2_free_bitmaps(BlockDriverState *bs);
+
 /* qcow2-cache.c functions */
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables,
     bool writethrough);
@@ -244,5 +315,9 @@ int qcow2_cache_get(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     void **table);
 int qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table);
+int coroutine_fn qcow2_cache_put_write(BlockDriverState *bs, Qcow2Cache *c,
+    void **table, int pos, const void *data, int size);
+void qcow2_cache_clean_unused(Qcow2Cache *c);
+void qcow2_cache_get_stats(Qcow2Cache *c, uint64_t *hits, uint64_t *misses);
 
 #endif
@@ -29,10 +29,15 @@
 
 /* posix-aio-compat.c - thread pool based implementation */
 int paio_init(void);
-BlockDriverAIOCB *paio_submit(BlockDriverState *bs, int fd,
+void paio_set_max_threads(int n);
+int paio_set_thread_affinity(const char *cpus);
+void *paio_queue_new(void);
+void paio_queue_delete(void *paio_ctx);
+void paio_get_info(void *paio_ctx, BlockDriverInfo *bdi);
+BlockDriverAIOCB *paio_submit(BlockDriverState *bs, void *paio_ctx, int fd,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockDriverCompletionFunc *cb, void *opaque, int type);
-BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
+BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, void *paio_ctx, int fd,
         unsigned long int req, void *buf,
         BlockDriverCompletionFunc *cb, void *opaque);
 
@@ -41,5 +46,7 @@ void *laio_init(void);
 BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockDriverCompletionFunc *cb, void *opaque, int type);
+void laio_io_plug(BlockDriverState *bs, void *aio_ctx);
+void laio_io_unplug(BlockDriverState *bs, void *aio_ctx);
 
 #endif /* QEMU_RAW_POSIX_AIO_H */
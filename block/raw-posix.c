@@ -129,6 +129,7 @@ typedef struct BDRVRawState {
     int use_aio;
     void *aio_ctx;
 #endif
+    void *paio_ctx;
     uint8_t *aligned_buf;
     unsigned aligned_buf_size;
 #ifdef CONFIG_XFS
@@ -234,6 +235,7 @@ static int raw_open_common(BlockDriverState *bs, const char *filename,
     if (paio_init() < 0) {
         goto out_free_buf;
     }
+    s->paio_ctx = paio_queue_new();
 
 #ifdef CONFIG_LINUX_AIO
     /*
@@ -245,7 +247,7 @@ static int raw_open_common(BlockDriverState *bs, const char *filename,
 
         s->aio_ctx = laio_init();
         if (!s->aio_ctx) {
-            goto out_free_buf;
+            goto out_free_queue;
         }
         s->use_aio = 1;
     } else
@@ -264,6 +266,10 @@ static int raw_open_common(BlockDriverState *bs, const char *filename,
 
     return 0;
 
+#ifdef CONFIG_LINUX_AIO
+out_free_queue:
+    paio_queue_delete(s->paio_ctx);
+#endif
 out_free_buf:
     qemu_vfree(s->aligned_buf);
 out_close:
@@ -337,7 +343,7 @@ static BlockDriverAIOCB *raw_aio_submit(BlockDriverState *bs,
         }
     }
 
-    return paio_submit(bs, s->fd, sector_num, qiov, nb_sectors,
+    return paio_submit(bs, s->paio_ctx, s->fd, sector_num, qiov, nb_sectors,
                        cb, opaque, type);
 }
 
@@ -365,7 +371,28 @@ static BlockDriverAIOCB *raw_aio_flush(BlockDriverState *bs,
     if (fd_open(bs) < 0)
         return NULL;
 
-    return paio_submit(bs, s->fd, 0, NULL, 0, cb, opaque, QEMU_AIO_FLUSH);
+    return paio_submit(bs, s->paio_ctx, s->fd, 0, NULL, 0, cb, opaque,
+                       QEMU_AIO_FLUSH);
+}
+
+static void raw_aio_plug(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_AIO
+    BDRVRawState *s = bs->opaque;
+    if (s->use_aio) {
+        laio_io_plug(bs, s->aio_ctx);
+    }
+#endif
+}
+
+static void raw_aio_unplug(BlockDriverState *bs)
+{
+#ifdef CONFIG_LINUX_AIO
+    BDRVRawState *s = bs->opaque;
+    if (s->use_aio) {
+        laio_io_unplug(bs, s->aio_ctx);
+    }
+#endif
 }
 
 static void raw_close(BlockDriverState *bs)
@@ -377,6 +404,15 @@ static void raw_close(BlockDriverState *bs)
         if (s->aligned_buf != NULL)
             qemu_vfree(s->aligned_buf);
     }
+    paio_queue_delete(s->paio_ctx);
+}
+
+static int raw_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
+{
+    BDRVRawState *s = bs->opaque;
+
+    paio_get_info(s->paio_ctx, bdi);
+    return 0;
 }
 
 static int raw_truncate(BlockDriverState *bs, int64_t offset)
@@ -638,6 +674,9 @@ static BlockDriver bdrv_file = {
     .bdrv_aio_readv = raw_aio_readv,
     .bdrv_aio_writev = raw_aio_writev,
     .bdrv_aio_flush = raw_aio_flush,
+    .bdrv_io_plug = raw_aio_plug,
+    .bdrv_io_unplug = raw_aio_unplug,
+    .bdrv_get_info = raw_get_info,
 
     .bdrv_truncate = raw_truncate,
     .bdrv_getlength = raw_getlength,
@@ -835,7 +874,7 @@ static BlockDriverAIOCB *hdev_aio_ioctl(BlockDriverState *bs,
 
     if (fd_open(bs) < 0)
         return NULL;
-    return paio_ioctl(bs, s->fd, req, buf, cb, opaque);
+    return paio_ioctl(bs, s->paio_ctx, s->fd, req, buf, cb, opaque);
 }
 
 #elif defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -906,6 +945,9 @@ static BlockDriver bdrv_host_device = {
     .bdrv_aio_readv	= raw_aio_readv,
     .bdrv_aio_writev	= raw_aio_writev,
     .bdrv_aio_flush	= raw_aio_flush,
+    .bdrv_io_plug	= raw_aio_plug,
+    .bdrv_io_unplug	= raw_aio_unplug,
+    .bdrv_get_info	= raw_get_info,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -1025,6 +1067,9 @@ static BlockDriver bdrv_host_floppy = {
     .bdrv_aio_readv     = raw_aio_readv,
     .bdrv_aio_writev    = raw_aio_writev,
     .bdrv_aio_flush	= raw_aio_flush,
+    .bdrv_io_plug	= raw_aio_plug,
+    .bdrv_io_unplug	= raw_aio_unplug,
+    .bdrv_get_info	= raw_get_info,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength	= raw_getlength,
@@ -1124,6 +1169,9 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_aio_readv     = raw_aio_readv,
     .bdrv_aio_writev    = raw_aio_writev,
     .bdrv_aio_flush	= raw_aio_flush,
+    .bdrv_io_plug	= raw_aio_plug,
+    .bdrv_io_unplug	= raw_aio_unplug,
+    .bdrv_get_info	= raw_get_info,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength     = raw_getlength,
@@ -1243,6 +1291,9 @@ static BlockDriver bdrv_host_cdrom = {
     .bdrv_aio_readv     = raw_aio_readv,
     .bdrv_aio_writev    = raw_aio_writev,
     .bdrv_aio_flush	= raw_aio_flush,
+    .bdrv_io_plug	= raw_aio_plug,
+    .bdrv_io_unplug	= raw_aio_unplug,
+    .bdrv_get_info	= raw_get_info,
 
     .bdrv_truncate      = raw_truncate,
     .bdrv_getlength     = raw_getlength,
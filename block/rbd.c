@@ -393,7 +393,7 @@ static void qemu_rbd_complete_aio(RADOSCB *rcb)
         }
     }
     /* Note that acb->bh can be NULL in case where the aio was cancelled */
-    acb->bh = qemu_bh_new(rbd_aio_bh_cb, acb);
+    acb->bh = qemu_bh_new_io(rbd_aio_bh_cb, acb);
     qemu_bh_schedule(acb->bh);
 done:
     g_free(rcb);
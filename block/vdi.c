@@ -300,7 +300,8 @@ static void vdi_header_print(VdiHeader *header)
 }
 #endif
 
-static int vdi_check(BlockDriverState *bs, BdrvCheckResult *res)
+static int vdi_check(BlockDriverState *bs, BdrvCheckResult *res,
+                     BdrvCheckMode fix)
 {
     /* TODO: additional checks possible. */
     BDRVVdiState *s = (BDRVVdiState *)bs->opaque;
@@ -546,7 +547,7 @@ static int vdi_schedule_bh(QEMUBHFunc *cb, VdiAIOCB *acb)
         return -EIO;
     }
 
-    acb->bh = qemu_bh_new(cb, acb);
+    acb->bh = qemu_bh_new_io(cb, acb);
     if (!acb->bh) {
         return -EIO;
     }
@@ -33,6 +33,7 @@
 
 #define BLOCK_FLAG_ENCRYPT	1
 #define BLOCK_FLAG_COMPAT6	4
+#define BLOCK_FLAG_LAZY_REFCOUNTS	8
 
 #define BLOCK_IO_LIMIT_READ     0
 #define BLOCK_IO_LIMIT_WRITE    1
@@ -50,6 +51,8 @@
 #define BLOCK_OPT_TABLE_SIZE    "table_size"
 #define BLOCK_OPT_PREALLOC      "preallocation"
 #define BLOCK_OPT_SUBFMT        "subformat"
+#define BLOCK_OPT_COMPAT_LEVEL  "compat"
+#define BLOCK_OPT_LAZY_REFCOUNTS "lazy_refcounts"
 
 typedef struct BdrvTrackedRequest BdrvTrackedRequest;
 
@@ -80,6 +83,13 @@ typedef struct BlockJobType {
 
     /** Optional callback for job types that support setting a speed limit */
     int (*set_speed)(BlockJob *job, int64_t value);
+
+    /**
+     * Optional callback run before guest data in the given range is
+     * overwritten or discarded, for job types that need the old contents
+     */
+    void coroutine_fn (*before_write)(BlockJob *job, int64_t sector_num,
+                                      int nb_sectors);
 } BlockJobType;
 
 /**
@@ -99,6 +109,20 @@ struct BlockJob {
     void *opaque;
 };
 
+/**
+ * Named dirty bitmap, one bit per @granularity bytes of guest data
+ */
+struct BdrvDirtyBitmap {
+    char *name;
+    int granularity;
+    int64_t nb_chunks;
+    int64_t count;          /* number of dirty chunks */
+    unsigned long *bitmap;
+    bool persistent;        /* stored in the image by the driver on close */
+    bool busy;              /* being exported by a block job */
+    QLIST_ENTRY(BdrvDirtyBitmap) list;
+};
+
 struct BlockDriver {
     const char *format_name;
     int instance_size;
@@ -159,6 +183,13 @@ struct BlockDriver {
     int (*bdrv_merge_requests)(BlockDriverState *bs, BlockRequest* a,
         BlockRequest *b);
 
+    /*
+     * Between bdrv_io_plug and bdrv_io_unplug the driver may hold back
+     * submitted requests and pass them to the host in a single batch.
+     */
+    void (*bdrv_io_plug)(BlockDriverState *bs);
+    void (*bdrv_io_unplug)(BlockDriverState *bs);
+
 
     const char *protocol_name;
     int (*bdrv_truncate)(BlockDriverState *bs, int64_t offset);
@@ -166,6 +197,14 @@ struct BlockDriver {
     int64_t (*bdrv_get_allocated_file_size)(BlockDriverState *bs);
     int (*bdrv_write_compressed)(BlockDriverState *bs, int64_t sector_num,
                                  const uint8_t *buf, int nb_sectors);
+    /* Compressed writes split in two steps.  bdrv_compress_cluster must not
+       touch the image state, so that callers can run it in worker threads;
+       bdrv_write_compressed_data then stores its result.  */
+    int (*bdrv_compress_cluster)(BlockDriverState *bs, const uint8_t *buf,
+                                 uint8_t *out_buf, int level);
+    int (*bdrv_write_compressed_data)(BlockDriverState *bs,
+                                      int64_t sector_num, const uint8_t *buf,
+                                      const uint8_t *out_buf, int out_len);
 
     int (*bdrv_snapshot_create)(BlockDriverState *bs,
                                 QEMUSnapshotInfo *sn_info);
@@ -178,6 +217,15 @@ struct BlockDriver {
                                   const char *snapshot_name);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
 
+    /*
+     * Whether a new dirty bitmap called name can be marked persistent, i.e.
+     * stored in the image file next to the persistent bitmaps that already
+     * exist.  The driver saves them on close and recreates them on open.
+     * Returns 0, -ENAMETOOLONG or -ENOSPC.
+     */
+    int (*bdrv_check_persistent_dirty_bitmap)(BlockDriverState *bs,
+                                              const char *name);
+
     int (*bdrv_save_vmstate)(BlockDriverState *bs, const uint8_t *buf,
                              int64_t pos, int size);
     int (*bdrv_load_vmstate)(BlockDriverState *bs, uint8_t *buf,
@@ -206,7 +254,8 @@ struct BlockDriver {
      * Returns 0 for completed check, -errno for internal errors.
      * The check results are stored in result.
      */
-    int (*bdrv_check)(BlockDriverState* bs, BdrvCheckResult *result);
+    int (*bdrv_check)(BlockDriverState* bs, BdrvCheckResult *result,
+        BdrvCheckMode fix);
 
     void (*bdrv_debug_event)(BlockDriverState *bs, BlkDebugEvent event);
 
@@ -230,6 +279,13 @@ struct BlockDriverState {
     int sg;        /* if true, the device is a /dev/sg* */
     int copy_on_read; /* if true, copy read backing sectors into image
                          note this is a reference count */
+    BdrvDetectZeroes detect_zeroes; /* what to do with all-zero writes */
+
+    /* metadata cache of the image format, in bytes; 0 for the format's
+       default, BDRV_CACHE_SIZE_MAX to cover the whole image */
+    int64_t l2_cache_size;
+    int64_t refcount_cache_size;
+    int cache_clean_interval; /* seconds, 0 never drops idle tables */
 
     BlockDriver *drv; /* NULL means no media */
     void *opaque;
@@ -289,6 +345,7 @@ struct BlockDriverState {
     char device_name[32];
     unsigned long *dirty_bitmap;
     int64_t dirty_count;
+    QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
     int in_use; /* users other than guest access, eg. block migration */
     QTAILQ_ENTRY(BlockDriverState) list;
     void *private;
@@ -330,5 +387,8 @@ bool block_job_is_cancelled(BlockJob *job);
 int stream_start(BlockDriverState *bs, BlockDriverState *base,
                  const char *base_id, BlockDriverCompletionFunc *cb,
                  void *opaque);
+int backup_start(BlockDriverState *bs, BlockDriverState *target,
+                 BdrvDirtyBitmap *bitmap, BlockDriverCompletionFunc *cb,
+                 void *opaque);
 
 #endif /* BLOCK_INT_H */
@@ -229,7 +229,7 @@ static void drive_put_ref_bh_schedule(DriveInfo *dinfo)
     DrivePutRefBH *s;
 
     s = g_new(DrivePutRefBH, 1);
-    s->bh = qemu_bh_new(drive_put_ref_bh, s);
+    s->bh = qemu_bh_new_io(drive_put_ref_bh, s);
     s->dinfo = dinfo;
     qemu_bh_schedule(s->bh);
 }
@@ -251,6 +251,22 @@ static int parse_block_error_action(const char *buf, int is_read)
     }
 }
 
+static int parse_cache_size(const char *buf, const char *name, int64_t *size)
+{
+    char *end;
+
+    if (!strcmp(buf, "max")) {
+        *size = BDRV_CACHE_SIZE_MAX;
+        return 0;
+    }
+    *size = strtosz_suffix(buf, &end, STRTOSZ_DEFSUFFIX_B);
+    if (*size < 0 || *end) {
+        error_report("'%s' invalid %s", buf, name);
+        return -1;
+    }
+    return 0;
+}
+
 static bool do_check_io_limits(BlockIOLimit *io_limits)
 {
     bool bps_flag;
@@ -293,6 +309,9 @@ DriveInfo *drive_init(QemuOpts *opts, int default_to_scsi)
     BlockIOLimit io_limits;
     int snapshot = 0;
     bool copy_on_read;
+    BdrvDetectZeroes detect_zeroes;
+    int64_t l2_cache_size = 0, refcount_cache_size = 0;
+    int cache_clean_interval;
     int ret;
 
     translation = BIOS_ATA_TRANSLATION_AUTO;
@@ -444,6 +463,28 @@ DriveInfo *drive_init(QemuOpts *opts, int default_to_scsi)
         }
     }
 
+    detect_zeroes = BDRV_DETECT_ZEROES_OFF;
+    if ((buf = qemu_opt_get(opts, "detect-zeroes")) != NULL) {
+        if (!strcmp(buf, "on")) {
+            detect_zeroes = BDRV_DETECT_ZEROES_ON;
+        } else if (!strcmp(buf, "unmap")) {
+            detect_zeroes = BDRV_DETECT_ZEROES_UNMAP;
+        } else if (strcmp(buf, "off")) {
+            error_report("'%s' invalid detect-zeroes option", buf);
+            return NULL;
+        }
+    }
+
+    if ((buf = qemu_opt_get(opts, "l2-cache-size")) != NULL &&
+        parse_cache_size(buf, "l2-cache-size", &l2_cache_size) < 0) {
+        return NULL;
+    }
+    if ((buf = qemu_opt_get(opts, "refcount-cache-size")) != NULL &&
+        parse_cache_size(buf, "refcount-cache-size", &refcount_cache_size) < 0) {
+        return NULL;
+    }
+    cache_clean_interval = qemu_opt_get_number(opts, "cache-clean-interval", 0);
+
     on_read_error = BLOCK_ERR_REPORT;
     if ((buf = qemu_opt_get(opts, "rerror")) != NULL) {
         if (type != IF_IDE && type != IF_VIRTIO && type != IF_SCSI && type != IF_NONE) {
@@ -537,6 +578,9 @@ DriveInfo *drive_init(QemuOpts *opts, int default_to_scsi)
     QTAILQ_INSERT_TAIL(&drives, dinfo, next);
 
     bdrv_set_on_error(dinfo->bdrv, on_read_error, on_write_error);
+    bdrv_set_detect_zeroes(dinfo->bdrv, detect_zeroes);
+    bdrv_set_metadata_cache(dinfo->bdrv, l2_cache_size, refcount_cache_size,
+                            cache_clean_interval);
 
     /* disk I/O throttling */
     bdrv_set_io_limits(dinfo->bdrv, &io_limits);
@@ -950,12 +994,12 @@ static QObject *qobject_from_block_job(BlockJob *job)
                               job->speed);
 }
 
-static void block_stream_cb(void *opaque, int ret)
+static void block_job_cb(void *opaque, int ret)
 {
     BlockDriverState *bs = opaque;
     QObject *obj;
 
-    trace_block_stream_cb(bs, bs->job, ret);
+    trace_block_job_cb(bs, bs->job, ret);
 
     assert(bs->job);
     obj = qobject_from_block_job(bs->job);
@@ -995,7 +1039,7 @@ void qmp_block_stream(const char *device, bool has_base,
         }
     }
 
-    ret = stream_start(bs, base_bs, base, block_stream_cb, bs);
+    ret = stream_start(bs, base_bs, base, block_job_cb, bs);
     if (ret < 0) {
         switch (ret) {
         case -EBUSY:
@@ -1015,6 +1059,177 @@ void qmp_block_stream(const char *device, bool has_base,
     trace_qmp_block_stream(bs, bs->job);
 }
 
+void qmp_block_dirty_bitmap_add(const char *device, const char *name,
+                                bool has_granularity, int64_t granularity,
+                                bool has_persistent, bool persistent,
+                                Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+    if (!bdrv_is_inserted(bs)) {
+        error_set(errp, QERR_DEVICE_HAS_NO_MEDIUM, device);
+        return;
+    }
+
+    if (!name[0] || bdrv_find_dirty_bitmap(bs, name)) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "name",
+                  "a new bitmap name");
+        return;
+    }
+
+    if (has_granularity) {
+        if (granularity < BDRV_SECTOR_SIZE || granularity > (1 << 30) ||
+            (granularity & (granularity - 1))) {
+            error_set(errp, QERR_INVALID_PARAMETER_VALUE, "granularity",
+                      "a power of two between 512 and 1G");
+            return;
+        }
+    } else {
+        BlockDriverInfo bdi;
+
+        granularity = 65536;
+        if (bdrv_get_info(bs, &bdi) >= 0 &&
+            bdi.cluster_size >= BDRV_SECTOR_SIZE &&
+            (bdi.cluster_size & (bdi.cluster_size - 1)) == 0) {
+            granularity = bdi.cluster_size;
+        }
+    }
+
+    if (has_persistent && persistent) {
+        switch (bdrv_check_persistent_dirty_bitmap(bs, name)) {
+        case 0:
+            break;
+        case -ENAMETOOLONG:
+            error_set(errp, QERR_INVALID_PARAMETER_VALUE, "name",
+                      "a shorter name for a persistent bitmap");
+            return;
+        case -ENOSPC:
+            error_set(errp, QERR_INVALID_PARAMETER_VALUE, "persistent",
+                      "false, the image has no room for another bitmap");
+            return;
+        default:
+            error_set(errp, QERR_BLOCK_FORMAT_FEATURE_NOT_SUPPORTED,
+                      bs->drv->format_name, device,
+                      "persistent dirty bitmaps");
+            return;
+        }
+    }
+
+    bitmap = bdrv_create_dirty_bitmap(bs, name, granularity);
+    bitmap->persistent = has_persistent && persistent;
+}
+
+void qmp_block_dirty_bitmap_remove(const char *device, const char *name,
+                                   Error **errp)
+{
+    BlockDriverState *bs;
+    BdrvDirtyBitmap *bitmap;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+
+    bitmap = bdrv_find_dirty_bitmap(bs, name);
+    if (!bitmap) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "name",
+                  "the name of a dirty bitmap of the device");
+        return;
+    }
+    if (bitmap->busy) {
+        error_set(errp, QERR_DEVICE_IN_USE, device);
+        return;
+    }
+
+    bdrv_release_dirty_bitmap(bs, bitmap);
+}
+
+void qmp_block_incremental_backup(const char *device, const char *bitmap_name,
+                                  const char *target, bool has_format,
+                                  const char *format, bool has_base,
+                                  const char *base, bool has_full, bool full,
+                                  Error **errp)
+{
+    BlockDriverState *bs, *target_bs;
+    BdrvDirtyBitmap *bitmap;
+    BlockDriver *drv;
+    int64_t size;
+    int ret;
+
+    bs = bdrv_find(device);
+    if (!bs) {
+        error_set(errp, QERR_DEVICE_NOT_FOUND, device);
+        return;
+    }
+
+    bitmap = bdrv_find_dirty_bitmap(bs, bitmap_name);
+    if (!bitmap) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "bitmap",
+                  "the name of a dirty bitmap of the device");
+        return;
+    }
+    if (bitmap->busy || bdrv_in_use(bs)) {
+        error_set(errp, QERR_DEVICE_IN_USE, device);
+        return;
+    }
+
+    if (!has_format) {
+        format = "qcow2";
+    }
+    drv = bdrv_find_format(format);
+    if (!drv) {
+        error_set(errp, QERR_INVALID_BLOCK_FORMAT, format);
+        return;
+    }
+
+    size = bdrv_getlength(bs);
+    if (size < 0) {
+        error_set(errp, QERR_UNDEFINED_ERROR);
+        return;
+    }
+
+    ret = bdrv_img_create(target, format, has_base ? base : NULL, NULL, NULL,
+                          size, bs->open_flags);
+    if (ret) {
+        error_set(errp, QERR_OPEN_FILE_FAILED, target);
+        return;
+    }
+
+    target_bs = bdrv_new("");
+    ret = bdrv_open(target_bs, target,
+                    (bs->open_flags & BDRV_O_CACHE_MASK) | BDRV_O_RDWR, drv);
+    if (ret < 0) {
+        bdrv_delete(target_bs);
+        error_set(errp, QERR_OPEN_FILE_FAILED, target);
+        return;
+    }
+
+    if (has_full && full) {
+        bdrv_dirty_bitmap_set_all(bitmap);
+    }
+
+    ret = backup_start(bs, target_bs, bitmap, block_job_cb, bs);
+    if (ret < 0) {
+        bdrv_delete(target_bs);
+        error_set(errp, QERR_DEVICE_IN_USE, device);
+        return;
+    }
+
+    /* Grab a reference so hotplug does not delete the BlockDriverState from
+     * underneath us.
+     */
+    drive_get_ref(drive_get_by_blockdev(bs));
+
+    trace_qmp_block_incremental_backup(bs, bs->job);
+}
+
 static BlockJob *find_block_job(const char *device)
 {
     BlockDriverState *bs;
@@ -227,6 +227,9 @@ typedef struct CPUWatchpoint {
     struct KVMState *kvm_state;                                         \
     struct kvm_run *kvm_run;                                            \
     int kvm_fd;                                                         \
-    int kvm_vcpu_dirty;
+    int kvm_vcpu_dirty;                                                 \
+    /* TCG scheduling statistics */                                     \
+    int64_t tcg_run_ns; /* host time spent running this CPU */          \
+    int64_t tcg_slices; /* number of times it was scheduled */
 
 #endif
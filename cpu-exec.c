@@ -121,7 +121,8 @@ static TranslationBlock *tb_find_slow(CPUState *env,
     }
  not_found:
    /* if no translated code available, then translate it now */
-    tb = tb_gen_code(env, pc, cs_base, flags, 0);
+    tb = tb_gen_code(env, pc, cs_base, flags,
+                     tb_io_lookup(pc, cs_base, flags, phys_pc));
 
  found:
     /* Move the last found TB to the head of the list */
@@ -552,6 +553,7 @@ int cpu_exec(CPUState *env)
                 if (next_tb != 0 && tb->page_addr[1] == -1) {
                     tb_add_jump((TranslationBlock *)(next_tb & ~3), next_tb & 3, tb);
                 }
+                tb_mark_used(tb);
                 spin_unlock(&tb_lock);
 
                 /* cpu_interrupt might be called while translating the
@@ -571,7 +573,7 @@ int cpu_exec(CPUState *env)
                         /* Restore PC.  */
                         cpu_pc_from_tb(env, tb);
                         insns_left = env->icount_decr.u32;
-                        if (env->icount_extra && insns_left >= 0) {
+                        if (env->icount_extra > 0 && insns_left >= 0) {
                             /* Refill decrementer and continue execution.  */
                             env->icount_extra += insns_left;
                             if (env->icount_extra > 0xffff) {
@@ -581,6 +583,17 @@ int cpu_exec(CPUState *env)
                             }
                             env->icount_extra -= insns_left;
                             env->icount_decr.u16.low = insns_left;
+                        } else if (use_icount == 2 && insns_left > 0 &&
+                                   env->icount_extra == 0) {
+                            /* With -icount auto the deadline need not
+                               be exact.  Rather than translating the
+                               head of the block uncached, run all of it
+                               and charge the excess as negative
+                               icount_extra, which the caller folds back
+                               into the instruction counter.  */
+                            env->icount_extra = insns_left - tb->icount;
+                            env->icount_decr.u16.low = tb->icount;
+                            next_tb = 0;
                         } else {
                             if (insns_left > 0) {
                                 /* Execute remaining instructions.  */
@@ -590,6 +603,14 @@ int cpu_exec(CPUState *env)
                             next_tb = 0;
                             cpu_loop_exit(env);
                         }
+                    } else if ((next_tb & 3) == 3) {
+                        /* Block became hot: replace it with a trace.  */
+                        tb = (TranslationBlock *)(long)(next_tb & ~3);
+                        cpu_pc_from_tb(env, tb);
+                        spin_lock(&tb_lock);
+                        tb_gen_trace(env, tb);
+                        spin_unlock(&tb_lock);
+                        next_tb = 0;
                     }
                 }
                 env->current_tb = NULL;
@@ -35,6 +35,7 @@
 #include "qemu-thread.h"
 #include "cpus.h"
 #include "main-loop.h"
+#include "replay.h"
 
 #ifndef _WIN32
 #include "compatfd.h"
@@ -60,6 +61,10 @@
 
 static CPUState *next_cpu;
 
+/* Time slice of each vCPU when TCG runs several of them in its thread.  */
+static int64_t tcg_slice_ns = 10 * SCALE_MS;
+static QEMUTimer *tcg_slice_timer;
+
 /***********************************************************/
 /* guest cycle counter */
 
@@ -74,6 +79,9 @@ static QEMUTimer *icount_vm_timer;
 static QEMUTimer *icount_warp_timer;
 static int64_t vm_clock_warp_start;
 static int64_t qemu_icount;
+/* Statistics of -icount auto.  */
+static int64_t icount_shift_increases;
+static int64_t icount_shift_decreases;
 
 typedef struct TimersState {
     int64_t cpu_ticks_prev;
@@ -101,6 +109,23 @@ int64_t cpu_get_icount(void)
     return qemu_icount_bias + (icount << icount_time_shift);
 }
 
+/* Return the number of instructions executed so far.  */
+int64_t cpu_get_icount_raw(void)
+{
+    CPUState *env = cpu_single_env;
+
+    if (env) {
+        return qemu_icount - (env->icount_decr.u16.low + env->icount_extra);
+    }
+    return qemu_icount;
+}
+
+/* Advance the virtual clock by delta ns without executing instructions.  */
+void cpu_warp_icount(int64_t delta)
+{
+    qemu_icount_bias += delta;
+}
+
 /* return the host CPU cycle counter and handle stop/restart */
 int64_t cpu_get_ticks(void)
 {
@@ -180,12 +205,14 @@ static void icount_adjust(void)
         && icount_time_shift > 0) {
         /* The guest is getting too far ahead.  Slow time down.  */
         icount_time_shift--;
+        icount_shift_decreases++;
     }
     if (delta < 0
         && last_delta - ICOUNT_WOBBLE > delta * 2
         && icount_time_shift < MAX_ICOUNT_SHIFT) {
         /* The guest is getting too far behind.  Speed time up.  */
         icount_time_shift++;
+        icount_shift_increases++;
     }
     last_delta = delta;
     qemu_icount_bias = cur_icount - (qemu_icount << icount_time_shift);
@@ -221,6 +248,9 @@ static void icount_warp_rt(void *opaque)
         int64_t warp_delta = clock - vm_clock_warp_start;
         if (use_icount == 1) {
             qemu_icount_bias += warp_delta;
+            if (replay_mode == REPLAY_MODE_RECORD) {
+                replay_warp(warp_delta);
+            }
         } else {
             /*
              * In adaptive mode, do not let the vm_clock run too
@@ -234,6 +264,10 @@ static void icount_warp_rt(void *opaque)
         if (qemu_clock_expired(vm_clock)) {
             qemu_notify_event();
         }
+        if (replay_mode != REPLAY_MODE_NONE) {
+            /* vm_clock timers run in the vCPU thread */
+            qemu_cpu_kick(first_cpu);
+        }
     }
     vm_clock_warp_start = -1;
 }
@@ -251,6 +285,11 @@ void qemu_clock_warp(QEMUClock *clock)
         return;
     }
 
+    /* When replaying, warps come from the journal.  */
+    if (replay_mode == REPLAY_MODE_PLAY) {
+        return;
+    }
+
     /*
      * If the CPUs have been sleeping, advance the vm_clock timer now.  This
      * ensures that the deadline for the timer is computed correctly below.
@@ -578,6 +617,8 @@ static void qemu_tcg_init_cpu_signals(void)
 
     sigemptyset(&set);
     sigaddset(&set, SIG_IPI);
+    /* sampling timer of the translated code profiler */
+    sigaddset(&set, SIGPROF);
     pthread_sigmask(SIG_UNBLOCK, &set, NULL);
 }
 
@@ -680,10 +721,14 @@ static void qemu_tcg_wait_io_event(void)
 {
     CPUState *env;
 
-    while (all_cpu_threads_idle()) {
+    while (all_cpu_threads_idle() ||
+           (replay_mode != REPLAY_MODE_NONE && replay_blocked())) {
        /* Start accounting real time to the virtual clock if the CPUs
           are idle.  */
         qemu_clock_warp(vm_clock);
+        if (replay_mode != REPLAY_MODE_NONE && replay_checkpoint()) {
+            continue;
+        }
         qemu_cond_wait(tcg_halt_cond, &qemu_global_mutex);
     }
 
@@ -824,6 +869,11 @@ int qemu_cpu_is_self(void *_env)
     return qemu_thread_is_self(env->thread);
 }
 
+bool qemu_in_vcpu_thread(void)
+{
+    return tcg_cpu_thread && qemu_thread_is_self(tcg_cpu_thread);
+}
+
 void qemu_mutex_lock_iothread(void)
 {
     if (kvm_enabled()) {
@@ -892,6 +942,16 @@ void resume_all_vcpus(void)
     }
 }
 
+/* Without icount the slices are measured in host time.  There is nothing
+   to do here but to come back: the I/O thread had to take the global
+   mutex to run this callback, which kicked the running vCPU out of
+   cpu_exec(), and tcg_exec_all() goes on with the next one.  */
+static void tcg_slice_expired(void *opaque)
+{
+    qemu_mod_timer_ns(tcg_slice_timer,
+                      qemu_get_clock_ns(rt_clock) + tcg_slice_ns);
+}
+
 static void qemu_tcg_init_vcpu(void *_env)
 {
     CPUState *env = _env;
@@ -914,6 +974,11 @@ static void qemu_tcg_init_vcpu(void *_env)
     } else {
         env->thread = tcg_cpu_thread;
         env->halt_cond = tcg_halt_cond;
+        if (!tcg_slice_timer && tcg_slice_ns && !use_icount) {
+            tcg_slice_timer = qemu_new_timer_ns(rt_clock, tcg_slice_expired,
+                                                NULL);
+            tcg_slice_expired(NULL);
+        }
     }
 }
 
@@ -981,6 +1046,7 @@ void vm_stop_force_state(RunState state)
 static int tcg_cpu_exec(CPUState *env)
 {
     int ret;
+    int64_t start;
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
@@ -988,6 +1054,7 @@ static int tcg_cpu_exec(CPUState *env)
 #ifdef CONFIG_PROFILER
     ti = profile_getclock();
 #endif
+    start = get_clock();
     if (use_icount) {
         int64_t count;
         int decr;
@@ -995,6 +1062,14 @@ static int tcg_cpu_exec(CPUState *env)
         env->icount_decr.u16.low = 0;
         env->icount_extra = 0;
         count = qemu_icount_round(qemu_clock_deadline(vm_clock));
+        if (first_cpu->next_cpu && tcg_slice_ns) {
+            /* The slice is measured in virtual time, so that the
+               interleaving of the vCPUs stays deterministic.  */
+            count = MIN(count, qemu_icount_round(tcg_slice_ns));
+        }
+        if (replay_mode == REPLAY_MODE_PLAY) {
+            count = replay_icount_budget(count);
+        }
         qemu_icount += count;
         decr = (count > 0xffff) ? 0xffff : count;
         count -= decr;
@@ -1005,6 +1080,8 @@ static int tcg_cpu_exec(CPUState *env)
 #ifdef CONFIG_PROFILER
     qemu_time += profile_getclock() - ti;
 #endif
+    env->tcg_run_ns += get_clock() - start;
+    env->tcg_slices++;
     if (use_icount) {
         /* Fold pending instructions back into the
            instruction counter, and clear the interrupt flag.  */
@@ -1023,6 +1100,13 @@ static void tcg_exec_all(void)
     /* Account partial waits to the vm_clock.  */
     qemu_clock_warp(vm_clock);
 
+    if (replay_mode != REPLAY_MODE_NONE) {
+        replay_checkpoint();
+        if (replay_blocked()) {
+            return;
+        }
+    }
+
     if (next_cpu == NULL) {
         next_cpu = first_cpu;
     }
@@ -1033,6 +1117,10 @@ static void tcg_exec_all(void)
                           (env->singlestep_enabled & SSTEP_NOTIMER) == 0);
 
         if (cpu_can_run(env)) {
+            if (env->halted && !qemu_cpu_has_work(env)) {
+                /* nothing to do until an interrupt is routed to it */
+                continue;
+            }
             r = tcg_cpu_exec(env);
             if (r == EXCP_DEBUG) {
                 cpu_handle_guest_debug(env);
@@ -1059,6 +1147,18 @@ void set_numa_modes(void)
     }
 }
 
+void set_tcg_slice(const char *optarg)
+{
+    char *end;
+    long long us = strtoll(optarg, &end, 0);
+
+    if (*end || us < 0) {
+        fprintf(stderr, "qemu: invalid time slice '%s'\n", optarg);
+        exit(1);
+    }
+    tcg_slice_ns = us * SCALE_US;
+}
+
 void set_cpu_log(const char *optarg)
 {
     int mask;
@@ -1106,6 +1206,12 @@ CpuInfoList *qmp_query_cpus(Error **errp)
         info->value->current = (env == first_cpu);
         info->value->halted = env->halted;
         info->value->thread_id = env->thread_id;
+        if (tcg_enabled()) {
+            info->value->has_run_time_ns = true;
+            info->value->run_time_ns = env->tcg_run_ns;
+            info->value->has_slices = true;
+            info->value->slices = env->tcg_slices;
+        }
 #if defined(TARGET_I386)
         info->value->has_pc = true;
         info->value->pc = env->eip + env->segs[R_CS].base;
@@ -1134,6 +1240,27 @@ CpuInfoList *qmp_query_cpus(Error **errp)
     return head;
 }
 
+IcountInfo *qmp_query_icount(Error **errp)
+{
+    IcountInfo *info = g_malloc0(sizeof(*info));
+    int64_t running_ns;
+
+    info->enabled = use_icount != 0;
+    if (!use_icount) {
+        return info;
+    }
+    info->adaptive = use_icount == 2;
+    info->shift = icount_time_shift;
+    info->instructions = cpu_get_icount_raw();
+    running_ns = cpu_get_clock();
+    if (running_ns > 0) {
+        info->mips = info->instructions * 1000 / running_ns;
+    }
+    info->shift_increases = icount_shift_increases;
+    info->shift_decreases = icount_shift_decreases;
+    return info;
+}
+
 void qmp_memsave(int64_t addr, int64_t size, const char *filename,
                  bool has_cpu, int64_t cpu_index, Error **errp)
 {
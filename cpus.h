@@ -15,6 +15,7 @@ void cpu_synchronize_all_post_init(void);
 extern int smp_cores;
 extern int smp_threads;
 void set_numa_modes(void);
+void set_tcg_slice(const char *optarg);
 void set_cpu_log(const char *optarg);
 void set_cpu_log_filename(const char *optarg);
 void list_cpus(FILE *f, fprintf_function cpu_fprintf, const char *optarg);
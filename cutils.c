@@ -303,6 +303,199 @@ void qemu_iovec_memset_skip(QEMUIOVector *qiov, int c, size_t count,
     }
 }
 
+/*
+ * Zero detection.  The generic version scans one unsigned long at a time;
+ * x86 hosts use SSE2, or AVX2 when both the compiler and the CPU support
+ * it.  The vector versions OR a whole 64 or 128 byte block together before
+ * testing it, and cover the unaligned ends of the buffer with one
+ * (possibly overlapping) unaligned load each.
+ */
+static bool buffer_is_zero_generic(const uint8_t *buf, size_t len)
+{
+    const unsigned long *p;
+    size_t n;
+
+    while (len && ((uintptr_t)buf & (sizeof(unsigned long) - 1))) {
+        if (*buf++) {
+            return false;
+        }
+        len--;
+    }
+
+    p = (const unsigned long *)buf;
+    for (n = len / sizeof(unsigned long); n >= 4; n -= 4, p += 4) {
+        if (p[0] | p[1] | p[2] | p[3]) {
+            return false;
+        }
+    }
+    for (; n; n--, p++) {
+        if (*p) {
+            return false;
+        }
+    }
+
+    buf = (const uint8_t *)p;
+    for (len &= sizeof(unsigned long) - 1; len; buf++, len--) {
+        if (*buf) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+#define SSE2_IS_ZERO(v) \
+    (_mm_movemask_epi8(_mm_cmpeq_epi8((v), _mm_setzero_si128())) == 0xFFFF)
+
+/* len must be at least 64 */
+static bool buffer_is_zero_sse2(const uint8_t *buf, size_t len)
+{
+    const __m128i *p, *end;
+    __m128i acc;
+
+    acc = _mm_or_si128(_mm_loadu_si128((const __m128i *)buf),
+                       _mm_loadu_si128((const __m128i *)(buf + len - 16)));
+    p = (const __m128i *)QEMU_ALIGN_UP((uintptr_t)buf, 16);
+    end = (const __m128i *)QEMU_ALIGN_DOWN((uintptr_t)buf + len, 16);
+
+    for (; p + 4 <= end; p += 4) {
+        acc = _mm_or_si128(acc, _mm_or_si128(_mm_or_si128(p[0], p[1]),
+                                             _mm_or_si128(p[2], p[3])));
+        if (!SSE2_IS_ZERO(acc)) {
+            return false;
+        }
+    }
+    for (; p < end; p++) {
+        acc = _mm_or_si128(acc, p[0]);
+    }
+    return SSE2_IS_ZERO(acc);
+}
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+/* len must be at least 128 */
+static bool buffer_is_zero_avx2(const uint8_t *buf, size_t len)
+{
+    const __m256i *p, *end;
+    __m256i acc;
+
+    acc = _mm256_or_si256(
+        _mm256_loadu_si256((const __m256i *)buf),
+        _mm256_loadu_si256((const __m256i *)(buf + len - 32)));
+    p = (const __m256i *)QEMU_ALIGN_UP((uintptr_t)buf, 32);
+    end = (const __m256i *)QEMU_ALIGN_DOWN((uintptr_t)buf + len, 32);
+
+    for (; p + 4 <= end; p += 4) {
+        acc = _mm256_or_si256(acc,
+                              _mm256_or_si256(_mm256_or_si256(p[0], p[1]),
+                                              _mm256_or_si256(p[2], p[3])));
+        if (!_mm256_testz_si256(acc, acc)) {
+            return false;
+        }
+    }
+    for (; p < end; p++) {
+        acc = _mm256_or_si256(acc, p[0]);
+    }
+    return _mm256_testz_si256(acc, acc);
+}
+#pragma GCC pop_options
+#endif
+
+typedef struct BufferZeroImpl {
+    const char *name;
+    bool (*fn)(const uint8_t *buf, size_t len);
+    size_t min_len;
+} BufferZeroImpl;
+
+static const BufferZeroImpl buffer_zero_impls[] = {
+#ifdef CONFIG_AVX2_OPT
+    { "avx2", buffer_is_zero_avx2, 128 },
+#endif
+#ifdef __SSE2__
+    { "sse2", buffer_is_zero_sse2, 64 },
+#endif
+    { "generic", buffer_is_zero_generic, 0 },
+};
+
+static const BufferZeroImpl *buffer_zero_impl =
+    &buffer_zero_impls[ARRAY_SIZE(buffer_zero_impls) - 1];
+
+static bool buffer_zero_impl_usable(const BufferZeroImpl *impl)
+{
+#ifdef CONFIG_AVX2_OPT
+    if (impl->fn == buffer_is_zero_avx2) {
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return true;
+}
+
+static void __attribute__((constructor)) init_buffer_is_zero(void)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(buffer_zero_impls); i++) {
+        if (buffer_zero_impl_usable(&buffer_zero_impls[i])) {
+            buffer_zero_impl = &buffer_zero_impls[i];
+            break;
+        }
+    }
+}
+
+/*
+ * Select the implementation of buffer_is_zero() by name ("generic",
+ * "sse2", "avx2"), for tests and benchmarks.  Returns false if it is not
+ * compiled in or not supported by the host.
+ */
+bool buffer_is_zero_select(const char *name)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(buffer_zero_impls); i++) {
+        if (!strcmp(buffer_zero_impls[i].name, name)) {
+            if (!buffer_zero_impl_usable(&buffer_zero_impls[i])) {
+                return false;
+            }
+            buffer_zero_impl = &buffer_zero_impls[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *buffer_is_zero_impl(void)
+{
+    return buffer_zero_impl->name;
+}
+
+/* Return true if the @len bytes at @buf are all zero */
+bool buffer_is_zero(const void *buf, size_t len)
+{
+    if (len < buffer_zero_impl->min_len) {
+        return buffer_is_zero_generic(buf, len);
+    }
+    return buffer_zero_impl->fn(buf, len);
+}
+
+bool qemu_iovec_is_zero(QEMUIOVector *qiov)
+{
+    int i;
+
+    for (i = 0; i < qiov->niov; i++) {
+        if (!buffer_is_zero(qiov->iov[i].iov_base, qiov->iov[i].iov_len)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 #ifndef _WIN32
 /* Sets a specific flag */
 int fcntl_setfl(int fd, int flag)
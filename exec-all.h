@@ -91,6 +91,18 @@ void cpu_io_recompile(CPUState *env, void *retaddr);
 TranslationBlock *tb_gen_code(CPUState *env, 
                               target_ulong pc, target_ulong cs_base, int flags,
                               int cflags);
+void tb_gen_trace(CPUState *env, TranslationBlock *tb);
+void tb_mark_used(TranslationBlock *tb);
+#if !defined(CONFIG_USER_ONLY)
+int tb_io_lookup(target_ulong pc, target_ulong cs_base, uint64_t flags,
+                 tb_page_addr_t phys_pc);
+#else
+static inline int tb_io_lookup(target_ulong pc, target_ulong cs_base,
+                               uint64_t flags, tb_page_addr_t phys_pc)
+{
+    return 0;
+}
+#endif
 void cpu_exec_init(CPUState *env);
 void QEMU_NORETURN cpu_loop_exit(CPUState *env1);
 int page_unprotect(target_ulong address, unsigned long pc, void *puc);
@@ -120,6 +132,9 @@ void tlb_set_page(CPUState *env, target_ulong vaddr,
 #define CODE_GEN_AVG_BLOCK_SIZE 64
 #endif
 
+/* maximum number of basic blocks followed when forming a hot trace */
+#define TB_TRACE_MAX_BLOCKS 8
+
 #if defined(_ARCH_PPC) || defined(__x86_64__) || defined(__arm__) || defined(__i386__)
 #define USE_DIRECT_JUMP
 #elif defined(CONFIG_TCG_INTERPRETER)
@@ -132,9 +147,17 @@ struct TranslationBlock {
     uint64_t flags; /* flags defining in which context the code was generated */
     uint16_t size;      /* size of target code for this block (1 <=
                            size <= TARGET_PAGE_SIZE) */
-    uint16_t cflags;    /* compile flags */
+    uint32_t cflags;    /* compile flags */
 #define CF_COUNT_MASK  0x7fff
 #define CF_LAST_IO     0x8000 /* Last insn may be an IO access.  */
+#define CF_TRACE      0x10000 /* Hot trace spanning several blocks.  */
+#define CF_INVALID    0x20000 /* Removed by tb_phys_invalidate().  */
+/* For a trace, the number of branches followed and, in bit n of the
+   path, whether the hot exit of the nth one is its fall-through.  */
+#define CF_TRACE_BLOCKS_SHIFT 18
+#define CF_TRACE_BLOCKS_MASK  (0xf << CF_TRACE_BLOCKS_SHIFT)
+#define CF_TRACE_PATH_SHIFT   22
+#define CF_TRACE_PATH_MASK    (0xff << CF_TRACE_PATH_SHIFT)
 
     uint8_t *tc_ptr;    /* pointer to the translated code */
     /* next matching tb for physical address. */
@@ -159,6 +182,17 @@ struct TranslationBlock {
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
     uint32_t icount;
+    /* number of executions and of taken exits of the final direct
+       branch, only maintained until the block becomes hot and is
+       retranslated as a trace */
+    uint32_t exec_count;
+    uint32_t taken_count;
+    /* final direct branch of the block, recorded at translation time */
+    target_ulong branch_dest;
+    uint8_t branch_kind;
+#define TB_BRANCH_NONE   0 /* no direct branch that a trace can follow */
+#define TB_BRANCH_ALWAYS 1
+#define TB_BRANCH_COND   2
 };
 
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
@@ -271,6 +305,8 @@ static inline void tb_add_jump(TranslationBlock *tb, int n,
 }
 
 TranslationBlock *tb_find_pc(unsigned long pc_ptr);
+unsigned int tb_code_generation(void);
+bool tb_in_code_buffer(unsigned long tc_ptr);
 
 #include "qemu-lock.h"
 
@@ -297,6 +333,31 @@ extern void *tci_tb_ptr;
 # define GETPC() ((void *)((unsigned long)__builtin_return_address(0) - 1))
 #endif
 
+#if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
+/* The qemu_ld/st TLB miss paths are emitted at the end of the TB, so the
+   return address of an MMU helper does not identify the guest memory
+   access.  The backend embeds the fast path return address right after
+   the helper call as a never executed jump:
+
+       call helper
+       jmp 1f              (2 bytes)  <- return address
+       jmp fast_path_next  (5 bytes)
+   1:  ...
+
+   GETPC_EXT() decodes it when called from generated code.  */
+# if defined(__i386__) || defined(__x86_64__)
+#  define GETRA() ((unsigned long)__builtin_return_address(0))
+#  define GETPC_LDST() ((void *)(GETRA() + 7 + \
+                                 *(int32_t *)(GETRA() + 3) - 1))
+# else
+#  error "CONFIG_QEMU_LDST_OPTIMIZATION needs GETPC_LDST() implementation"
+# endif
+int is_tcg_gen_code(unsigned long tc_ptr);
+# define GETPC_EXT() (is_tcg_gen_code(GETRA()) ? GETPC_LDST() : GETPC())
+#else
+# define GETPC_EXT() GETPC()
+#endif
+
 #if !defined(CONFIG_USER_ONLY)
 
 uint64_t io_mem_read(int index, target_phys_addr_t addr, unsigned size);
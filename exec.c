@@ -35,6 +35,7 @@
 #include "qemu-timer.h"
 #include "memory.h"
 #include "exec-memory.h"
+#include "qemu-barrier.h"
 #if defined(CONFIG_USER_ONLY)
 #include <qemu.h>
 #if defined(__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -82,7 +83,6 @@
 static TranslationBlock *tbs;
 static int code_gen_max_blocks;
 TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
-static int nb_tbs;
 /* any access to the tbs or the page table must use this lock */
 spinlock_t tb_lock = SPIN_LOCK_UNLOCKED;
 
@@ -109,6 +109,31 @@ static unsigned long code_gen_buffer_size;
 static unsigned long code_gen_buffer_max_size;
 static uint8_t *code_gen_ptr;
 
+/* The code buffer is split in regions which are filled one after the
+   other.  When the current region is full, the least recently used one
+   is evicted and reused instead of flushing the whole buffer.  */
+#define CODE_GEN_MAX_REGIONS      8
+#define CODE_GEN_MIN_REGION_SIZE  (1024 * 1024)
+
+typedef struct CodeGenRegion {
+    uint8_t *start;
+    uint8_t *end;       /* threshold to switch to another region */
+    uint8_t *ptr;       /* end of the code, except for the current region */
+    int tb_start;       /* first TB of the region in tbs[] */
+    int nb_tbs;
+    /* value of code_gen_clock when a TB of the region was last used */
+    unsigned long last_used;
+    int evict_count;
+} CodeGenRegion;
+
+static CodeGenRegion code_gen_regions[CODE_GEN_MAX_REGIONS];
+static int code_gen_nb_regions;
+static int code_gen_cur_region;
+static unsigned long code_gen_region_size;
+static int code_gen_region_max_blocks;
+/* number of TBs allocated so far, used as the age of the regions */
+static unsigned long code_gen_clock;
+
 #if !defined(CONFIG_USER_ONLY)
 int phys_ram_fd;
 static int in_migration;
@@ -131,6 +156,9 @@ DEFINE_TLS(CPUState *,cpu_single_env);
    1 = Precise instruction counting.
    2 = Adaptive rate instruction counting.  */
 int use_icount = 0;
+/* Number of executions after which a TB is retranslated as a trace
+   following its hot exits.  0 disables trace formation.  */
+int tb_trace_threshold = 1000;
 
 typedef struct PageDesc {
     /* list of TBs intersecting this ram page */
@@ -204,6 +232,38 @@ typedef struct PhysPageDesc {
    The bottom level has pointers to PhysPageDesc.  */
 static void *l1_phys_map[P_L1_SIZE];
 
+/* Flat view of l1_phys_map used for lookups: the non-unassigned pages
+   as sorted runs of pages whose descriptors advance linearly, plus a
+   bucket index on the high bits of the page number that narrows the
+   search to the runs overlapping a fixed-size slice of the address
+   space.  It is rebuilt once per topology change, when the memory
+   core commits it, and published with a single pointer store; readers
+   only load that pointer, so they always see a complete table without
+   taking a lock.  Until the commit they keep seeing the old topology.  */
+typedef struct PhysMapRun {
+    target_phys_addr_t start;   /* first page index */
+    target_phys_addr_t end;     /* last page index + 1 */
+    ram_addr_t phys_offset;     /* descriptor of the first page */
+    ram_addr_t region_offset;
+    bool ram;                   /* phys_offset advances with each page */
+} PhysMapRun;
+
+#define PHYS_MAP_INDEX_BITS (TARGET_PHYS_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+#define PHYS_MAP_BUCKET_BITS 12
+#define PHYS_MAP_BUCKET_SHIFT (PHYS_MAP_INDEX_BITS - PHYS_MAP_BUCKET_BITS)
+#define PHYS_MAP_BUCKETS (1 << PHYS_MAP_BUCKET_BITS)
+
+typedef struct PhysMap {
+    int nb_runs;
+    PhysMapRun *runs;
+    /* index of the first run that ends after the start of each bucket */
+    int bucket[PHYS_MAP_BUCKETS + 1];
+} PhysMap;
+
+static PhysMap *phys_map;
+/* l1_phys_map changed since phys_map was built */
+static bool phys_map_dirty = true;
+
 static void io_mem_init(void);
 static void memory_map_init(void);
 
@@ -228,7 +288,9 @@ static int log_append = 0;
 static int tlb_flush_count;
 #endif
 static int tb_flush_count;
+static int tb_evict_count;
 static int tb_phys_invalidate_count;
+static int tb_trace_count;
 
 #ifdef _WIN32
 static void map_exec(void *addr, long size)
@@ -439,18 +501,153 @@ static PhysPageDesc *phys_page_find_alloc(target_phys_addr_t index, int alloc)
     return pd + (index & (L2_SIZE - 1));
 }
 
-static inline PhysPageDesc phys_page_find(target_phys_addr_t index)
+static bool is_ram_rom_romd(ram_addr_t pd);
+
+typedef struct PhysMapBuilder {
+    PhysMapRun *runs;
+    int nb_runs;
+    int nb_alloc;
+} PhysMapBuilder;
+
+static void phys_map_add_page(PhysMapBuilder *b, target_phys_addr_t index,
+                              PhysPageDesc *pd)
+{
+    PhysMapRun *r;
+    ram_addr_t n;
+
+    if (pd->phys_offset == io_mem_unassigned.ram_addr &&
+        pd->region_offset == (ram_addr_t)(index << TARGET_PAGE_BITS)) {
+        return;
+    }
+
+    if (b->nb_runs) {
+        r = &b->runs[b->nb_runs - 1];
+        n = (ram_addr_t)(r->end - r->start) << TARGET_PAGE_BITS;
+        if (r->end == index &&
+            pd->phys_offset == r->phys_offset + (r->ram ? n : 0) &&
+            pd->region_offset == r->region_offset + n) {
+            r->end++;
+            return;
+        }
+    }
+
+    if (b->nb_runs == b->nb_alloc) {
+        b->nb_alloc = b->nb_alloc ? b->nb_alloc * 2 : 64;
+        b->runs = g_renew(PhysMapRun, b->runs, b->nb_alloc);
+    }
+    r = &b->runs[b->nb_runs++];
+    r->start = index;
+    r->end = index + 1;
+    r->phys_offset = pd->phys_offset;
+    r->region_offset = pd->region_offset;
+    r->ram = is_ram_rom_romd(pd->phys_offset);
+}
+
+static void phys_map_walk(PhysMapBuilder *b, void **lp, int level,
+                          target_phys_addr_t index)
 {
-    PhysPageDesc *p = phys_page_find_alloc(index, 0);
+    int i;
 
-    if (p) {
-        return *p;
+    if (*lp == NULL) {
+        return;
+    }
+    if (level == 0) {
+        PhysPageDesc *pd = *lp;
+        for (i = 0; i < L2_SIZE; ++i) {
+            phys_map_add_page(b, index + i, pd + i);
+        }
     } else {
+        void **pp = *lp;
+        for (i = 0; i < L2_SIZE; ++i) {
+            phys_map_walk(b, pp + i, level - 1,
+                          index + ((target_phys_addr_t)i << (level * L2_BITS)));
+        }
+    }
+}
+
+/* Rebuild the flat map from l1_phys_map and publish it.  */
+static void phys_map_rebuild(void)
+{
+    PhysMapBuilder b = { NULL, 0, 0 };
+    PhysMap *map, *old;
+    target_phys_addr_t start;
+    int i, j;
+
+    for (i = 0; i < P_L1_SIZE; i++) {
+        phys_map_walk(&b, l1_phys_map + i, P_L1_SHIFT / L2_BITS - 1,
+                      (target_phys_addr_t)i << P_L1_SHIFT);
+    }
+
+    map = g_malloc(sizeof(*map));
+    map->nb_runs = b.nb_runs;
+    map->runs = b.runs;
+    for (i = 0, j = 0; i < PHYS_MAP_BUCKETS; i++) {
+        start = (target_phys_addr_t)i << PHYS_MAP_BUCKET_SHIFT;
+        while (j < b.nb_runs && b.runs[j].end <= start) {
+            j++;
+        }
+        map->bucket[i] = j;
+    }
+    map->bucket[PHYS_MAP_BUCKETS] = b.nb_runs;
+
+    /* Make the table visible before the pointer to it.  Readers run
+       under the global mutex, so the old table can go right away;
+       concurrent readers would need it to be reclaimed after a grace
+       period instead.  */
+    smp_wmb();
+    old = phys_map;
+    phys_map = map;
+    phys_map_dirty = false;
+    if (old) {
+        g_free(old->runs);
+        g_free(old);
+    }
+}
+
+/* Called by the memory core once all the ranges of a topology change
+   have been registered.  */
+void cpu_register_physical_memory_commit(void)
+{
+    if (phys_map_dirty) {
+        phys_map_rebuild();
+    }
+}
+
+static inline PhysPageDesc phys_page_find(target_phys_addr_t index)
+{
+    PhysMap *map;
+    PhysMapRun *r;
+    target_phys_addr_t page;
+    int lo, hi, mid;
+
+    map = phys_map;
+
+    page = index & (((target_phys_addr_t)1 << PHYS_MAP_INDEX_BITS) - 1);
+    lo = map->bucket[page >> PHYS_MAP_BUCKET_SHIFT];
+    hi = map->bucket[(page >> PHYS_MAP_BUCKET_SHIFT) + 1];
+    /* first run that ends after PAGE */
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (map->runs[mid].end > page) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    if (lo < map->nb_runs && map->runs[lo].start <= page) {
+        ram_addr_t n;
+
+        r = &map->runs[lo];
+        n = (ram_addr_t)(page - r->start) << TARGET_PAGE_BITS;
         return (PhysPageDesc) {
-            .phys_offset = io_mem_unassigned.ram_addr,
-            .region_offset = index << TARGET_PAGE_BITS,
+            .phys_offset = r->phys_offset + (r->ram ? n : 0),
+            .region_offset = r->region_offset + n,
         };
     }
+    return (PhysPageDesc) {
+        .phys_offset = io_mem_unassigned.ram_addr,
+        .region_offset = index << TARGET_PAGE_BITS,
+    };
 }
 
 static void tlb_protect_code(ram_addr_t ram_addr);
@@ -473,6 +670,35 @@ static uint8_t static_code_gen_buffer[DEFAULT_CODE_GEN_BUFFER_SIZE]
                __attribute__((aligned (CODE_GEN_ALIGN)));
 #endif
 
+static void code_gen_regions_init(void)
+{
+    CodeGenRegion *r;
+    int i;
+
+    code_gen_nb_regions = code_gen_buffer_size / CODE_GEN_MIN_REGION_SIZE;
+    if (code_gen_nb_regions > CODE_GEN_MAX_REGIONS) {
+        code_gen_nb_regions = CODE_GEN_MAX_REGIONS;
+    }
+    if (code_gen_nb_regions < 1) {
+        code_gen_nb_regions = 1;
+    }
+    code_gen_region_size = code_gen_buffer_size / code_gen_nb_regions;
+    code_gen_region_max_blocks = code_gen_max_blocks / code_gen_nb_regions;
+    for (i = 0; i < code_gen_nb_regions; i++) {
+        r = &code_gen_regions[i];
+        r->start = code_gen_buffer + i * code_gen_region_size;
+        /* keep room for the largest TB at the end of each region */
+        r->end = r->start + code_gen_region_size -
+            (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
+        r->ptr = r->start;
+        r->tb_start = i * code_gen_region_max_blocks;
+        r->nb_tbs = 0;
+        r->last_used = 0;
+        r->evict_count = 0;
+    }
+    code_gen_cur_region = 0;
+}
+
 static void code_gen_alloc(unsigned long tb_size)
 {
 #ifdef USE_STATIC_CODE_GEN_BUFFER
@@ -571,6 +797,7 @@ static void code_gen_alloc(unsigned long tb_size)
         (TCG_MAX_OP_SIZE * OPC_BUF_SIZE);
     code_gen_max_blocks = code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
     tbs = g_malloc(code_gen_max_blocks * sizeof(TranslationBlock));
+    code_gen_regions_init();
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -676,32 +903,51 @@ void cpu_exec_init(CPUState *env)
 #endif
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Allocate a new translation block. Return NULL if the current region
+   has too many translation blocks or too much generated code. */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    CodeGenRegion *r = &code_gen_regions[code_gen_cur_region];
     TranslationBlock *tb;
 
-    if (nb_tbs >= code_gen_max_blocks ||
-        (code_gen_ptr - code_gen_buffer) >= code_gen_buffer_max_size)
+    if (r->nb_tbs >= code_gen_region_max_blocks ||
+        code_gen_ptr >= r->end)
         return NULL;
-    tb = &tbs[nb_tbs++];
+    tb = &tbs[r->tb_start + r->nb_tbs++];
     tb->pc = pc;
     tb->cflags = 0;
+    tb->exec_count = 0;
+    tb->taken_count = 0;
+    tb->branch_kind = TB_BRANCH_NONE;
+    r->last_used = ++code_gen_clock;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    CodeGenRegion *r = &code_gen_regions[code_gen_cur_region];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (nb_tbs > 0 && tb == &tbs[nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &tbs[r->tb_start + r->nb_tbs - 1]) {
         code_gen_ptr = tb->tc_ptr;
-        nb_tbs--;
+        r->nb_tbs--;
     }
 }
 
+static inline CodeGenRegion *tb_region(TranslationBlock *tb)
+{
+    return &code_gen_regions[(tb - tbs) / code_gen_region_max_blocks];
+}
+
+/* Record that 'tb' has just been executed, so that its region is not
+   the next one to be evicted.  */
+void tb_mark_used(TranslationBlock *tb)
+{
+    tb_region(tb)->last_used = code_gen_clock;
+}
+
 static inline void invalidate_page_bitmap(PageDesc *p)
 {
     if (p->code_bitmap) {
@@ -746,17 +992,23 @@ static void page_flush_tb(void)
 /* XXX: tb_flush is currently not thread safe */
 void tb_flush(CPUState *env1)
 {
+    CodeGenRegion *r;
     CPUState *env;
+    int i;
+
 #if defined(DEBUG_FLUSH)
-    printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
-           (unsigned long)(code_gen_ptr - code_gen_buffer),
-           nb_tbs, nb_tbs > 0 ?
-           ((unsigned long)(code_gen_ptr - code_gen_buffer)) / nb_tbs : 0);
+    printf("qemu: flush region=%d code_size=%ld\n", code_gen_cur_region,
+           (unsigned long)(code_gen_ptr - code_gen_buffer));
 #endif
     if ((unsigned long)(code_gen_ptr - code_gen_buffer) > code_gen_buffer_size)
         cpu_abort(env1, "Internal error: code buffer overflow\n");
 
-    nb_tbs = 0;
+    for (i = 0; i < code_gen_nb_regions; i++) {
+        r = &code_gen_regions[i];
+        r->ptr = r->start;
+        r->nb_tbs = 0;
+    }
+    code_gen_cur_region = 0;
 
     for(env = first_cpu; env != NULL; env = env->next_cpu) {
         memset (env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
@@ -771,6 +1023,63 @@ void tb_flush(CPUState *env1)
     tb_flush_count++;
 }
 
+/* Make room for new code by reusing the least recently used region of
+   the code buffer.  Invalidating its TBs unlinks all the direct jumps
+   coming from the other regions, so the rest of the code stays valid.
+   Like tb_flush(), this must not be called while the generated code of
+   the evicted region may be returned to.  */
+static void tb_evict_region(CPUState *env1)
+{
+    CodeGenRegion *r, *victim;
+    TranslationBlock *tb;
+    int i;
+
+    if (code_gen_nb_regions == 1) {
+        tb_flush(env1);
+        return;
+    }
+
+    code_gen_regions[code_gen_cur_region].ptr = code_gen_ptr;
+    victim = NULL;
+    for (i = 0; i < code_gen_nb_regions; i++) {
+        r = &code_gen_regions[i];
+        if (i == code_gen_cur_region) {
+            continue;
+        }
+        if (!victim || r->last_used < victim->last_used) {
+            victim = r;
+        }
+    }
+#if defined(DEBUG_FLUSH)
+    printf("qemu: evict region=%d nb_tbs=%d\n",
+           (int)(victim - code_gen_regions), victim->nb_tbs);
+#endif
+
+    for (i = 0; i < victim->nb_tbs; i++) {
+        tb = &tbs[victim->tb_start + i];
+        if (!(tb->cflags & CF_INVALID)) {
+            tb_phys_invalidate(tb, -1);
+        }
+    }
+    victim->nb_tbs = 0;
+    victim->ptr = victim->start;
+    victim->evict_count++;
+    code_gen_cur_region = victim - code_gen_regions;
+    code_gen_ptr = victim->start;
+    tb_evict_count++;
+}
+
+/* Offset in its first page of the lowest code address covered by 'tb'.
+   A trace can follow backward branches within that page, so it is
+   assumed to cover the page from its start.  */
+static inline int tb_page_start(TranslationBlock *tb)
+{
+    if (tb->cflags & CF_TRACE) {
+        return 0;
+    }
+    return tb->pc & ~TARGET_PAGE_MASK;
+}
+
 #ifdef DEBUG_TB_CHECK
 
 static void tb_invalidate_check(target_ulong address)
@@ -780,7 +1089,8 @@ static void tb_invalidate_check(target_ulong address)
     address &= TARGET_PAGE_MASK;
     for(i = 0;i < CODE_GEN_PHYS_HASH_SIZE; i++) {
         for(tb = tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
-            if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
+            if (!(address + TARGET_PAGE_SIZE <=
+                  (tb->pc & TARGET_PAGE_MASK) + tb_page_start(tb) ||
                   address >= tb->pc + tb->size)) {
                 printf("ERROR invalidate: address=" TARGET_FMT_lx
                        " PC=%08lx size=%04x\n",
@@ -930,6 +1240,7 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((long)tb | 2); /* fail safe */
 
+    tb->cflags |= CF_INVALID;
     tb_phys_invalidate_count++;
 }
 
@@ -975,8 +1286,8 @@ static void build_page_bitmap(PageDesc *p)
         if (n == 0) {
             /* NOTE: tb_end may be after the end of the page, but
                it is not a problem */
-            tb_start = tb->pc & ~TARGET_PAGE_MASK;
-            tb_end = tb_start + tb->size;
+            tb_start = tb_page_start(tb);
+            tb_end = (tb->pc & ~TARGET_PAGE_MASK) + tb->size;
             if (tb_end > TARGET_PAGE_SIZE)
                 tb_end = TARGET_PAGE_SIZE;
         } else {
@@ -1001,8 +1312,8 @@ TranslationBlock *tb_gen_code(CPUState *env,
     phys_pc = get_page_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+        /* eviction or flush must be done */
+        tb_evict_region(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         /* Don't forget to invalidate previous TB info.  */
@@ -1026,6 +1337,157 @@ TranslationBlock *tb_gen_code(CPUState *env,
     return tb;
 }
 
+/* Return the block translated for 'pc' in the first page of 'tb', if
+   it is a plain block with the same CPU state as 'tb'.  */
+static TranslationBlock *tb_find_profiled(TranslationBlock *tb,
+                                          target_ulong pc)
+{
+    TranslationBlock *p;
+    tb_page_addr_t phys_pc;
+
+    phys_pc = tb->page_addr[0] + (pc & ~TARGET_PAGE_MASK);
+    for (p = tb_phys_hash[tb_phys_hash_func(phys_pc)]; p != NULL;
+         p = p->phys_hash_next) {
+        if (p->pc == pc && p->page_addr[0] == tb->page_addr[0] &&
+            p->cs_base == tb->cs_base && p->flags == tb->flags &&
+            !(p->cflags & (CF_TRACE | CF_LAST_IO | CF_COUNT_MASK))) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+/* Retranslate the hot block 'tb' as a trace.  The CPU state must be
+   the one at the entry of 'tb'.  Starting from 'tb', the hot exit of
+   each block is picked from its execution and taken-branch counts and
+   followed, backward branches included, as long as it stays in the
+   page of 'tb', reaches a block that has already run and does not
+   close a loop back to 'tb'.  The
+   decisions are recorded in the cflags of the trace, so that
+   retranslating it to restore the CPU state gives the same code.
+
+   The new TB is inserted at the head of the physical hash chain, so
+   invalidating the old one unlinks all jumps to it and lets the
+   callers chain to the trace instead.  If no branch can be followed,
+   the counts are reset so that the block is profiled again.  */
+void tb_gen_trace(CPUState *env, TranslationBlock *tb)
+{
+    TranslationBlock *p;
+    target_ulong pc, cs_base, next;
+    int flags, n, path;
+
+    if (tb->cflags & (CF_TRACE | CF_LAST_IO | CF_COUNT_MASK | CF_INVALID)) {
+        return;
+    }
+    if (env->singlestep_enabled || singlestep) {
+        tb->exec_count = 0;
+        tb->taken_count = 0;
+        return;
+    }
+
+    path = 0;
+    p = tb;
+    for (n = 0; n < TB_TRACE_MAX_BLOCKS; n++) {
+        if (p->branch_kind == TB_BRANCH_NONE) {
+            break;
+        }
+        next = p->branch_dest;
+        if (p->branch_kind == TB_BRANCH_COND &&
+            p->exec_count - p->taken_count > p->taken_count) {
+            next = p->pc + p->size;
+            path |= 1 << n;
+        }
+        /* a loop back to the entry is chained to the trace itself */
+        if (next == tb->pc ||
+            (next & TARGET_PAGE_MASK) != (tb->pc & TARGET_PAGE_MASK)) {
+            break;
+        }
+        p = tb_find_profiled(tb, next);
+        if (!p || !p->exec_count) {
+            break;
+        }
+    }
+    if (n == 0) {
+        if (tb->branch_kind != TB_BRANCH_NONE) {
+            tb->exec_count = 0;
+            tb->taken_count = 0;
+        }
+        return;
+    }
+
+    pc = tb->pc;
+    cs_base = tb->cs_base;
+    flags = tb->flags;
+
+    /* invalidate first, as making room for the trace may reuse 'tb' */
+    tb_phys_invalidate(tb, -1);
+    tb_gen_code(env, pc, cs_base, flags,
+                CF_TRACE | (n << CF_TRACE_BLOCKS_SHIFT) |
+                ((path << CF_TRACE_PATH_SHIFT) & CF_TRACE_PATH_MASK));
+    tb_trace_count++;
+}
+
+#if !defined(CONFIG_USER_ONLY)
+/* Under icount, an I/O access must be the last instruction of its TB.
+   cpu_io_recompile() fixes up blocks that break the rule by splitting
+   them, and remembers the split here so that a block evicted from the
+   code buffer is directly retranslated with CF_LAST_IO instead of
+   faulting again.  Entries are never stale in a harmful way: at worst
+   the block ends earlier than needed.  */
+
+#define TB_IO_CACHE_BITS 12
+#define TB_IO_CACHE_SIZE (1 << TB_IO_CACHE_BITS)
+
+typedef struct TBIOEntry {
+    tb_page_addr_t phys_pc;
+    target_ulong pc;
+    target_ulong cs_base;
+    uint64_t flags;
+    int cflags;
+} TBIOEntry;
+
+static TBIOEntry tb_io_cache[TB_IO_CACHE_SIZE];
+static int tb_io_recompile_count;
+static int tb_io_cache_hits;
+
+static inline TBIOEntry *tb_io_entry(tb_page_addr_t phys_pc)
+{
+    return &tb_io_cache[tb_phys_hash_func(phys_pc) & (TB_IO_CACHE_SIZE - 1)];
+}
+
+static void tb_io_record(TranslationBlock *tb, int cflags)
+{
+    tb_page_addr_t phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
+    TBIOEntry *e = tb_io_entry(phys_pc);
+
+    e->phys_pc = phys_pc;
+    e->pc = tb->pc;
+    e->cs_base = tb->cs_base;
+    e->flags = tb->flags;
+    e->cflags = cflags;
+}
+
+/* Return the compile flags to use for a block that is not yet
+   translated: under icount, those of the split recorded for it by
+   cpu_io_recompile(), if any.  */
+int tb_io_lookup(target_ulong pc, target_ulong cs_base, uint64_t flags,
+                 tb_page_addr_t phys_pc)
+{
+    TBIOEntry *e;
+
+    if (!use_icount) {
+        return 0;
+    }
+    e = tb_io_entry(phys_pc);
+    if (!e->cflags || e->phys_pc != phys_pc || e->pc != pc ||
+        e->cs_base != cs_base || e->flags != flags) {
+        return 0;
+    }
+    tb_io_cache_hits++;
+    return e->cflags;
+}
+#endif
+
 /* invalidate all TBs which intersect with the target physical page
    starting in range [start;end[. NOTE: start and end must refer to
    the same physical page. 'is_cpu_write_access' should be true if called
@@ -1069,8 +1531,9 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
         if (n == 0) {
             /* NOTE: tb_end may be after the end of the page, but
                it is not a problem */
-            tb_start = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-            tb_end = tb_start + tb->size;
+            tb_start = tb->page_addr[0] + tb_page_start(tb);
+            tb_end = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK) +
+                     tb->size;
         } else {
             tb_start = tb->page_addr[1];
             tb_end = tb_start + ((tb->pc + tb->size) & ~TARGET_PAGE_MASK);
@@ -1322,22 +1785,44 @@ void tb_link_page(TranslationBlock *tb,
     mmap_unlock();
 }
 
+/* Incremented whenever translated code is thrown away, so that a host
+   code address recorded asynchronously can be checked for staleness
+   before it is looked up with tb_find_pc().  Signal safe.  */
+unsigned int tb_code_generation(void)
+{
+    return tb_flush_count + tb_evict_count;
+}
+
+/* True if 'tc_ptr' points into the translated code buffer.  Signal safe. */
+bool tb_in_code_buffer(unsigned long tc_ptr)
+{
+    return tc_ptr >= (unsigned long)code_gen_buffer &&
+           tc_ptr < (unsigned long)code_gen_buffer + code_gen_buffer_size;
+}
+
 /* find the TB 'tb' such that tb[0].tc_ptr <= tc_ptr <
    tb[1].tc_ptr. Return NULL if not found */
 TranslationBlock *tb_find_pc(unsigned long tc_ptr)
 {
-    int m_min, m_max, m;
+    int m_min, m_max, m, i;
     unsigned long v;
     TranslationBlock *tb;
+    CodeGenRegion *r;
 
-    if (nb_tbs <= 0)
+    if (tc_ptr < (unsigned long)code_gen_buffer)
+        return NULL;
+    i = (tc_ptr - (unsigned long)code_gen_buffer) / code_gen_region_size;
+    if (i >= code_gen_nb_regions)
+        return NULL;
+    r = &code_gen_regions[i];
+    if (r->nb_tbs <= 0)
         return NULL;
-    if (tc_ptr < (unsigned long)code_gen_buffer ||
-        tc_ptr >= (unsigned long)code_gen_ptr)
+    if (tc_ptr >= (unsigned long)(i == code_gen_cur_region ?
+                                  code_gen_ptr : r->ptr))
         return NULL;
     /* binary search (cf Knuth) */
-    m_min = 0;
-    m_max = nb_tbs - 1;
+    m_min = r->tb_start;
+    m_max = r->tb_start + r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
         tb = &tbs[m];
@@ -1353,6 +1838,17 @@ TranslationBlock *tb_find_pc(unsigned long tc_ptr)
     return &tbs[m_max];
 }
 
+#if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
+/* check whether the given addr is in TCG generated code buffer or not */
+int is_tcg_gen_code(unsigned long tc_ptr)
+{
+    /* This can be called during code generation, code_gen_buffer_size
+       is used instead of code_gen_ptr for upper boundary checking */
+    return (tc_ptr >= (unsigned long)code_gen_buffer &&
+            tc_ptr < (unsigned long)(code_gen_buffer + code_gen_buffer_size));
+}
+#endif
+
 static void tb_reset_jump_recursive(TranslationBlock *tb);
 
 static inline void tb_reset_jump_recursive2(TranslationBlock *tb, int n)
@@ -1673,6 +2169,15 @@ static void tcg_handle_interrupt(CPUState *env, int mask)
         return;
     }
 
+    /*
+     * All TCG vCPUs share one thread.  If another vCPU wakes this one
+     * up, end the slice of the running vCPU so that the halted one
+     * handles the interrupt without waiting for the slice to expire.
+     */
+    if (cpu_single_env && cpu_single_env != env && env->halted) {
+        cpu_exit(cpu_single_env);
+    }
+
     if (use_icount) {
         env->icount_decr.u16.high = 0xffff;
         if (!can_do_io(env)
@@ -2558,6 +3063,7 @@ void cpu_register_physical_memory_log(MemoryRegionSection *section,
     region_offset &= TARGET_PAGE_MASK;
     size = (size + TARGET_PAGE_SIZE - 1) & TARGET_PAGE_MASK;
     end_addr = start_addr + (target_phys_addr_t)size;
+    phys_map_dirty = true;
 
     addr = start_addr;
     do {
@@ -4307,6 +4813,10 @@ void cpu_io_recompile(CPUState *env, void *retaddr)
     pc = tb->pc;
     cs_base = tb->cs_base;
     flags = tb->flags;
+#if !defined(CONFIG_USER_ONLY)
+    tb_io_record(tb, cflags);
+    tb_io_recompile_count++;
+#endif
     tb_phys_invalidate(tb, -1);
     /* FIXME: In theory this could raise an exception.  In practice
        we have already translated the block once so it's probably ok.  */
@@ -4321,10 +4831,20 @@ void cpu_io_recompile(CPUState *env, void *retaddr)
 
 #if !defined(CONFIG_USER_ONLY)
 
+static unsigned long code_gen_region_used(int i)
+{
+    CodeGenRegion *r = &code_gen_regions[i];
+
+    return (i == code_gen_cur_region ? code_gen_ptr : r->ptr) - r->start;
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    int nb_tbs;
+    long code_size;
+    CodeGenRegion *r;
     TranslationBlock *tb;
 
     target_code_size = 0;
@@ -4332,32 +4852,39 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for(i = 0; i < nb_tbs; i++) {
-        tb = &tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size)
-            max_target_code_size = tb->size;
-        if (tb->page_addr[1] != -1)
-            cross_page++;
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    nb_tbs = 0;
+    code_size = 0;
+    for (j = 0; j < code_gen_nb_regions; j++) {
+        r = &code_gen_regions[j];
+        nb_tbs += r->nb_tbs;
+        code_size += code_gen_region_used(j);
+        for (i = 0; i < r->nb_tbs; i++) {
+            tb = &tbs[r->tb_start + i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size)
+                max_target_code_size = tb->size;
+            if (tb->page_addr[1] != -1)
+                cross_page++;
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%ld\n",
-                code_gen_ptr - code_gen_buffer, code_gen_buffer_max_size);
+    cpu_fprintf(f, "gen code size       %ld/%ld\n",
+                code_size, code_gen_buffer_max_size);
     cpu_fprintf(f, "TB count            %d/%d\n", 
                 nb_tbs, code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
                 nb_tbs ? target_code_size / nb_tbs : 0,
                 max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-                nb_tbs ? (code_gen_ptr - code_gen_buffer) / nb_tbs : 0,
-                target_code_size ? (double) (code_gen_ptr - code_gen_buffer) / target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %ld bytes (expansion ratio: %0.1f)\n",
+                nb_tbs ? code_size / nb_tbs : 0,
+                target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n",
             cross_page,
             nb_tbs ? (cross_page * 100) / nb_tbs : 0);
@@ -4368,11 +4895,39 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 nb_tbs ? (direct_jmp2_count * 100) / nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tb_flush_count);
+    cpu_fprintf(f, "TB evict count      %d\n", tb_evict_count);
     cpu_fprintf(f, "TB invalidate count %d\n", tb_phys_invalidate_count);
+    cpu_fprintf(f, "TB trace count      %d\n", tb_trace_count);
+#if !defined(CONFIG_USER_ONLY)
+    cpu_fprintf(f, "TB I/O recompiles   %d (%d cached retranslations)\n",
+                tb_io_recompile_count, tb_io_cache_hits);
+#endif
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
     tcg_dump_info(f, cpu_fprintf);
 }
 
+void dump_code_regions(FILE *f, fprintf_function cpu_fprintf)
+{
+    CodeGenRegion *r;
+    unsigned long used;
+    int i;
+
+    cpu_fprintf(f, "%d regions of %lu KiB, flushes %d, evictions %d\n",
+                code_gen_nb_regions, code_gen_region_size / 1024,
+                tb_flush_count, tb_evict_count);
+    cpu_fprintf(f, "region  fill        TBs      age  evictions\n");
+    for (i = 0; i < code_gen_nb_regions; i++) {
+        r = &code_gen_regions[i];
+        used = code_gen_region_used(i);
+        cpu_fprintf(f, "%c%-5d %3lu%% %6luK %6d %8lu %10d\n",
+                    i == code_gen_cur_region ? '*' : ' ', i,
+                    used * 100 / code_gen_region_size, used / 1024, r->nb_tbs,
+                    code_gen_clock - r->last_used, r->evict_count);
+    }
+    cpu_fprintf(f, "(age is the number of translations since a TB of "
+                "the region was last used)\n");
+}
+
 /* NOTE: this function can trigger an exception */
 /* NOTE2: the returned address is not exactly the physical address: it
    is the offset relative to phys_ram_base */
@@ -33,6 +33,59 @@ static void gen_icount_end(TranslationBlock *tb, int num_insns)
     }
 }
 
+/* Whether the executions of 'tb' are profiled for trace formation.  */
+static inline int gen_trace_profiled(TranslationBlock *tb)
+{
+    return tb_trace_threshold && !use_icount &&
+        !(tb->cflags & (CF_TRACE | CF_LAST_IO | CF_COUNT_MASK));
+}
+
+/* Count executions of 'tb' and leave it once, through the hash table
+   lookup, when it becomes hot so that it gets retranslated as a trace.
+   Must be emitted before any guest instruction.  */
+static inline void gen_trace_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr;
+    TCGv_i32 count;
+    int l1;
+
+    if (!gen_trace_profiled(tb)) {
+        return;
+    }
+
+    l1 = gen_new_label();
+    ptr = tcg_const_ptr(&tb->exec_count);
+    count = tcg_temp_new_i32();
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, tb_trace_threshold, l1);
+    tcg_gen_exit_tb((tcg_target_long)tb + 3);
+    gen_set_label(l1);
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+}
+
+/* Count the taken exits of the conditional branch ending 'tb'.  Must be
+   emitted on the taken path only.  */
+static inline void gen_trace_count_taken(TranslationBlock *tb)
+{
+    TCGv_ptr ptr;
+    TCGv_i32 count;
+
+    if (!gen_trace_profiled(tb)) {
+        return;
+    }
+
+    ptr = tcg_const_ptr(&tb->taken_count);
+    count = tcg_temp_new_i32();
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_temp_free_i32(count);
+    tcg_temp_free_ptr(ptr);
+}
+
 static inline void gen_io_start(void)
 {
     TCGv_i32 tmp = tcg_const_i32(1);
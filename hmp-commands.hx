@@ -1302,6 +1302,51 @@ Password is invalidated at the given time.  @var{nsec} are the seconds
 passed since 1970, i.e. unix epoch.
 
 @end table
+ETEXI
+
+    {
+        .name       = "tcg_profile_start",
+        .args_type  = "hz:i?,symbols:F?",
+        .params     = "[hz [symbols]]",
+        .help       = "start sampling the translated code",
+        .mhandler.cmd = hmp_tcg_profile_start,
+    },
+
+STEXI
+@item tcg_profile_start [@var{hz} [@var{symbols}]]
+@findex tcg_profile_start
+Start the sampling profiler for translated code, @var{hz} times per second
+of vCPU time (default 1000).  Guest addresses are named with the symbol
+table of the ELF file @var{symbols} if given.  See @code{info tcg-profile}.
+ETEXI
+
+    {
+        .name       = "tcg_profile_stop",
+        .args_type  = "",
+        .params     = "",
+        .help       = "stop sampling the translated code",
+        .mhandler.cmd = hmp_tcg_profile_stop,
+    },
+
+STEXI
+@item tcg_profile_stop
+@findex tcg_profile_stop
+Stop the sampling profiler for translated code.  The samples are kept.
+ETEXI
+
+    {
+        .name       = "tcg_profile_dump",
+        .args_type  = "filename:F",
+        .params     = "filename",
+        .help       = "write the translated code profile as folded stacks",
+        .mhandler.cmd = hmp_tcg_profile_dump,
+    },
+
+STEXI
+@item tcg_profile_dump @var{filename}
+@findex tcg_profile_dump
+Write the samples of the translated code profiler to @var{filename}, one
+@samp{cpu;symbol count} line per entry, for flame graph tools.
 ETEXI
 
     {
@@ -1346,6 +1391,12 @@ show virtual to physical memory mappings (i386, SH4, SPARC, and PPC only)
 show the active virtual memory mappings (i386 only)
 @item info jit
 show dynamic compiler info
+@item info jit-regions
+show the fill level and age of the regions of the translated code buffer
+@item info tcg-profile
+show the samples of the translated code profiler, hottest code first
+@item info icount
+show the instruction counting mode, shift and achieved guest speed
 @item info numa
 show NUMA information
 @item info kvm
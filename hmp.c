@@ -188,7 +188,13 @@ void hmp_info_cpus(Monitor *mon)
             monitor_printf(mon, " (halted)");
         }
 
-        monitor_printf(mon, " thread_id=%" PRId64 "\n", cpu->value->thread_id);
+        monitor_printf(mon, " thread_id=%" PRId64, cpu->value->thread_id);
+        if (cpu->value->has_run_time_ns) {
+            monitor_printf(mon, " time=%" PRId64 "ms slices=%" PRId64,
+                           cpu->value->run_time_ns / 1000000,
+                           cpu->value->slices);
+        }
+        monitor_printf(mon, "\n");
     }
 
     qapi_free_CpuInfoList(cpu_list);
@@ -265,8 +271,7 @@ void hmp_info_blockstats(Monitor *mon)
                        " flush_operations=%" PRId64
                        " wr_total_time_ns=%" PRId64
                        " rd_total_time_ns=%" PRId64
-                       " flush_total_time_ns=%" PRId64
-                       "\n",
+                       " flush_total_time_ns=%" PRId64,
                        stats->value->stats->rd_bytes,
                        stats->value->stats->wr_bytes,
                        stats->value->stats->rd_operations,
@@ -275,6 +280,17 @@ void hmp_info_blockstats(Monitor *mon)
                        stats->value->stats->wr_total_time_ns,
                        stats->value->stats->rd_total_time_ns,
                        stats->value->stats->flush_total_time_ns);
+        if (stats->value->stats->has_l2_cache_hits) {
+            monitor_printf(mon, " l2_cache_hits=%" PRId64
+                           " l2_cache_misses=%" PRId64
+                           " refcount_cache_hits=%" PRId64
+                           " refcount_cache_misses=%" PRId64,
+                           stats->value->stats->l2_cache_hits,
+                           stats->value->stats->l2_cache_misses,
+                           stats->value->stats->refcount_cache_hits,
+                           stats->value->stats->refcount_cache_misses);
+        }
+        monitor_printf(mon, "\n");
     }
 
     qapi_free_BlockStatsList(stats_list);
@@ -509,6 +525,28 @@ void hmp_info_pci(Monitor *mon)
     qapi_free_PciInfoList(info_list);
 }
 
+void hmp_info_icount(Monitor *mon)
+{
+    IcountInfo *info;
+
+    info = qmp_query_icount(NULL);
+    if (!info->enabled) {
+        monitor_printf(mon, "icount: disabled\n");
+    } else {
+        monitor_printf(mon, "icount: %s, shift %" PRId64 ", %" PRId64
+                       " instructions, %" PRId64 " MIPS\n",
+                       info->adaptive ? "auto" : "fixed", info->shift,
+                       info->instructions, info->mips);
+        if (info->adaptive) {
+            monitor_printf(mon, "shift adjustments: %" PRId64 " up, %" PRId64
+                           " down\n", info->shift_increases,
+                           info->shift_decreases);
+        }
+    }
+
+    qapi_free_IcountInfo(info);
+}
+
 void hmp_info_block_jobs(Monitor *mon)
 {
     BlockJobInfoList *list;
@@ -851,3 +889,78 @@ void hmp_block_job_cancel(Monitor *mon, const QDict *qdict)
 
     hmp_handle_error(mon, &error);
 }
+
+void hmp_info_tcg_profile(Monitor *mon)
+{
+    TcgProfileInfo *info;
+    TcgProfileCpuList *cpu;
+    TcgProfileEntryList *entry;
+    Error *err = NULL;
+
+    info = qmp_query_tcg_profile(true, 20, false, false, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "profiler: %s, period %" PRId64 " ns, %" PRId64
+                   " samples, %" PRId64 " dropped\n",
+                   info->enabled ? "running" : "stopped", info->period_ns,
+                   info->samples, info->dropped);
+    for (cpu = info->cpus; cpu; cpu = cpu->next) {
+        monitor_printf(mon, "CPU #%" PRId64 ": %" PRId64 " samples, %"
+                       PRId64 " ms\n", cpu->value->cpu, cpu->value->samples,
+                       cpu->value->time_ns / 1000000);
+    }
+    for (entry = info->entries; entry; entry = entry->next) {
+        TcgProfileEntry *e = entry->value;
+
+        monitor_printf(mon, "%5.1f%% %8" PRId64,
+                       info->samples ? e->samples * 100.0 / info->samples : 0,
+                       e->samples);
+        if (e->has_cpu) {
+            monitor_printf(mon, "  cpu%-3" PRId64, e->cpu);
+        } else {
+            monitor_printf(mon, "  -     ");
+        }
+        monitor_printf(mon, " %-6s %s", TcgProfileKind_lookup[e->kind],
+                       e->symbol);
+        if (e->has_pc && strncmp(e->symbol, "0x", 2) != 0) {
+            monitor_printf(mon, " (0x%" PRIx64 ")", e->pc);
+        }
+        monitor_printf(mon, "\n");
+    }
+
+    qapi_free_TcgProfileInfo(info);
+}
+
+void hmp_tcg_profile_start(Monitor *mon, const QDict *qdict)
+{
+    Error *error = NULL;
+    bool has_hz = qdict_haskey(qdict, "hz");
+    int64_t hz = qdict_get_try_int(qdict, "hz", 0);
+    const char *symbols = qdict_get_try_str(qdict, "symbols");
+
+    qmp_tcg_profile_start(has_hz, hz, symbols != NULL, symbols, &error);
+
+    hmp_handle_error(mon, &error);
+}
+
+void hmp_tcg_profile_stop(Monitor *mon, const QDict *qdict)
+{
+    Error *error = NULL;
+
+    qmp_tcg_profile_stop(&error);
+
+    hmp_handle_error(mon, &error);
+}
+
+void hmp_tcg_profile_dump(Monitor *mon, const QDict *qdict)
+{
+    Error *error = NULL;
+    const char *filename = qdict_get_str(qdict, "filename");
+
+    qmp_tcg_profile_dump(filename, &error);
+
+    hmp_handle_error(mon, &error);
+}
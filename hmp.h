@@ -33,6 +33,8 @@ void hmp_info_spice(Monitor *mon);
 void hmp_info_balloon(Monitor *mon);
 void hmp_info_pci(Monitor *mon);
 void hmp_info_block_jobs(Monitor *mon);
+void hmp_info_icount(Monitor *mon);
+void hmp_info_tcg_profile(Monitor *mon);
 void hmp_quit(Monitor *mon, const QDict *qdict);
 void hmp_stop(Monitor *mon, const QDict *qdict);
 void hmp_system_reset(Monitor *mon, const QDict *qdict);
@@ -58,5 +60,8 @@ void hmp_block_set_io_throttle(Monitor *mon, const QDict *qdict);
 void hmp_block_stream(Monitor *mon, const QDict *qdict);
 void hmp_block_job_set_speed(Monitor *mon, const QDict *qdict);
 void hmp_block_job_cancel(Monitor *mon, const QDict *qdict);
+void hmp_tcg_profile_start(Monitor *mon, const QDict *qdict);
+void hmp_tcg_profile_stop(Monitor *mon, const QDict *qdict);
+void hmp_tcg_profile_dump(Monitor *mon, const QDict *qdict);
 
 #endif
@@ -457,7 +457,9 @@ static MemoryRegion* ox820_init_common(ram_addr_t ram_size,
 
     /*=========================================================================*/
     /* GMACA */
+    qemu_check_nic_model(&nd_table[0], "ox820-gmac");
     dev = qdev_create(NULL, "ox820-gmac");
+    qdev_set_nic_properties(dev, &nd_table[0]);
     qdev_init_nofail(dev);
     busdev = sysbus_from_qdev(dev);
     memory_region_add_subregion(main_1gb_region, 0x00400000, sysbus_mmio_get_region(busdev, 0));
@@ -474,7 +476,9 @@ static MemoryRegion* ox820_init_common(ram_addr_t ram_size,
     /* GMACB */
     if(variant == OX820_VARIANT_7825)
     {
+        qemu_check_nic_model(&nd_table[1], "ox820-gmac");
         dev = qdev_create(NULL, "ox820-gmac");
+        qdev_set_nic_properties(dev, &nd_table[1]);
         qdev_init_nofail(dev);
         busdev = sysbus_from_qdev(dev);
         memory_region_add_subregion(main_1gb_region, 0x004800000, sysbus_mmio_get_region(busdev, 0));
@@ -8,6 +8,37 @@
 
 #include "sysbus.h"
 #include "net.h"
+#include <zlib.h>
+
+#define MAC_CONFIG_RE           (1 << 2)    /* receiver enable */
+
+#define DMA_STATUS_RI           (1 << 6)    /* receive interrupt */
+#define DMA_STATUS_RU           (1 << 7)    /* receive buffer unavailable */
+#define DMA_STATUS_AIS          (1 << 15)
+#define DMA_STATUS_NIS          (1 << 16)
+#define DMA_STATUS_NORMAL       0x00004045  /* TI, TU, RI, ERI */
+#define DMA_STATUS_ABNORMAL     0x000027BA
+#define DMA_STATUS_RS_MASK      (7 << 17)   /* receive process state */
+#define DMA_STATUS_RS_STOPPED   (0 << 17)
+#define DMA_STATUS_RS_WAITING   (3 << 17)
+#define DMA_STATUS_RS_SUSPENDED (4 << 17)
+
+#define DMA_OPMODE_SR           (1 << 1)    /* start receive */
+
+/* Receive descriptor: status, control, buffer 1, buffer 2 / next */
+#define RDES0_OWN               (1u << 31)
+#define RDES0_FL_SHIFT          16
+#define RDES0_FL_MASK           0x3FFF
+#define RDES0_FS                (1 << 9)
+#define RDES0_LS                (1 << 8)
+#define RDES1_DIC               (1u << 31)
+#define RDES1_RER               (1 << 25)
+#define RDES1_RCH               (1 << 24)
+#define RDES1_RBS2_SHIFT        11
+#define RDES1_RBS_MASK          0x7FF
+
+/* Most descriptors a single frame may take before it is dropped */
+#define RX_MAX_DESC             64
 
 typedef struct {
     SysBusDevice    busdev;
@@ -105,9 +136,38 @@ typedef struct {
 
 static void ox820_gmac_irq_update(ox820_gmac_state* s)
 {
-    int irqset = 0;
+    uint32_t pending = s->dma.status & s->dma.intenable;
+    int irqset;
+
+    s->dma.status &= ~(DMA_STATUS_NIS | DMA_STATUS_AIS);
+    if (pending & DMA_STATUS_NORMAL) {
+        s->dma.status |= DMA_STATUS_NIS;
+    }
+    if (pending & DMA_STATUS_ABNORMAL) {
+        s->dma.status |= DMA_STATUS_AIS;
+    }
+
+    irqset = (s->dma.status & s->dma.intenable &
+              (DMA_STATUS_NIS | DMA_STATUS_AIS)) != 0;
     qemu_set_irq(s->mac_irq, irqset);
-    qemu_set_irq(s->pmt_irq, irqset);
+    qemu_set_irq(s->pmt_irq, 0);
+}
+
+static void ox820_gmac_rx_set_state(ox820_gmac_state *s, uint32_t state)
+{
+    s->dma.status = (s->dma.status & ~DMA_STATUS_RS_MASK) | state;
+}
+
+/* The guest handed back descriptors or restarted reception: deliver the
+ * frames that were held back while the ring was full.
+ */
+static void ox820_gmac_rx_resume(ox820_gmac_state *s)
+{
+    if (!(s->dma.opmode & DMA_OPMODE_SR)) {
+        return;
+    }
+    ox820_gmac_rx_set_state(s, DMA_STATUS_RS_WAITING);
+    qemu_flush_queued_packets(&s->nic->nc);
 }
 
 static void ox820_gmac_mac_phy_address(ox820_gmac_state* s)
@@ -578,10 +638,12 @@ static void ox820_gmac_dma_write(void *opaque, target_phys_addr_t offset,
         break;
 
     case 0x008 >> 2:
+        ox820_gmac_rx_resume(s);
         break;
 
     case 0x00C >> 2:
         s->dma.receive_desc_list = value;
+        s->dma.cur_host_rx_desc = value;
         break;
 
     case 0x010 >> 2:
@@ -589,15 +651,22 @@ static void ox820_gmac_dma_write(void *opaque, target_phys_addr_t offset,
         break;
 
     case 0x014 >> 2:
-        s->dma.status &= (~value);
+        s->dma.status &= ~(value & 0x0001FFFF);
+        ox820_gmac_irq_update(s);
         break;
 
     case 0x018 >> 2:
         s->dma.opmode = value & 0x07F1FFDE;
+        if (s->dma.opmode & DMA_OPMODE_SR) {
+            ox820_gmac_rx_resume(s);
+        } else {
+            ox820_gmac_rx_set_state(s, DMA_STATUS_RS_STOPPED);
+        }
         break;
 
     case 0x001C >> 2:
         s->dma.intenable = value & 0x0001E7FF;
+        ox820_gmac_irq_update(s);
         break;
 
     case 0x0020 >> 2:
@@ -706,29 +775,163 @@ static int ox820_gmac_eth_can_receive(VLANClientState *nc)
     return s->rsten == 0 && s->cken != 0;
 }
 
+static target_phys_addr_t ox820_gmac_rx_next_desc(ox820_gmac_state *s,
+                                                  target_phys_addr_t desc,
+                                                  uint32_t rdes1)
+{
+    if (rdes1 & RDES1_RER) {
+        return s->dma.receive_desc_list;
+    }
+    if (rdes1 & RDES1_RCH) {
+        return ldl_le_phys(desc + 12);
+    }
+    return desc + 16 + ((s->dma.bus_mode >> 2) & 0x1F) * 4;
+}
+
+static size_t ox820_gmac_rx_desc_space(uint32_t rdes1)
+{
+    size_t space = rdes1 & RDES1_RBS_MASK;
+
+    if (!(rdes1 & RDES1_RCH)) {
+        space += (rdes1 >> RDES1_RBS2_SHIFT) & RDES1_RBS_MASK;
+    }
+    return space;
+}
+
+/* Returns how many descriptors a frame of @len bytes takes, 0 if the guest
+ * has not given enough of them back yet and -1 if it will never fit.
+ */
+static int ox820_gmac_rx_desc_count(ox820_gmac_state *s, size_t len)
+{
+    target_phys_addr_t desc = s->dma.cur_host_rx_desc;
+    int n;
+
+    for (n = 1; n <= RX_MAX_DESC; n++) {
+        uint32_t rdes1;
+        size_t space;
+
+        if (!(ldl_le_phys(desc) & RDES0_OWN)) {
+            return 0;
+        }
+        rdes1 = ldl_le_phys(desc + 4);
+        space = ox820_gmac_rx_desc_space(rdes1);
+        if (space >= len) {
+            return n;
+        }
+        len -= space;
+
+        desc = ox820_gmac_rx_next_desc(s, desc, rdes1);
+        if (desc == s->dma.cur_host_rx_desc) {
+            break;
+        }
+    }
+    return -1;
+}
+
+/* Copies @len bytes at @offset of the frame, i.e. @buf followed by @fcs */
+static void ox820_gmac_rx_write(target_phys_addr_t addr, const uint8_t *buf,
+                                size_t size, const uint8_t *fcs,
+                                size_t offset, size_t len)
+{
+    if (offset < size) {
+        size_t n = MIN(len, size - offset);
+
+        cpu_physical_memory_write(addr, buf + offset, n);
+        addr += n;
+        offset += n;
+        len -= n;
+    }
+    if (len) {
+        cpu_physical_memory_write(addr, fcs + (offset - size), len);
+    }
+}
+
 static ssize_t ox820_gmac_eth_receive(VLANClientState *nc, const uint8_t *buf, size_t size)
 {
-//    unsigned char sa_bcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff };
-//    ox820_gmac_state *s = DO_UPCAST(NICState, nc, nc)->opaque;
+    ox820_gmac_state *s = DO_UPCAST(NICState, nc, nc)->opaque;
+    target_phys_addr_t desc;
+    size_t frame_len = size + 4;
+    size_t offset = 0;
+    uint32_t crc;
+    int i, n;
 
     if (size < 12) {
         return -1;
     }
 
-#if 0
-    /* Does the frame get through the address filters?  */
-    if ((!use_ma0 || memcmp(buf, eth->macaddr[0], 6))
-        && (!use_ma1 || memcmp(buf, eth->macaddr[1], 6))
-        && (!r_bcast || memcmp(buf, sa_bcast, 6))
-        && !eth_match_groupaddr(eth, buf))
+    if (!(s->mac.mac_config & MAC_CONFIG_RE) ||
+        !(s->dma.opmode & DMA_OPMODE_SR)) {
         return size;
-#endif
-    /* FIXME: Find another way to pass on the fake csum.  */
-//    etraxfs_dmac_input(eth->dma_in, (void *)buf, size + 4, 1);
+    }
 
+    n = ox820_gmac_rx_desc_count(s, frame_len);
+    if (n == 0) {
+        /* Hold the frame back until the guest issues a receive poll demand */
+        s->dma.status |= DMA_STATUS_RU;
+        ox820_gmac_rx_set_state(s, DMA_STATUS_RS_SUSPENDED);
+        return 0;
+    }
+    if (n < 0) {
+        if ((s->dma.miss_frame_and_buf_ovl_cnt & 0xFFFF) != 0xFFFF) {
+            s->dma.miss_frame_and_buf_ovl_cnt++;
+        }
+        return size;
+    }
+
+    crc = cpu_to_le32(crc32(0, buf, size));
+
+    desc = s->dma.cur_host_rx_desc;
+    for (i = 0; i < n; i++) {
+        uint32_t rdes1 = ldl_le_phys(desc + 4);
+        uint32_t rdes0 = 0;
+        size_t len;
+
+        len = MIN(rdes1 & RDES1_RBS_MASK, frame_len - offset);
+        s->dma.cur_host_rx_bufaddr = ldl_le_phys(desc + 8);
+        ox820_gmac_rx_write(s->dma.cur_host_rx_bufaddr, buf, size,
+                            (uint8_t *)&crc, offset, len);
+        offset += len;
+
+        if (!(rdes1 & RDES1_RCH) && offset < frame_len) {
+            len = MIN((rdes1 >> RDES1_RBS2_SHIFT) & RDES1_RBS_MASK,
+                      frame_len - offset);
+            s->dma.cur_host_rx_bufaddr = ldl_le_phys(desc + 12);
+            ox820_gmac_rx_write(s->dma.cur_host_rx_bufaddr, buf, size,
+                                (uint8_t *)&crc, offset, len);
+            offset += len;
+        }
+
+        if (i == 0) {
+            rdes0 |= RDES0_FS;
+        }
+        if (i == n - 1) {
+            rdes0 |= RDES0_LS |
+                     ((frame_len & RDES0_FL_MASK) << RDES0_FL_SHIFT);
+            if (!(rdes1 & RDES1_DIC)) {
+                s->dma.status |= DMA_STATUS_RI;
+            }
+        }
+        stl_le_phys(desc, rdes0);
+
+        desc = ox820_gmac_rx_next_desc(s, desc, rdes1);
+    }
+    s->dma.cur_host_rx_desc = desc;
+
+    s->mac.rxframecount_gb++;
+    s->mac.rxoctectcount_gb += frame_len;
+
+    /* The interrupt is raised by ox820_gmac_eth_batch_end() */
     return size;
 }
 
+/* One interrupt for all the frames the backend passed in one go */
+static void ox820_gmac_eth_batch_end(VLANClientState *nc)
+{
+    ox820_gmac_state *s = DO_UPCAST(NICState, nc, nc)->opaque;
+
+    ox820_gmac_irq_update(s);
+}
+
 #if 0
 static int ox820_gmac_eth_tx_push(void *opaque, unsigned char *buf, int len, bool eop)
 {
@@ -765,6 +968,7 @@ static NetClientInfo ox820_gmac_eth_info = {
     .size = sizeof(NICState),
     .can_receive = ox820_gmac_eth_can_receive,
     .receive = ox820_gmac_eth_receive,
+    .receive_batch_end = ox820_gmac_eth_batch_end,
     .cleanup = ox820_gmac_eth_cleanup,
     .link_status_changed = ox820_gmac_eth_set_link,
 };
@@ -966,6 +1170,7 @@ static int ox820_gmac_init(SysBusDevice *dev)
 
 static Property ox820_gmac_properties[] = {
     DEFINE_PROP_UINT32("phyaddr", ox820_gmac_state, phyaddr, 1),
+    DEFINE_NIC_PROPERTIES(ox820_gmac_state, conf),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -0,0 +1,145 @@
+/*
+ * ox820 register file helper
+ *
+ * This code is licensed under the GPL.
+ */
+
+#include "sysbus.h"
+#include "cpu.h"
+#include "ox820_regs.h"
+
+/* The directly readable window is rounded up to this, so that it covers
+   whole target pages and the guest hits it through the TLB.  */
+#define OX820_REGFILE_RAM_ALIGN 0x1000
+
+static uint64_t ox820_regfile_read(void *opaque, target_phys_addr_t offset,
+                                   unsigned size)
+{
+    OX820RegFile *rf = opaque;
+    const OX820RegInfo *ri;
+
+    /* a region that does not start on a page boundary is handed offsets
+       relative to the page rather than to the region */
+    offset -= rf->iomem.addr & ~TARGET_PAGE_MASK;
+    if ((offset >> 2) >= rf->nb_words) {
+        return 0;
+    }
+    ri = rf->index[offset >> 2];
+    if (!ri) {
+        return 0;
+    }
+    if (ri->read) {
+        return ri->read(rf->opaque);
+    }
+    return ox820_regfile_get(rf, offset);
+}
+
+static void ox820_regfile_write(void *opaque, target_phys_addr_t offset,
+                                uint64_t value, unsigned size)
+{
+    OX820RegFile *rf = opaque;
+    const OX820RegInfo *ri;
+    uint32_t old;
+
+    offset -= rf->iomem.addr & ~TARGET_PAGE_MASK;
+    if ((offset >> 2) >= rf->nb_words) {
+        return;
+    }
+    ri = rf->index[offset >> 2];
+    if (!ri) {
+        return;
+    }
+    if (ri->wmask) {
+        old = ox820_regfile_get(rf, offset);
+        ox820_regfile_set(rf, offset, (old & ~ri->wmask) | (value & ri->wmask));
+    }
+    if (ri->write) {
+        ri->write(rf->opaque, value);
+    }
+}
+
+static const MemoryRegionOps ox820_regfile_ops = {
+    .read = ox820_regfile_read,
+    .write = ox820_regfile_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+};
+
+static void ox820_regfile_build_index(OX820RegFile *rf,
+                                      const OX820RegInfo *regs, void *opaque)
+{
+    const OX820RegInfo *ri;
+    uint32_t nb_words = 0;
+
+    for (ri = regs; ri->name; ri++) {
+        assert(!(ri->offset & 3));
+        nb_words = MAX(nb_words, (ri->offset >> 2) + 1);
+    }
+
+    rf->regs = regs;
+    rf->opaque = opaque;
+    rf->nb_words = nb_words;
+    rf->values_size = nb_words * sizeof(uint32_t);
+    rf->index = g_new0(const OX820RegInfo *, nb_words);
+    for (ri = regs; ri->name; ri++) {
+        assert(!rf->index[ri->offset >> 2]);
+        rf->index[ri->offset >> 2] = ri;
+    }
+}
+
+void ox820_regfile_init(OX820RegFile *rf, const OX820RegInfo *regs,
+                        void *opaque, const char *name, uint64_t size)
+{
+    ox820_regfile_build_index(rf, regs, opaque);
+    rf->values = g_malloc0(rf->values_size);
+    memory_region_init_io(&rf->iomem, &ox820_regfile_ops, rf, name, size);
+    ox820_regfile_reset(rf);
+}
+
+void ox820_regfile_init_ram(OX820RegFile *rf, DeviceState *dev,
+                            const OX820RegInfo *regs, void *opaque,
+                            const char *name, uint64_t size)
+{
+    const OX820RegInfo *ri;
+    uint64_t ram_size;
+
+    for (ri = regs; ri->name; ri++) {
+        assert(!ri->read);
+    }
+    ox820_regfile_build_index(rf, regs, opaque);
+
+    ram_size = (rf->values_size + OX820_REGFILE_RAM_ALIGN - 1)
+               & ~(uint64_t)(OX820_REGFILE_RAM_ALIGN - 1);
+    ram_size = MIN(ram_size, size);
+    assert(ram_size >= rf->values_size);
+
+    /* Reads are served from the RAM block, writes still go through
+       ox820_regfile_write() to apply masks and hooks.  */
+    memory_region_init(&rf->iomem, name, size);
+    memory_region_init_rom_device(&rf->ram, &ox820_regfile_ops, rf,
+                                  name, ram_size);
+    vmstate_register_ram(&rf->ram, dev);
+    memory_region_add_subregion(&rf->iomem, 0, &rf->ram);
+    rf->values = memory_region_get_ram_ptr(&rf->ram);
+    memset(rf->values, 0, ram_size);
+    ox820_regfile_reset(rf);
+}
+
+void ox820_regfile_reset(OX820RegFile *rf)
+{
+    const OX820RegInfo *ri;
+
+    for (ri = rf->regs; ri->name; ri++) {
+        ox820_regfile_set(rf, ri->offset, ri->reset);
+    }
+}
+
+const VMStateDescription vmstate_ox820_regfile = {
+    .name = "ox820-regfile",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .minimum_version_id_old = 1,
+    .fields      = (VMStateField[]) {
+        VMSTATE_VBUFFER_UINT32(values, OX820RegFile, 0, NULL, 0, values_size),
+        VMSTATE_END_OF_LIST()
+    }
+};
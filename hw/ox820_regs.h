@@ -0,0 +1,76 @@
+#ifndef _ox820_regs_h
+#define _ox820_regs_h
+
+#include "sysbus.h"
+
+/*
+ * Register file helper for the ox820 system control style units that are
+ * little more than a bank of 32-bit registers.
+ *
+ * A device describes its registers with a table of OX820RegInfo, which the
+ * helper turns into a per-word lookup table and a backing array, so a plain
+ * register access is an array index instead of a switch.  Write masks,
+ * reset values and side-effect hooks are declared per register.
+ *
+ * ox820_regfile_init_ram() additionally backs the registers with a RAM page
+ * that the guest reads directly, trapping only writes; it can only be used
+ * when no register has a read hook.
+ */
+
+typedef struct OX820RegInfo {
+    const char *name;
+    uint32_t offset;
+    uint32_t reset;
+    /* bits stored by a guest write; 0 makes the register read-only */
+    uint32_t wmask;
+    /* called instead of returning the stored value */
+    uint32_t (*read)(void *opaque);
+    /* called after the masked value has been stored, with the raw value */
+    void (*write)(void *opaque, uint32_t value);
+} OX820RegInfo;
+
+#define OX820_REG_END { .name = NULL }
+
+typedef struct OX820RegFile {
+    MemoryRegion iomem;
+    MemoryRegion ram;
+    const OX820RegInfo **index;
+    uint32_t *values;
+    uint32_t nb_words;
+    uint32_t values_size;
+    const OX820RegInfo *regs;
+    void *opaque;
+} OX820RegFile;
+
+void ox820_regfile_init(OX820RegFile *rf, const OX820RegInfo *regs,
+                        void *opaque, const char *name, uint64_t size);
+void ox820_regfile_init_ram(OX820RegFile *rf, DeviceState *dev,
+                            const OX820RegInfo *regs, void *opaque,
+                            const char *name, uint64_t size);
+void ox820_regfile_reset(OX820RegFile *rf);
+
+static inline uint32_t ox820_regfile_get(OX820RegFile *rf, uint32_t offset)
+{
+#ifdef TARGET_WORDS_BIGENDIAN
+    return be32_to_cpu(rf->values[offset >> 2]);
+#else
+    return le32_to_cpu(rf->values[offset >> 2]);
+#endif
+}
+
+static inline void ox820_regfile_set(OX820RegFile *rf, uint32_t offset,
+                                     uint32_t value)
+{
+#ifdef TARGET_WORDS_BIGENDIAN
+    rf->values[offset >> 2] = cpu_to_be32(value);
+#else
+    rf->values[offset >> 2] = cpu_to_le32(value);
+#endif
+}
+
+extern const VMStateDescription vmstate_ox820_regfile;
+
+#define VMSTATE_OX820_REGFILE(_field, _state)                         \
+    VMSTATE_STRUCT(_field, _state, 0, vmstate_ox820_regfile, OX820RegFile)
+
+#endif
@@ -7,54 +7,36 @@
  */
 
 #include "sysbus.h"
+#include "ox820_regs.h"
 
 typedef struct {
     SysBusDevice    busdev;
-    MemoryRegion    iomem;
+    OX820RegFile    regs;
     uint32_t        chip_configuration;
     uint32_t        chip_id;
 } ox820_rps_misc_state;
 
+static const OX820RegInfo ox820_rps_misc_regs[] = {
+    { .name = "chip_configuration", .offset = 0x03C0 - 0x3C0 },
+    { .name = "chip_id", .offset = 0x03FC - 0x3C0 },
+    OX820_REG_END
+};
 
-static uint64_t ox820_rps_misc_read(void *opaque, target_phys_addr_t offset,
-                           unsigned size)
+static void ox820_rps_misc_reset(DeviceState *d)
 {
-    ox820_rps_misc_state *s = (ox820_rps_misc_state*)opaque;
-    uint32_t c = 0;
-
-    offset -= s->iomem.addr;
-    switch (offset >> 2) {
-    case (0x03C0 - 0x3C0) >> 2:
-        c = s->chip_configuration;
-        break;
-
-    case (0x03FC - 0x3C0) >> 2:
-        c = s->chip_id;
-        break;
-
-    default:
-        return 0;
-    }
-    return c;
-}
+    ox820_rps_misc_state *s = DO_UPCAST(ox820_rps_misc_state, busdev.qdev, d);
 
-static void ox820_rps_misc_write(void *opaque, target_phys_addr_t offset,
-                                uint64_t value, unsigned size)
-{
+    ox820_regfile_set(&s->regs, 0x03C0 - 0x3C0, s->chip_configuration);
+    ox820_regfile_set(&s->regs, 0x03FC - 0x3C0, s->chip_id);
 }
 
-static const MemoryRegionOps ox820_rps_misc_ops = {
-    .read = ox820_rps_misc_read,
-    .write = ox820_rps_misc_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-};
-
 static int ox820_rps_misc_init(SysBusDevice *dev)
 {
     ox820_rps_misc_state *s = FROM_SYSBUS(ox820_rps_misc_state, dev);
 
-    memory_region_init_io(&s->iomem, &ox820_rps_misc_ops, s, "ox820-rps-misc", 0x40);
-    sysbus_init_mmio(dev, &s->iomem);
+    ox820_regfile_init(&s->regs, ox820_rps_misc_regs, s, "ox820-rps-misc", 0x40);
+    sysbus_init_mmio(dev, &s->regs.iomem);
+    ox820_rps_misc_reset(&dev->qdev);
     return 0;
 }
 
@@ -71,6 +53,7 @@ static void ox820_rps_misc_class_init(ObjectClass *klass, void *data)
 
     dc->no_user = 1;
     sdc->init = ox820_rps_misc_init;
+    dc->reset = ox820_rps_misc_reset;
     dc->props = ox820_rps_misc_properties;
 }
 
@@ -7,110 +7,37 @@
  */
 
 #include "sysbus.h"
+#include "ox820_regs.h"
 
 typedef struct {
     SysBusDevice    busdev;
-    MemoryRegion    iomem;
-    uint32_t        static_cfg[4];
-    uint32_t        ext_control_reg;
+    OX820RegFile    regs;
 } ox820_static_state;
 
-
-static uint64_t ox820_static_read(void *opaque, target_phys_addr_t offset,
-                           unsigned size)
-{
-    ox820_static_state *s = (ox820_static_state *)opaque;
-    uint32_t c = 0;
-
-    switch (offset >> 2) {
-    case 0x0000 >> 2:
-        c = 2;
-        break;
-
-    case 0x0004 >> 2:
-        c = s->static_cfg[0];
-        break;
-
-    case 0x0008 >> 2:
-        c = s->static_cfg[1];
-        break;
-
-    case 0x000C >> 2:
-        c = s->static_cfg[2];
-        break;
-
-    case 0x0010 >> 2:
-        c = s->static_cfg[3];
-        break;
-
-    case 0x0014 >> 2:
-        c = s->ext_control_reg;
-        break;
-
-    default:
-        return 0;
-    }
-    return c;
-}
-
-static void ox820_static_write(void *opaque, target_phys_addr_t offset,
-                                uint64_t value, unsigned size)
-{
-    ox820_static_state *s = (ox820_static_state *)opaque;
-
-    switch(offset >> 2) {
-
-    case 0x0004 >> 2:
-        s->static_cfg[0] = value;
-        break;
-
-    case 0x0008 >> 2:
-        s->static_cfg[1] = value;
-        break;
-
-    case 0x000C >> 2:
-        s->static_cfg[2] = value;
-        break;
-
-    case 0x0010 >> 2:
-        s->static_cfg[3] = value;
-        break;
-
-    case 0x0014 >> 2:
-        s->ext_control_reg = value;
-        break;
-
-    default:
-        break;
-    }
-}
+static const OX820RegInfo ox820_static_regs[] = {
+    { .name = "static_id", .offset = 0x0000, .reset = 2 },
+    { .name = "static_cfg0", .offset = 0x0004, .wmask = 0xFFFFFFFF },
+    { .name = "static_cfg1", .offset = 0x0008, .wmask = 0xFFFFFFFF },
+    { .name = "static_cfg2", .offset = 0x000C, .wmask = 0xFFFFFFFF },
+    { .name = "static_cfg3", .offset = 0x0010, .wmask = 0xFFFFFFFF },
+    { .name = "ext_control_reg", .offset = 0x0014, .wmask = 0xFFFFFFFF },
+    OX820_REG_END
+};
 
 static void ox820_static_reset(DeviceState *d)
 {
     ox820_static_state *s = DO_UPCAST(ox820_static_state, busdev.qdev, d);
 
-    s->static_cfg[0] = 0;
-    s->static_cfg[1] = 0;
-    s->static_cfg[2] = 0;
-    s->static_cfg[3] = 0;
-    s->ext_control_reg = 0;
+    ox820_regfile_reset(&s->regs);
 }
 
-static const MemoryRegionOps ox820_static_ops = {
-    .read = ox820_static_read,
-    .write = ox820_static_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-};
-
-
 static const VMStateDescription vmstate_ox820_static = {
     .name = "ox820-static",
-    .version_id = 1,
-    .minimum_version_id = 1,
-    .minimum_version_id_old = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .minimum_version_id_old = 2,
     .fields      = (VMStateField[]) {
-        VMSTATE_UINT32_ARRAY(static_cfg, ox820_static_state, 4),
-        VMSTATE_UINT32(ext_control_reg, ox820_static_state),
+        VMSTATE_OX820_REGFILE(regs, ox820_static_state),
         VMSTATE_END_OF_LIST()
     }
 };
@@ -119,14 +46,8 @@ static int ox820_static_init(SysBusDevice *dev)
 {
     ox820_static_state *s = FROM_SYSBUS(ox820_static_state, dev);
 
-    memory_region_init_io(&s->iomem, &ox820_static_ops, s, "ox820-static", 0x400000);
-    sysbus_init_mmio(dev, &s->iomem);
-
-    s->ext_control_reg = 0;
-    s->static_cfg[0] = 0;
-    s->static_cfg[1] = 0;
-    s->static_cfg[2] = 0;
-    s->static_cfg[3] = 0;
+    ox820_regfile_init_ram(&s->regs, &dev->qdev, ox820_static_regs, s, "ox820-static", 0x400000);
+    sysbus_init_mmio(dev, &s->regs.iomem);
 
     vmstate_register(&dev->qdev, -1, &vmstate_ox820_static, s);
     return 0;
@@ -7,100 +7,35 @@
  */
 
 #include "sysbus.h"
+#include "ox820_regs.h"
 
 typedef struct {
     SysBusDevice    busdev;
-    MemoryRegion    iomem;
-    uint32_t        plla_ctrl0;
-    uint32_t        plla_ctrl1;
-    uint32_t        plla_ctrl2;
-    uint32_t        plla_ctrl3;
+    OX820RegFile    regs;
 } ox820_sysctrl_plla_state;
 
-static uint64_t ox820_sysctrl_plla_read(void *opaque, target_phys_addr_t offset,
-                           unsigned size)
-{
-    ox820_sysctrl_plla_state *s = (ox820_sysctrl_plla_state *)opaque;
-    uint32_t c = 0;
-
-    offset -= s->iomem.addr;
-    switch (offset >> 2) {
-    case 0x0000 >> 2:
-        c = s->plla_ctrl0;
-        break;
-
-    case 0x0004 >> 2:
-        c = s->plla_ctrl1;
-        break;
-
-    case 0x0008 >> 2:
-        c = s->plla_ctrl2;
-        break;
-
-    case 0x000C >> 2:
-        c = s->plla_ctrl3;
-        break;
-
-    default:
-        return 0;
-    }
-    return c;
-}
-
-static void ox820_sysctrl_plla_write(void *opaque, target_phys_addr_t offset,
-                                uint64_t value, unsigned size)
-{
-    ox820_sysctrl_plla_state *s = (ox820_sysctrl_plla_state *)opaque;
-
-    offset -= s->iomem.addr;
-    switch(offset >> 2) {
-    case 0x0000 >> 2:
-        s->plla_ctrl0 = value;
-        break;
-
-    case 0x0004 >> 2:
-        s->plla_ctrl1 = value;
-        break;
-
-    case 0x0008 >> 2:
-        s->plla_ctrl2 = value;
-        break;
-
-    case 0x000C >> 2:
-        s->plla_ctrl3 = value;
-        break;
-
-    default:
-        break;
-    }
-}
+static const OX820RegInfo ox820_sysctrl_plla_regs[] = {
+    { .name = "plla_ctrl0", .offset = 0x0000, .wmask = 0xFFFFFFFF },
+    { .name = "plla_ctrl1", .offset = 0x0004, .wmask = 0xFFFFFFFF },
+    { .name = "plla_ctrl2", .offset = 0x0008, .wmask = 0xFFFFFFFF },
+    { .name = "plla_ctrl3", .offset = 0x000C, .wmask = 0xFFFFFFFF },
+    OX820_REG_END
+};
 
 static void ox820_sysctrl_plla_reset(DeviceState *d)
 {
     ox820_sysctrl_plla_state *s = DO_UPCAST(ox820_sysctrl_plla_state, busdev.qdev, d);
 
-    s->plla_ctrl0 = 0;
-    s->plla_ctrl1 = 0;
-    s->plla_ctrl2 = 0;
-    s->plla_ctrl3 = 0;
+    ox820_regfile_reset(&s->regs);
 }
 
-static const MemoryRegionOps ox820_sysctrl_plla_ops = {
-    .read = ox820_sysctrl_plla_read,
-    .write = ox820_sysctrl_plla_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-};
-
 static const VMStateDescription vmstate_ox820_sysctrl_plla = {
     .name = "ox820-sysctrl-plla",
-    .version_id = 1,
-    .minimum_version_id = 1,
-    .minimum_version_id_old = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .minimum_version_id_old = 2,
     .fields      = (VMStateField[]) {
-        VMSTATE_UINT32(plla_ctrl0, ox820_sysctrl_plla_state),
-        VMSTATE_UINT32(plla_ctrl1, ox820_sysctrl_plla_state),
-        VMSTATE_UINT32(plla_ctrl2, ox820_sysctrl_plla_state),
-        VMSTATE_UINT32(plla_ctrl3, ox820_sysctrl_plla_state),
+        VMSTATE_OX820_REGFILE(regs, ox820_sysctrl_plla_state),
         VMSTATE_END_OF_LIST()
     }
 };
@@ -109,13 +44,8 @@ static int ox820_sysctrl_plla_init(SysBusDevice *dev)
 {
     ox820_sysctrl_plla_state *s = FROM_SYSBUS(ox820_sysctrl_plla_state, dev);
 
-    memory_region_init_io(&s->iomem, &ox820_sysctrl_plla_ops, s, "ox820-sysctrl-plla", 0x10);
-    sysbus_init_mmio(dev, &s->iomem);
-
-    s->plla_ctrl0 = 0;
-    s->plla_ctrl1 = 0;
-    s->plla_ctrl2 = 0;
-    s->plla_ctrl3 = 0;
+    ox820_regfile_init(&s->regs, ox820_sysctrl_plla_regs, s, "ox820-sysctrl-plla", 0x10);
+    sysbus_init_mmio(dev, &s->regs.iomem);
 
     vmstate_register(&dev->qdev, -1, &vmstate_ox820_sysctrl_plla, s);
     return 0;
@@ -7,112 +7,106 @@
  */
 
 #include "sysbus.h"
+#include "ox820_regs.h"
+
+#define CKEN_STAT   0x0000
+#define RSTEN_STAT  0x0004
 
 typedef struct {
     SysBusDevice    busdev;
-    MemoryRegion    iomem;
-    uint32_t        cken_stat;
-    uint32_t        rsten_stat;
+    OX820RegFile    regs;
     qemu_irq        cken_out[32];
     qemu_irq        rsten_out[32];
 } ox820_sysctrl_rstck_state;
 
 static void ox820_sysctrl_rstck_update(ox820_sysctrl_rstck_state* s)
 {
+    uint32_t cken_stat = ox820_regfile_get(&s->regs, CKEN_STAT);
+    uint32_t rsten_stat = ox820_regfile_get(&s->regs, RSTEN_STAT);
     unsigned int n;
+
     for(n = 0; n < 32; ++n)
     {
-        qemu_set_irq(s->cken_out[n], 0 != (s->cken_stat & (1u << n)));
+        qemu_set_irq(s->cken_out[n], 0 != (cken_stat & (1u << n)));
     }
+
     for(n = 0; n < 32; ++n)
     {
-        qemu_set_irq(s->rsten_out[n], 0 != (s->rsten_stat & (1u << n)));
+        qemu_set_irq(s->rsten_out[n], 0 != (rsten_stat & (1u << n)));
     }
 }
 
-static uint64_t ox820_sysctrl_rstck_read(void *opaque, target_phys_addr_t offset,
-                           unsigned size)
+static void ox820_sysctrl_rstck_cken_set_write(void *opaque, uint32_t value)
 {
     ox820_sysctrl_rstck_state *s = (ox820_sysctrl_rstck_state *)opaque;
-    uint32_t c = 0;
 
-    offset -= s->iomem.addr;
-    switch (offset >> 2) {
-    case 0x0000 >> 2:
-        c = s->cken_stat;
-        break;
+    ox820_regfile_set(&s->regs, CKEN_STAT,
+                      ox820_regfile_get(&s->regs, CKEN_STAT) | value);
+    ox820_sysctrl_rstck_update(s);
+}
 
-    case 0x0004 >> 2:
-        c = s->rsten_stat;
-        break;
+static void ox820_sysctrl_rstck_cken_clr_write(void *opaque, uint32_t value)
+{
+    ox820_sysctrl_rstck_state *s = (ox820_sysctrl_rstck_state *)opaque;
 
-    default:
-        return 0;
-    }
-    return c;
+    ox820_regfile_set(&s->regs, CKEN_STAT,
+                      ox820_regfile_get(&s->regs, CKEN_STAT) & ~value);
+    ox820_sysctrl_rstck_update(s);
 }
 
-static void ox820_sysctrl_rstck_write(void *opaque, target_phys_addr_t offset,
-                                uint64_t value, unsigned size)
+static void ox820_sysctrl_rstck_rsten_set_write(void *opaque, uint32_t value)
 {
     ox820_sysctrl_rstck_state *s = (ox820_sysctrl_rstck_state *)opaque;
 
-    offset -= s->iomem.addr;
-    switch(offset >> 2) {
-    case 0x0008 >> 2:
-        s->cken_stat |= value;
-        ox820_sysctrl_rstck_update(s);
-        break;
-
-    case 0x000C >> 2:
-        s->cken_stat &= (~value);
+    ox820_regfile_set(&s->regs, RSTEN_STAT,
+                      ox820_regfile_get(&s->regs, RSTEN_STAT) | value);
+    ox820_sysctrl_rstck_update(s);
+    if(value & 0xD)
+    {
+        ox820_regfile_set(&s->regs, RSTEN_STAT,
+                          ox820_regfile_get(&s->regs, RSTEN_STAT) & ~0xD);
         ox820_sysctrl_rstck_update(s);
-        break;
+    }
+}
 
-    case 0x0010 >> 2:
-        s->rsten_stat |= value;
-        ox820_sysctrl_rstck_update(s);
-        if(value & 0xD)
-        {
-            s->rsten_stat &= (~0xD);
-            ox820_sysctrl_rstck_update(s);
-        }
-        break;
-
-    case 0x0014 >> 2:
-        s->rsten_stat &= (~value);
-        ox820_sysctrl_rstck_update(s);
-        break;
+static void ox820_sysctrl_rstck_rsten_clr_write(void *opaque, uint32_t value)
+{
+    ox820_sysctrl_rstck_state *s = (ox820_sysctrl_rstck_state *)opaque;
 
-    default:
-        break;
-    }
+    ox820_regfile_set(&s->regs, RSTEN_STAT,
+                      ox820_regfile_get(&s->regs, RSTEN_STAT) & ~value);
+    ox820_sysctrl_rstck_update(s);
 }
 
+static const OX820RegInfo ox820_sysctrl_rstck_regs[] = {
+    { .name = "cken_stat", .offset = CKEN_STAT, .reset = 0x10000 },
+    { .name = "rsten_stat", .offset = RSTEN_STAT, .reset = 0x8FFEFFF2 },
+    { .name = "cken_set_ctrl", .offset = 0x0008,
+      .write = ox820_sysctrl_rstck_cken_set_write },
+    { .name = "cken_clr_ctrl", .offset = 0x000C,
+      .write = ox820_sysctrl_rstck_cken_clr_write },
+    { .name = "rsten_set_ctrl", .offset = 0x0010,
+      .write = ox820_sysctrl_rstck_rsten_set_write },
+    { .name = "rsten_clr_ctrl", .offset = 0x0014,
+      .write = ox820_sysctrl_rstck_rsten_clr_write },
+    OX820_REG_END
+};
+
 static void ox820_sysctrl_rstck_reset(DeviceState *d)
 {
     ox820_sysctrl_rstck_state *s = DO_UPCAST(ox820_sysctrl_rstck_state, busdev.qdev, d);
 
-    s->cken_stat = 0x10000;
-    s->rsten_stat = 0x8FFEFFF2;
-
+    ox820_regfile_reset(&s->regs);
     ox820_sysctrl_rstck_update(s);
 }
 
-static const MemoryRegionOps ox820_sysctrl_rstck_ops = {
-    .read = ox820_sysctrl_rstck_read,
-    .write = ox820_sysctrl_rstck_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-};
-
 static const VMStateDescription vmstate_ox820_sysctrl_rstck = {
     .name = "ox820-sysctrl-rstck",
-    .version_id = 1,
-    .minimum_version_id = 1,
-    .minimum_version_id_old = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .minimum_version_id_old = 2,
     .fields      = (VMStateField[]) {
-        VMSTATE_UINT32(cken_stat, ox820_sysctrl_rstck_state),
-        VMSTATE_UINT32(rsten_stat, ox820_sysctrl_rstck_state),
+        VMSTATE_OX820_REGFILE(regs, ox820_sysctrl_rstck_state),
         VMSTATE_END_OF_LIST()
     }
 };
@@ -122,8 +116,8 @@ static int ox820_sysctrl_rstck_init(SysBusDevice *dev)
     ox820_sysctrl_rstck_state *s = FROM_SYSBUS(ox820_sysctrl_rstck_state, dev);
     unsigned int n;
 
-    memory_region_init_io(&s->iomem, &ox820_sysctrl_rstck_ops, s, "ox820-sysctrl-rstck", 0x18);
-    sysbus_init_mmio(dev, &s->iomem);
+    ox820_regfile_init(&s->regs, ox820_sysctrl_rstck_regs, s, "ox820-sysctrl-rstck", 0x18);
+    sysbus_init_mmio(dev, &s->regs.iomem);
 
     for(n = 0; n < 32; ++n)
     {
@@ -135,8 +129,6 @@ static int ox820_sysctrl_rstck_init(SysBusDevice *dev)
         sysbus_init_irq(dev, &s->cken_out[n]);
     }
 
-    s->cken_stat = 0x10000;
-    s->rsten_stat = 0x8FFEFFF2;
     ox820_sysctrl_rstck_update(s);
 
     vmstate_register(&dev->qdev, -1, &vmstate_ox820_sysctrl_rstck, s);
@@ -7,92 +7,40 @@
  */
 
 #include "sysbus.h"
+#include "ox820_regs.h"
 
 typedef struct {
     SysBusDevice    busdev;
-    MemoryRegion    iomem;
-    uint32_t        scratchword[4];
+    OX820RegFile    regs;
 } ox820_sysctrl_scratchword_state;
 
-static uint64_t ox820_sysctrl_scratchword_read(void *opaque, target_phys_addr_t offset,
-                           unsigned size)
-{
-    ox820_sysctrl_scratchword_state *s = (ox820_sysctrl_scratchword_state *)opaque;
-    uint32_t c = 0;
-
-    offset -= s->iomem.addr;
-    switch (offset >> 2) {
-    case 0x0000 >> 2:
-        c = s->scratchword[0];
-        break;
-
-    case 0x0004 >> 2:
-        c = s->scratchword[1];
-        break;
-
-    case 0x0008 >> 2:
-        c = s->scratchword[2];
-        break;
-
-    case 0x000C >> 2:
-        c = s->scratchword[3];
-        break;
-
-    default:
-        return 0;
-    }
-    return c;
-}
-
-static void ox820_sysctrl_scratchword_write(void *opaque, target_phys_addr_t offset,
-                                uint64_t value, unsigned size)
-{
-    ox820_sysctrl_scratchword_state *s = (ox820_sysctrl_scratchword_state *)opaque;
-
-    offset -= s->iomem.addr;
-    switch(offset >> 2) {
-    case 0x0000 >> 2:
-        s->scratchword[0] = value;
-        break;
-
-    case 0x0004 >> 2:
-        s->scratchword[1] = value;
-        break;
-
-    case 0x0008 >> 2:
-        s->scratchword[2] = value;
-        break;
-
-    case 0x000C >> 2:
-        s->scratchword[3] = value;
-        break;
-
-    default:
-        break;
-    }
-}
+static const OX820RegInfo ox820_sysctrl_scratchword_regs[] = {
+    { .name = "scratchword0", .offset = 0x0000, .wmask = 0xFFFFFFFF },
+    { .name = "scratchword1", .offset = 0x0004, .wmask = 0xFFFFFFFF },
+    { .name = "scratchword2", .offset = 0x0008, .wmask = 0xFFFFFFFF },
+    { .name = "scratchword3", .offset = 0x000C, .wmask = 0xFFFFFFFF },
+    OX820_REG_END
+};
 
 static void ox820_sysctrl_scratchword_reset(DeviceState *d)
 {
     ox820_sysctrl_scratchword_state *s = DO_UPCAST(ox820_sysctrl_scratchword_state, busdev.qdev, d);
+    uint32_t scratchword2 = ox820_regfile_get(&s->regs, 0x0008);
+    uint32_t scratchword3 = ox820_regfile_get(&s->regs, 0x000C);
 
-    s->scratchword[0] = 0;
-    s->scratchword[1] = 0;
+    /* the upper two scratch words survive a reset */
+    ox820_regfile_reset(&s->regs);
+    ox820_regfile_set(&s->regs, 0x0008, scratchword2);
+    ox820_regfile_set(&s->regs, 0x000C, scratchword3);
 }
 
-static const MemoryRegionOps ox820_sysctrl_scratchword_ops = {
-    .read = ox820_sysctrl_scratchword_read,
-    .write = ox820_sysctrl_scratchword_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-};
-
 static const VMStateDescription vmstate_ox820_sysctrl_scratchword = {
     .name = "ox820-sysctrl-scratchword",
-    .version_id = 1,
-    .minimum_version_id = 1,
-    .minimum_version_id_old = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .minimum_version_id_old = 2,
     .fields      = (VMStateField[]) {
-        VMSTATE_UINT32_ARRAY(scratchword, ox820_sysctrl_scratchword_state, 4),
+        VMSTATE_OX820_REGFILE(regs, ox820_sysctrl_scratchword_state),
         VMSTATE_END_OF_LIST()
     }
 };
@@ -101,13 +49,8 @@ static int ox820_sysctrl_scratchword_init(SysBusDevice *dev)
 {
     ox820_sysctrl_scratchword_state *s = FROM_SYSBUS(ox820_sysctrl_scratchword_state, dev);
 
-    memory_region_init_io(&s->iomem, &ox820_sysctrl_scratchword_ops, s, "ox820-sysctrl-scratchword", 0x10);
-    sysbus_init_mmio(dev, &s->iomem);
-
-    s->scratchword[0] = 0;
-    s->scratchword[1] = 0;
-    s->scratchword[2] = 0;
-    s->scratchword[3] = 0;
+    ox820_regfile_init(&s->regs, ox820_sysctrl_scratchword_regs, s, "ox820-sysctrl-scratchword", 0x10);
+    sysbus_init_mmio(dev, &s->regs.iomem);
 
     vmstate_register(&dev->qdev, -1, &vmstate_ox820_sysctrl_scratchword, s);
     return 0;
@@ -7,15 +7,16 @@
  */
 
 #include "sysbus.h"
+#include "ox820_regs.h"
+
+#define SEMA_STAT       0x0000
+#define SEMA_MASKA_CTRL 0x000C
+#define SEMA_MASKB_CTRL 0x0010
+#define SEMA_MASKC_CTRL 0x0014
 
 typedef struct {
     SysBusDevice    busdev;
-    MemoryRegion    iomem;
-    uint32_t        sema_stat;
-    uint32_t        sema_maska_ctrl;
-    uint32_t        sema_maskb_ctrl;
-    uint32_t        sema_maskc_ctrl;
-
+    OX820RegFile    regs;
     qemu_irq        irq_sema_a;
     qemu_irq        irq_sema_b;
     qemu_irq        irq_sema_c;
@@ -23,104 +24,64 @@ typedef struct {
 
 static void ox820_sysctrl_sema_update(ox820_sysctrl_sema_state* s)
 {
-    qemu_set_irq(s->irq_sema_a, (s->sema_stat & s->sema_maska_ctrl) != 0);
-    qemu_set_irq(s->irq_sema_b, (s->sema_stat & s->sema_maskb_ctrl) != 0);
-    qemu_set_irq(s->irq_sema_c, (s->sema_stat & s->sema_maskc_ctrl) != 0);
+    uint32_t sema_stat = ox820_regfile_get(&s->regs, SEMA_STAT);
+
+    qemu_set_irq(s->irq_sema_a, (sema_stat & ox820_regfile_get(&s->regs, SEMA_MASKA_CTRL)) != 0);
+    qemu_set_irq(s->irq_sema_b, (sema_stat & ox820_regfile_get(&s->regs, SEMA_MASKB_CTRL)) != 0);
+    qemu_set_irq(s->irq_sema_c, (sema_stat & ox820_regfile_get(&s->regs, SEMA_MASKC_CTRL)) != 0);
 }
 
-static uint64_t ox820_sysctrl_sema_read(void *opaque, target_phys_addr_t offset,
-                           unsigned size)
+static void ox820_sysctrl_sema_set_write(void *opaque, uint32_t value)
 {
     ox820_sysctrl_sema_state *s = (ox820_sysctrl_sema_state *)opaque;
-    uint32_t c = 0;
-
-    offset -= s->iomem.addr;
-    switch (offset >> 2) {
-    case 0x0000 >> 2:
-        c = s->sema_stat;
-        break;
-
-    case 0x000C >> 2:
-        c = s->sema_maska_ctrl;
-        break;
 
-    case 0x0010 >> 2:
-        c = s->sema_maskb_ctrl;
-        break;
-
-    case 0x0014 >> 2:
-        c = s->sema_maskc_ctrl;
-        break;
-
-    default:
-        return 0;
-    }
-    return c;
+    ox820_regfile_set(&s->regs, SEMA_STAT,
+                      ox820_regfile_get(&s->regs, SEMA_STAT) | value);
 }
 
-static void ox820_sysctrl_sema_write(void *opaque, target_phys_addr_t offset,
-                                uint64_t value, unsigned size)
+static void ox820_sysctrl_sema_clr_write(void *opaque, uint32_t value)
 {
     ox820_sysctrl_sema_state *s = (ox820_sysctrl_sema_state *)opaque;
 
-    offset -= s->iomem.addr;
-    switch(offset >> 2) {
-    case 0x0004 >> 2:
-        s->sema_stat |= value;
-        break;
-
-    case 0x0008 >> 2:
-        s->sema_stat &= (~value);
-        break;
-
-    case 0x000C >> 2:
-        s->sema_maska_ctrl = value;
-        ox820_sysctrl_sema_update(s);
-        break;
-
-    case 0x0010 >> 2:
-        s->sema_maskb_ctrl = value;
-        ox820_sysctrl_sema_update(s);
-        break;
-
-    case 0x0014 >> 2:
-        s->sema_maskc_ctrl = value;
-        ox820_sysctrl_sema_update(s);
-        break;
-
-    default:
-        break;
-    }
+    ox820_regfile_set(&s->regs, SEMA_STAT,
+                      ox820_regfile_get(&s->regs, SEMA_STAT) & ~value);
 }
 
+static void ox820_sysctrl_sema_mask_write(void *opaque, uint32_t value)
+{
+    ox820_sysctrl_sema_update((ox820_sysctrl_sema_state *)opaque);
+}
+
+static const OX820RegInfo ox820_sysctrl_sema_regs[] = {
+    { .name = "sema_stat", .offset = SEMA_STAT },
+    { .name = "sema_set_ctrl", .offset = 0x0004,
+      .write = ox820_sysctrl_sema_set_write },
+    { .name = "sema_clr_ctrl", .offset = 0x0008,
+      .write = ox820_sysctrl_sema_clr_write },
+    { .name = "sema_maska_ctrl", .offset = SEMA_MASKA_CTRL, .wmask = 0xFFFFFFFF,
+      .write = ox820_sysctrl_sema_mask_write },
+    { .name = "sema_maskb_ctrl", .offset = SEMA_MASKB_CTRL, .wmask = 0xFFFFFFFF,
+      .write = ox820_sysctrl_sema_mask_write },
+    { .name = "sema_maskc_ctrl", .offset = SEMA_MASKC_CTRL, .wmask = 0xFFFFFFFF,
+      .write = ox820_sysctrl_sema_mask_write },
+    OX820_REG_END
+};
+
 static void ox820_sysctrl_sema_reset(DeviceState *d)
 {
     ox820_sysctrl_sema_state *s = DO_UPCAST(ox820_sysctrl_sema_state, busdev.qdev, d);
 
-    s->sema_stat = 0;
-    s->sema_maska_ctrl = 0;
-    s->sema_maskb_ctrl = 0;
-    s->sema_maskc_ctrl = 0;
-
+    ox820_regfile_reset(&s->regs);
     ox820_sysctrl_sema_update(s);
 }
 
-static const MemoryRegionOps ox820_sysctrl_sema_ops = {
-    .read = ox820_sysctrl_sema_read,
-    .write = ox820_sysctrl_sema_write,
-    .endianness = DEVICE_NATIVE_ENDIAN,
-};
-
 static const VMStateDescription vmstate_ox820_sysctrl_sema = {
     .name = "ox820-sysctrl-sema",
-    .version_id = 1,
-    .minimum_version_id = 1,
-    .minimum_version_id_old = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
+    .minimum_version_id_old = 2,
     .fields      = (VMStateField[]) {
-        VMSTATE_UINT32(sema_stat, ox820_sysctrl_sema_state),
-        VMSTATE_UINT32(sema_maska_ctrl, ox820_sysctrl_sema_state),
-        VMSTATE_UINT32(sema_maskb_ctrl, ox820_sysctrl_sema_state),
-        VMSTATE_UINT32(sema_maskc_ctrl, ox820_sysctrl_sema_state),
+        VMSTATE_OX820_REGFILE(regs, ox820_sysctrl_sema_state),
         VMSTATE_END_OF_LIST()
     }
 };
@@ -129,17 +90,12 @@ static int ox820_sysctrl_sema_init(SysBusDevice *dev)
 {
     ox820_sysctrl_sema_state *s = FROM_SYSBUS(ox820_sysctrl_sema_state, dev);
 
-    memory_region_init_io(&s->iomem, &ox820_sysctrl_sema_ops, s, "ox820-sysctrl-sema", 0x18);
-    sysbus_init_mmio(dev, &s->iomem);
+    ox820_regfile_init(&s->regs, ox820_sysctrl_sema_regs, s, "ox820-sysctrl-sema", 0x18);
+    sysbus_init_mmio(dev, &s->regs.iomem);
     sysbus_init_irq(dev, &s->irq_sema_a);
     sysbus_init_irq(dev, &s->irq_sema_b);
     sysbus_init_irq(dev, &s->irq_sema_c);
 
-    s->sema_stat = 0;
-    s->sema_maska_ctrl = 0;
-    s->sema_maskb_ctrl = 0;
-    s->sema_maskc_ctrl = 0;
-
     vmstate_register(&dev->qdev, -1, &vmstate_ox820_sysctrl_sema, s);
     return 0;
 }
@@ -166,7 +166,7 @@ static void sigchld_bh_handler(void *opaque)
 static void qemu_init_child_watch(void)
 {
     struct sigaction act;
-    sigchld_bh = qemu_bh_new(sigchld_bh_handler, NULL);
+    sigchld_bh = qemu_bh_new_io(sigchld_bh_handler, NULL);
 
     act.sa_handler = sigchld_handler;
     act.sa_flags = SA_NOCLDSTOP;
@@ -25,6 +25,9 @@
  */
 #define MAX_EVENTS 128
 
+/* Requests queued while plugged, submitted with a single io_submit() */
+#define MAX_QUEUED_IO  128
+
 struct qemu_laiocb {
     BlockDriverAIOCB common;
     struct qemu_laio_state *ctx;
@@ -36,10 +39,19 @@ struct qemu_laiocb {
     QLIST_ENTRY(qemu_laiocb) node;
 };
 
+typedef struct {
+    struct iocb *iocbs[MAX_QUEUED_IO];
+    int plugged;
+    unsigned int idx;
+} LaioQueue;
+
 struct qemu_laio_state {
     io_context_t ctx;
     int efd;
     int count;
+
+    /* io queue for submit at batch */
+    LaioQueue io_q;
 };
 
 static inline ssize_t io_event_ret(struct io_event *ev)
@@ -80,26 +92,29 @@ static void qemu_laio_process_completion(struct qemu_laio_state *s,
 static void qemu_laio_completion_cb(void *opaque)
 {
     struct qemu_laio_state *s = opaque;
+    struct io_event events[MAX_EVENTS];
+    struct timespec ts = { 0 };
+    uint64_t val;
+    ssize_t ret;
+    int nevents, i;
 
-    while (1) {
-        struct io_event events[MAX_EVENTS];
-        uint64_t val;
-        ssize_t ret;
-        struct timespec ts = { 0 };
-        int nevents, i;
-
-        do {
-            ret = read(s->efd, &val, sizeof(val));
-        } while (ret == -1 && errno == EINTR);
-
-        if (ret == -1 && errno == EAGAIN)
-            break;
+    do {
+        ret = read(s->efd, &val, sizeof(val));
+    } while (ret == -1 && errno == EINTR);
 
-        if (ret != 8)
-            break;
+    if (ret != 8) {
+        return;
+    }
 
+    /*
+     * The eventfd has been reset, so reap everything that is ready now
+     * instead of going back to it for every MAX_EVENTS batch.  Requests
+     * that complete meanwhile are picked up here as well; the eventfd
+     * wakeup they cause then simply finds nothing to do.
+     */
+    do {
         do {
-            nevents = io_getevents(s->ctx, val, MAX_EVENTS, events, &ts);
+            nevents = io_getevents(s->ctx, 0, MAX_EVENTS, events, &ts);
         } while (nevents == -EINTR);
 
         for (i = 0; i < nevents; i++) {
@@ -110,6 +125,86 @@ static void qemu_laio_completion_cb(void *opaque)
             laiocb->ret = io_event_ret(&events[i]);
             qemu_laio_process_completion(s, laiocb);
         }
+    } while (nevents == MAX_EVENTS);
+}
+
+static void ioq_init(LaioQueue *io_q)
+{
+    io_q->plugged = 0;
+    io_q->idx = 0;
+}
+
+/*
+ * Submits all queued requests with one io_submit().  Requests that the
+ * kernel did not take are completed with an error.
+ */
+static int ioq_submit(struct qemu_laio_state *s)
+{
+    int ret, i;
+    int len = s->io_q.idx;
+
+    if (!len) {
+        return 0;
+    }
+
+    i = 0;
+    do {
+        ret = io_submit(s->ctx, len, s->io_q.iocbs);
+    } while ((ret == -EINTR || ret == -EAGAIN) && i++ < 3);
+
+    /* empty io queue */
+    s->io_q.idx = 0;
+
+    for (i = MAX(ret, 0); i < len; i++) {
+        struct qemu_laiocb *laiocb =
+            container_of(s->io_q.iocbs[i], struct qemu_laiocb, iocb);
+
+        laiocb->ret = (ret < 0) ? ret : -EIO;
+        qemu_laio_process_completion(s, laiocb);
+    }
+    return ret;
+}
+
+static void ioq_enqueue(struct qemu_laio_state *s, struct iocb *iocb)
+{
+    /* Submit the earlier requests first so that a failure never completes
+     * this one before laio_submit() has returned it to the caller.  */
+    if (s->io_q.idx == MAX_QUEUED_IO) {
+        ioq_submit(s);
+    }
+    s->io_q.iocbs[s->io_q.idx++] = iocb;
+}
+
+/* Drops a request from the plug queue.  Returns false if it isn't there.  */
+static bool ioq_remove(struct qemu_laio_state *s, struct iocb *iocb)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->io_q.idx; i++) {
+        if (s->io_q.iocbs[i] == iocb) {
+            memmove(&s->io_q.iocbs[i], &s->io_q.iocbs[i + 1],
+                    (s->io_q.idx - i - 1) * sizeof(s->io_q.iocbs[0]));
+            s->io_q.idx--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void laio_io_plug(BlockDriverState *bs, void *aio_ctx)
+{
+    struct qemu_laio_state *s = aio_ctx;
+
+    s->io_q.plugged++;
+}
+
+void laio_io_unplug(BlockDriverState *bs, void *aio_ctx)
+{
+    struct qemu_laio_state *s = aio_ctx;
+
+    assert(s->io_q.plugged > 0);
+    if (--s->io_q.plugged == 0) {
+        ioq_submit(s);
     }
 }
 
@@ -117,6 +212,9 @@ static int qemu_laio_flush_cb(void *opaque)
 {
     struct qemu_laio_state *s = opaque;
 
+    /* Whoever waits for the requests wants them to make progress */
+    ioq_submit(s);
+
     return (s->count > 0) ? 1 : 0;
 }
 
@@ -129,6 +227,13 @@ static void laio_cancel(BlockDriverAIOCB *blockacb)
     if (laiocb->ret != -EINPROGRESS)
         return;
 
+    /* A request still sitting in the plug queue is not known to the kernel */
+    if (ioq_remove(laiocb->ctx, &laiocb->iocb)) {
+        laiocb->ctx->count--;
+        qemu_aio_release(laiocb);
+        return;
+    }
+
     /*
      * Note that as of Linux 2.6.31 neither the block device code nor any
      * filesystem implements cancellation of AIO request.
@@ -190,8 +295,11 @@ BlockDriverAIOCB *laio_submit(BlockDriverState *bs, void *aio_ctx, int fd,
     io_set_eventfd(&laiocb->iocb, s->efd);
     s->count++;
 
-    if (io_submit(s->ctx, 1, &iocbs) < 0)
+    if (s->io_q.plugged) {
+        ioq_enqueue(s, iocbs);
+    } else if (io_submit(s->ctx, 1, &iocbs) < 0) {
         goto out_dec_count;
+    }
     return &laiocb->common;
 
 out_dec_count:
@@ -214,6 +322,8 @@ void *laio_init(void)
     if (io_setup(MAX_EVENTS, &s->ctx) != 0)
         goto out_close_efd;
 
+    ioq_init(&s->io_q);
+
     qemu_aio_set_fd_handler(s->efd, qemu_laio_completion_cb, NULL,
         qemu_laio_flush_cb, NULL, s);
 
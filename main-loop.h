@@ -270,6 +270,16 @@ typedef void QEMUBHFunc(void *opaque);
  */
 QEMUBH *qemu_bh_new(QEMUBHFunc *cb, void *opaque);
 
+/**
+ * qemu_bh_new_io: Allocate a new bottom half for host-side work.
+ *
+ * Like qemu_bh_new, but for bottom halves that only drive host resources
+ * (for example the internals of the block layer) and never touch guest
+ * state directly.  Under record/replay, other bottom halves only run at
+ * checkpoints in the vCPU thread; these keep running in the main loop.
+ */
+QEMUBH *qemu_bh_new_io(QEMUBHFunc *cb, void *opaque);
+
 /**
  * qemu_bh_schedule: Schedule a bottom half.
  *
@@ -364,6 +374,7 @@ void qemu_iohandler_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds, int rc
 
 void qemu_bh_schedule_idle(QEMUBH *bh);
 int qemu_bh_poll(void);
+int qemu_bh_poll_guest(void);
 void qemu_bh_update_timeout(int *timeout);
 
 #endif
@@ -172,6 +172,7 @@ struct AddressSpaceOps {
     void (*log_stop)(AddressSpace *as, FlatRange *fr);
     void (*ioeventfd_add)(AddressSpace *as, MemoryRegionIoeventfd *fd);
     void (*ioeventfd_del)(AddressSpace *as, MemoryRegionIoeventfd *fd);
+    void (*commit)(AddressSpace *as);
 };
 
 #define FOR_EACH_FLAT_RANGE(var, view)          \
@@ -361,6 +362,11 @@ static void as_memory_ioeventfd_del(AddressSpace *as, MemoryRegionIoeventfd *fd)
     }
 }
 
+static void as_memory_commit(AddressSpace *as)
+{
+    cpu_register_physical_memory_commit();
+}
+
 static const AddressSpaceOps address_space_ops_memory = {
     .range_add = as_memory_range_add,
     .range_del = as_memory_range_del,
@@ -368,6 +374,7 @@ static const AddressSpaceOps address_space_ops_memory = {
     .log_stop = as_memory_log_stop,
     .ioeventfd_add = as_memory_ioeventfd_add,
     .ioeventfd_del = as_memory_ioeventfd_del,
+    .commit = as_memory_commit,
 };
 
 static AddressSpace address_space_memory = {
@@ -781,6 +788,9 @@ static void address_space_update_topology(AddressSpace *as)
     as->current_map = new_view;
     flatview_destroy(&old_view);
     address_space_update_ioeventfds(as);
+    if (as->ops->commit) {
+        as->ops->commit(as);
+    }
 }
 
 static void memory_region_update_topology(MemoryRegion *mr)
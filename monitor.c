@@ -776,6 +776,11 @@ static void do_info_jit(Monitor *mon)
     dump_exec_info((FILE *)mon, monitor_fprintf);
 }
 
+static void do_info_jit_regions(Monitor *mon)
+{
+    dump_code_regions((FILE *)mon, monitor_fprintf);
+}
+
 static void do_info_history(Monitor *mon)
 {
     int i;
@@ -2414,6 +2419,27 @@ static mon_cmd_t info_cmds[] = {
         .help       = "show dynamic compiler info",
         .mhandler.info = do_info_jit,
     },
+    {
+        .name       = "jit-regions",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the regions of the translated code buffer",
+        .mhandler.info = do_info_jit_regions,
+    },
+    {
+        .name       = "icount",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show instruction counting statistics",
+        .mhandler.info = hmp_info_icount,
+    },
+    {
+        .name       = "tcg-profile",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the hottest translated code",
+        .mhandler.info = hmp_info_tcg_profile,
+    },
     {
         .name       = "kvm",
         .args_type  = "",
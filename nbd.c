@@ -564,10 +564,10 @@ int nbd_receive_reply(int csock, struct nbd_reply *reply)
     return 0;
 }
 
-static int nbd_send_reply(int csock, struct nbd_reply *reply)
-{
-    uint8_t buf[4 + 4 + 8];
+#define NBD_REPLY_SIZE (4 + 4 + 8)
 
+static void nbd_encode_reply(uint8_t *buf, struct nbd_reply *reply)
+{
     /* Reply
        [ 0 ..  3]    magic   (NBD_REPLY_MAGIC)
        [ 4 ..  7]    error   (0 == no error)
@@ -576,15 +576,6 @@ static int nbd_send_reply(int csock, struct nbd_reply *reply)
     cpu_to_be32w((uint32_t*)buf, NBD_REPLY_MAGIC);
     cpu_to_be32w((uint32_t*)(buf + 4), reply->error);
     cpu_to_be64w((uint64_t*)(buf + 8), reply->handle);
-
-    TRACE("Sending response to client");
-
-    if (write_sync(csock, buf, sizeof(buf)) != sizeof(buf)) {
-        LOG("writing to socket failed");
-        errno = EINVAL;
-        return -1;
-    }
-    return 0;
 }
 
 #define MAX_NBD_REQUESTS 16
@@ -707,32 +698,30 @@ static int nbd_co_send_reply(NBDRequest *req, struct nbd_reply *reply,
 {
     NBDClient *client = req->client;
     int csock = client->sock;
-    int rc, ret;
+    uint8_t buf[NBD_REPLY_SIZE];
+    struct iovec iov[2];
+    int rc;
 
     qemu_co_mutex_lock(&client->send_lock);
     qemu_set_fd_handler2(csock, nbd_can_read, nbd_read,
                          nbd_restart_write, client);
     client->send_coroutine = qemu_coroutine_self();
 
-    if (!len) {
-        rc = nbd_send_reply(csock, reply);
-        if (rc == -1) {
-            rc = -errno;
-        }
-    } else {
-        socket_set_cork(csock, 1);
-        rc = nbd_send_reply(csock, reply);
-        if (rc != -1) {
-            ret = qemu_co_send(csock, req->data, len);
-            if (ret != len) {
-                errno = EIO;
-                rc = -1;
-            }
-        }
-        if (rc == -1) {
-            rc = -errno;
-        }
-        socket_set_cork(csock, 0);
+    /* The header and the data that the block layer read into req->data go
+     * out with a single sendmsg, without corking or copying them together.
+     */
+    nbd_encode_reply(buf, reply);
+    iov[0].iov_base = buf;
+    iov[0].iov_len = sizeof(buf);
+    iov[1].iov_base = req->data;
+    iov[1].iov_len = len;
+
+    TRACE("Sending response to client");
+
+    rc = 0;
+    if (qemu_co_sendv(csock, iov, sizeof(buf) + len, 0) != sizeof(buf) + len) {
+        LOG("writing to socket failed");
+        rc = -EIO;
     }
 
     client->send_coroutine = NULL;
@@ -792,6 +781,8 @@ static void nbd_trip(void *opaque)
     NBDExport *exp = client->exp;
     struct nbd_request request;
     struct nbd_reply reply;
+    struct iovec iov;
+    QEMUIOVector qiov;
     int ret;
 
     TRACE("Reading request.");
@@ -803,6 +794,8 @@ static void nbd_trip(void *opaque)
 
     reply.handle = request.handle;
     reply.error = 0;
+    iov.iov_base = req->data;
+    iov.iov_len = request.len & ~(BDRV_SECTOR_SIZE - 1);
 
     if (ret < 0) {
         reply.error = -ret;
@@ -822,8 +815,9 @@ static void nbd_trip(void *opaque)
     case NBD_CMD_READ:
         TRACE("Request type is READ");
 
-        ret = bdrv_read(exp->bs, (request.from + exp->dev_offset) / 512,
-                        req->data, request.len / 512);
+        qemu_iovec_init_external(&qiov, &iov, 1);
+        ret = bdrv_co_readv(exp->bs, (request.from + exp->dev_offset) / 512,
+                            request.len / 512, &qiov);
         if (ret < 0) {
             LOG("reading from file failed");
             reply.error = -ret;
@@ -845,8 +839,9 @@ static void nbd_trip(void *opaque)
 
         TRACE("Writing to device");
 
-        ret = bdrv_write(exp->bs, (request.from + exp->dev_offset) / 512,
-                         req->data, request.len / 512);
+        qemu_iovec_init_external(&qiov, &iov, 1);
+        ret = bdrv_co_writev(exp->bs, (request.from + exp->dev_offset) / 512,
+                             request.len / 512, &qiov);
         if (ret < 0) {
             LOG("writing to file failed");
             reply.error = -ret;
@@ -37,6 +37,7 @@
 #include "qmp-commands.h"
 #include "hw/qdev.h"
 #include "iov.h"
+#include "replay.h"
 
 /* Net bridge is currently not supported for W32. */
 #if !defined(_WIN32)
@@ -226,6 +227,7 @@ VLANClientState *qemu_new_net_client(NetClientInfo *info,
                                             qemu_deliver_packet_iov,
                                             vc);
     }
+    replay_register_net(vc);
 
     return vc;
 }
@@ -266,6 +268,7 @@ static void qemu_cleanup_vlan_client(VLANClientState *vc)
 
 static void qemu_free_vlan_client(VLANClientState *vc)
 {
+    replay_unregister_net(vc);
     if (!vc->vlan) {
         if (vc->send_queue) {
             qemu_del_net_queue(vc->send_queue);
@@ -388,6 +391,15 @@ int qemu_can_send_packet(VLANClientState *sender)
     return 1;
 }
 
+static void qemu_receive_done(VLANClientState *vc, unsigned flags,
+                              ssize_t ret)
+{
+    if (vc->info->receive_batch_end &&
+        (ret == 0 || !(flags & QEMU_NET_PACKET_FLAG_MORE))) {
+        vc->info->receive_batch_end(vc);
+    }
+}
+
 static ssize_t qemu_deliver_packet(VLANClientState *sender,
                                    unsigned flags,
                                    const uint8_t *data,
@@ -414,6 +426,7 @@ static ssize_t qemu_deliver_packet(VLANClientState *sender,
     if (ret == 0) {
         vc->receive_disabled = 1;
     };
+    qemu_receive_done(vc, flags, ret);
 
     return ret;
 }
@@ -454,6 +467,7 @@ static ssize_t qemu_vlan_deliver_packet(VLANClientState *sender,
         if (len == 0) {
             vc->receive_disabled = 1;
         }
+        qemu_receive_done(vc, flags, len);
 
         ret = (ret >= 0) ? ret : len;
 
@@ -510,6 +524,16 @@ static ssize_t qemu_send_packet_async_with_flags(VLANClientState *sender,
         return size;
     }
 
+    if (replay_mode != REPLAY_MODE_NONE) {
+        struct iovec iov = {
+            .iov_base = (void *)buf,
+            .iov_len = size,
+        };
+        if (replay_net_send(sender, flags, &iov, 1)) {
+            return size;
+        }
+    }
+
     if (sender->peer) {
         queue = sender->peer->send_queue;
     } else {
@@ -538,6 +562,41 @@ ssize_t qemu_send_packet_raw(VLANClientState *vc, const uint8_t *buf, int size)
                                              buf, size, NULL);
 }
 
+/* Sends @count packets, one per element of @pkts, as a batch.  Returns 0 if
+ * some of them were queued, in which case the sender must not send anything
+ * else until @sent_cb is called.
+ */
+ssize_t qemu_send_packets_async(VLANClientState *sender,
+                                const struct iovec *pkts, int count,
+                                NetPacketSent *sent_cb)
+{
+    NetQueue *queue;
+    ssize_t ret = 0;
+    int i;
+
+    if (sender->link_down || (!sender->peer && !sender->vlan)) {
+        return iov_size(pkts, count);
+    }
+
+    /* Playback injects packets one at a time, so record them that way */
+    if (replay_mode != REPLAY_MODE_NONE) {
+        for (i = 0; i < count; i++) {
+            ret = qemu_send_packet_async(sender, pkts[i].iov_base,
+                                         pkts[i].iov_len, sent_cb);
+        }
+        return ret;
+    }
+
+    if (sender->peer) {
+        queue = sender->peer->send_queue;
+    } else {
+        queue = sender->vlan->send_queue;
+    }
+
+    return qemu_net_queue_send_batch(queue, sender, QEMU_NET_PACKET_FLAG_NONE,
+                                     pkts, count, sent_cb);
+}
+
 static ssize_t vc_sendv_compat(VLANClientState *vc, const struct iovec *iov,
                                int iovcnt)
 {
@@ -556,16 +615,20 @@ static ssize_t qemu_deliver_packet_iov(VLANClientState *sender,
                                        void *opaque)
 {
     VLANClientState *vc = opaque;
+    ssize_t ret;
 
     if (vc->link_down) {
         return iov_size(iov, iovcnt);
     }
 
     if (vc->info->receive_iov) {
-        return vc->info->receive_iov(vc, iov, iovcnt);
+        ret = vc->info->receive_iov(vc, iov, iovcnt);
     } else {
-        return vc_sendv_compat(vc, iov, iovcnt);
+        ret = vc_sendv_compat(vc, iov, iovcnt);
     }
+    qemu_receive_done(vc, flags, ret);
+
+    return ret;
 }
 
 static ssize_t qemu_vlan_deliver_packet_iov(VLANClientState *sender,
@@ -597,6 +660,7 @@ static ssize_t qemu_vlan_deliver_packet_iov(VLANClientState *sender,
         } else {
             len = vc_sendv_compat(vc, iov, iovcnt);
         }
+        qemu_receive_done(vc, flags, len);
 
         ret = (ret >= 0) ? ret : len;
     }
@@ -614,6 +678,11 @@ ssize_t qemu_sendv_packet_async(VLANClientState *sender,
         return iov_size(iov, iovcnt);
     }
 
+    if (replay_mode != REPLAY_MODE_NONE &&
+        replay_net_send(sender, QEMU_NET_PACKET_FLAG_NONE, iov, iovcnt)) {
+        return iov_size(iov, iovcnt);
+    }
+
     if (sender->peer) {
         queue = sender->peer->send_queue;
     } else {
@@ -23,6 +23,7 @@
 
 #include "net/queue.h"
 #include "qemu-queue.h"
+#include "iov.h"
 
 /* The delivery handler may only return zero if it will call
  * qemu_net_queue_flush() when it determines that it is once again able
@@ -36,6 +37,12 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * Packets sent with send_batch() are delivered with
+ * QEMU_NET_PACKET_FLAG_MORE set on all but the last one, so that the
+ * receiver can complete the whole batch at once (e.g. with a single
+ * interrupt).  Queued packets from the same sender are flushed the
+ * same way.
  */
 
 struct NetPacket {
@@ -220,6 +227,47 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+/* Returns 0 if the receiver could not take the whole batch; the rest of it
+ * is queued and @sent_cb is invoked once its last packet was delivered.
+ */
+ssize_t qemu_net_queue_send_batch(NetQueue *queue,
+                                  VLANClientState *sender,
+                                  unsigned flags,
+                                  const struct iovec *pkts,
+                                  int count,
+                                  NetPacketSent *sent_cb)
+{
+    ssize_t ret;
+    int i;
+
+    if (queue->delivering) {
+        for (i = 0; i < count; i++) {
+            qemu_net_queue_append(queue, sender, flags, pkts[i].iov_base,
+                                  pkts[i].iov_len, NULL);
+        }
+        return iov_size(pkts, count);
+    }
+
+    for (i = 0; i < count; i++) {
+        ret = qemu_net_queue_deliver(queue, sender,
+                                     i < count - 1 ?
+                                     flags | QEMU_NET_PACKET_FLAG_MORE : flags,
+                                     pkts[i].iov_base, pkts[i].iov_len);
+        if (ret == 0) {
+            for (; i < count; i++) {
+                qemu_net_queue_append(queue, sender, flags, pkts[i].iov_base,
+                                      pkts[i].iov_len,
+                                      i == count - 1 ? sent_cb : NULL);
+            }
+            return 0;
+        }
+    }
+
+    qemu_net_queue_flush(queue);
+
+    return iov_size(pkts, count);
+}
+
 void qemu_net_queue_purge(NetQueue *queue, VLANClientState *from)
 {
     NetPacket *packet, *next;
@@ -235,15 +283,22 @@ void qemu_net_queue_purge(NetQueue *queue, VLANClientState *from)
 void qemu_net_queue_flush(NetQueue *queue)
 {
     while (!QTAILQ_EMPTY(&queue->packets)) {
-        NetPacket *packet;
+        NetPacket *packet, *next;
+        unsigned flags;
         int ret;
 
         packet = QTAILQ_FIRST(&queue->packets);
         QTAILQ_REMOVE(&queue->packets, packet, entry);
 
+        flags = packet->flags;
+        next = QTAILQ_FIRST(&queue->packets);
+        if (next && next->sender == packet->sender) {
+            flags |= QEMU_NET_PACKET_FLAG_MORE;
+        }
+
         ret = qemu_net_queue_deliver(queue,
                                      packet->sender,
-                                     packet->flags,
+                                     flags,
                                      packet->data,
                                      packet->size);
         if (ret == 0) {
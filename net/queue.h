@@ -45,6 +45,7 @@ typedef ssize_t (NetPacketDeliverIOV) (VLANClientState *sender,
 
 #define QEMU_NET_PACKET_FLAG_NONE  0
 #define QEMU_NET_PACKET_FLAG_RAW  (1<<0)
+#define QEMU_NET_PACKET_FLAG_MORE (1<<1) /* more packets of a batch follow */
 
 NetQueue *qemu_new_net_queue(NetPacketDeliver *deliver,
                              NetPacketDeliverIOV *deliver_iov,
@@ -65,6 +66,13 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 int iovcnt,
                                 NetPacketSent *sent_cb);
 
+ssize_t qemu_net_queue_send_batch(NetQueue *queue,
+                                  VLANClientState *sender,
+                                  unsigned flags,
+                                  const struct iovec *pkts,
+                                  int count,
+                                  NetPacketSent *sent_cb);
+
 void qemu_net_queue_purge(NetQueue *queue, VLANClientState *from);
 void qemu_net_queue_flush(NetQueue *queue);
 
@@ -48,12 +48,15 @@
  */
 #define TAP_BUFSIZE (4096 + 65536)
 
+/* Maximum number of packets read from the tap fd and passed on as a batch */
+#define TAP_BATCH 8
+
 typedef struct TAPState {
     VLANClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[TAP_BUFSIZE];
+    uint8_t buf[TAP_BATCH][TAP_BUFSIZE];
     unsigned int read_poll : 1;
     unsigned int write_poll : 1;
     unsigned int using_vnet_hdr : 1;
@@ -191,26 +194,39 @@ static void tap_send_completed(VLANClientState *nc, ssize_t len)
 static void tap_send(void *opaque)
 {
     TAPState *s = opaque;
-    int size;
+    struct iovec pkts[TAP_BATCH];
+    int count;
 
     do {
-        uint8_t *buf = s->buf;
+        /* Drain what is there, up to a batch, then hand it over at once */
+        for (count = 0; count < TAP_BATCH; count++) {
+            uint8_t *buf = s->buf[count];
+            int size;
+
+            size = tap_read_packet(s->fd, buf, TAP_BUFSIZE);
+            if (size <= 0) {
+                break;
+            }
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
-        if (size <= 0) {
-            break;
+            if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+                buf  += s->host_vnet_hdr_len;
+                size -= s->host_vnet_hdr_len;
+            }
+
+            pkts[count].iov_base = buf;
+            pkts[count].iov_len  = size;
         }
 
-        if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
-            buf  += s->host_vnet_hdr_len;
-            size -= s->host_vnet_hdr_len;
+        if (count == 0) {
+            break;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
+        if (qemu_send_packets_async(&s->nc, pkts, count,
+                                    tap_send_completed) == 0) {
             tap_read_poll(s, 0);
+            break;
         }
-    } while (size > 0 && qemu_can_send_packet(&s->nc));
+    } while (count == TAP_BATCH && qemu_can_send_packet(&s->nc));
 }
 
 int tap_has_ufo(VLANClientState *nc)
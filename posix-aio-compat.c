@@ -27,6 +27,7 @@
 #include "osdep.h"
 #include "sysemu.h"
 #include "qemu-common.h"
+#include "qemu-timer.h"
 #include "trace.h"
 #include "block_int.h"
 
@@ -34,6 +35,11 @@
 
 static void do_spawn_thread(void);
 
+/* At most this many adjacent requests are merged into one preadv/pwritev */
+#define PAIO_MAX_MERGE 32
+
+typedef struct PaioQueue PaioQueue;
+
 struct qemu_paiocb {
     BlockDriverAIOCB common;
     int aio_fildes;
@@ -51,6 +57,26 @@ struct qemu_paiocb {
     ssize_t ret;
     int active;
     struct qemu_paiocb *next;
+
+    PaioQueue *queue;
+    int64_t submit_time;
+    /* requests that a worker handles together with this one */
+    struct qemu_paiocb *merge_next;
+};
+
+/*
+ * The requests of one drive.  Workers take requests from the queues in
+ * round-robin order, so that a drive with a deep queue doesn't starve the
+ * others.  A queue is on active_queues while it has requests.
+ */
+struct PaioQueue {
+    QTAILQ_HEAD(, qemu_paiocb) requests;
+    QTAILQ_ENTRY(PaioQueue) next;
+    int in_flight;
+    bool deleted;
+
+    uint64_t depth_hist[BDRV_QUEUE_DEPTH_BUCKETS];
+    uint64_t latency_hist[BDRV_LATENCY_BUCKETS];
 };
 
 typedef struct PosixAioState {
@@ -69,7 +95,11 @@ static int idle_threads = 0;
 static int new_threads = 0;     /* backlog of threads we need to create */
 static int pending_threads = 0; /* threads created but not running yet */
 static QEMUBH *new_thread_bh;
-static QTAILQ_HEAD(, qemu_paiocb) request_list;
+static QTAILQ_HEAD(, PaioQueue) active_queues;
+#ifdef CONFIG_LINUX
+static cpu_set_t thread_cpus;
+static bool thread_cpus_set;
+#endif
 
 #ifdef CONFIG_PREADV
 static int preadv_present = 1;
@@ -309,6 +339,175 @@ static ssize_t handle_aiocb_rw(struct qemu_paiocb *aiocb)
     return nbytes;
 }
 
+/*
+ * Reads/writes a chain of adjacent requests with a single preadv/pwritev.
+ * Returns false if that did not transfer everything; the requests must
+ * then be handled one by one.
+ */
+static bool handle_aiocb_merged(struct qemu_paiocb *aiocb)
+{
+    struct qemu_paiocb *acb;
+    struct iovec *iov;
+    size_t nbytes = 0;
+    ssize_t len;
+    int niov = 0;
+
+    for (acb = aiocb; acb; acb = acb->merge_next) {
+        niov += acb->aio_niov;
+    }
+    iov = g_new(struct iovec, niov);
+    niov = 0;
+    for (acb = aiocb; acb; acb = acb->merge_next) {
+        memcpy(&iov[niov], acb->aio_iov, acb->aio_niov * sizeof(*iov));
+        niov += acb->aio_niov;
+        nbytes += acb->aio_nbytes;
+    }
+
+    do {
+        if (aiocb->aio_type & QEMU_AIO_WRITE) {
+            len = qemu_pwritev(aiocb->aio_fildes, iov, niov,
+                               aiocb->aio_offset);
+        } else {
+            len = qemu_preadv(aiocb->aio_fildes, iov, niov,
+                              aiocb->aio_offset);
+        }
+    } while (len == -1 && errno == EINTR);
+
+    g_free(iov);
+    return len == nbytes;
+}
+
+static ssize_t handle_aiocb(struct qemu_paiocb *aiocb)
+{
+    ssize_t ret;
+
+    switch (aiocb->aio_type & QEMU_AIO_TYPE_MASK) {
+    case QEMU_AIO_READ:
+        ret = handle_aiocb_rw(aiocb);
+        if (ret >= 0 && ret < aiocb->aio_nbytes && aiocb->common.bs->growable) {
+            /* A short read means that we have reached EOF. Pad the buffer
+             * with zeros for bytes after EOF. */
+            QEMUIOVector qiov;
+
+            qemu_iovec_init_external(&qiov, aiocb->aio_iov,
+                                     aiocb->aio_niov);
+            qemu_iovec_memset_skip(&qiov, 0, aiocb->aio_nbytes - ret, ret);
+
+            ret = aiocb->aio_nbytes;
+        }
+        break;
+    case QEMU_AIO_WRITE:
+        ret = handle_aiocb_rw(aiocb);
+        break;
+    case QEMU_AIO_FLUSH:
+        ret = handle_aiocb_flush(aiocb);
+        break;
+    case QEMU_AIO_IOCTL:
+        ret = handle_aiocb_ioctl(aiocb);
+        break;
+    default:
+        fprintf(stderr, "invalid aio request (0x%x)\n", aiocb->aio_type);
+        ret = -EINVAL;
+        break;
+    }
+
+    return ret;
+}
+
+/* Index of the histogram bucket for value; bucket i counts values up to 2^i */
+static int paio_hist_bucket(int64_t value, int nb_buckets)
+{
+    int i = 0;
+
+    while (i < nb_buckets - 1 && value > (1LL << i)) {
+        i++;
+    }
+    return i;
+}
+
+/* Takes a request off its queue.  Called with lock held.  */
+static void paio_queue_remove(struct qemu_paiocb *aiocb)
+{
+    PaioQueue *q = aiocb->queue;
+
+    QTAILQ_REMOVE(&q->requests, aiocb, node);
+    if (QTAILQ_EMPTY(&q->requests)) {
+        QTAILQ_REMOVE(&active_queues, q, next);
+    }
+    aiocb->active = 1;
+    aiocb->merge_next = NULL;
+}
+
+/* Called with lock held.  */
+static void paio_queue_put(PaioQueue *q)
+{
+    if (--q->in_flight == 0 && q->deleted) {
+        g_free(q);
+    }
+}
+
+/*
+ * Picks the next request for a worker and, for reads and writes, the
+ * requests queued for the sectors right behind it.  Called with lock held.
+ */
+static struct qemu_paiocb *paio_dequeue(void)
+{
+    PaioQueue *q = QTAILQ_FIRST(&active_queues);
+    struct qemu_paiocb *aiocb, *last, *acb;
+    off_t end;
+    int niov, nb;
+
+    aiocb = QTAILQ_FIRST(&q->requests);
+    paio_queue_remove(aiocb);
+
+    /* let the other drives have their turn first */
+    if (!QTAILQ_EMPTY(&q->requests)) {
+        QTAILQ_REMOVE(&active_queues, q, next);
+        QTAILQ_INSERT_TAIL(&active_queues, q, next);
+    }
+
+    if ((aiocb->aio_type != QEMU_AIO_READ &&
+         aiocb->aio_type != QEMU_AIO_WRITE) || !preadv_present) {
+        return aiocb;
+    }
+
+    last = aiocb;
+    end = aiocb->aio_offset + aiocb->aio_nbytes;
+    niov = aiocb->aio_niov;
+    nb = 1;
+retry:
+    if (nb == PAIO_MAX_MERGE) {
+        return aiocb;
+    }
+    QTAILQ_FOREACH(acb, &q->requests, node) {
+        if (acb->aio_type == aiocb->aio_type &&
+            acb->aio_fildes == aiocb->aio_fildes &&
+            acb->aio_offset == end &&
+            niov + acb->aio_niov <= IOV_MAX) {
+            paio_queue_remove(acb);
+            last->merge_next = acb;
+            last = acb;
+            end += acb->aio_nbytes;
+            niov += acb->aio_niov;
+            nb++;
+            goto retry;
+        }
+    }
+
+    return aiocb;
+}
+
+/* Called with lock held.  */
+static void paio_complete(struct qemu_paiocb *aiocb, ssize_t ret)
+{
+    PaioQueue *q = aiocb->queue;
+    int64_t us = (get_clock() - aiocb->submit_time) / 1000;
+
+    q->latency_hist[paio_hist_bucket(us, BDRV_LATENCY_BUCKETS)]++;
+    paio_queue_put(q);
+    aiocb->ret = ret;
+}
+
 static void posix_aio_notify_event(void);
 
 static void *aio_thread(void *unused)
@@ -318,11 +517,19 @@ static void *aio_thread(void *unused)
     mutex_unlock(&lock);
     do_spawn_thread();
 
+#ifdef CONFIG_LINUX
+    if (thread_cpus_set) {
+        pthread_setaffinity_np(pthread_self(), sizeof(thread_cpus),
+                               &thread_cpus);
+    }
+#endif
+
     while (1) {
-        struct qemu_paiocb *aiocb;
+        struct qemu_paiocb *aiocb, *acb, *next;
         ssize_t ret = 0;
         qemu_timeval tv;
         struct timespec ts;
+        bool merged;
 
         qemu_gettimeofday(&tv);
         ts.tv_sec = tv.tv_sec + 10;
@@ -330,55 +537,30 @@ static void *aio_thread(void *unused)
 
         mutex_lock(&lock);
 
-        while (QTAILQ_EMPTY(&request_list) &&
+        while (QTAILQ_EMPTY(&active_queues) &&
                !(ret == ETIMEDOUT)) {
             idle_threads++;
             ret = cond_timedwait(&cond, &lock, &ts);
             idle_threads--;
         }
 
-        if (QTAILQ_EMPTY(&request_list))
+        if (QTAILQ_EMPTY(&active_queues))
             break;
 
-        aiocb = QTAILQ_FIRST(&request_list);
-        QTAILQ_REMOVE(&request_list, aiocb, node);
-        aiocb->active = 1;
+        aiocb = paio_dequeue();
         mutex_unlock(&lock);
 
-        switch (aiocb->aio_type & QEMU_AIO_TYPE_MASK) {
-        case QEMU_AIO_READ:
-            ret = handle_aiocb_rw(aiocb);
-            if (ret >= 0 && ret < aiocb->aio_nbytes && aiocb->common.bs->growable) {
-                /* A short read means that we have reached EOF. Pad the buffer
-                 * with zeros for bytes after EOF. */
-                QEMUIOVector qiov;
+        merged = aiocb->merge_next && handle_aiocb_merged(aiocb);
 
-                qemu_iovec_init_external(&qiov, aiocb->aio_iov,
-                                         aiocb->aio_niov);
-                qemu_iovec_memset_skip(&qiov, 0, aiocb->aio_nbytes - ret, ret);
+        for (acb = aiocb; acb; acb = next) {
+            next = acb->merge_next;
+            ret = merged ? acb->aio_nbytes : handle_aiocb(acb);
 
-                ret = aiocb->aio_nbytes;
-            }
-            break;
-        case QEMU_AIO_WRITE:
-            ret = handle_aiocb_rw(aiocb);
-            break;
-        case QEMU_AIO_FLUSH:
-            ret = handle_aiocb_flush(aiocb);
-            break;
-        case QEMU_AIO_IOCTL:
-            ret = handle_aiocb_ioctl(aiocb);
-            break;
-        default:
-            fprintf(stderr, "invalid aio request (0x%x)\n", aiocb->aio_type);
-            ret = -EINVAL;
-            break;
+            mutex_lock(&lock);
+            paio_complete(acb, ret);
+            mutex_unlock(&lock);
         }
 
-        mutex_lock(&lock);
-        aiocb->ret = ret;
-        mutex_unlock(&lock);
-
         posix_aio_notify_event();
     }
 
@@ -435,12 +617,21 @@ static void spawn_thread(void)
 
 static void qemu_paio_submit(struct qemu_paiocb *aiocb)
 {
+    PaioQueue *q = aiocb->queue;
+
     aiocb->ret = -EINPROGRESS;
     aiocb->active = 0;
+    aiocb->submit_time = get_clock();
     mutex_lock(&lock);
     if (idle_threads == 0 && cur_threads < max_threads)
         spawn_thread();
-    QTAILQ_INSERT_TAIL(&request_list, aiocb, node);
+    if (QTAILQ_EMPTY(&q->requests)) {
+        QTAILQ_INSERT_TAIL(&active_queues, q, next);
+    }
+    QTAILQ_INSERT_TAIL(&q->requests, aiocb, node);
+    q->in_flight++;
+    q->depth_hist[paio_hist_bucket(q->in_flight,
+                                   BDRV_QUEUE_DEPTH_BUCKETS)]++;
     mutex_unlock(&lock);
     cond_signal(&cond);
 }
@@ -584,7 +775,8 @@ static void paio_cancel(BlockDriverAIOCB *blockacb)
 
     mutex_lock(&lock);
     if (!acb->active) {
-        QTAILQ_REMOVE(&request_list, acb, node);
+        paio_queue_remove(acb);
+        paio_queue_put(acb->queue);
         acb->ret = -ECANCELED;
     } else if (acb->ret == -EINPROGRESS) {
         active = 1;
@@ -606,13 +798,14 @@ static AIOPool raw_aio_pool = {
     .cancel             = paio_cancel,
 };
 
-BlockDriverAIOCB *paio_submit(BlockDriverState *bs, int fd,
+BlockDriverAIOCB *paio_submit(BlockDriverState *bs, void *paio_ctx, int fd,
         int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
         BlockDriverCompletionFunc *cb, void *opaque, int type)
 {
     struct qemu_paiocb *acb;
 
     acb = qemu_aio_get(&raw_aio_pool, bs, cb, opaque);
+    acb->queue = paio_ctx;
     acb->aio_type = type;
     acb->aio_fildes = fd;
 
@@ -631,13 +824,14 @@ BlockDriverAIOCB *paio_submit(BlockDriverState *bs, int fd,
     return &acb->common;
 }
 
-BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, int fd,
+BlockDriverAIOCB *paio_ioctl(BlockDriverState *bs, void *paio_ctx, int fd,
         unsigned long int req, void *buf,
         BlockDriverCompletionFunc *cb, void *opaque)
 {
     struct qemu_paiocb *acb;
 
     acb = qemu_aio_get(&raw_aio_pool, bs, cb, opaque);
+    acb->queue = paio_ctx;
     acb->aio_type = QEMU_AIO_IOCTL;
     acb->aio_fildes = fd;
     acb->aio_offset = 0;
@@ -686,9 +880,81 @@ int paio_init(void)
     if (ret)
         die2(ret, "pthread_attr_setdetachstate");
 
-    QTAILQ_INIT(&request_list);
-    new_thread_bh = qemu_bh_new(spawn_thread_bh_fn, NULL);
+    QTAILQ_INIT(&active_queues);
+    new_thread_bh = qemu_bh_new_io(spawn_thread_bh_fn, NULL);
 
     posix_aio_state = s;
     return 0;
 }
+
+void *paio_queue_new(void)
+{
+    PaioQueue *q = g_new0(PaioQueue, 1);
+
+    QTAILQ_INIT(&q->requests);
+    return q;
+}
+
+void paio_queue_delete(void *paio_ctx)
+{
+    PaioQueue *q = paio_ctx;
+
+    /* Requests that are still in flight free the queue when they are done */
+    mutex_lock(&lock);
+    if (q->in_flight) {
+        q->deleted = true;
+    } else {
+        g_free(q);
+    }
+    mutex_unlock(&lock);
+}
+
+void paio_get_info(void *paio_ctx, BlockDriverInfo *bdi)
+{
+    PaioQueue *q = paio_ctx;
+
+    mutex_lock(&lock);
+    bdi->has_queue_stats = true;
+    memcpy(bdi->queue_depth_hist, q->depth_hist, sizeof(q->depth_hist));
+    memcpy(bdi->latency_hist, q->latency_hist, sizeof(q->latency_hist));
+    mutex_unlock(&lock);
+}
+
+void paio_set_max_threads(int n)
+{
+    max_threads = n;
+}
+
+/* cpus is a CPU number or a range of them, first-last */
+int paio_set_thread_affinity(const char *cpus)
+{
+#ifdef CONFIG_LINUX
+    unsigned long first, last;
+    char *end;
+
+    first = strtoul(cpus, &end, 10);
+    if (end == cpus) {
+        return -EINVAL;
+    }
+    last = first;
+    if (*end == '-') {
+        cpus = end + 1;
+        last = strtoul(cpus, &end, 10);
+        if (end == cpus) {
+            return -EINVAL;
+        }
+    }
+    if (*end || last < first || last >= CPU_SETSIZE) {
+        return -EINVAL;
+    }
+
+    CPU_ZERO(&thread_cpus);
+    for (; first <= last; first++) {
+        CPU_SET(first, &thread_cpus);
+    }
+    thread_cpus_set = true;
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
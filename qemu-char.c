@@ -32,6 +32,7 @@
 #include "hw/baum.h"
 #include "hw/msmouse.h"
 #include "qmp-commands.h"
+#include "replay.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -160,6 +161,9 @@ int qemu_chr_be_can_write(CharDriverState *s)
 
 void qemu_chr_be_write(CharDriverState *s, uint8_t *buf, int len)
 {
+    if (replay_mode != REPLAY_MODE_NONE && replay_char_write(s, buf, len)) {
+        return;
+    }
     s->chr_read(s->handler_opaque, buf, len);
 }
 
@@ -2804,6 +2808,7 @@ CharDriverState *qemu_chr_new_from_opts(QemuOpts *opts,
         chr->filename = g_strdup(qemu_opt_get(opts, "backend"));
     chr->init = init;
     QTAILQ_INSERT_TAIL(&chardevs, chr, next);
+    replay_register_char(chr);
 
     if (qemu_opt_get_bool(opts, "mux", 0)) {
         CharDriverState *base = chr;
@@ -2814,6 +2819,7 @@ CharDriverState *qemu_chr_new_from_opts(QemuOpts *opts,
         chr->filename = base->filename;
         chr->avail_connections = MAX_MUX;
         QTAILQ_INSERT_TAIL(&chardevs, chr, next);
+        replay_register_char(chr);
     } else {
         chr->avail_connections = 1;
     }
@@ -2867,6 +2873,7 @@ void qemu_chr_fe_close(struct CharDriverState *chr)
 void qemu_chr_delete(CharDriverState *chr)
 {
     QTAILQ_REMOVE(&chardevs, chr, next);
+    replay_unregister_char(chr);
     if (chr->chr_close)
         chr->chr_close(chr);
     g_free(chr->filename);
@@ -99,6 +99,9 @@ static inline char *realpath(const char *path, char *resolved_path)
 void configure_icount(const char *option);
 extern int use_icount;
 
+/* hot trace formation */
+extern int tb_trace_threshold;
+
 /* FIXME: Remove NEED_CPU_H.  */
 #ifndef NEED_CPU_H
 
@@ -270,6 +273,7 @@ int cpu_load(QEMUFile *f, void *opaque, int version_id);
 void qemu_cpu_kick(void *env);
 void qemu_cpu_kick_self(void);
 int qemu_cpu_is_self(void *env);
+bool qemu_in_vcpu_thread(void);
 bool all_cpu_threads_idle(void);
 
 /* work queue */
@@ -333,6 +337,11 @@ void qemu_iovec_from_buffer(QEMUIOVector *qiov, const void *buf, size_t count);
 void qemu_iovec_memset(QEMUIOVector *qiov, int c, size_t count);
 void qemu_iovec_memset_skip(QEMUIOVector *qiov, int c, size_t count,
                             size_t skip);
+bool qemu_iovec_is_zero(QEMUIOVector *qiov);
+
+bool buffer_is_zero(const void *buf, size_t len);
+bool buffer_is_zero_select(const char *name);
+const char *buffer_is_zero_impl(void);
 
 void qemu_progress_init(int enabled, float min_skip);
 void qemu_progress_end(void);
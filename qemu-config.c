@@ -113,6 +113,22 @@ static QemuOptsList qemu_drive_opts = {
             .name = "copy-on-read",
             .type = QEMU_OPT_BOOL,
             .help = "copy read data from backing file into image file",
+        },{
+            .name = "detect-zeroes",
+            .type = QEMU_OPT_STRING,
+            .help = "optimize zero writes (on, off, unmap)",
+        },{
+            .name = "l2-cache-size",
+            .type = QEMU_OPT_STRING,
+            .help = "qcow2 L2 table cache size in bytes, or 'max'",
+        },{
+            .name = "refcount-cache-size",
+            .type = QEMU_OPT_STRING,
+            .help = "qcow2 refcount block cache size in bytes, or 'max'",
+        },{
+            .name = "cache-clean-interval",
+            .type = QEMU_OPT_NUMBER,
+            .help = "drop metadata cache entries idle for this many seconds",
         },
         { /* end of list */ }
     },
@@ -317,6 +333,23 @@ static QemuOptsList qemu_rtc_opts = {
     },
 };
 
+static QemuOptsList qemu_aio_threads_opts = {
+    .name = "aio-threads",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_aio_threads_opts.head),
+    .desc = {
+        {
+            .name = "max",
+            .type = QEMU_OPT_NUMBER,
+            .help = "maximum number of I/O threads",
+        },{
+            .name = "cpus",
+            .type = QEMU_OPT_STRING,
+            .help = "host CPUs the I/O threads run on",
+        },
+        { /* end of list */ }
+    },
+};
+
 static QemuOptsList qemu_global_opts = {
     .name = "global",
     .head = QTAILQ_HEAD_INITIALIZER(qemu_global_opts.head),
@@ -566,6 +599,45 @@ QemuOptsList qemu_boot_opts = {
     },
 };
 
+static QemuOptsList qemu_tcg_profile_opts = {
+    .name = "tcg-profile",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_tcg_profile_opts.head),
+    .desc = {
+        {
+            .name = "hz",
+            .type = QEMU_OPT_NUMBER,
+            .help = "sampling frequency",
+        }, {
+            .name = "symbols",
+            .type = QEMU_OPT_STRING,
+            .help = "ELF file with the guest symbols",
+        }, {
+            .name = "dump",
+            .type = QEMU_OPT_STRING,
+            .help = "write folded stacks to this file at exit",
+        },
+        { /* End of list */ }
+    },
+};
+
+static QemuOptsList qemu_replay_opts = {
+    .name = "replay",
+    .implied_opt_name = "mode",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_replay_opts.head),
+    .desc = {
+        {
+            .name = "mode",
+            .type = QEMU_OPT_STRING,
+            .help = "record or play",
+        }, {
+            .name = "file",
+            .type = QEMU_OPT_STRING,
+            .help = "journal of the external inputs",
+        },
+        { /* End of list */ }
+    },
+};
+
 static QemuOptsList *vm_config_groups[32] = {
     &qemu_drive_opts,
     &qemu_chardev_opts,
@@ -573,6 +645,7 @@ static QemuOptsList *vm_config_groups[32] = {
     &qemu_netdev_opts,
     &qemu_net_opts,
     &qemu_rtc_opts,
+    &qemu_aio_threads_opts,
     &qemu_global_opts,
     &qemu_mon_opts,
     &qemu_cpudef_opts,
@@ -580,6 +653,8 @@ static QemuOptsList *vm_config_groups[32] = {
     &qemu_option_rom_opts,
     &qemu_machine_opts,
     &qemu_boot_opts,
+    &qemu_tcg_profile_opts,
+    &qemu_replay_opts,
     NULL,
 };
 
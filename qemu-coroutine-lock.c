@@ -49,7 +49,7 @@ void qemu_co_queue_init(CoQueue *queue)
     QTAILQ_INIT(&queue->entries);
 
     if (!unlock_bh) {
-        unlock_bh = qemu_bh_new(qemu_co_queue_next_bh, NULL);
+        unlock_bh = qemu_bh_new_io(qemu_co_queue_next_bh, NULL);
     }
 }
 
@@ -27,6 +27,7 @@
 #include "osdep.h"
 #include "sysemu.h"
 #include "block_int.h"
+#include "qemu-thread.h"
 #include <stdio.h>
 
 #ifdef _WIN32
@@ -84,6 +85,16 @@ static void help(void)
            "  '-p' show progress of command (only certain commands)\n"
            "  '-S' indicates the consecutive number of bytes that must contain only zeros\n"
            "       for qemu-img to create a sparse image during conversion\n"
+           "  '-m' number of parallel coroutines (or threads with '-c') for convert\n"
+           "       (default 8, max 16)\n"
+           "  '-W' allow out-of-order writes to the target during convert\n"
+           "  '-z' zlib compression level (0-9) for '-c'\n"
+           "\n"
+           "Parameters to check subcommand:\n"
+           "  '-r' tries to repair any inconsistencies that are found during the check.\n"
+           "       '-r leaks' repairs only cluster leaks, whereas '-r all' fixes all\n"
+           "       kinds of errors, with a higher risk of choosing the wrong fix or\n"
+           "       hiding corruption that has already occurred.\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -372,10 +383,12 @@ static int img_check(int argc, char **argv)
     const char *filename, *fmt;
     BlockDriverState *bs;
     BdrvCheckResult result;
+    int fix = 0;
+    int flags = BDRV_O_FLAGS;
 
     fmt = NULL;
     for(;;) {
-        c = getopt(argc, argv, "f:h");
+        c = getopt(argc, argv, "f:hr:");
         if (c == -1) {
             break;
         }
@@ -387,6 +400,17 @@ static int img_check(int argc, char **argv)
         case 'f':
             fmt = optarg;
             break;
+        case 'r':
+            flags |= BDRV_O_RDWR;
+
+            if (!strcmp(optarg, "leaks")) {
+                fix = BDRV_FIX_LEAKS;
+            } else if (!strcmp(optarg, "all")) {
+                fix = BDRV_FIX_LEAKS | BDRV_FIX_ERRORS;
+            } else {
+                help();
+            }
+            break;
         }
     }
     if (optind >= argc) {
@@ -394,11 +418,11 @@ static int img_check(int argc, char **argv)
     }
     filename = argv[optind++];
 
-    bs = bdrv_new_open(filename, fmt, BDRV_O_FLAGS);
+    bs = bdrv_new_open(filename, fmt, flags);
     if (!bs) {
         return 1;
     }
-    ret = bdrv_check(bs, &result);
+    ret = bdrv_check(bs, &result, fix);
 
     if (ret == -ENOTSUP) {
         error_report("This image format does not support checks");
@@ -406,6 +430,15 @@ static int img_check(int argc, char **argv)
         return 1;
     }
 
+    if (result.corruptions_fixed || result.leaks_fixed) {
+        printf("The following inconsistencies were found and repaired:\n\n"
+               "    %d leaked clusters\n"
+               "    %d corruptions\n\n"
+               "Double checking the fixed image now...\n",
+               result.leaks_fixed,
+               result.corruptions_fixed);
+    }
+
     if (!(result.corruptions || result.leaks || result.check_errors)) {
         printf("No errors were found on the image.\n");
     } else {
@@ -514,40 +547,6 @@ static int img_commit(int argc, char **argv)
     return 0;
 }
 
-/*
- * Checks whether the sector is not a zero sector.
- *
- * Attention! The len must be a multiple of 4 * sizeof(long) due to
- * restriction of optimizations in this function.
- */
-static int is_not_zero(const uint8_t *sector, int len)
-{
-    /*
-     * Use long as the biggest available internal data type that fits into the
-     * CPU register and unroll the loop to smooth out the effect of memory
-     * latency.
-     */
-
-    int i;
-    long d0, d1, d2, d3;
-    const long * const data = (const long *) sector;
-
-    len /= sizeof(long);
-
-    for(i = 0; i < len; i += 4) {
-        d0 = data[i + 0];
-        d1 = data[i + 1];
-        d2 = data[i + 2];
-        d3 = data[i + 3];
-
-        if (d0 || d1 || d2 || d3) {
-            return 1;
-        }
-    }
-
-    return 0;
-}
-
 /*
  * Returns true iff the first sector pointed to by 'buf' contains at least
  * a non-NUL byte.
@@ -563,10 +562,15 @@ static int is_allocated_sectors(const uint8_t *buf, int n, int *pnum)
         *pnum = 0;
         return 0;
     }
-    v = is_not_zero(buf, 512);
+    v = !buffer_is_zero(buf, 512);
+    if (!v && buffer_is_zero(buf, n * 512)) {
+        /* the common case of a whole buffer of zeroes */
+        *pnum = n;
+        return 0;
+    }
     for(i = 1; i < n; i++) {
         buf += 512;
-        if (v != is_not_zero(buf, 512))
+        if (v != !buffer_is_zero(buf, 512))
             break;
     }
     *pnum = i;
@@ -647,18 +651,439 @@ static int compare_sectors(const uint8_t *buf1, const uint8_t *buf2, int n,
 }
 
 #define IO_BUF_SIZE (2 * 1024 * 1024)
+#define MAX_CONVERT_COROUTINES 16
+
+/*
+ * State of the pipelined part of img_convert.  Each of the num_coroutines
+ * workers claims the next chunk of the (concatenated) input, reads it and
+ * writes it to the target, so that up to num_coroutines reads and writes
+ * are in flight at the same time.
+ */
+typedef struct ImgConvertState {
+    BlockDriverState **src;
+    int src_num;
+    BlockDriverState *target;
+    int64_t total_sectors;
+    bool has_zero_init;
+    bool backing;           /* unallocated input sectors come from a base */
+    int min_sparse;
+
+    CoMutex lock;           /* protects sector_num and the source lookup */
+    int64_t sector_num;     /* start of the next chunk to hand out */
+    int src_cur;
+    int64_t src_cur_offset;
+    int64_t src_cur_sectors;
+
+    bool wr_in_order;
+    int64_t wr_offs;        /* next chunk to write if wr_in_order */
+    int64_t wait_sector_num[MAX_CONVERT_COROUTINES];
+    Coroutine *co[MAX_CONVERT_COROUTINES];
+    int num_coroutines;
+    int running_coroutines;
+
+    int64_t bytes_read;
+    int ret;
+} ImgConvertState;
+
+/*
+ * Pick the next chunk.  On return *src_num is the sector within
+ * s->src[*src_idx] and *pallocated tells whether the chunk has to be
+ * copied at all.  Returns the chunk size, or 0 at the end of the input.
+ */
+static int coroutine_fn convert_next_chunk(ImgConvertState *s,
+                                           int64_t *sector_num, int *src_idx,
+                                           int64_t *src_num, int *pallocated)
+{
+    uint64_t bs_sectors;
+    int n, n1;
+
+    if (s->sector_num >= s->total_sectors || s->ret < 0) {
+        return 0;
+    }
+
+    while (s->sector_num - s->src_cur_offset >= s->src_cur_sectors) {
+        s->src_cur++;
+        assert(s->src_cur < s->src_num);
+        s->src_cur_offset += s->src_cur_sectors;
+        bdrv_get_geometry(s->src[s->src_cur], &bs_sectors);
+        s->src_cur_sectors = bs_sectors;
+    }
+
+    n = MIN(s->total_sectors - s->sector_num, IO_BUF_SIZE / 512);
+    n = MIN(n, s->src_cur_offset + s->src_cur_sectors - s->sector_num);
+
+    *pallocated = 1;
+    if (s->has_zero_init && s->backing) {
+        /* If the output image is being created as a copy on write image,
+           assume that sectors which are unallocated in the input image
+           are present in both the output's and input's base images (no
+           need to copy them). */
+        *pallocated = bdrv_co_is_allocated(s->src[s->src_cur],
+                                           s->sector_num - s->src_cur_offset,
+                                           n, &n1);
+        n = n1;
+    }
+
+    *sector_num = s->sector_num;
+    *src_idx = s->src_cur;
+    *src_num = s->sector_num - s->src_cur_offset;
+    s->sector_num += n;
+    return n;
+}
+
+static int coroutine_fn convert_write(ImgConvertState *s, int64_t sector_num,
+                                      uint8_t *buf, int n)
+{
+    QEMUIOVector qiov;
+    struct iovec iov;
+    int n1 = n;
+    int ret;
+
+    /* NOTE: at the same time we convert, we do not write zero
+       sectors to have a chance to compress the image. Ideally, we
+       should add a specific call to have the info to go faster */
+    while (n > 0) {
+        /* If the output image is being created as a copy on write image,
+           copy all sectors even the ones containing only NUL bytes,
+           because they may differ from the sectors in the base image.
+
+           If the output is to a host device, we also write out
+           sectors that are entirely 0, since whatever data was
+           already there is garbage, not 0s. */
+        if (!s->has_zero_init || s->backing ||
+            is_allocated_sectors_min(buf, n, &n1, s->min_sparse)) {
+            iov.iov_base = buf;
+            iov.iov_len = n1 * BDRV_SECTOR_SIZE;
+            qemu_iovec_init_external(&qiov, &iov, 1);
+            ret = bdrv_co_writev(s->target, sector_num, n1, &qiov);
+            if (ret < 0) {
+                error_report("error while writing sector %" PRId64
+                             ": %s", sector_num, strerror(-ret));
+                return ret;
+            }
+        }
+        sector_num += n1;
+        n -= n1;
+        buf += n1 * BDRV_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+/* Restart the worker whose chunk starts at s->wr_offs, if it is waiting */
+static void convert_wake_writer(ImgConvertState *s)
+{
+    int i;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] && s->wait_sector_num[i] == s->wr_offs) {
+            qemu_coroutine_enter(s->co[i], NULL);
+            break;
+        }
+    }
+}
+
+/* On error, let every worker waiting for its turn see s->ret and quit */
+static void convert_wake_all(ImgConvertState *s)
+{
+    int i;
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i] && s->wait_sector_num[i] != -1) {
+            qemu_coroutine_enter(s->co[i], NULL);
+        }
+    }
+}
+
+static void coroutine_fn convert_co_do_copy(void *opaque)
+{
+    ImgConvertState *s = opaque;
+    QEMUIOVector qiov;
+    struct iovec iov;
+    uint8_t *buf;
+    int64_t sector_num, src_num;
+    int index, src_idx, allocated, n, ret = 0;
+
+    for (index = 0; index < s->num_coroutines; index++) {
+        if (s->co[index] == qemu_coroutine_self()) {
+            break;
+        }
+    }
+    assert(index < s->num_coroutines);
+
+    buf = qemu_blockalign(s->target, IO_BUF_SIZE);
+
+    for (;;) {
+        qemu_co_mutex_lock(&s->lock);
+        n = convert_next_chunk(s, &sector_num, &src_idx, &src_num,
+                               &allocated);
+        qemu_co_mutex_unlock(&s->lock);
+        if (n <= 0) {
+            break;
+        }
+
+        if (allocated) {
+            iov.iov_base = buf;
+            iov.iov_len = n * BDRV_SECTOR_SIZE;
+            qemu_iovec_init_external(&qiov, &iov, 1);
+            ret = bdrv_co_readv(s->src[src_idx], src_num, n, &qiov);
+            if (ret < 0) {
+                error_report("error while reading sector %" PRId64 ": %s",
+                             src_num, strerror(-ret));
+                goto fail;
+            }
+            s->bytes_read += n * BDRV_SECTOR_SIZE;
+        }
+        if (s->ret < 0) {
+            break;
+        }
+
+        if (s->wr_in_order) {
+            /* keep writes in order */
+            while (s->wr_offs != sector_num) {
+                s->wait_sector_num[index] = sector_num;
+                qemu_coroutine_yield();
+                s->wait_sector_num[index] = -1;
+                if (s->ret < 0) {
+                    goto out;
+                }
+            }
+        }
+
+        if (allocated) {
+            ret = convert_write(s, sector_num, buf, n);
+            if (ret < 0) {
+                goto fail;
+            }
+        }
+
+        qemu_progress_print(100.0 * n / s->total_sectors, 100);
+
+        if (s->wr_in_order) {
+            s->wr_offs = sector_num + n;
+            convert_wake_writer(s);
+        }
+    }
+    goto out;
+
+fail:
+    if (s->ret == 0) {
+        s->ret = ret;
+        convert_wake_all(s);
+    }
+out:
+    qemu_vfree(buf);
+    s->co[index] = NULL;
+    s->running_coroutines--;
+}
+
+static int convert_do_copy(ImgConvertState *s)
+{
+    uint64_t bs_sectors;
+    int i;
+
+    bdrv_get_geometry(s->src[0], &bs_sectors);
+    s->src_cur = 0;
+    s->src_cur_offset = 0;
+    s->src_cur_sectors = bs_sectors;
+    s->sector_num = 0;
+    s->wr_offs = 0;
+    s->ret = 0;
+    qemu_co_mutex_init(&s->lock);
+
+    for (i = 0; i < s->num_coroutines; i++) {
+        s->co[i] = qemu_coroutine_create(convert_co_do_copy);
+        s->wait_sector_num[i] = -1;
+    }
+    s->running_coroutines = s->num_coroutines;
+    for (i = 0; i < s->num_coroutines; i++) {
+        if (s->co[i]) {
+            qemu_coroutine_enter(s->co[i], s);
+        }
+    }
+
+    while (s->running_coroutines) {
+        qemu_aio_wait();
+    }
+    return s->ret;
+}
+
+/*
+ * Worker threads for img_convert -c.  The main thread reads clusters into
+ * a ring of jobs and writes them out in order; the workers do the zero
+ * detection and the compression, which is where the time goes.
+ */
+typedef struct CompressJob {
+    uint8_t *buf;
+    uint8_t *out_buf;
+    int64_t sector_num;
+    int ret;                /* compressed size, 0 to store as is, -errno */
+    bool zero;
+    bool done;
+} CompressJob;
+
+typedef struct CompressPool {
+    BlockDriverState *bs;
+    int cluster_size;
+    int level;
+
+    QemuMutex lock;
+    QemuCond work_cond;
+    QemuCond done_cond;
+    CompressJob *jobs;
+    int nb_jobs;
+    int64_t submitted;      /* handed to the workers */
+    int64_t picked;         /* taken by a worker */
+    int64_t retired;        /* written to the image */
+    bool stop;
+
+    QemuThread *threads;
+    int nb_threads;
+} CompressPool;
+
+static void *compress_worker(void *opaque)
+{
+    CompressPool *p = opaque;
+    CompressJob *job;
+
+    qemu_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->picked == p->submitted && !p->stop) {
+            qemu_cond_wait(&p->work_cond, &p->lock);
+        }
+        if (p->picked == p->submitted) {
+            break;
+        }
+        job = &p->jobs[p->picked++ % p->nb_jobs];
+        qemu_mutex_unlock(&p->lock);
+
+        job->zero = buffer_is_zero(job->buf, p->cluster_size);
+        if (!job->zero) {
+            job->ret = bdrv_compress_cluster(p->bs, job->buf, job->out_buf,
+                                             p->level);
+        }
+
+        qemu_mutex_lock(&p->lock);
+        job->done = true;
+        qemu_cond_broadcast(&p->done_cond);
+    }
+    qemu_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+static CompressPool *compress_pool_new(BlockDriverState *bs, int cluster_size,
+                                       int level, int nb_threads)
+{
+    CompressPool *p = g_malloc0(sizeof(*p));
+    int i;
+
+    p->bs = bs;
+    p->cluster_size = cluster_size;
+    p->level = level;
+    qemu_mutex_init(&p->lock);
+    qemu_cond_init(&p->work_cond);
+    qemu_cond_init(&p->done_cond);
+
+    /* two jobs per thread, so that reading the next cluster overlaps
+       with the compression of the previous one */
+    p->nb_jobs = 2 * nb_threads;
+    p->jobs = g_malloc0(p->nb_jobs * sizeof(CompressJob));
+    for (i = 0; i < p->nb_jobs; i++) {
+        p->jobs[i].buf = qemu_blockalign(bs, cluster_size);
+        p->jobs[i].out_buf = g_malloc(cluster_size);
+    }
+
+    p->nb_threads = nb_threads;
+    p->threads = g_malloc0(nb_threads * sizeof(QemuThread));
+    for (i = 0; i < nb_threads; i++) {
+        qemu_thread_create(&p->threads[i], compress_worker, p,
+                           QEMU_THREAD_JOINABLE);
+    }
+    return p;
+}
+
+static void compress_pool_free(CompressPool *p)
+{
+    int i;
+
+    qemu_mutex_lock(&p->lock);
+    p->stop = true;
+    qemu_cond_broadcast(&p->work_cond);
+    qemu_mutex_unlock(&p->lock);
+    for (i = 0; i < p->nb_threads; i++) {
+        qemu_thread_join(&p->threads[i]);
+    }
+
+    for (i = 0; i < p->nb_jobs; i++) {
+        qemu_vfree(p->jobs[i].buf);
+        g_free(p->jobs[i].out_buf);
+    }
+    qemu_cond_destroy(&p->work_cond);
+    qemu_cond_destroy(&p->done_cond);
+    qemu_mutex_destroy(&p->lock);
+    g_free(p->jobs);
+    g_free(p->threads);
+    g_free(p);
+}
+
+/* Slot for the next cluster; only valid if compress_pool_full() is false */
+static CompressJob *compress_pool_next(CompressPool *p)
+{
+    return &p->jobs[p->submitted % p->nb_jobs];
+}
+
+static bool compress_pool_full(CompressPool *p)
+{
+    return p->submitted - p->retired == p->nb_jobs;
+}
+
+static void compress_pool_submit(CompressPool *p)
+{
+    qemu_mutex_lock(&p->lock);
+    p->jobs[p->submitted % p->nb_jobs].done = false;
+    p->submitted++;
+    qemu_cond_signal(&p->work_cond);
+    qemu_mutex_unlock(&p->lock);
+}
+
+/* Wait for the oldest job and write it out.  Returns 0 or -errno.  */
+static int compress_pool_retire(CompressPool *p)
+{
+    CompressJob *job = &p->jobs[p->retired % p->nb_jobs];
+    int ret;
+
+    qemu_mutex_lock(&p->lock);
+    while (!job->done) {
+        qemu_cond_wait(&p->done_cond, &p->lock);
+    }
+    qemu_mutex_unlock(&p->lock);
+    p->retired++;
+
+    if (job->zero) {
+        return 0;
+    }
+    ret = job->ret;
+    if (ret >= 0) {
+        ret = bdrv_write_compressed_data(p->bs, job->sector_num, job->buf,
+                                         p->cluster_size >> 9,
+                                         job->out_buf, job->ret);
+    }
+    if (ret < 0) {
+        error_report("error while compressing sector %" PRId64
+                     ": %s", job->sector_num, strerror(-ret));
+    }
+    return ret;
+}
 
 static int img_convert(int argc, char **argv)
 {
-    int c, ret = 0, n, n1, bs_n, bs_i, compress, cluster_size, cluster_sectors;
+    int c, ret = 0, n, bs_n, bs_i, compress, cluster_size, cluster_sectors;
     int progress = 0, flags;
     const char *fmt, *out_fmt, *cache, *out_baseimg, *out_filename;
     BlockDriver *drv, *proto_drv;
     BlockDriverState **bs = NULL, *out_bs = NULL;
     int64_t total_sectors, nb_sectors, sector_num, bs_offset;
     uint64_t bs_sectors;
-    uint8_t * buf = NULL;
-    const uint8_t *buf1;
+    CompressPool *pool = NULL;
     BlockDriverInfo bdi;
     QEMUOptionParameter *param = NULL, *create_options = NULL;
     QEMUOptionParameter *out_baseimg_param;
@@ -666,6 +1091,10 @@ static int img_convert(int argc, char **argv)
     const char *snapshot_name = NULL;
     float local_progress;
     int min_sparse = 8; /* Need at least 4k of zeros for sparse detection */
+    int num_coroutines = 8;
+    int compress_level = -1; /* zlib default */
+    bool wr_in_order = true;
+    int64_t start_time, bytes_read = 0;
 
     fmt = NULL;
     out_fmt = "raw";
@@ -673,7 +1102,7 @@ static int img_convert(int argc, char **argv)
     out_baseimg = NULL;
     compress = 0;
     for(;;) {
-        c = getopt(argc, argv, "f:O:B:s:hce6o:pS:t:");
+        c = getopt(argc, argv, "f:O:B:s:hce6o:pS:t:m:Wz:");
         if (c == -1) {
             break;
         }
@@ -727,6 +1156,32 @@ static int img_convert(int argc, char **argv)
         case 't':
             cache = optarg;
             break;
+        case 'm':
+        {
+            char *end;
+            num_coroutines = strtol(optarg, &end, 10);
+            if (*end || num_coroutines < 1 ||
+                num_coroutines > MAX_CONVERT_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d",
+                             MAX_CONVERT_COROUTINES);
+                return 1;
+            }
+            break;
+        }
+        case 'W':
+            wr_in_order = false;
+            break;
+        case 'z':
+        {
+            char *end;
+            compress_level = strtol(optarg, &end, 10);
+            if (*end || compress_level < 0 || compress_level > 9) {
+                error_report("Invalid compression level, must be 0-9");
+                return 1;
+            }
+            break;
+        }
         }
     }
 
@@ -735,6 +1190,11 @@ static int img_convert(int argc, char **argv)
         help();
     }
 
+    if (compress && !wr_in_order) {
+        error_report("Out of order write and compress are mutually exclusive");
+        return 1;
+    }
+
     out_filename = argv[argc - 1];
 
     if (options && !strcmp(options, "?")) {
@@ -748,7 +1208,7 @@ static int img_convert(int argc, char **argv)
         ret = -1;
         goto out;
     }
-        
+
     qemu_progress_init(progress, 2.0);
     qemu_progress_print(0, 100);
 
@@ -884,7 +1344,7 @@ static int img_convert(int argc, char **argv)
     bs_i = 0;
     bs_offset = 0;
     bdrv_get_geometry(bs[0], &bs_sectors);
-    buf = qemu_blockalign(out_bs, IO_BUF_SIZE);
+    start_time = get_clock();
 
     if (compress) {
         ret = bdrv_get_info(out_bs, &bdi);
@@ -900,6 +1360,8 @@ static int img_convert(int argc, char **argv)
         }
         cluster_sectors = cluster_size >> 9;
         sector_num = 0;
+        pool = compress_pool_new(out_bs, cluster_size, compress_level,
+                                 num_coroutines);
 
         nb_sectors = total_sectors;
         local_progress = (float)100 /
@@ -909,6 +1371,7 @@ static int img_convert(int argc, char **argv)
             int64_t bs_num;
             int remainder;
             uint8_t *buf2;
+            CompressJob *job;
 
             nb_sectors = total_sectors - sector_num;
             if (nb_sectors <= 0)
@@ -918,10 +1381,20 @@ static int img_convert(int argc, char **argv)
             else
                 n = nb_sectors;
 
+            if (compress_pool_full(pool)) {
+                ret = compress_pool_retire(pool);
+                if (ret < 0) {
+                    goto out;
+                }
+                qemu_progress_print(local_progress, 100);
+            }
+            job = compress_pool_next(pool);
+            job->sector_num = sector_num;
+
             bs_num = sector_num - bs_offset;
             assert (bs_num >= 0);
             remainder = n;
-            buf2 = buf;
+            buf2 = job->buf;
             while (remainder > 0) {
                 int nlow;
                 while (bs_num == bs_sectors) {
@@ -951,115 +1424,56 @@ static int img_convert(int argc, char **argv)
                 remainder -= nlow;
             }
             assert (remainder == 0);
+            bytes_read += n * 512;
 
             if (n < cluster_sectors) {
-                memset(buf + n * 512, 0, cluster_size - n * 512);
-            }
-            if (is_not_zero(buf, cluster_size)) {
-                ret = bdrv_write_compressed(out_bs, sector_num, buf,
-                                            cluster_sectors);
-                if (ret != 0) {
-                    error_report("error while compressing sector %" PRId64
-                                 ": %s", sector_num, strerror(-ret));
-                    goto out;
-                }
+                memset(job->buf + n * 512, 0, cluster_size - n * 512);
             }
+            compress_pool_submit(pool);
             sector_num += n;
-            qemu_progress_print(local_progress, 100);
         }
-        /* signal EOF to align */
-        bdrv_write_compressed(out_bs, 0, NULL, 0);
-    } else {
-        int has_zero_init = bdrv_has_zero_init(out_bs);
-
-        sector_num = 0; // total number of sectors converted so far
-        nb_sectors = total_sectors - sector_num;
-        local_progress = (float)100 /
-            (nb_sectors / MIN(nb_sectors, IO_BUF_SIZE / 512));
-
-        for(;;) {
-            nb_sectors = total_sectors - sector_num;
-            if (nb_sectors <= 0) {
-                break;
-            }
-            if (nb_sectors >= (IO_BUF_SIZE / 512)) {
-                n = (IO_BUF_SIZE / 512);
-            } else {
-                n = nb_sectors;
-            }
-
-            while (sector_num - bs_offset >= bs_sectors) {
-                bs_i ++;
-                assert (bs_i < bs_n);
-                bs_offset += bs_sectors;
-                bdrv_get_geometry(bs[bs_i], &bs_sectors);
-                /* printf("changing part: sector_num=%" PRId64 ", bs_i=%d, "
-                  "bs_offset=%" PRId64 ", bs_sectors=%" PRId64 "\n",
-                   sector_num, bs_i, bs_offset, bs_sectors); */
-            }
-
-            if (n > bs_offset + bs_sectors - sector_num) {
-                n = bs_offset + bs_sectors - sector_num;
-            }
-
-            if (has_zero_init) {
-                /* If the output image is being created as a copy on write image,
-                   assume that sectors which are unallocated in the input image
-                   are present in both the output's and input's base images (no
-                   need to copy them). */
-                if (out_baseimg) {
-                    if (!bdrv_is_allocated(bs[bs_i], sector_num - bs_offset,
-                                           n, &n1)) {
-                        sector_num += n1;
-                        continue;
-                    }
-                    /* The next 'n1' sectors are allocated in the input image. Copy
-                       only those as they may be followed by unallocated sectors. */
-                    n = n1;
-                }
-            } else {
-                n1 = n;
-            }
-
-            ret = bdrv_read(bs[bs_i], sector_num - bs_offset, buf, n);
+        while (pool->retired < pool->submitted) {
+            ret = compress_pool_retire(pool);
             if (ret < 0) {
-                error_report("error while reading sector %" PRId64 ": %s",
-                             sector_num - bs_offset, strerror(-ret));
                 goto out;
             }
-            /* NOTE: at the same time we convert, we do not write zero
-               sectors to have a chance to compress the image. Ideally, we
-               should add a specific call to have the info to go faster */
-            buf1 = buf;
-            while (n > 0) {
-                /* If the output image is being created as a copy on write image,
-                   copy all sectors even the ones containing only NUL bytes,
-                   because they may differ from the sectors in the base image.
-
-                   If the output is to a host device, we also write out
-                   sectors that are entirely 0, since whatever data was
-                   already there is garbage, not 0s. */
-                if (!has_zero_init || out_baseimg ||
-                    is_allocated_sectors_min(buf1, n, &n1, min_sparse)) {
-                    ret = bdrv_write(out_bs, sector_num, buf1, n1);
-                    if (ret < 0) {
-                        error_report("error while writing sector %" PRId64
-                                     ": %s", sector_num, strerror(-ret));
-                        goto out;
-                    }
-                }
-                sector_num += n1;
-                n -= n1;
-                buf1 += n1 * 512;
-            }
             qemu_progress_print(local_progress, 100);
         }
+        /* signal EOF to align */
+        bdrv_write_compressed(out_bs, 0, NULL, 0);
+    } else {
+        ImgConvertState state = {
+            .src = bs,
+            .src_num = bs_n,
+            .target = out_bs,
+            .total_sectors = total_sectors,
+            .has_zero_init = bdrv_has_zero_init(out_bs),
+            .backing = out_baseimg != NULL,
+            .min_sparse = min_sparse,
+            .wr_in_order = wr_in_order,
+            .num_coroutines = num_coroutines,
+        };
+
+        ret = convert_do_copy(&state);
+        if (ret < 0) {
+            goto out;
+        }
+        bytes_read = state.bytes_read;
+    }
+    if (progress) {
+        double secs = (get_clock() - start_time) / 1e9;
+
+        printf("\n    %.1f MiB read in %.2f s (%.1f MiB/s)",
+               bytes_read / 1048576.0, secs,
+               secs > 0 ? bytes_read / 1048576.0 / secs : 0.0);
     }
 out:
     qemu_progress_end();
     free_option_parameters(create_options);
     free_option_parameters(param);
-    qemu_vfree(buf);
+    if (pool) {
+        compress_pool_free(pool);
+    }
     if (out_bs) {
         bdrv_delete(out_bs);
     }
@@ -33,6 +33,8 @@
 #include <libgen.h>
 #include <pthread.h>
 
+#define QEMU_NBD_OPT_AIO    1
+
 #define SOCKET_PATH    "/var/lock/qemu-nbd-%s"
 
 static NBDExport *exp;
@@ -60,6 +62,9 @@ static void usage(const char *name)
 "  -P, --partition=NUM  only expose partition NUM\n"
 "  -s, --snapshot       use snapshot file\n"
 "  -n, --nocache        disable host cache\n"
+#ifdef CONFIG_LINUX_AIO
+"      --aio=MODE       set AIO mode (native or threads)\n"
+#endif
 "  -c, --connect=DEV    connect FILE to the local NBD device DEV\n"
 "  -d, --disconnect     disconnect the specified device\n"
 "  -e, --shared=NUM     device can be shared by NUM clients (default '1')\n"
@@ -289,6 +294,9 @@ int main(int argc, char **argv)
         { "disconnect", 0, NULL, 'd' },
         { "snapshot", 0, NULL, 's' },
         { "nocache", 0, NULL, 'n' },
+#ifdef CONFIG_LINUX_AIO
+        { "aio", 1, NULL, QEMU_NBD_OPT_AIO },
+#endif
         { "shared", 1, NULL, 'e' },
         { "persistent", 0, NULL, 't' },
         { "verbose", 0, NULL, 'v' },
@@ -321,6 +329,17 @@ int main(int argc, char **argv)
         case 'n':
             flags |= BDRV_O_NOCACHE | BDRV_O_CACHE_WB;
             break;
+#ifdef CONFIG_LINUX_AIO
+        case QEMU_NBD_OPT_AIO:
+            if (!strcmp(optarg, "native")) {
+                flags |= BDRV_O_NATIVE_AIO;
+            } else if (!strcmp(optarg, "threads")) {
+                flags &= ~BDRV_O_NATIVE_AIO;
+            } else {
+                errx(EXIT_FAILURE, "invalid aio mode '%s'", optarg);
+            }
+            break;
+#endif
         case 'b':
             bindto = optarg;
             break;
@@ -400,6 +419,10 @@ int main(int argc, char **argv)
              argv[0]);
     }
 
+    if ((flags & BDRV_O_NATIVE_AIO) && !(flags & BDRV_O_NOCACHE)) {
+        errx(EXIT_FAILURE, "--aio=native requires --nocache");
+    }
+
     if (disconnect) {
         fd = open(argv[optind], O_RDWR);
         if (fd == -1)
@@ -139,6 +139,9 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,id=name][,aio=threads|native]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
+    "       [,detect-zeroes=on|off|unmap]\n"
+    "       [,l2-cache-size=size|max][,refcount-cache-size=size|max]\n"
+    "       [,cache-clean-interval=seconds]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]][[,iops=i]|[[,iops_rd=r][,iops_wr=w]]\n"
     "                use 'file' as a drive image\n", QEMU_ARCH_ALL)
 STEXI
@@ -193,6 +196,23 @@ Open drive @option{file} as read-only. Guest write attempts will fail.
 @item copy-on-read=@var{copy-on-read}
 @var{copy-on-read} is "on" or "off" and enables whether to copy read backing
 file sectors into the image file.
+@item detect-zeroes=@var{detect-zeroes}
+@var{detect-zeroes} is "off", "on" or "unmap".  With "on", guest writes that
+contain only zeroes are dropped for the parts of the image that are not
+allocated yet, so they stay sparse.  "unmap" also discards the written range
+where the image format supports it, which frees clusters that the guest
+zeroes out.  Both only apply to images without a backing file.
+@item l2-cache-size=@var{size}
+@itemx refcount-cache-size=@var{size}
+Size in bytes of the qcow2 L2 table and refcount block caches (suffixes
+k, M and G are accepted).  "max" makes the cache large enough to hold all
+of the image's tables, so that metadata is never read twice.  The size is
+rounded to whole clusters.  By default 16 L2 tables and 4 refcount blocks
+are cached.
+@item cache-clean-interval=@var{seconds}
+Every @var{seconds}, cached qcow2 metadata tables that have not been used
+since the last interval are dropped and their memory is returned to the host.
+The default, 0, keeps them until they are replaced.
 @end table
 
 By default, writethrough caching is used for all block device.  This means that
@@ -370,6 +390,20 @@ the raw disk image you use is not written back. You can however force
 the write back by pressing @key{C-a s} (@pxref{disk_images}).
 ETEXI
 
+DEF("aio-threads", HAS_ARG, QEMU_OPTION_aio_threads,
+    "-aio-threads [max=n][,cpus=cpu[-cpu]]\n"
+    "                limit the host I/O threads and bind them to host CPUs\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -aio-threads [max=@var{n}][,cpus=@var{first}[-@var{last}]]
+@findex -aio-threads
+Configure the pool of host threads that perform disk I/O for drives that
+don't use @code{aio=native}.  The pool grows up to @var{n} threads (default
+64), shared by all drives; each drive has its own queue, and the threads
+serve the queues in turn.  With @option{cpus}, the threads only run on the
+given host CPUs.
+ETEXI
+
 DEF("m", HAS_ARG, QEMU_OPTION_m,
     "-m megs         set virtual RAM size to megs MB [default="
     stringify(DEFAULT_RAM_SIZE) "]\n", QEMU_ARCH_ALL)
@@ -2453,6 +2487,29 @@ order cores with complex cache hierarchies.  The number of instructions
 executed often has little or no correlation with actual performance.
 ETEXI
 
+DEF("replay", HAS_ARG, QEMU_OPTION_replay, \
+    "-replay [mode=record|play],file=file\n" \
+    "                record the external inputs of the guest to file, or\n" \
+    "                replay them from file (requires -icount N)\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -replay [mode=record|play],file=@var{file}
+@findex -replay
+Make the execution of the guest reproducible.  In @code{record} mode (the
+default), chardev input, packets received from network backends, disk
+request completions and the advances of the virtual clock while the CPUs
+are idle are written to @var{file} with the instruction count at which the
+guest saw them.  In @code{play} mode these inputs are taken from @var{file}
+instead and delivered at the same instruction counts, so the guest runs
+exactly as it did when recorded.  When the journal ends, or if execution
+diverges from it, the VM is paused.
+
+Both runs need a fixed @option{-icount} shift and the same command line,
+and disk images must have the same contents at the start of each run
+(use @option{-snapshot}).  Real time clocks are derived from the virtual
+clock, starting at the time of the recording.
+ETEXI
+
 DEF("watchdog", HAS_ARG, QEMU_OPTION_watchdog, \
     "-watchdog i6300esb|ib700\n" \
     "                enable virtual hardware watchdog [default=none]\n",
@@ -2554,6 +2611,52 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tcg-slice", HAS_ARG, QEMU_OPTION_tcg_slice, \
+    "-tcg-slice us   run each vCPU for at most 'us' microseconds in turn (0=off)\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tcg-slice @var{us}
+@findex -tcg-slice
+TCG runs all virtual CPUs in a single host thread, one after the other.
+Switch to the next virtual CPU after @var{us} microseconds (default 10000),
+so that a busy CPU cannot starve the others.  With @option{-icount} the
+slice is measured in virtual time, which keeps the execution deterministic.
+Halted CPUs are skipped until an interrupt wakes them up.  A value of 0
+lets each CPU run until it halts or an I/O event interrupts it.
+ETEXI
+
+DEF("tb-trace-threshold", HAS_ARG, QEMU_OPTION_tb_trace_threshold, \
+    "-tb-trace-threshold n\n" \
+    "                retranslate TBs executed n times as traces (0=off)\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tb-trace-threshold @var{n}
+@findex -tb-trace-threshold
+Retranslate a translation block as a trace after it has been executed
+@var{n} times.  Blocks count how often their final branch is taken, and
+the trace follows the most frequent exit of each block within the same
+page, loop back-edges included, so that hot code paths are optimized as a
+whole; the other exits leave the trace.  Currently only ARM targets form
+traces.  A value of 0 disables trace formation.
+ETEXI
+
+DEF("tcg-profile", HAS_ARG, QEMU_OPTION_tcg_profile, \
+    "-tcg-profile [hz=n][,symbols=file][,dump=file]\n"
+    "                sample the translated code n times per second of vCPU time\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -tcg-profile [hz=@var{n}][,symbols=@var{file}][,dump=@var{file}]
+@findex -tcg-profile
+Start the sampling profiler for translated code when the guest starts.
+The vCPU thread is interrupted @var{n} times per second of its CPU time
+(default 1000) and each sample is charged to the translation block, or to
+the helper called from it, that was running.  Guest addresses are named
+with the ELF symbol table of @option{symbols}, or of the @option{-kernel}
+image.  With @option{dump}, the profile is written at exit to @var{file}
+as folded stacks, one @samp{cpu;symbol count} line per entry, as used by
+flame graph tools.  See also the @code{info tcg-profile} monitor command.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming p     prepare for incoming migration, listen on port p\n",
     QEMU_ARCH_ALL)
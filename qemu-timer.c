@@ -28,6 +28,7 @@
 #include "console.h"
 
 #include "hw/hw.h"
+#include "replay.h"
 
 #include <unistd.h>
 #include <fcntl.h>
@@ -397,13 +398,14 @@ int qemu_timer_expired(QEMUTimer *timer_head, int64_t current_time)
     return qemu_timer_expired_ns(timer_head, current_time * timer_head->scale);
 }
 
-static void qemu_run_timers(QEMUClock *clock)
+bool qemu_run_timers(QEMUClock *clock)
 {
     QEMUTimer **ptimer_head, *ts;
     int64_t current_time;
+    bool progress = false;
    
     if (!clock->enabled)
-        return;
+        return false;
 
     current_time = qemu_get_clock_ns(clock);
     ptimer_head = &clock->active_timers;
@@ -418,7 +420,9 @@ static void qemu_run_timers(QEMUClock *clock)
 
         /* run the callback (the timer list can be modified) */
         ts->cb(ts->opaque);
+        progress = true;
     }
+    return progress;
 }
 
 int64_t qemu_get_clock_ns(QEMUClock *clock)
@@ -478,8 +482,10 @@ void qemu_run_all_timers(void)
         qemu_rearm_alarm_timer(alarm_timer);
     }
 
-    /* vm time timers */
-    qemu_run_timers(vm_clock);
+    /* vm time timers; record/replay runs them from the vCPU thread */
+    if (replay_mode == REPLAY_MODE_NONE) {
+        qemu_run_timers(vm_clock);
+    }
     qemu_run_timers(rt_clock);
     qemu_run_timers(host_clock);
 }
@@ -804,8 +810,10 @@ int init_timer_alarm(void)
         goto fail;
     }
 
-    /* first event is at time 0 */
+    /* first event is at time 0; the main loop then rearms the timer for
+       whatever was scheduled before it started */
     atexit(quit_timers);
+    t->expired = alarm_has_dynticks(t);
     t->pending = 1;
     alarm_timer = t;
 
@@ -21,6 +21,7 @@
 #include "main-loop.h"
 #include "qemu_socket.h"
 #include "slirp/libslirp.h"
+#include "replay.h"
 
 #include <sys/time.h>
 
@@ -83,6 +84,23 @@ void qemu_clock_warp(QEMUClock *clock)
 {
 }
 
+ReplayMode replay_mode;
+
+uint64_t replay_block_request(void)
+{
+    return 0;
+}
+
+void replay_block_complete(uint64_t id, void (*cb)(void *opaque, int ret),
+                           void *opaque, int ret)
+{
+    abort();
+}
+
+void replay_block_flush(void)
+{
+}
+
 int qemu_init_main_loop(void)
 {
     init_clocks();
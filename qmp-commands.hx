@@ -654,6 +654,99 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_input_block_stream,
     },
 
+    {
+        .name       = "block-dirty-bitmap-add",
+        .args_type  = "device:B,name:s,granularity:i?,persistent:b?",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_add,
+    },
+
+SQMP
+block-dirty-bitmap-add
+----------------------
+
+Create a dirty bitmap that records which parts of a block device the guest
+writes to.  The bitmap starts out clean.
+
+Arguments:
+
+- "device": device name (json-string)
+- "name": name of the new bitmap (json-string)
+- "granularity": bytes tracked by each bit, a power of two of at least 512;
+                 defaults to the cluster size of the image (json-int, optional)
+- "persistent": store the bitmap in the image file when the device is closed,
+                qcow2 compat=1.1 images only (json-bool, optional)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-add", "arguments": { "device": "ide0-hd0",
+                                                         "name": "nightly",
+                                                         "persistent": true } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-dirty-bitmap-remove",
+        .args_type  = "device:B,name:s",
+        .mhandler.cmd_new = qmp_marshal_input_block_dirty_bitmap_remove,
+    },
+
+SQMP
+block-dirty-bitmap-remove
+-------------------------
+
+Delete a dirty bitmap.
+
+Arguments:
+
+- "device": device name (json-string)
+- "name": name of the bitmap (json-string)
+
+Example:
+
+-> { "execute": "block-dirty-bitmap-remove", "arguments": { "device": "ide0-hd0",
+                                                            "name": "nightly" } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "block-incremental-backup",
+        .args_type  = "device:B,bitmap:s,target:s,format:s?,base:s?,full:b?",
+        .mhandler.cmd_new = qmp_marshal_input_block_incremental_backup,
+    },
+
+SQMP
+block-incremental-backup
+------------------------
+
+Start a background job that copies the parts of a block device that are dirty
+in a dirty bitmap to a new image.  The new image holds the contents of the
+device at the time the command was issued.  The bitmap is cleared and tracks
+the writes for the next backup; if the job fails or is cancelled, the dirty
+bits are restored.
+
+Arguments:
+
+- "device": device name (json-string)
+- "bitmap": name of the dirty bitmap (json-string)
+- "target": name of the new image file (json-string)
+- "format": format of the new image, default is qcow2 (json-string, optional)
+- "base": backing file of the new image, normally the previous backup
+          (json-string, optional)
+- "full": copy the whole device to start a new chain of backups
+          (json-bool, optional)
+
+Example:
+
+-> { "execute": "block-incremental-backup",
+     "arguments": { "device": "ide0-hd0", "bitmap": "nightly",
+                    "target": "/backup/disk-0002.qcow2",
+                    "base": "/backup/disk-0001.qcow2" } }
+<- { "return": {} }
+
+EQMP
+
     {
         .name       = "block_job_set_speed",
         .args_type  = "device:B,value:o",
@@ -1161,6 +1254,12 @@ Each json-object contain the following:
                and the VM is configured to stop on errors. It's always reset
                to "ok" when the "cont" command is issued (json_string, optional)
              - Possible values: "ok", "failed", "nospace"
+- "dirty-bitmaps": only present if the device has named dirty bitmaps, it is
+   a json-array of json-objects containing the following:
+         - "name": bitmap name (json-string)
+         - "granularity": bytes tracked by each bit (json-int)
+         - "count": number of dirty bytes (json-int)
+         - "persistent": true if stored in the image file (json-bool)
 
 Example:
 
@@ -1239,6 +1338,22 @@ Each json-object contain the following:
     - "flush_total_time_ns": total time spend on cache flushes in nano-seconds (json-int)
     - "wr_highest_offset": Highest offset of a sector written since the
                            BlockDriverState has been opened (json-int)
+    - "l2_cache_hits": L2 table lookups served from the image format's
+                       metadata cache (json-int, optional)
+    - "l2_cache_misses": L2 table lookups that read the image (json-int,
+                         optional)
+    - "refcount_cache_hits": refcount block lookups served from the cache
+                             (json-int, optional)
+    - "refcount_cache_misses": refcount block lookups that read the image
+                               (json-int, optional)
+    - "queue_depth": histogram of the requests in flight in the host I/O
+                     thread pool when a request was submitted, as a
+                     json-array of json-objects with "max" (upper bound of
+                     the bucket, -1 for the last one) and "count" (json-array,
+                     optional)
+    - "latency_us": histogram of the time requests spent in the host I/O
+                    thread pool, in microseconds, in the same format
+                    (json-array, optional)
 - "parent": Contains recursively the statistics of the underlying
             protocol (e.g. the host file for a qcow2 image). If there is
             no underlying protocol, this field is omitted
@@ -1346,6 +1461,10 @@ Return a json-array. Each CPU is represented by a json-object, which contains:
      "pc" and "npc": sparc (json-int)
      "PC": mips (json-int)
 - "thread_id": ID of the underlying host thread (json-int)
+- "run-time-ns": host time spent running the CPU, TCG only (json-int,
+                 optional)
+- "slices": number of times the CPU was scheduled, TCG only (json-int,
+            optional)
 
 Example:
 
@@ -2047,3 +2166,134 @@ EQMP
         .args_type  = "implements:s?,abstract:b?",
         .mhandler.cmd_new = qmp_marshal_input_qom_list_types,
     },
+
+SQMP
+query-tcg-profile
+-----------------
+
+Return the results of the TCG sampling profiler.
+
+Arguments:
+
+- "limit": maximum number of entries to return (json-int, optional)
+- "reset": clear the results after returning them (json-bool, optional)
+
+Example:
+
+-> { "execute": "query-tcg-profile", "arguments": { "limit": 1 } }
+<- { "return": { "enabled": true, "period-ns": 1000000, "samples": 5000,
+                 "dropped": 0,
+                 "cpus": [ { "cpu": 0, "samples": 4990,
+                             "time-ns": 4990000000 } ],
+                 "entries": [ { "cpu": 0, "kind": "code",
+                                "symbol": "memcpy", "pc": 3221430272,
+                                "samples": 812, "time-ns": 812000000 } ] } }
+
+EQMP
+
+    {
+        .name       = "query-tcg-profile",
+        .args_type  = "limit:i?,reset:b?",
+        .mhandler.cmd_new = qmp_marshal_input_query_tcg_profile,
+    },
+
+SQMP
+tcg-profile-start
+-----------------
+
+Start sampling the guest code executed by the vCPU thread.
+
+Arguments:
+
+- "hz": samples per second of host CPU time (json-int, optional)
+- "symbols": ELF file with guest symbols (json-string, optional)
+
+Example:
+
+-> { "execute": "tcg-profile-start",
+     "arguments": { "hz": 1000, "symbols": "/tmp/vmlinux" } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "tcg-profile-start",
+        .args_type  = "hz:i?,symbols:s?",
+        .mhandler.cmd_new = qmp_marshal_input_tcg_profile_start,
+    },
+
+SQMP
+tcg-profile-stop
+----------------
+
+Stop the TCG sampling profiler.
+
+Example:
+
+-> { "execute": "tcg-profile-stop" }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "tcg-profile-stop",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_tcg_profile_stop,
+    },
+
+SQMP
+tcg-profile-dump
+----------------
+
+Write the TCG profiler results to a file in folded stack format.
+
+Arguments:
+
+- "filename": file path (json-string)
+
+Example:
+
+-> { "execute": "tcg-profile-dump",
+     "arguments": { "filename": "/tmp/guest.folded" } }
+<- { "return": {} }
+
+EQMP
+
+    {
+        .name       = "tcg-profile-dump",
+        .args_type  = "filename:s",
+        .mhandler.cmd_new = qmp_marshal_input_tcg_profile_dump,
+    },
+
+SQMP
+query-icount
+------------
+
+Return the state of instruction counting.
+
+Return a json-object with the following information:
+
+- "enabled": true if -icount is in use (json-bool)
+- "adaptive": true for -icount auto (json-bool)
+- "shift": virtual nanoseconds per instruction, as a power of 2 (json-int)
+- "instructions": guest instructions executed (json-int)
+- "mips": average guest speed in millions of instructions per second
+          (json-int)
+- "shift-increases": adjustments that sped the virtual clock up (json-int)
+- "shift-decreases": adjustments that slowed the virtual clock down
+                     (json-int)
+
+Example:
+
+-> { "execute": "query-icount" }
+<- { "return": { "enabled": true, "adaptive": true, "shift": 2,
+                 "instructions": 7240114812, "mips": 261,
+                 "shift-increases": 3, "shift-decreases": 4 } }
+
+EQMP
+
+    {
+        .name       = "query-icount",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_input_query_icount,
+    },
@@ -0,0 +1,586 @@
+/*
+ * Deterministic record/replay
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The journal is a small header followed by a stream of events.  Each event
+ * is a kind byte, the number of instructions executed since the previous
+ * event as a variable length integer, and a payload that depends on the
+ * kind.  Recording only appends to a buffered file under the global mutex,
+ * so it is cheap enough to leave enabled.
+ *
+ * Inputs are recorded when the I/O thread delivers them; the vCPU thread is
+ * then outside cpu_exec() and the instruction counter is exact.  On replay,
+ * the vCPU thread stops at the recorded instruction counts and delivers the
+ * journal entries itself, in journal order.
+ */
+
+#include "cpu.h"
+#include "qemu-common.h"
+#include "qemu-char.h"
+#include "qemu-timer.h"
+#include "qemu-queue.h"
+#include "main-loop.h"
+#include "sysemu.h"
+#include "net.h"
+#include "net/queue.h"
+#include "iov.h"
+#include "replay.h"
+
+#define REPLAY_MAGIC            "QRJ\n"
+#define REPLAY_VERSION          1
+#define REPLAY_BUFFER_SIZE      (64 * 1024)
+#define REPLAY_FLUSH_MS         1000
+#define REPLAY_MAX_PAYLOAD      (16 * 1024 * 1024)
+
+enum {
+    REPLAY_EVENT_CHAR,          /* chardev index, length, data */
+    REPLAY_EVENT_NET,           /* net client index, flags, length, data */
+    REPLAY_EVENT_ASYNC,         /* disk request id */
+    REPLAY_EVENT_TIMERS,        /* vm_clock timers ran */
+    REPLAY_EVENT_BH,            /* guest bottom halves ran */
+    REPLAY_EVENT_WARP,          /* vm_clock advanced by n ns while idle */
+    REPLAY_EVENT_END,
+};
+
+typedef struct ReplayEvent {
+    int kind;
+    int64_t icount;
+    uint64_t index;
+    uint64_t value;
+    uint8_t *buf;
+    uint64_t size;
+} ReplayEvent;
+
+typedef struct ReplayCompletion {
+    uint64_t id;
+    void (*cb)(void *opaque, int ret);
+    void *opaque;
+    int ret;
+    QSIMPLEQ_ENTRY(ReplayCompletion) next;
+} ReplayCompletion;
+
+ReplayMode replay_mode;
+
+static FILE *replay_file;
+static QEMUTimer *replay_flush_timer;
+static int64_t replay_time;
+static int64_t replay_last_icount;
+static uint64_t replay_next_id = 1;
+
+/* play mode: the next journal entry, valid while replay_playing */
+static ReplayEvent replay_event;
+static uint64_t replay_buf_size;
+static bool replay_playing;
+static bool replay_stopping;
+
+static QSIMPLEQ_HEAD(, ReplayCompletion) replay_completions =
+    QSIMPLEQ_HEAD_INITIALIZER(replay_completions);
+
+static CharDriverState **replay_chardevs;
+static int replay_nb_chardevs;
+static VLANClientState **replay_net_clients;
+static int replay_nb_net_clients;
+
+/***********************************************************/
+/* journal encoding */
+
+static void replay_put_varint(uint64_t v)
+{
+    while (v >= 0x80) {
+        putc((v & 0x7f) | 0x80, replay_file);
+        v >>= 7;
+    }
+    putc(v, replay_file);
+}
+
+static void replay_put_event(int kind)
+{
+    int64_t icount = cpu_get_icount_raw();
+
+    if (!qemu_timer_pending(replay_flush_timer)) {
+        qemu_mod_timer(replay_flush_timer,
+                       qemu_get_clock_ms(rt_clock) + REPLAY_FLUSH_MS);
+    }
+    putc(kind, replay_file);
+    replay_put_varint(icount - replay_last_icount);
+    replay_last_icount = icount;
+}
+
+static uint64_t replay_get_varint(void)
+{
+    uint64_t v = 0;
+    int shift = 0;
+    int c;
+
+    do {
+        c = getc(replay_file);
+        if (c == EOF) {
+            return 0;
+        }
+        v |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while ((c & 0x80) && shift < 64);
+    return v;
+}
+
+/* Entries reach the file at most REPLAY_FLUSH_MS after they are made.  */
+static void replay_flush(void *opaque)
+{
+    fflush(replay_file);
+}
+
+/* Read the next entry into replay_event.  A truncated journal, as left by
+   a recording that was killed, ends at its last complete entry.  */
+static void replay_fetch_event(void)
+{
+    ReplayEvent *ev = &replay_event;
+    int kind;
+
+    kind = getc(replay_file);
+    if (kind == EOF) {
+        ev->kind = REPLAY_EVENT_END;
+        return;
+    }
+    ev->kind = kind;
+    ev->icount += replay_get_varint();
+
+    switch (kind) {
+    case REPLAY_EVENT_CHAR:
+    case REPLAY_EVENT_NET:
+        ev->index = replay_get_varint();
+        ev->value = kind == REPLAY_EVENT_NET ? replay_get_varint() : 0;
+        ev->size = replay_get_varint();
+        if (ev->size > REPLAY_MAX_PAYLOAD) {
+            fprintf(stderr, "replay: corrupt journal entry\n");
+            ev->kind = REPLAY_EVENT_END;
+            return;
+        }
+        if (ev->size > replay_buf_size) {
+            replay_buf_size = ev->size;
+            ev->buf = g_realloc(ev->buf, replay_buf_size);
+        }
+        if (fread(ev->buf, 1, ev->size, replay_file) != ev->size) {
+            ev->kind = REPLAY_EVENT_END;
+            return;
+        }
+        break;
+    case REPLAY_EVENT_ASYNC:
+    case REPLAY_EVENT_WARP:
+        ev->value = replay_get_varint();
+        break;
+    case REPLAY_EVENT_TIMERS:
+    case REPLAY_EVENT_BH:
+    case REPLAY_EVENT_END:
+        break;
+    default:
+        fprintf(stderr, "replay: unknown journal entry %d\n", kind);
+        ev->kind = REPLAY_EVENT_END;
+        return;
+    }
+    if (feof(replay_file)) {
+        ev->kind = REPLAY_EVENT_END;
+    }
+}
+
+/***********************************************************/
+/* setup */
+
+void replay_configure(QemuOpts *opts)
+{
+    const char *mode = qemu_opt_get(opts, "mode");
+    const char *filename = qemu_opt_get(opts, "file");
+    char magic[4];
+
+    if (!filename) {
+        fprintf(stderr, "-replay: a journal file is required\n");
+        exit(1);
+    }
+    if (!mode || !strcmp(mode, "record")) {
+        replay_mode = REPLAY_MODE_RECORD;
+    } else if (!strcmp(mode, "play")) {
+        replay_mode = REPLAY_MODE_PLAY;
+    } else {
+        fprintf(stderr, "-replay: invalid mode '%s'\n", mode);
+        exit(1);
+    }
+
+    replay_file = fopen(filename,
+                        replay_mode == REPLAY_MODE_RECORD ? "wb" : "rb");
+    if (!replay_file) {
+        fprintf(stderr, "-replay: cannot open %s: %s\n", filename,
+                strerror(errno));
+        exit(1);
+    }
+    setvbuf(replay_file, NULL, _IOFBF, REPLAY_BUFFER_SIZE);
+
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_time = time(NULL);
+        fwrite(REPLAY_MAGIC, 1, sizeof(magic), replay_file);
+        replay_put_varint(REPLAY_VERSION);
+        replay_put_varint(replay_time);
+        replay_flush_timer = qemu_new_timer_ms(rt_clock, replay_flush, NULL);
+    } else {
+        if (fread(magic, 1, sizeof(magic), replay_file) != sizeof(magic) ||
+            memcmp(magic, REPLAY_MAGIC, sizeof(magic)) ||
+            replay_get_varint() != REPLAY_VERSION) {
+            fprintf(stderr, "-replay: %s is not a replay journal\n",
+                    filename);
+            exit(1);
+        }
+        replay_time = replay_get_varint();
+        replay_playing = true;
+        replay_fetch_event();
+    }
+}
+
+void replay_finish(void)
+{
+    if (!replay_file) {
+        return;
+    }
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_put_event(REPLAY_EVENT_END);
+        qemu_del_timer(replay_flush_timer);
+    }
+    fclose(replay_file);
+    replay_file = NULL;
+}
+
+/* Host time at the start of the recording, used for the guest RTCs.  */
+int64_t replay_start_time(void)
+{
+    return replay_time;
+}
+
+/***********************************************************/
+/* input sources */
+
+static int replay_find(void **table, int nb, void *p)
+{
+    int i;
+
+    for (i = 0; i < nb; i++) {
+        if (table[i] == p) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Chardevs and net clients are identified by their creation order, which
+   is the same in both runs as long as the command line is.  */
+void replay_register_char(CharDriverState *chr)
+{
+    if (replay_mode == REPLAY_MODE_NONE) {
+        return;
+    }
+    replay_chardevs = g_renew(CharDriverState *, replay_chardevs,
+                              replay_nb_chardevs + 1);
+    replay_chardevs[replay_nb_chardevs++] = chr;
+}
+
+void replay_unregister_char(CharDriverState *chr)
+{
+    int i = replay_find((void **)replay_chardevs, replay_nb_chardevs, chr);
+
+    if (i >= 0) {
+        replay_chardevs[i] = NULL;
+    }
+}
+
+void replay_register_net(VLANClientState *vc)
+{
+    if (replay_mode == REPLAY_MODE_NONE) {
+        return;
+    }
+    replay_net_clients = g_renew(VLANClientState *, replay_net_clients,
+                                 replay_nb_net_clients + 1);
+    replay_net_clients[replay_nb_net_clients++] = vc;
+}
+
+void replay_unregister_net(VLANClientState *vc)
+{
+    int i = replay_find((void **)replay_net_clients, replay_nb_net_clients,
+                        vc);
+
+    if (i >= 0) {
+        replay_net_clients[i] = NULL;
+    }
+}
+
+/* Whether an input comes from outside the guest.  Writes done by the vCPU
+   thread follow from guest execution (or are the replayed entries
+   themselves) and pass through untouched.  */
+static bool replay_is_external(void)
+{
+    if (qemu_in_vcpu_thread()) {
+        return false;
+    }
+    return replay_mode == REPLAY_MODE_RECORD || replay_playing;
+}
+
+bool replay_char_write(CharDriverState *chr, const uint8_t *buf, int len)
+{
+    int index;
+
+    if (!replay_is_external()) {
+        return false;
+    }
+    index = replay_find((void **)replay_chardevs, replay_nb_chardevs, chr);
+    if (index < 0) {
+        return false;
+    }
+    if (replay_mode == REPLAY_MODE_PLAY) {
+        return true;
+    }
+    replay_put_event(REPLAY_EVENT_CHAR);
+    replay_put_varint(index);
+    replay_put_varint(len);
+    fwrite(buf, 1, len, replay_file);
+    return false;
+}
+
+bool replay_net_send(VLANClientState *sender, unsigned flags,
+                     const struct iovec *iov, int iovcnt)
+{
+    int index;
+    int i;
+
+    if (sender->info->type == NET_CLIENT_TYPE_NIC || !replay_is_external()) {
+        return false;
+    }
+    index = replay_find((void **)replay_net_clients, replay_nb_net_clients,
+                        sender);
+    if (index < 0) {
+        return false;
+    }
+    if (replay_mode == REPLAY_MODE_PLAY) {
+        return true;
+    }
+    replay_put_event(REPLAY_EVENT_NET);
+    replay_put_varint(index);
+    replay_put_varint(flags);
+    replay_put_varint(iov_size(iov, iovcnt));
+    for (i = 0; i < iovcnt; i++) {
+        fwrite(iov[i].iov_base, 1, iov[i].iov_len, replay_file);
+    }
+    return false;
+}
+
+void replay_warp(int64_t delta)
+{
+    replay_put_event(REPLAY_EVENT_WARP);
+    replay_put_varint(delta);
+}
+
+/***********************************************************/
+/* disk requests */
+
+/* Requests of guest devices are numbered in submission order, which is
+   part of the deterministic guest execution; their completions are
+   journaled by number.  */
+uint64_t replay_block_request(void)
+{
+    if (replay_mode == REPLAY_MODE_NONE) {
+        return 0;
+    }
+    return replay_next_id++;
+}
+
+void replay_block_complete(uint64_t id, void (*cb)(void *opaque, int ret),
+                           void *opaque, int ret)
+{
+    ReplayCompletion *c = g_new(ReplayCompletion, 1);
+
+    c->id = id;
+    c->cb = cb;
+    c->opaque = opaque;
+    c->ret = ret;
+    QSIMPLEQ_INSERT_TAIL(&replay_completions, c, next);
+    if (!qemu_in_vcpu_thread()) {
+        qemu_cpu_kick(first_cpu);
+    }
+}
+
+static void replay_run_completion(ReplayCompletion *c)
+{
+    c->cb(c->opaque, c->ret);
+    g_free(c);
+}
+
+/* Called when a request is cancelled: all outstanding requests have been
+   drained, and the callbacks must run before the cancellation returns.  The
+   set of pending completions is the same in both runs at this point, so
+   they are not journaled.  */
+void replay_block_flush(void)
+{
+    ReplayCompletion *c;
+
+    while ((c = QSIMPLEQ_FIRST(&replay_completions)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&replay_completions, next);
+        replay_run_completion(c);
+    }
+}
+
+static ReplayCompletion *replay_take_completion(uint64_t id)
+{
+    ReplayCompletion *c;
+
+    QSIMPLEQ_FOREACH(c, &replay_completions, next) {
+        if (c->id == id) {
+            QSIMPLEQ_REMOVE(&replay_completions, c, ReplayCompletion, next);
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/***********************************************************/
+/* checkpoints */
+
+static void replay_stop(const char *msg)
+{
+    fprintf(stderr, "replay: %s at instruction %" PRId64 "\n", msg,
+            cpu_get_icount_raw());
+    replay_playing = false;
+    replay_stopping = true;
+    vm_stop(RUN_STATE_PAUSED);
+}
+
+/* Run the deferred guest work, journaling it when recording.  This is also
+   what happens once a replay has reached the end of its journal.  */
+static bool replay_run_pending(bool record)
+{
+    ReplayCompletion *c;
+    bool progress = false;
+
+    while ((c = QSIMPLEQ_FIRST(&replay_completions)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(&replay_completions, next);
+        if (record) {
+            replay_put_event(REPLAY_EVENT_ASYNC);
+            replay_put_varint(c->id);
+        }
+        replay_run_completion(c);
+        progress = true;
+    }
+    /* Neither timers nor bottom halves journal anything themselves, so
+       they can be logged after the fact.  */
+    if (qemu_run_timers(vm_clock)) {
+        if (record) {
+            replay_put_event(REPLAY_EVENT_TIMERS);
+        }
+        progress = true;
+    }
+    if (qemu_bh_poll_guest()) {
+        if (record) {
+            replay_put_event(REPLAY_EVENT_BH);
+        }
+        progress = true;
+    }
+    return progress;
+}
+
+/* Deliver the journal entries due at the current instruction count.  */
+static bool replay_play_events(void)
+{
+    ReplayEvent *ev = &replay_event;
+    int64_t icount = cpu_get_icount_raw();
+    ReplayCompletion *c;
+    bool progress = false;
+
+    while (replay_playing && ev->icount == icount) {
+        switch (ev->kind) {
+        case REPLAY_EVENT_CHAR:
+            if (ev->index < replay_nb_chardevs &&
+                replay_chardevs[ev->index] &&
+                replay_chardevs[ev->index]->chr_read) {
+                qemu_chr_be_write(replay_chardevs[ev->index], ev->buf,
+                                  ev->size);
+            }
+            break;
+        case REPLAY_EVENT_NET:
+            if (ev->index < replay_nb_net_clients &&
+                replay_net_clients[ev->index]) {
+                if (ev->value & QEMU_NET_PACKET_FLAG_RAW) {
+                    qemu_send_packet_raw(replay_net_clients[ev->index],
+                                         ev->buf, ev->size);
+                } else {
+                    qemu_send_packet(replay_net_clients[ev->index],
+                                     ev->buf, ev->size);
+                }
+            }
+            break;
+        case REPLAY_EVENT_ASYNC:
+            c = replay_take_completion(ev->value);
+            if (!c) {
+                /* still in flight; replay_blocked() waits for it */
+                return progress;
+            }
+            replay_run_completion(c);
+            break;
+        case REPLAY_EVENT_TIMERS:
+            qemu_run_timers(vm_clock);
+            break;
+        case REPLAY_EVENT_BH:
+            qemu_bh_poll_guest();
+            break;
+        case REPLAY_EVENT_WARP:
+            cpu_warp_icount(ev->value);
+            break;
+        case REPLAY_EVENT_END:
+            replay_stop("end of the journal");
+            return true;
+        }
+        progress = true;
+        replay_fetch_event();
+    }
+
+    if (replay_playing &&
+        (ev->icount < icount ||
+         (runstate_is_running() && all_cpu_threads_idle()))) {
+        /* Either the entry was skipped, or the guest went to sleep where
+           it did not during the recording.  */
+        replay_stop("execution diverged from the journal");
+        return true;
+    }
+    return progress;
+}
+
+/* Called by the vCPU thread outside cpu_exec().  Returns whether any guest
+   work was done.  */
+bool replay_checkpoint(void)
+{
+    if (replay_mode == REPLAY_MODE_PLAY && replay_playing) {
+        return replay_play_events();
+    }
+    return replay_run_pending(replay_mode == REPLAY_MODE_RECORD);
+}
+
+/* Whether the vCPUs must not run yet: a journaled disk completion is
+   still in flight, or a replay that stopped waits for the pause.  */
+bool replay_blocked(void)
+{
+    if (replay_stopping) {
+        if (first_cpu->stop || first_cpu->stopped) {
+            replay_stopping = false;
+            return false;
+        }
+        return true;
+    }
+    return replay_playing && replay_event.kind == REPLAY_EVENT_ASYNC &&
+           replay_event.icount == cpu_get_icount_raw();
+}
+
+/* Limit the instructions executed before the next journal entry.  */
+int64_t replay_icount_budget(int64_t count)
+{
+    int64_t left;
+
+    if (!replay_playing) {
+        return count;
+    }
+    left = replay_event.icount - cpu_get_icount_raw();
+    return MAX(MIN(count, left), 0);
+}
@@ -0,0 +1,57 @@
+#ifndef QEMU_REPLAY_H
+#define QEMU_REPLAY_H
+
+#include "qemu-common.h"
+#include "qemu-option.h"
+
+/*
+ * Deterministic record/replay on top of -icount.
+ *
+ * In record mode every input that reaches the guest from outside (chardev
+ * input, packets from net backends, completions of guest disk requests and
+ * warps of the virtual clock while the CPUs sleep) is written to a journal
+ * together with the instruction count at which it was delivered.  In play
+ * mode the real inputs are dropped and the journal entries are delivered
+ * again at the same instruction counts.
+ *
+ * To give the remaining guest-visible work a well defined place in the
+ * instruction stream, vm_clock timers, guest bottom halves and disk
+ * completions run in the vCPU thread at checkpoints while either mode is
+ * active, instead of in the I/O thread.
+ */
+
+typedef enum ReplayMode {
+    REPLAY_MODE_NONE,
+    REPLAY_MODE_RECORD,
+    REPLAY_MODE_PLAY,
+} ReplayMode;
+
+extern ReplayMode replay_mode;
+
+void replay_configure(QemuOpts *opts);
+void replay_finish(void);
+int64_t replay_start_time(void);
+
+/* vCPU thread */
+bool replay_checkpoint(void);
+bool replay_blocked(void);
+int64_t replay_icount_budget(int64_t count);
+void replay_warp(int64_t delta);
+
+/* External inputs.  They return true if the input must be dropped.  */
+void replay_register_char(CharDriverState *chr);
+void replay_unregister_char(CharDriverState *chr);
+bool replay_char_write(CharDriverState *chr, const uint8_t *buf, int len);
+
+void replay_register_net(VLANClientState *vc);
+void replay_unregister_net(VLANClientState *vc);
+bool replay_net_send(VLANClientState *sender, unsigned flags,
+                     const struct iovec *iov, int iovcnt);
+
+/* Disk requests of guest devices */
+uint64_t replay_block_request(void);
+void replay_block_complete(uint64_t id, void (*cb)(void *opaque, int ret),
+                           void *opaque, int ret);
+void replay_block_flush(void);
+
+#endif
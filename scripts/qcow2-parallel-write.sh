@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# Times concurrent allocating writes to a fresh qcow2 image and checks them
+#
+# Issues COUNT aio_writes of SIZE bytes in shuffled order through a single
+# qemu-io, so that they are all in flight at once, then reads every one back
+# with its pattern and runs qemu-img check on the result.  Arguments after --
+# are passed to the writing qemu-io, e.g. -- -n to use cache=none; without
+# them the image is opened writethrough, which exercises L2 write-back.
+#
+# Usage: qcow2-parallel-write.sh [-c count] [-s size] [-r runs] [-- qemu-io args]
+#
+# QEMU_IO and QEMU_IMG select the binaries, TMPDIR the scratch directory.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+
+QEMU_IO=${QEMU_IO:-./qemu-io}
+QEMU_IMG=${QEMU_IMG:-./qemu-img}
+
+count=2048
+size=65536
+runs=5
+
+while getopts "c:s:r:" opt; do
+    case $opt in
+    c) count=$OPTARG ;;
+    s) size=$OPTARG ;;
+    r) runs=$OPTARG ;;
+    *) echo "usage: $0 [-c count] [-s size] [-r runs] [-- qemu-io args]" >&2
+       exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/qcow2-pw.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT
+img=$dir/test.qcow2
+
+# One line per write: offset and pattern, in shuffled order
+awk -v n="$count" -v size="$size" 'BEGIN {
+    srand(1);
+    for (i = 0; i < n; i++) {
+        printf "%.6f %d %d\n", rand(), i * size, i % 255 + 1;
+    }
+}' | sort -n | cut -d' ' -f2- > "$dir/writes"
+
+while read -r off pat; do
+    echo "aio_write -q -P $pat $off $size"
+done < "$dir/writes" > "$dir/write-cmds"
+echo "aio_flush" >> "$dir/write-cmds"
+
+while read -r off pat; do
+    echo "read -q -P $pat $off $size"
+done < "$dir/writes" > "$dir/read-cmds"
+
+run=1
+while [ $run -le "$runs" ]; do
+    "$QEMU_IMG" create -f qcow2 "$img" $((count * size)) > /dev/null || exit 1
+
+    start=$(date +%s%N)
+    "$QEMU_IO" "$@" "$img" < "$dir/write-cmds" > "$dir/write-out" 2>&1
+    end=$(date +%s%N)
+
+    if grep -q "failed\|error" "$dir/write-out"; then
+        echo "run $run: write failed" >&2
+        cat "$dir/write-out" >&2
+        exit 1
+    fi
+    if "$QEMU_IO" "$img" < "$dir/read-cmds" 2>&1 | grep -q "mismatch\|failed"; then
+        echo "run $run: pattern mismatch" >&2
+        exit 1
+    fi
+    if ! "$QEMU_IMG" check "$img" > "$dir/check-out" 2>&1; then
+        echo "run $run: qemu-img check failed" >&2
+        cat "$dir/check-out" >&2
+        exit 1
+    fi
+
+    echo "run $run: $count x $size bytes in $(((end - start) / 1000000)) ms"
+    run=$((run + 1))
+done
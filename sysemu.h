@@ -176,4 +176,8 @@ void register_devices(void);
 void add_boot_device_path(int32_t bootindex, DeviceState *dev,
                           const char *suffix);
 char *get_boot_devices_list(uint32_t *size);
+
+/* translated code profiler */
+void tcg_profile_init(QemuOpts *opts);
+void tcg_profile_exit(void);
 #endif
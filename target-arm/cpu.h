@@ -154,8 +154,20 @@ typedef struct CPUARMState {
         uint32_t c15_diagnostic; /* diagnostic register */
         uint32_t c15_power_diagnostic;
         uint32_t c15_power_control; /* power control */
+        uint32_t c15_pmnc; /* ARM11 performance monitor control */
     } cp15;
 
+    /* ARM11 performance monitor counters.  Each counter holds the value it
+       had when it was last brought up to date, and the running total of
+       its event at that time.  */
+    struct {
+        uint32_t count[3]; /* PMN0, PMN1, CCNT */
+        uint64_t base[3];
+        uint64_t insns; /* instructions executed, added per TB */
+        uint64_t itlb_miss; /* TLB refills for instruction fetches */
+        uint64_t dtlb_miss; /* TLB refills for data accesses */
+    } pmu;
+
     struct {
         uint32_t other_sp;
         uint32_t vecbase;
@@ -242,6 +254,8 @@ void cpu_arm_close(CPUARMState *s);
 void do_interrupt(CPUARMState *);
 void switch_mode(CPUARMState *, int);
 uint32_t do_arm_semihosting(CPUARMState *env);
+void arm11_pmu_sync(CPUARMState *env);
+void arm11_pmu_rebase(CPUARMState *env);
 
 /* you can call this signal handler from your SIGBUS and SIGSEGV
    signal handlers to inform the virtual CPU of exceptions. non zero
@@ -383,6 +397,7 @@ enum arm_features {
     ARM_FEATURE_ARM_DIV, /* divide supported in ARM encoding */
     ARM_FEATURE_VFP4, /* VFPv4 (implies that NEON is v2) */
     ARM_FEATURE_GENERIC_TIMER,
+    ARM_FEATURE_ARM11_PMU, /* ARM11 cp15 c15 performance monitor */
 };
 
 static inline int arm_feature(CPUARMState *env, int feature)
@@ -455,7 +470,7 @@ void cpu_arm_set_cp_io(CPUARMState *env, int cpnum,
 #define cpu_signal_handler cpu_arm_signal_handler
 #define cpu_list arm_cpu_list
 
-#define CPU_SAVE_VERSION 6
+#define CPU_SAVE_VERSION 7
 
 /* MMU modes definitions */
 #define MMU_MODE0_SUFFIX _kernel
@@ -490,7 +505,14 @@ static inline void cpu_clone_regs(CPUState *env, target_ulong newsp)
 #define ARM_TBFLAG_VFPEN_MASK       (1 << ARM_TBFLAG_VFPEN_SHIFT)
 #define ARM_TBFLAG_CONDEXEC_SHIFT   8
 #define ARM_TBFLAG_CONDEXEC_MASK    (0xff << ARM_TBFLAG_CONDEXEC_SHIFT)
-/* Bits 31..16 are currently unused. */
+/* Registers that change which coprocessor accesses are allowed.  Making
+   them part of the TB flags avoids flushing the TBs when they change.  */
+#define ARM_TBFLAG_PMUSEREN_SHIFT   16
+#define ARM_TBFLAG_PMUSEREN_MASK    (1 << ARM_TBFLAG_PMUSEREN_SHIFT)
+#define ARM_TBFLAG_TEECR_SHIFT      17
+#define ARM_TBFLAG_TEECR_MASK       (1 << ARM_TBFLAG_TEECR_SHIFT)
+#define ARM_TBFLAG_XSCALE_CPAR_SHIFT 18
+#define ARM_TBFLAG_XSCALE_CPAR_MASK (0x3fffU << ARM_TBFLAG_XSCALE_CPAR_SHIFT)
 
 /* some convenience accessor macros */
 #define ARM_TBFLAG_THUMB(F) \
@@ -505,6 +527,12 @@ static inline void cpu_clone_regs(CPUState *env, target_ulong newsp)
     (((F) & ARM_TBFLAG_VFPEN_MASK) >> ARM_TBFLAG_VFPEN_SHIFT)
 #define ARM_TBFLAG_CONDEXEC(F) \
     (((F) & ARM_TBFLAG_CONDEXEC_MASK) >> ARM_TBFLAG_CONDEXEC_SHIFT)
+#define ARM_TBFLAG_PMUSEREN(F) \
+    (((F) & ARM_TBFLAG_PMUSEREN_MASK) >> ARM_TBFLAG_PMUSEREN_SHIFT)
+#define ARM_TBFLAG_TEECR(F) \
+    (((F) & ARM_TBFLAG_TEECR_MASK) >> ARM_TBFLAG_TEECR_SHIFT)
+#define ARM_TBFLAG_XSCALE_CPAR(F) \
+    (((F) & ARM_TBFLAG_XSCALE_CPAR_MASK) >> ARM_TBFLAG_XSCALE_CPAR_SHIFT)
 
 static inline void cpu_get_tb_cpu_state(CPUState *env, target_ulong *pc,
                                         target_ulong *cs_base, int *flags)
@@ -527,6 +555,14 @@ static inline void cpu_get_tb_cpu_state(CPUState *env, target_ulong *pc,
     if (env->vfp.xregs[ARM_VFP_FPEXC] & (1 << 30)) {
         *flags |= ARM_TBFLAG_VFPEN_MASK;
     }
+    if (env->cp15.c9_pmuserenr) {
+        *flags |= ARM_TBFLAG_PMUSEREN_MASK;
+    }
+    if (env->teecr & 1) {
+        *flags |= ARM_TBFLAG_TEECR_MASK;
+    }
+    *flags |= (env->cp15.c15_cpar << ARM_TBFLAG_XSCALE_CPAR_SHIFT)
+        & ARM_TBFLAG_XSCALE_CPAR_MASK;
 }
 
 static inline bool cpu_has_work(CPUState *env)
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <float.h>
+#include <math.h>
 
 #include "cpu.h"
 #include "gdbstub.h"
@@ -94,6 +96,7 @@ static void cpu_reset_model_id(CPUARMState *env, uint32_t id)
          */
         set_feature(env, ARM_FEATURE_V6);
         set_feature(env, ARM_FEATURE_VFP);
+        set_feature(env, ARM_FEATURE_ARM11_PMU);
         /* These ID register values are correct for 1136 but may be wrong
          * for 1136_r2 (in particular r0p2 does not actually implement most
          * of the ID registers).
@@ -109,6 +112,7 @@ static void cpu_reset_model_id(CPUARMState *env, uint32_t id)
     case ARM_CPUID_ARM1176:
         set_feature(env, ARM_FEATURE_V6K);
         set_feature(env, ARM_FEATURE_VFP);
+        set_feature(env, ARM_FEATURE_ARM11_PMU);
         set_feature(env, ARM_FEATURE_VAPA);
         env->vfp.xregs[ARM_VFP_FPSID] = 0x410120b5;
         env->vfp.xregs[ARM_VFP_MVFR0] = 0x11111111;
@@ -121,6 +125,7 @@ static void cpu_reset_model_id(CPUARMState *env, uint32_t id)
     case ARM_CPUID_ARM11MPCORE:
         set_feature(env, ARM_FEATURE_V6K);
         set_feature(env, ARM_FEATURE_VFP);
+        set_feature(env, ARM_FEATURE_ARM11_PMU);
         set_feature(env, ARM_FEATURE_VAPA);
         env->vfp.xregs[ARM_VFP_FPSID] = 0x410120b4;
         env->vfp.xregs[ARM_VFP_MVFR0] = 0x11111111;
@@ -1450,6 +1455,133 @@ static uint32_t extended_mpu_ap_bits(uint32_t val)
     return ret;
 }
 
+/* ARM11 performance monitor (c15, c12).  The counters are not incremented
+   one by one: instructions are counted per TB by the translator, TLB refills
+   in tlb_fill() and cycles follow vm_clock (one cycle per nanosecond, which
+   with -icount makes them deterministic).  A counter is brought up to date
+   from these running totals only when it is accessed.  Events that are not
+   modelled never occur.  */
+
+#define ARM11_PMNC_E            (1 << 0)   /* enable */
+#define ARM11_PMNC_P            (1 << 1)   /* reset PMN0 and PMN1 */
+#define ARM11_PMNC_C            (1 << 2)   /* reset CCNT */
+#define ARM11_PMNC_D            (1 << 3)   /* CCNT counts every 64th cycle */
+#define ARM11_PMNC_FLAGS_SHIFT  8          /* overflow flags, write 1 to clear */
+#define ARM11_PMNC_WMASK        0x0ffff879
+
+enum {
+    ARM11_PMN0,
+    ARM11_PMN1,
+    ARM11_CCNT,
+};
+
+static uint64_t arm11_pmu_total(CPUState *env, int counter)
+{
+    uint32_t pmnc = env->cp15.c15_pmnc;
+    uint64_t cycles;
+    int event;
+
+    if (counter == ARM11_CCNT) {
+        event = 0xff;
+    } else {
+        event = (pmnc >> (counter == ARM11_PMN0 ? 20 : 12)) & 0xff;
+    }
+    switch (event) {
+    case 0x03: /* instruction MicroTLB miss */
+        return env->pmu.itlb_miss;
+    case 0x04: /* data MicroTLB miss */
+        return env->pmu.dtlb_miss;
+    case 0x07: /* instruction executed */
+        return env->pmu.insns;
+    case 0x0f: /* main TLB miss */
+        return env->pmu.itlb_miss + env->pmu.dtlb_miss;
+    case 0xff: /* cycle */
+        cycles = qemu_get_clock_ns(vm_clock);
+        if (counter == ARM11_CCNT && (pmnc & ARM11_PMNC_D)) {
+            cycles >>= 6;
+        }
+        return cycles;
+    default:
+        return 0;
+    }
+}
+
+/* Bring the counters up to date, setting the overflow flags of those
+   that wrapped.  */
+void arm11_pmu_sync(CPUState *env)
+{
+    uint64_t total, delta;
+    int i;
+
+    if (!(env->cp15.c15_pmnc & ARM11_PMNC_E)) {
+        return;
+    }
+    for (i = 0; i < 3; i++) {
+        total = arm11_pmu_total(env, i);
+        delta = total - env->pmu.base[i];
+        if (env->pmu.count[i] + delta > 0xffffffffu) {
+            env->cp15.c15_pmnc |= 1 << (ARM11_PMNC_FLAGS_SHIFT + i);
+        }
+        env->pmu.count[i] += delta;
+        env->pmu.base[i] = total;
+    }
+}
+
+/* Restart counting from the current totals, after the events or the
+   enable bit changed.  */
+void arm11_pmu_rebase(CPUState *env)
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        env->pmu.base[i] = arm11_pmu_total(env, i);
+    }
+}
+
+static void arm11_pmu_write(CPUState *env, int op2, uint32_t val)
+{
+    arm11_pmu_sync(env);
+    switch (op2) {
+    case 0: /* performance monitor control */
+        env->cp15.c15_pmnc &= ~(val & (7 << ARM11_PMNC_FLAGS_SHIFT));
+        env->cp15.c15_pmnc = (env->cp15.c15_pmnc & ~ARM11_PMNC_WMASK)
+                             | (val & ARM11_PMNC_WMASK);
+        if (val & ARM11_PMNC_P) {
+            env->pmu.count[ARM11_PMN0] = 0;
+            env->pmu.count[ARM11_PMN1] = 0;
+        }
+        if (val & ARM11_PMNC_C) {
+            env->pmu.count[ARM11_CCNT] = 0;
+        }
+        break;
+    case 1: /* cycle counter */
+        env->pmu.count[ARM11_CCNT] = val;
+        break;
+    case 2: /* count register 0 */
+        env->pmu.count[ARM11_PMN0] = val;
+        break;
+    case 3: /* count register 1 */
+        env->pmu.count[ARM11_PMN1] = val;
+        break;
+    }
+    arm11_pmu_rebase(env);
+}
+
+static uint32_t arm11_pmu_read(CPUState *env, int op2)
+{
+    arm11_pmu_sync(env);
+    switch (op2) {
+    case 0: /* performance monitor control */
+        return env->cp15.c15_pmnc;
+    case 1: /* cycle counter */
+        return env->pmu.count[ARM11_CCNT];
+    case 2: /* count register 0 */
+        return env->pmu.count[ARM11_PMN0];
+    default: /* count register 1 */
+        return env->pmu.count[ARM11_PMN1];
+    }
+}
+
 void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
 {
     int op1;
@@ -1498,11 +1630,9 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
         case 2:
             if (arm_feature(env, ARM_FEATURE_XSCALE))
                 goto bad_reg;
-            if (env->cp15.c1_coproc != val) {
-                env->cp15.c1_coproc = val;
-                /* ??? Is this safe when called from within a TB?  */
-                tb_flush(env);
-            }
+            /* Not used at translation time, VFP accesses depend on
+               FPEXC.EN which is part of the TB flags.  */
+            env->cp15.c1_coproc = val;
             break;
         default:
             goto bad_reg;
@@ -1749,9 +1879,9 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
             }
             switch (op2) {
             case 0: /* user enable */
+                /* changes access rights for cp registers, which are
+                   part of the TB flags */
                 env->cp15.c9_pmuserenr = val & 1;
-                /* changes access rights for cp registers, so flush tbs */
-                tb_flush(env);
                 break;
             case 1: /* interrupt enable set */
                 /* We have no event counters so only the C bit can be changed */
@@ -1801,13 +1931,16 @@ void HELPER(set_cp15)(CPUState *env, uint32_t insn, uint32_t val)
         }
         goto bad_reg;
     case 15: /* Implementation specific.  */
+        if (arm_feature(env, ARM_FEATURE_ARM11_PMU)
+            && op1 == 0 && crm == 12 && op2 <= 3) {
+            arm11_pmu_write(env, op2, val);
+            break;
+        }
         if (arm_feature(env, ARM_FEATURE_XSCALE)) {
             if (op2 == 0 && crm == 1) {
-                if (env->cp15.c15_cpar != (val & 0x3fff)) {
-                    /* Changes cp0 to cp13 behavior, so needs a TB flush.  */
-                    tb_flush(env);
-                    env->cp15.c15_cpar = val & 0x3fff;
-                }
+                /* Changes cp0 to cp13 behavior, which is part of the
+                   TB flags.  */
+                env->cp15.c15_cpar = val & 0x3fff;
                 break;
             }
             goto bad_reg;
@@ -2191,6 +2324,10 @@ uint32_t HELPER(get_cp15)(CPUState *env, uint32_t insn)
         }
         goto bad_reg;
     case 15: /* Implementation specific.  */
+        if (arm_feature(env, ARM_FEATURE_ARM11_PMU)
+            && op1 == 0 && crm == 12 && op2 <= 3) {
+            return arm11_pmu_read(env, op2);
+        }
         if (arm_feature(env, ARM_FEATURE_XSCALE)) {
             if (op2 == 0 && crm == 1)
                 return env->cp15.c15_cpar;
@@ -2759,58 +2896,154 @@ void vfp_set_fpscr(CPUState *env, uint32_t val)
 
 #define VFP_HELPER(name, p) HELPER(glue(glue(vfp_,name),p))
 
-#define VFP_BINOP(name) \
-float32 VFP_HELPER(name, s)(float32 a, float32 b, void *fpstp) \
-{ \
-    float_status *fpst = fpstp; \
-    return float32_ ## name(a, b, fpst); \
-} \
-float64 VFP_HELPER(name, d)(float64 a, float64 b, void *fpstp) \
-{ \
-    float_status *fpst = fpstp; \
-    return float64_ ## name(a, b, fpst); \
+/* Host FPU fast path.  With round-to-nearest-even and the cumulative
+   inexact flag already set, an operation on zero or normal inputs whose
+   result is a finite normal number yields exactly the value and flags
+   softfloat would, so the host FPU can compute it.  Denormals, NaNs,
+   infinities, overflow, underflow and zero results are redone with
+   softfloat, which also covers flush-to-zero and default NaN mode.
+   Hosts that evaluate in extended precision (x87) would double round
+   and always take the softfloat path.  */
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define VFP_HOST_FPU 1
+#else
+#define VFP_HOST_FPU 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} VFPHostFloat32;
+
+typedef union {
+    float64 s;
+    double h;
+} VFPHostFloat64;
+
+static inline int vfp_host_fpu_ok(float_status *fpst)
+{
+    return VFP_HOST_FPU
+        && (get_float_exception_flags(fpst) & float_flag_inexact)
+        && fpst->float_rounding_mode == float_round_nearest_even;
 }
-VFP_BINOP(add)
-VFP_BINOP(sub)
-VFP_BINOP(mul)
-VFP_BINOP(div)
-#undef VFP_BINOP
 
-float32 VFP_HELPER(neg, s)(float32 a)
+static inline int vfp_f32_is_zero_or_normal(float32 a)
 {
-    return float32_chs(a);
+    uint32_t exp = float32_val(a) & 0x7f800000;
+    return (exp != 0 && exp != 0x7f800000) || float32_is_zero(a);
 }
 
-float64 VFP_HELPER(neg, d)(float64 a)
+static inline int vfp_f64_is_zero_or_normal(float64 a)
 {
-    return float64_chs(a);
+    uint64_t exp = float64_val(a) & 0x7ff0000000000000ULL;
+    return (exp != 0 && exp != 0x7ff0000000000000ULL) || float64_is_zero(a);
 }
 
-float32 VFP_HELPER(abs, s)(float32 a)
+static inline int vfp_f32_host_result_ok(float r)
 {
-    return float32_abs(a);
+    return fabsf(r) > FLT_MIN && fabsf(r) <= FLT_MAX;
 }
 
-float64 VFP_HELPER(abs, d)(float64 a)
+static inline int vfp_f64_host_result_ok(double r)
 {
-    return float64_abs(a);
+    return fabs(r) > DBL_MIN && fabs(r) <= DBL_MAX;
+}
+
+#define VFP_BINOP(name, op) \
+float32 VFP_HELPER(name, s)(float32 a, float32 b, void *fpstp) \
+{ \
+    float_status *fpst = fpstp; \
+    if (vfp_host_fpu_ok(fpst) && vfp_f32_is_zero_or_normal(a) \
+        && vfp_f32_is_zero_or_normal(b)) { \
+        VFPHostFloat32 ua, ub, ur; \
+        ua.s = a; \
+        ub.s = b; \
+        ur.h = ua.h op ub.h; \
+        if (vfp_f32_host_result_ok(ur.h)) { \
+            return ur.s; \
+        } \
+    } \
+    return float32_ ## name(a, b, fpst); \
+} \
+float64 VFP_HELPER(name, d)(float64 a, float64 b, void *fpstp) \
+{ \
+    float_status *fpst = fpstp; \
+    if (vfp_host_fpu_ok(fpst) && vfp_f64_is_zero_or_normal(a) \
+        && vfp_f64_is_zero_or_normal(b)) { \
+        VFPHostFloat64 ua, ub, ur; \
+        ua.s = a; \
+        ub.s = b; \
+        ur.h = ua.h op ub.h; \
+        if (vfp_f64_host_result_ok(ur.h)) { \
+            return ur.s; \
+        } \
+    } \
+    return float64_ ## name(a, b, fpst); \
 }
+VFP_BINOP(add, +)
+VFP_BINOP(sub, -)
+VFP_BINOP(mul, *)
+VFP_BINOP(div, /)
+#undef VFP_BINOP
 
 float32 VFP_HELPER(sqrt, s)(float32 a, CPUState *env)
 {
-    return float32_sqrt(a, &env->vfp.fp_status);
+    float_status *fpst = &env->vfp.fp_status;
+
+    if (vfp_host_fpu_ok(fpst) && vfp_f32_is_zero_or_normal(a)
+        && !float32_is_neg(a)) {
+        VFPHostFloat32 ua, ur;
+        ua.s = a;
+        ur.h = sqrtf(ua.h);
+        if (vfp_f32_host_result_ok(ur.h)) {
+            return ur.s;
+        }
+    }
+    return float32_sqrt(a, fpst);
 }
 
 float64 VFP_HELPER(sqrt, d)(float64 a, CPUState *env)
 {
-    return float64_sqrt(a, &env->vfp.fp_status);
-}
+    float_status *fpst = &env->vfp.fp_status;
+
+    if (vfp_host_fpu_ok(fpst) && vfp_f64_is_zero_or_normal(a)
+        && !float64_is_neg(a)) {
+        VFPHostFloat64 ua, ur;
+        ua.s = a;
+        ur.h = sqrt(ua.h);
+        if (vfp_f64_host_result_ok(ur.h)) {
+            return ur.s;
+        }
+    }
+    return float64_sqrt(a, fpst);
+}
+
+/* Comparing zero or normal numbers never raises an exception nor
+   depends on the rounding mode, so the host comparison can be used.  */
+#define VFP_HOST_CMP(p, htype) \
+    if (VFP_HOST_FPU && vfp_##p##_is_zero_or_normal(a) \
+        && vfp_##p##_is_zero_or_normal(b)) { \
+        htype ua, ub; \
+        ua.s = a; \
+        ub.s = b; \
+        if (ua.h == ub.h) { \
+            flags = 0x6; \
+        } else if (ua.h < ub.h) { \
+            flags = 0x8; \
+        } else { \
+            flags = 0x2; \
+        } \
+        env->vfp.xregs[ARM_VFP_FPSCR] = (flags << 28) \
+            | (env->vfp.xregs[ARM_VFP_FPSCR] & 0x0fffffff); \
+        return; \
+    }
 
 /* XXX: check quiet/signaling case */
-#define DO_VFP_cmp(p, type) \
+#define DO_VFP_cmp(p, type, f, htype) \
 void VFP_HELPER(cmp, p)(type a, type b, CPUState *env)  \
 { \
     uint32_t flags; \
+    VFP_HOST_CMP(f, htype) \
     switch(type ## _compare_quiet(a, b, &env->vfp.fp_status)) { \
     case 0: flags = 0x6; break; \
     case -1: flags = 0x8; break; \
@@ -2823,6 +3056,7 @@ void VFP_HELPER(cmp, p)(type a, type b, CPUState *env)  \
 void VFP_HELPER(cmpe, p)(type a, type b, CPUState *env) \
 { \
     uint32_t flags; \
+    VFP_HOST_CMP(f, htype) \
     switch(type ## _compare(a, b, &env->vfp.fp_status)) { \
     case 0: flags = 0x6; break; \
     case -1: flags = 0x8; break; \
@@ -2832,9 +3066,10 @@ void VFP_HELPER(cmpe, p)(type a, type b, CPUState *env) \
     env->vfp.xregs[ARM_VFP_FPSCR] = (flags << 28) \
         | (env->vfp.xregs[ARM_VFP_FPSCR] & 0x0fffffff); \
 }
-DO_VFP_cmp(s, float32)
-DO_VFP_cmp(d, float64)
+DO_VFP_cmp(s, float32, f32, VFPHostFloat32)
+DO_VFP_cmp(d, float64, f64, VFPHostFloat64)
 #undef DO_VFP_cmp
+#undef VFP_HOST_CMP
 
 /* Integer to float and float to integer conversions */
 
@@ -3230,9 +3465,6 @@ float64 VFP_HELPER(muladd, d)(float64 a, float64 b, float64 c, void *fpstp)
 
 void HELPER(set_teecr)(CPUState *env, uint32_t val)
 {
-    val &= 1;
-    if (env->teecr != val) {
-        env->teecr = val;
-        tb_flush(env);
-    }
+    /* part of the TB flags, translation ends after the write */
+    env->teecr = val & 1;
 }
@@ -82,10 +82,6 @@ DEF_HELPER_3(vfp_muls, f32, f32, f32, ptr)
 DEF_HELPER_3(vfp_muld, f64, f64, f64, ptr)
 DEF_HELPER_3(vfp_divs, f32, f32, f32, ptr)
 DEF_HELPER_3(vfp_divd, f64, f64, f64, ptr)
-DEF_HELPER_1(vfp_negs, f32, f32)
-DEF_HELPER_1(vfp_negd, f64, f64)
-DEF_HELPER_1(vfp_abss, f32, f32)
-DEF_HELPER_1(vfp_absd, f64, f64)
 DEF_HELPER_2(vfp_sqrts, f32, f32, env)
 DEF_HELPER_2(vfp_sqrtd, f64, f64, env)
 DEF_HELPER_3(vfp_cmps, void, f32, f32, env)
@@ -289,6 +285,58 @@ DEF_HELPER_2(neon_ceq_u8, i32, i32, i32)
 DEF_HELPER_2(neon_ceq_u16, i32, i32, i32)
 DEF_HELPER_2(neon_ceq_u32, i32, i32, i32)
 
+/* Whole quad register operations */
+DEF_HELPER_3(neon_add_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_add_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_add_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_sub_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_sub_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_sub_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qadd_s8_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qadd_u8_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qadd_s16_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qadd_u16_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qsub_s8_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qsub_u8_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qsub_s16_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_4(neon_qsub_u16_q, void, env, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cgt_s8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cgt_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cgt_s16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cgt_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cgt_s32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cgt_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cge_s8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cge_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cge_s16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cge_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cge_s32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_cge_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_max_s8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_max_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_max_s16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_max_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_max_s32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_max_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_min_s8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_min_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_min_s16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_min_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_min_s32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_min_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_abd_s8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_abd_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_abd_s16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_abd_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_abd_s32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_abd_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_ceq_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_ceq_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_ceq_u32_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_tst_u8_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_tst_u16_q, void, ptr, ptr, ptr)
+DEF_HELPER_3(neon_tst_u32_q, void, ptr, ptr, ptr)
+
 DEF_HELPER_1(neon_abs_s8, i32, i32)
 DEF_HELPER_1(neon_abs_s16, i32, i32)
 DEF_HELPER_1(neon_clz_u8, i32, i32)
@@ -110,6 +110,14 @@ void cpu_save(QEMUFile *f, void *opaque)
         qemu_put_be32(f, env->teecr);
         qemu_put_be32(f, env->teehbr);
     }
+
+    if (arm_feature(env, ARM_FEATURE_ARM11_PMU)) {
+        arm11_pmu_sync(env);
+        qemu_put_be32(f, env->cp15.c15_pmnc);
+        for (i = 0; i < 3; i++) {
+            qemu_put_be32(f, env->pmu.count[i]);
+        }
+    }
 }
 
 int cpu_load(QEMUFile *f, void *opaque, int version_id)
@@ -229,5 +237,13 @@ int cpu_load(QEMUFile *f, void *opaque, int version_id)
         env->teehbr = qemu_get_be32(f);
     }
 
+    if (arm_feature(env, ARM_FEATURE_ARM11_PMU)) {
+        env->cp15.c15_pmnc = qemu_get_be32(f);
+        for (i = 0; i < 3; i++) {
+            env->pmu.count[i] = qemu_get_be32(f);
+        }
+        arm11_pmu_rebase(env);
+    }
+
     return 0;
 }
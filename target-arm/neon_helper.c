@@ -13,6 +13,10 @@
 #include "exec-all.h"
 #include "helper.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define SIGNBIT (uint32_t)0x80000000
 #define SIGNBIT64 ((uint64_t)1 << 63)
 
@@ -2015,3 +2019,245 @@ void HELPER(neon_zip16)(CPUState *env, uint32_t rd, uint32_t rm)
     env->vfp.regs[rm] = make_float64(m0);
     env->vfp.regs[rd] = make_float64(d0);
 }
+
+/* Whole quad register operations.  The translator uses these for the Q
+   forms of the common elementwise integer ops instead of four calls on
+   32-bit chunks.  VD, VN and VM point to the 128-bit registers in
+   CPUState; VD may be the same register as either source.  On SSE2
+   hosts each op is a handful of vector instructions, elsewhere the
+   32-bit helpers are applied to each chunk.  */
+
+#ifdef __SSE2__
+
+static inline __m128i neon_sse2_signbits(int size)
+{
+    switch (size) {
+    case 0:
+        return _mm_set1_epi8(0x80);
+    case 1:
+        return _mm_set1_epi16(0x8000);
+    default:
+        return _mm_set1_epi32(0x80000000);
+    }
+}
+
+static inline __m128i neon_sse2_add(__m128i a, __m128i b, int size)
+{
+    switch (size) {
+    case 0:
+        return _mm_add_epi8(a, b);
+    case 1:
+        return _mm_add_epi16(a, b);
+    default:
+        return _mm_add_epi32(a, b);
+    }
+}
+
+static inline __m128i neon_sse2_sub(__m128i a, __m128i b, int size)
+{
+    switch (size) {
+    case 0:
+        return _mm_sub_epi8(a, b);
+    case 1:
+        return _mm_sub_epi16(a, b);
+    default:
+        return _mm_sub_epi32(a, b);
+    }
+}
+
+static inline __m128i neon_sse2_ceq(__m128i a, __m128i b, int size)
+{
+    switch (size) {
+    case 0:
+        return _mm_cmpeq_epi8(a, b);
+    case 1:
+        return _mm_cmpeq_epi16(a, b);
+    default:
+        return _mm_cmpeq_epi32(a, b);
+    }
+}
+
+/* SSE2 only has signed compares: bias unsigned operands by the sign bit. */
+static inline __m128i neon_sse2_cgt(__m128i a, __m128i b, int size, int u)
+{
+    if (u) {
+        a = _mm_xor_si128(a, neon_sse2_signbits(size));
+        b = _mm_xor_si128(b, neon_sse2_signbits(size));
+    }
+    switch (size) {
+    case 0:
+        return _mm_cmpgt_epi8(a, b);
+    case 1:
+        return _mm_cmpgt_epi16(a, b);
+    default:
+        return _mm_cmpgt_epi32(a, b);
+    }
+}
+
+static inline __m128i neon_sse2_not(__m128i a)
+{
+    return _mm_xor_si128(a, _mm_set1_epi32(-1));
+}
+
+/* Select A where MASK is set, B elsewhere.  */
+static inline __m128i neon_sse2_select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+static inline __m128i neon_sse2_max(__m128i a, __m128i b, int size, int u)
+{
+    return neon_sse2_select(neon_sse2_cgt(a, b, size, u), a, b);
+}
+
+static inline __m128i neon_sse2_min(__m128i a, __m128i b, int size, int u)
+{
+    return neon_sse2_select(neon_sse2_cgt(a, b, size, u), b, a);
+}
+
+static inline __m128i neon_sse2_abd(__m128i a, __m128i b, int size, int u)
+{
+    __m128i gt = neon_sse2_cgt(a, b, size, u);
+    return neon_sse2_sub(neon_sse2_select(gt, a, b),
+                         neon_sse2_select(gt, b, a), size);
+}
+
+static inline __m128i neon_sse2_tst(__m128i a, __m128i b, int size)
+{
+    return neon_sse2_not(neon_sse2_ceq(_mm_and_si128(a, b),
+                                       _mm_setzero_si128(), size));
+}
+
+static inline __m128i neon_sse2_qadd(CPUState *env, __m128i a, __m128i b,
+                                     int size, int u)
+{
+    __m128i res;
+
+    if (size == 0) {
+        res = u ? _mm_adds_epu8(a, b) : _mm_adds_epi8(a, b);
+    } else {
+        res = u ? _mm_adds_epu16(a, b) : _mm_adds_epi16(a, b);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(res, neon_sse2_add(a, b, size)))
+        != 0xffff) {
+        SET_QC();
+    }
+    return res;
+}
+
+static inline __m128i neon_sse2_qsub(CPUState *env, __m128i a, __m128i b,
+                                     int size, int u)
+{
+    __m128i res;
+
+    if (size == 0) {
+        res = u ? _mm_subs_epu8(a, b) : _mm_subs_epi8(a, b);
+    } else {
+        res = u ? _mm_subs_epu16(a, b) : _mm_subs_epi16(a, b);
+    }
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(res, neon_sse2_sub(a, b, size)))
+        != 0xffff) {
+        SET_QC();
+    }
+    return res;
+}
+
+#define NEON_QOP(name, expr, fn) \
+void HELPER(glue(glue(neon_, name), _q))(void *vd, void *vn, void *vm) \
+{ \
+    __m128i a = _mm_loadu_si128((__m128i *)vn); \
+    __m128i b = _mm_loadu_si128((__m128i *)vm); \
+    _mm_storeu_si128((__m128i *)vd, expr); \
+}
+
+#define NEON_QOP_ENV(name, expr, fn) \
+void HELPER(glue(glue(neon_, name), _q))(CPUState *env, void *vd, \
+                                         void *vn, void *vm) \
+{ \
+    __m128i a = _mm_loadu_si128((__m128i *)vn); \
+    __m128i b = _mm_loadu_si128((__m128i *)vm); \
+    _mm_storeu_si128((__m128i *)vd, expr); \
+}
+
+#else
+
+#define NEON_QOP(name, expr, fn) \
+void HELPER(glue(glue(neon_, name), _q))(void *vd, void *vn, void *vm) \
+{ \
+    uint32_t *d = vd; \
+    uint32_t *n = vn; \
+    uint32_t *m = vm; \
+    int i; \
+    for (i = 0; i < 4; i++) { \
+        d[i] = fn(n[i], m[i]); \
+    } \
+}
+
+#define NEON_QOP_ENV(name, expr, fn) \
+void HELPER(glue(glue(neon_, name), _q))(CPUState *env, void *vd, \
+                                         void *vn, void *vm) \
+{ \
+    uint32_t *d = vd; \
+    uint32_t *n = vn; \
+    uint32_t *m = vm; \
+    int i; \
+    for (i = 0; i < 4; i++) { \
+        d[i] = fn(env, n[i], m[i]); \
+    } \
+}
+
+static inline uint32_t neon_add_u32(uint32_t a, uint32_t b)
+{
+    return a + b;
+}
+
+static inline uint32_t neon_sub_u32(uint32_t a, uint32_t b)
+{
+    return a - b;
+}
+
+#endif
+
+NEON_QOP(add_u8, neon_sse2_add(a, b, 0), HELPER(neon_add_u8))
+NEON_QOP(add_u16, neon_sse2_add(a, b, 1), HELPER(neon_add_u16))
+NEON_QOP(add_u32, neon_sse2_add(a, b, 2), neon_add_u32)
+NEON_QOP(sub_u8, neon_sse2_sub(a, b, 0), HELPER(neon_sub_u8))
+NEON_QOP(sub_u16, neon_sse2_sub(a, b, 1), HELPER(neon_sub_u16))
+NEON_QOP(sub_u32, neon_sse2_sub(a, b, 2), neon_sub_u32)
+
+NEON_QOP_ENV(qadd_s8, neon_sse2_qadd(env, a, b, 0, 0), HELPER(neon_qadd_s8))
+NEON_QOP_ENV(qadd_u8, neon_sse2_qadd(env, a, b, 0, 1), HELPER(neon_qadd_u8))
+NEON_QOP_ENV(qadd_s16, neon_sse2_qadd(env, a, b, 1, 0), HELPER(neon_qadd_s16))
+NEON_QOP_ENV(qadd_u16, neon_sse2_qadd(env, a, b, 1, 1), HELPER(neon_qadd_u16))
+NEON_QOP_ENV(qsub_s8, neon_sse2_qsub(env, a, b, 0, 0), HELPER(neon_qsub_s8))
+NEON_QOP_ENV(qsub_u8, neon_sse2_qsub(env, a, b, 0, 1), HELPER(neon_qsub_u8))
+NEON_QOP_ENV(qsub_s16, neon_sse2_qsub(env, a, b, 1, 0), HELPER(neon_qsub_s16))
+NEON_QOP_ENV(qsub_u16, neon_sse2_qsub(env, a, b, 1, 1), HELPER(neon_qsub_u16))
+
+#define NEON_QOP_SU(name, expr) \
+NEON_QOP(glue(name, _s8), expr(a, b, 0, 0), HELPER(glue(neon_, glue(name, _s8)))) \
+NEON_QOP(glue(name, _u8), expr(a, b, 0, 1), HELPER(glue(neon_, glue(name, _u8)))) \
+NEON_QOP(glue(name, _s16), expr(a, b, 1, 0), HELPER(glue(neon_, glue(name, _s16)))) \
+NEON_QOP(glue(name, _u16), expr(a, b, 1, 1), HELPER(glue(neon_, glue(name, _u16)))) \
+NEON_QOP(glue(name, _s32), expr(a, b, 2, 0), HELPER(glue(neon_, glue(name, _s32)))) \
+NEON_QOP(glue(name, _u32), expr(a, b, 2, 1), HELPER(glue(neon_, glue(name, _u32))))
+
+#define neon_sse2_cge(a, b, size, u) neon_sse2_not(neon_sse2_cgt(b, a, size, u))
+
+NEON_QOP_SU(cgt, neon_sse2_cgt)
+NEON_QOP_SU(cge, neon_sse2_cge)
+NEON_QOP_SU(max, neon_sse2_max)
+NEON_QOP_SU(min, neon_sse2_min)
+NEON_QOP_SU(abd, neon_sse2_abd)
+
+NEON_QOP(ceq_u8, neon_sse2_ceq(a, b, 0), HELPER(neon_ceq_u8))
+NEON_QOP(ceq_u16, neon_sse2_ceq(a, b, 1), HELPER(neon_ceq_u16))
+NEON_QOP(ceq_u32, neon_sse2_ceq(a, b, 2), HELPER(neon_ceq_u32))
+NEON_QOP(tst_u8, neon_sse2_tst(a, b, 0), HELPER(neon_tst_u8))
+NEON_QOP(tst_u16, neon_sse2_tst(a, b, 1), HELPER(neon_tst_u16))
+NEON_QOP(tst_u32, neon_sse2_tst(a, b, 2), HELPER(neon_tst_u32))
+
+#undef neon_sse2_cge
+#undef NEON_QOP_SU
+#undef NEON_QOP_ENV
+#undef NEON_QOP
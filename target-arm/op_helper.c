@@ -85,6 +85,11 @@ void tlb_fill(CPUState *env1, target_ulong addr, int is_write, int mmu_idx,
 
     saved_env = env;
     env = env1;
+    if (is_write == 2) {
+        env->pmu.itlb_miss++;
+    } else {
+        env->pmu.dtlb_miss++;
+    }
     ret = cpu_arm_handle_mmu_fault(env, addr, is_write, mmu_idx);
     if (unlikely(ret)) {
         if (retaddr) {
@@ -65,6 +65,17 @@ typedef struct DisasContext {
     int vfp_enabled;
     int vec_len;
     int vec_stride;
+    int pmuserenr;
+    int teecr;
+    int c15_cpar;
+    /* Number of branches followed and end of the code covered so far
+       when translating a hot trace.  */
+    int trace_blocks;
+    target_ulong trace_end;
+    /* Set once a side exit of the trace uses jump slot 1.  */
+    int trace_side_jump;
+    /* Number of instructions translated before the current one.  */
+    int num_insns;
 } DisasContext;
 
 static uint32_t gen_opc_condexec_bits[OPC_BUF_SIZE];
@@ -149,6 +160,79 @@ static inline void store_cpu_offset(TCGv var, int offset)
 #define store_cpu_field(var, name) \
     store_cpu_offset(var, offsetof(CPUState, name))
 
+/* Instructions executed, for the ARM11 performance monitor.  The count is
+   added on entry to the TB, so a TB left early by an exception counts all
+   of its instructions.  */
+static TCGArg *pmu_insns_arg;
+/* Side exits of a trace, which give back the instructions not run.  */
+static TCGArg *pmu_side_exit_arg[TB_TRACE_MAX_BLOCKS];
+static int pmu_side_exit_insns[TB_TRACE_MAX_BLOCKS];
+static int pmu_side_exits;
+
+/* Add a count that is not known yet to pmu.insns, returning where
+   gen_pmu_insns_set() finds the constant to fix up.  The total is 64-bit
+   so that it does not wrap between two syncs of the counters.  */
+static TCGArg *gen_pmu_insns_add(void)
+{
+    TCGv_i64 tmp = tcg_temp_new_i64();
+    TCGv_i64 n = tcg_temp_new_i64();
+    TCGArg *arg;
+
+    tcg_gen_ld_i64(tmp, cpu_env, offsetof(CPUState, pmu.insns));
+    arg = gen_opparam_ptr + 1;
+    tcg_gen_movi_i64(n, 0xdeadbeef);
+    tcg_gen_add_i64(tmp, tmp, n);
+    tcg_gen_st_i64(tmp, cpu_env, offsetof(CPUState, pmu.insns));
+    tcg_temp_free_i64(n);
+    tcg_temp_free_i64(tmp);
+    return arg;
+}
+
+static void gen_pmu_insns_set(TCGArg *arg, int64_t n)
+{
+#if TCG_TARGET_REG_BITS == 64
+    arg[0] = n;
+#else
+    /* movi_i64 is a movi_i32 of each half */
+    arg[0] = (uint32_t)n;
+    arg[2] = (uint32_t)(n >> 32);
+#endif
+}
+
+static void gen_pmu_insns_start(CPUState *env)
+{
+    pmu_insns_arg = NULL;
+    pmu_side_exits = 0;
+#ifndef CONFIG_USER_ONLY
+    if (arm_feature(env, ARM_FEATURE_ARM11_PMU)) {
+        /* Fixed up with the real count by gen_pmu_insns_end().  */
+        pmu_insns_arg = gen_pmu_insns_add();
+    }
+#endif
+}
+
+static void gen_pmu_side_exit(DisasContext *s)
+{
+    if (pmu_insns_arg) {
+        /* Fixed up by gen_pmu_insns_end() as well.  */
+        pmu_side_exit_arg[pmu_side_exits] = gen_pmu_insns_add();
+        pmu_side_exit_insns[pmu_side_exits++] = s->num_insns + 1;
+    }
+}
+
+static void gen_pmu_insns_end(int num_insns)
+{
+    int i;
+
+    if (pmu_insns_arg) {
+        gen_pmu_insns_set(pmu_insns_arg, num_insns);
+        for (i = 0; i < pmu_side_exits; i++) {
+            gen_pmu_insns_set(pmu_side_exit_arg[i],
+                              pmu_side_exit_insns[i] - num_insns);
+        }
+    }
+}
+
 /* Set a variable to the value of a CPU register.  */
 static void load_reg_var(DisasContext *s, TCGv var, int reg)
 {
@@ -936,30 +1020,42 @@ static inline void gen_vfp_F1_mul(int dp)
     tcg_temp_free_ptr(fpst);
 }
 
+/* Negation and absolute value only touch the sign bit and never raise
+   exceptions, so they are expanded inline rather than calling softfloat.  */
+static inline void gen_vfp_negs(TCGv_i32 dest, TCGv_i32 src)
+{
+    tcg_gen_xori_i32(dest, src, 0x80000000);
+}
+
+static inline void gen_vfp_negd(TCGv_i64 dest, TCGv_i64 src)
+{
+    tcg_gen_xori_i64(dest, src, 1ULL << 63);
+}
+
 static inline void gen_vfp_F1_neg(int dp)
 {
     /* Like gen_vfp_neg() but put result in F1 */
     if (dp) {
-        gen_helper_vfp_negd(cpu_F1d, cpu_F0d);
+        gen_vfp_negd(cpu_F1d, cpu_F0d);
     } else {
-        gen_helper_vfp_negs(cpu_F1s, cpu_F0s);
+        gen_vfp_negs(cpu_F1s, cpu_F0s);
     }
 }
 
 static inline void gen_vfp_abs(int dp)
 {
     if (dp)
-        gen_helper_vfp_absd(cpu_F0d, cpu_F0d);
+        tcg_gen_andi_i64(cpu_F0d, cpu_F0d, ~(1ULL << 63));
     else
-        gen_helper_vfp_abss(cpu_F0s, cpu_F0s);
+        tcg_gen_andi_i32(cpu_F0s, cpu_F0s, 0x7fffffff);
 }
 
 static inline void gen_vfp_neg(int dp)
 {
     if (dp)
-        gen_helper_vfp_negd(cpu_F0d, cpu_F0d);
+        gen_vfp_negd(cpu_F0d, cpu_F0d);
     else
-        gen_helper_vfp_negs(cpu_F0s, cpu_F0s);
+        gen_vfp_negs(cpu_F0s, cpu_F0s);
 }
 
 static inline void gen_vfp_sqrt(int dp)
@@ -2471,7 +2567,7 @@ static int disas_cp_insn(CPUState *env, DisasContext *s, uint32_t insn)
     return 0;
 }
 
-static int cp15_user_ok(CPUState *env, uint32_t insn)
+static int cp15_user_ok(CPUState *env, DisasContext *s, uint32_t insn)
 {
     int cpn = (insn >> 16) & 0xf;
     int cpm = insn & 0xf;
@@ -2485,7 +2581,7 @@ static int cp15_user_ok(CPUState *env, uint32_t insn)
          */
         if ((cpm == 12 && (op < 6)) ||
             (cpm == 13 && (op < 3))) {
-            return env->cp15.c9_pmuserenr;
+            return s->pmuserenr;
         } else if (cpm == 14 && op == 0 && (insn & ARM_CP_RW_BIT)) {
             /* PMUSERENR, read only */
             return 1;
@@ -2625,7 +2721,7 @@ static int disas_cp15_insn(CPUState *env, DisasContext *s, uint32_t insn)
         break;
     }
 
-    if (IS_USER(s) && !cp15_user_ok(env, insn)) {
+    if (IS_USER(s) && !cp15_user_ok(env, s, insn)) {
         return 1;
     }
 
@@ -3160,13 +3256,13 @@ static int disas_vfp_insn(CPUState * env, DisasContext *s, uint32_t insn)
                         TCGv_i64 frd;
                         if (op & 1) {
                             /* VFNMS, VFMS */
-                            gen_helper_vfp_negd(cpu_F0d, cpu_F0d);
+                            gen_vfp_negd(cpu_F0d, cpu_F0d);
                         }
                         frd = tcg_temp_new_i64();
                         tcg_gen_ld_f64(frd, cpu_env, vfp_reg_offset(dp, rd));
                         if (op & 2) {
                             /* VFNMA, VFNMS */
-                            gen_helper_vfp_negd(frd, frd);
+                            gen_vfp_negd(frd, frd);
                         }
                         fpst = get_fpstatus_ptr(0);
                         gen_helper_vfp_muladdd(cpu_F0d, cpu_F0d,
@@ -3178,12 +3274,12 @@ static int disas_vfp_insn(CPUState * env, DisasContext *s, uint32_t insn)
                         TCGv_i32 frd;
                         if (op & 1) {
                             /* VFNMS, VFMS */
-                            gen_helper_vfp_negs(cpu_F0s, cpu_F0s);
+                            gen_vfp_negs(cpu_F0s, cpu_F0s);
                         }
                         frd = tcg_temp_new_i32();
                         tcg_gen_ld_f32(frd, cpu_env, vfp_reg_offset(dp, rd));
                         if (op & 2) {
-                            gen_helper_vfp_negs(frd, frd);
+                            gen_vfp_negs(frd, frd);
                         }
                         fpst = get_fpstatus_ptr(0);
                         gen_helper_vfp_muladds(cpu_F0s, cpu_F0s,
@@ -3549,7 +3645,8 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
     TranslationBlock *tb;
 
     tb = s->tb;
-    if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK)) {
+    if ((tb->pc & TARGET_PAGE_MASK) == (dest & TARGET_PAGE_MASK) &&
+        !(n == 1 && s->trace_side_jump)) {
         tcg_gen_goto_tb(n);
         gen_set_pc_im(dest);
         tcg_gen_exit_tb((tcg_target_long)tb + n);
@@ -3559,6 +3656,75 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
     }
 }
 
+/* Leave a trace where it departs from the hot path.  The first side
+   exit is chained through jump slot 1, the others and the fall-through
+   of a final conditional branch then go through the hash table.  */
+static void gen_trace_side_exit(DisasContext *s, uint32_t dest)
+{
+    gen_pmu_side_exit(s);
+    gen_goto_tb(s, 1, dest);
+    s->trace_side_jump = 1;
+}
+
+/* When translating a hot trace, continue at the hot exit of a direct
+   branch instead of ending the block, as planned by tb_gen_trace().
+   The cold exit of a conditional branch leaves the trace.  Followed
+   targets are in the page of the trace entry, which the trace is
+   assumed to cover from its start up to trace_end.  */
+static inline int gen_trace_follow(DisasContext *s, uint32_t dest)
+{
+    TranslationBlock *tb = s->tb;
+    int l1;
+
+    if (!(tb->cflags & CF_TRACE) || s->condexec_mask ||
+        s->trace_blocks >= (tb->cflags & CF_TRACE_BLOCKS_MASK) >>
+                           CF_TRACE_BLOCKS_SHIFT) {
+        return 0;
+    }
+    if (s->pc > s->trace_end) {
+        s->trace_end = s->pc;
+    }
+    if (s->condjmp &&
+        ((tb->cflags >> (CF_TRACE_PATH_SHIFT + s->trace_blocks)) & 1)) {
+        /* Hot fall-through: leave if the branch is taken.  */
+        gen_trace_side_exit(s, dest);
+        gen_set_label(s->condlabel);
+        s->condjmp = 0;
+    } else {
+        if ((dest & TARGET_PAGE_MASK) != (tb->pc & TARGET_PAGE_MASK)) {
+            return 0;
+        }
+        if (s->condjmp) {
+            /* Hot target: leave if the branch is not taken.  */
+            l1 = gen_new_label();
+            tcg_gen_br(l1);
+            gen_set_label(s->condlabel);
+            gen_trace_side_exit(s, s->pc);
+            gen_set_label(l1);
+            s->condjmp = 0;
+        }
+        s->pc = dest;
+    }
+    s->trace_blocks++;
+    return 1;
+}
+
+/* Record the direct branch ending a plain block, and count its taken
+   exits if it is conditional, for tb_gen_trace().  */
+static inline void gen_trace_profile(DisasContext *s, uint32_t dest)
+{
+    TranslationBlock *tb = s->tb;
+
+    if ((tb->cflags & CF_TRACE) || s->condexec_mask) {
+        return;
+    }
+    tb->branch_kind = s->condjmp ? TB_BRANCH_COND : TB_BRANCH_ALWAYS;
+    tb->branch_dest = dest;
+    if (s->condjmp) {
+        gen_trace_count_taken(tb);
+    }
+}
+
 static inline void gen_jmp (DisasContext *s, uint32_t dest)
 {
     if (unlikely(s->singlestep_enabled)) {
@@ -3566,7 +3732,10 @@ static inline void gen_jmp (DisasContext *s, uint32_t dest)
         if (s->thumb)
             dest |= 1;
         gen_bx_im(s, dest);
+    } else if (gen_trace_follow(s, dest)) {
+        /* The branch is folded into the trace.  */
     } else {
+        gen_trace_profile(s, dest);
         gen_goto_tb(s, 0, dest);
         s->is_jmp = DISAS_TB_JUMP;
     }
@@ -4617,6 +4786,112 @@ static const uint8_t neon_2rm_sizes[] = {
     [NEON_2RM_VCVT_UF] = 0x4,
 };
 
+typedef void NeonGenQuadFn(TCGv_ptr, TCGv_ptr, TCGv_ptr);
+typedef void NeonGenQuadEnvFn(TCGv_ptr, TCGv_ptr, TCGv_ptr, TCGv_ptr);
+
+/* Whole quad register helpers, indexed by [size][u].  */
+#define NEON_QUAD_FNS(name) { \
+    { gen_helper_neon_##name##_s8_q, gen_helper_neon_##name##_u8_q }, \
+    { gen_helper_neon_##name##_s16_q, gen_helper_neon_##name##_u16_q }, \
+    { gen_helper_neon_##name##_s32_q, gen_helper_neon_##name##_u32_q }, \
+}
+
+static NeonGenQuadFn * const neon_quad_cgt[3][2] = NEON_QUAD_FNS(cgt);
+static NeonGenQuadFn * const neon_quad_cge[3][2] = NEON_QUAD_FNS(cge);
+static NeonGenQuadFn * const neon_quad_max[3][2] = NEON_QUAD_FNS(max);
+static NeonGenQuadFn * const neon_quad_min[3][2] = NEON_QUAD_FNS(min);
+static NeonGenQuadFn * const neon_quad_abd[3][2] = NEON_QUAD_FNS(abd);
+#undef NEON_QUAD_FNS
+
+static NeonGenQuadEnvFn * const neon_quad_qadd[2][2] = {
+    { gen_helper_neon_qadd_s8_q, gen_helper_neon_qadd_u8_q },
+    { gen_helper_neon_qadd_s16_q, gen_helper_neon_qadd_u16_q },
+};
+static NeonGenQuadEnvFn * const neon_quad_qsub[2][2] = {
+    { gen_helper_neon_qsub_s8_q, gen_helper_neon_qsub_u8_q },
+    { gen_helper_neon_qsub_s16_q, gen_helper_neon_qsub_u16_q },
+};
+
+/* Indexed by [size][u]: VADD/VSUB and VTST/VCEQ.  */
+static NeonGenQuadFn * const neon_quad_add_sub[3][2] = {
+    { gen_helper_neon_add_u8_q, gen_helper_neon_sub_u8_q },
+    { gen_helper_neon_add_u16_q, gen_helper_neon_sub_u16_q },
+    { gen_helper_neon_add_u32_q, gen_helper_neon_sub_u32_q },
+};
+static NeonGenQuadFn * const neon_quad_tst_ceq[3][2] = {
+    { gen_helper_neon_tst_u8_q, gen_helper_neon_ceq_u8_q },
+    { gen_helper_neon_tst_u16_q, gen_helper_neon_ceq_u16_q },
+    { gen_helper_neon_tst_u32_q, gen_helper_neon_ceq_u32_q },
+};
+
+/* Emit a Q form three registers of the same length integer op as a
+   single whole register helper call.  Return nonzero if it was handled,
+   zero if the caller must process it in 32-bit chunks.  */
+static int gen_neon_3r_quad(int op, int u, int size, int rd, int rn, int rm)
+{
+    NeonGenQuadFn *fn = NULL;
+    NeonGenQuadEnvFn *envfn = NULL;
+    TCGv_ptr pd, pn, pm;
+
+    if (size > 2) {
+        return 0;
+    }
+    switch (op) {
+    case NEON_3R_VQADD:
+        if (size < 2) {
+            envfn = neon_quad_qadd[size][u];
+        }
+        break;
+    case NEON_3R_VQSUB:
+        if (size < 2) {
+            envfn = neon_quad_qsub[size][u];
+        }
+        break;
+    case NEON_3R_VCGT:
+        fn = neon_quad_cgt[size][u];
+        break;
+    case NEON_3R_VCGE:
+        fn = neon_quad_cge[size][u];
+        break;
+    case NEON_3R_VMAX:
+        fn = neon_quad_max[size][u];
+        break;
+    case NEON_3R_VMIN:
+        fn = neon_quad_min[size][u];
+        break;
+    case NEON_3R_VABD:
+        fn = neon_quad_abd[size][u];
+        break;
+    case NEON_3R_VADD_VSUB:
+        fn = neon_quad_add_sub[size][u];
+        break;
+    case NEON_3R_VTST_VCEQ:
+        fn = neon_quad_tst_ceq[size][u];
+        break;
+    default:
+        break;
+    }
+    if (!fn && !envfn) {
+        return 0;
+    }
+
+    pd = tcg_temp_new_ptr();
+    pn = tcg_temp_new_ptr();
+    pm = tcg_temp_new_ptr();
+    tcg_gen_addi_ptr(pd, cpu_env, vfp_reg_offset(1, rd));
+    tcg_gen_addi_ptr(pn, cpu_env, vfp_reg_offset(1, rn));
+    tcg_gen_addi_ptr(pm, cpu_env, vfp_reg_offset(1, rm));
+    if (envfn) {
+        envfn(cpu_env, pd, pn, pm);
+    } else {
+        fn(pd, pn, pm);
+    }
+    tcg_temp_free_ptr(pd);
+    tcg_temp_free_ptr(pn);
+    tcg_temp_free_ptr(pm);
+    return 1;
+}
+
 /* Translate a NEON data processing instruction.  Return nonzero if the
    instruction is invalid.
    We process data in a mixture of 32-bit and 64-bit chunks.
@@ -4793,6 +5068,10 @@ static int disas_neon_data_insn(CPUState * env, DisasContext *s, uint32_t insn)
             return 1;
         }
 
+        if (q && gen_neon_3r_quad(op, u, size, rd, rn, rm)) {
+            return 0;
+        }
+
         for (pass = 0; pass < (q ? 4 : 2); pass++) {
 
         if (pairwise) {
@@ -5071,7 +5350,7 @@ static int disas_neon_data_insn(CPUState * env, DisasContext *s, uint32_t insn)
             TCGv_i32 tmp3 = neon_load_reg(rd, pass);
             if (size) {
                 /* VFMS */
-                gen_helper_vfp_negs(tmp, tmp);
+                gen_vfp_negs(tmp, tmp);
             }
             gen_helper_vfp_muladds(tmp, tmp, tmp2, tmp3, fpstatus);
             tcg_temp_free_i32(tmp3);
@@ -6435,7 +6714,7 @@ static int disas_cp14_read(CPUState * env, DisasContext *s, uint32_t insn)
         }
         if (op1 == 6 && crn == 1 && crm == 0 && op2 == 0) {
             /* TEEHBR */
-            if (IS_USER(s) && (env->teecr & 1))
+            if (IS_USER(s) && s->teecr)
                 return 1;
             tmp = load_cpu_field(teehbr);
             store_reg(s, rt, tmp);
@@ -6462,11 +6741,13 @@ static int disas_cp14_write(CPUState * env, DisasContext *s, uint32_t insn)
             tmp = load_reg(s, rt);
             gen_helper_set_teecr(cpu_env, tmp);
             tcg_temp_free_i32(tmp);
+            /* TEECR is part of the TB flags */
+            gen_lookup_tb(s);
             return 0;
         }
         if (op1 == 6 && crn == 1 && crm == 0 && op2 == 0) {
             /* TEEHBR */
-            if (IS_USER(s) && (env->teecr & 1))
+            if (IS_USER(s) && s->teecr)
                 return 1;
             tmp = load_reg(s, rt);
             store_cpu_field(tmp, teehbr);
@@ -6482,7 +6763,7 @@ static int disas_coproc_insn(CPUState * env, DisasContext *s, uint32_t insn)
 
     cpnum = (insn >> 8) & 0xf;
     if (arm_feature(env, ARM_FEATURE_XSCALE)
-	    && ((env->cp15.c15_cpar ^ 0x3fff) & (1 << cpnum)))
+	    && ((s->c15_cpar ^ 0x3fff) & (1 << cpnum)))
 	return 1;
 
     switch (cpnum) {
@@ -6890,7 +7171,7 @@ static void disas_arm_insn(CPUState * env, DisasContext *s)
         } else if ((insn & 0x0e000f00) == 0x0c000100) {
             if (arm_feature(env, ARM_FEATURE_IWMMXT)) {
                 /* iWMMXt register transfer.  */
-                if (env->cp15.c15_cpar & (1 << 1))
+                if (s->c15_cpar & (1 << 1))
                     if (!disas_iwmmxt_insn(env, s, insn))
                         return;
             }
@@ -9863,6 +10144,12 @@ static inline void gen_intermediate_code_internal(CPUState *env,
     dc->vfp_enabled = ARM_TBFLAG_VFPEN(tb->flags);
     dc->vec_len = ARM_TBFLAG_VECLEN(tb->flags);
     dc->vec_stride = ARM_TBFLAG_VECSTRIDE(tb->flags);
+    dc->pmuserenr = ARM_TBFLAG_PMUSEREN(tb->flags);
+    dc->teecr = ARM_TBFLAG_TEECR(tb->flags);
+    dc->c15_cpar = ARM_TBFLAG_XSCALE_CPAR(tb->flags);
+    dc->trace_blocks = 0;
+    dc->trace_end = pc_start;
+    dc->trace_side_jump = 0;
     cpu_F0s = tcg_temp_new_i32();
     cpu_F1s = tcg_temp_new_i32();
     cpu_F0d = tcg_temp_new_i64();
@@ -9878,7 +10165,9 @@ static inline void gen_intermediate_code_internal(CPUState *env,
     if (max_insns == 0)
         max_insns = CF_COUNT_MASK;
 
+    gen_trace_count(tb);
     gen_icount_start();
+    gen_pmu_insns_start(env);
 
     tcg_clear_temp_count();
 
@@ -9973,6 +10262,7 @@ static inline void gen_intermediate_code_internal(CPUState *env,
             tcg_gen_debug_insn_start(dc->pc);
         }
 
+        dc->num_insns = num_insns;
         if (dc->thumb) {
             disas_thumb_insn(env, dc);
             if (dc->condexec_mask) {
@@ -10082,13 +10372,17 @@ static inline void gen_intermediate_code_internal(CPUState *env,
 
 done_generating:
     gen_icount_end(tb, num_insns);
+    gen_pmu_insns_end(num_insns);
     *gen_opc_ptr = INDEX_op_end;
+    if (dc->pc > dc->trace_end) {
+        dc->trace_end = dc->pc;
+    }
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)) {
         qemu_log("----------------\n");
         qemu_log("IN: %s\n", lookup_symbol(pc_start));
-        log_target_disas(pc_start, dc->pc - pc_start, dc->thumb);
+        log_target_disas(pc_start, dc->trace_end - pc_start, dc->thumb);
         qemu_log("\n");
     }
 #endif
@@ -10098,7 +10392,7 @@ done_generating:
         while (lj <= j)
             gen_opc_instr_start[lj++] = 0;
     } else {
-        tb->size = dc->pc - pc_start;
+        tb->size = dc->trace_end - pc_start;
         tb->icount = num_insns;
     }
 }
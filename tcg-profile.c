@@ -0,0 +1,732 @@
+/*
+ * Sampling profiler for translated code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A per-thread CPU time timer interrupts the TCG vCPU thread with SIGPROF.
+ * The signal handler only records the interrupted host PC and the current
+ * TB in a ring buffer; the samples are resolved to translation blocks and
+ * guest symbols from the main loop, where the TB structures are stable.
+ */
+
+#include "config.h"
+#include "cpu.h"
+#include "exec-all.h"
+#include "disas.h"
+#include "elf.h"
+#include "qemu-common.h"
+#include "qemu-thread.h"
+#include "qemu-timer.h"
+#include "qemu-barrier.h"
+#include "qemu-option.h"
+#include "qerror.h"
+#include "sysemu.h"
+#include "qmp-commands.h"
+
+#if defined(__linux__)
+#include <signal.h>
+#include <ucontext.h>
+#define TCG_PROFILE_SUPPORTED
+#endif
+
+#define TCG_PROFILE_DEFAULT_HZ  1000
+#define TCG_PROFILE_MAX_HZ      100000
+#define TCG_PROFILE_RING_SIZE   4096
+#define TCG_PROFILE_DRAIN_MS    100
+
+typedef struct TCGProfileSample {
+    unsigned long host_pc;
+    target_ulong tb_pc;
+    int cpu_index;              /* -1 if no vCPU was running */
+    bool in_tb;                 /* a TB was executing */
+    unsigned int generation;    /* tb_code_generation() at sample time */
+} TCGProfileSample;
+
+typedef struct TCGProfileEntry {
+    int cpu_index;
+    TcgProfileKind kind;
+    target_ulong pc;
+    uint64_t samples;
+} TCGProfileEntry;
+
+typedef struct TCGProfileSymbol {
+    target_ulong addr;
+    target_ulong size;
+    char *name;
+} TCGProfileSymbol;
+
+/* One line of the report: entries of the same vCPU, kind and symbol
+   added together.  */
+typedef struct TCGProfileLine {
+    int cpu_index;
+    TcgProfileKind kind;
+    const char *symbol;
+    char buf[32];
+    target_ulong pc;
+    bool has_pc;
+    uint64_t samples;
+} TCGProfileLine;
+
+typedef struct TCGProfileReport {
+    TCGProfileLine *lines;
+    int nb_lines;
+    int nb_alloc;
+} TCGProfileReport;
+
+static bool tcg_profile_enabled;
+static int64_t tcg_profile_period_ns = 1000000000LL / TCG_PROFILE_DEFAULT_HZ;
+static QEMUTimer *tcg_profile_drain_timer;
+static char *tcg_profile_dump_file;
+
+/* Written by the signal handler, read by tcg_profile_drain().  */
+static TCGProfileSample tcg_profile_ring[TCG_PROFILE_RING_SIZE];
+static volatile unsigned int tcg_profile_head;
+static volatile unsigned int tcg_profile_tail;
+static volatile unsigned int tcg_profile_dropped;
+
+static GHashTable *tcg_profile_entries;
+static uint64_t tcg_profile_samples;
+static uint64_t *tcg_profile_cpu_samples;
+
+static TCGProfileSymbol *tcg_profile_syms;
+static int tcg_profile_nb_syms;
+
+#ifdef TCG_PROFILE_SUPPORTED
+static timer_t tcg_profile_timer;
+
+static unsigned long tcg_profile_host_pc(void *puc)
+{
+    ucontext_t *uc = puc;
+
+#if defined(__x86_64__)
+    return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+    return uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__arm__)
+    return uc->uc_mcontext.arm_pc;
+#else
+    return 0;
+#endif
+}
+
+static void tcg_profile_signal(int sig, siginfo_t *info, void *puc)
+{
+    CPUState *env = cpu_single_env;
+    TranslationBlock *tb = env ? env->current_tb : NULL;
+    unsigned int head = tcg_profile_head;
+    TCGProfileSample *s;
+
+    if (head - tcg_profile_tail >= TCG_PROFILE_RING_SIZE) {
+        tcg_profile_dropped++;
+        return;
+    }
+    s = &tcg_profile_ring[head % TCG_PROFILE_RING_SIZE];
+    s->host_pc = tcg_profile_host_pc(puc);
+    s->generation = tb_code_generation();
+    s->cpu_index = env ? env->cpu_index : -1;
+    s->in_tb = tb != NULL;
+    s->tb_pc = tb ? tb->pc : 0;
+    smp_wmb();
+    tcg_profile_head = head + 1;
+}
+#endif
+
+static guint tcg_profile_entry_hash(gconstpointer key)
+{
+    const TCGProfileEntry *e = key;
+
+    return (guint)e->pc ^ (guint)((uint64_t)e->pc >> 32) ^
+           ((guint)e->cpu_index << 24) ^ ((guint)e->kind << 30);
+}
+
+static gboolean tcg_profile_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TCGProfileEntry *ea = a, *eb = b;
+
+    return ea->cpu_index == eb->cpu_index && ea->kind == eb->kind &&
+           ea->pc == eb->pc;
+}
+
+static void tcg_profile_reset(void)
+{
+    if (tcg_profile_entries) {
+        g_hash_table_destroy(tcg_profile_entries);
+    }
+    tcg_profile_entries = g_hash_table_new_full(tcg_profile_entry_hash,
+                                                tcg_profile_entry_equal,
+                                                NULL, g_free);
+    g_free(tcg_profile_cpu_samples);
+    tcg_profile_cpu_samples = g_new0(uint64_t, smp_cpus);
+    tcg_profile_samples = 0;
+    tcg_profile_dropped = 0;
+}
+
+static void tcg_profile_account(int cpu_index, TcgProfileKind kind,
+                                target_ulong pc)
+{
+    TCGProfileEntry key = { cpu_index, kind, pc, 0 };
+    TCGProfileEntry *e;
+
+    e = g_hash_table_lookup(tcg_profile_entries, &key);
+    if (!e) {
+        e = g_memdup(&key, sizeof(key));
+        g_hash_table_insert(tcg_profile_entries, e, e);
+    }
+    e->samples++;
+    tcg_profile_samples++;
+    if (cpu_index >= 0 && cpu_index < smp_cpus) {
+        tcg_profile_cpu_samples[cpu_index]++;
+    }
+}
+
+/* Move the samples from the ring buffer to the hash table.  Must run with
+   the global mutex held, so that no code is translated or thrown away
+   while the host PCs are looked up.  */
+static void tcg_profile_drain(void)
+{
+    unsigned int tail = tcg_profile_tail;
+    unsigned int head = tcg_profile_head;
+    unsigned int generation = tb_code_generation();
+    TCGProfileSample *s;
+    TranslationBlock *tb;
+
+    smp_rmb();
+    for (; tail != head; tail++) {
+        s = &tcg_profile_ring[tail % TCG_PROFILE_RING_SIZE];
+        tb = NULL;
+        if (tb_in_code_buffer(s->host_pc)) {
+            if (s->generation == generation) {
+                tb = tb_find_pc(s->host_pc);
+            }
+            if (tb) {
+                tcg_profile_account(s->cpu_index, TCG_PROFILE_KIND_CODE,
+                                    tb->pc);
+            } else {
+                /* the code is gone, fall back to the TB that was entered */
+                tcg_profile_account(s->cpu_index, TCG_PROFILE_KIND_CODE,
+                                    s->tb_pc);
+            }
+        } else if (s->in_tb) {
+            tcg_profile_account(s->cpu_index, TCG_PROFILE_KIND_HELPER,
+                                s->tb_pc);
+        } else {
+            tcg_profile_account(s->cpu_index, TCG_PROFILE_KIND_QEMU, 0);
+        }
+    }
+    smp_mb();
+    tcg_profile_tail = tail;
+}
+
+static void tcg_profile_drain_cb(void *opaque)
+{
+    tcg_profile_drain();
+    qemu_mod_timer(tcg_profile_drain_timer,
+                   qemu_get_clock_ms(rt_clock) + TCG_PROFILE_DRAIN_MS);
+}
+
+/* Guest symbols */
+
+static int tcg_profile_sym_cmp(const void *a, const void *b)
+{
+    const TCGProfileSymbol *sa = a, *sb = b;
+
+    return sa->addr < sb->addr ? -1 : sa->addr > sb->addr;
+}
+
+static void tcg_profile_free_symbols(void)
+{
+    int i;
+
+    for (i = 0; i < tcg_profile_nb_syms; i++) {
+        g_free(tcg_profile_syms[i].name);
+    }
+    g_free(tcg_profile_syms);
+    tcg_profile_syms = NULL;
+    tcg_profile_nb_syms = 0;
+}
+
+static uint64_t elf_get(const uint8_t *p, int size, bool swap)
+{
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+
+    switch (size) {
+    case 1:
+        return *p;
+    case 2:
+        memcpy(&v16, p, 2);
+        return swap ? bswap16(v16) : v16;
+    case 4:
+        memcpy(&v32, p, 4);
+        return swap ? bswap32(v32) : v32;
+    default:
+        memcpy(&v64, p, 8);
+        return swap ? bswap64(v64) : v64;
+    }
+}
+
+#define ELF_GET(p, type, field) \
+    elf_get((p) + offsetof(type, field), sizeof(((type *)0)->field), swap)
+
+/* Read the function symbols of an ELF file of either class.  */
+static int tcg_profile_load_symbols(const char *filename)
+{
+    uint8_t *buf = NULL;
+    long len;
+    FILE *f;
+    bool swap, is64;
+    uint64_t shoff, symoff, symsize, stroff, strsize, entsize;
+    unsigned int shnum, shentsize, link, i;
+    const uint8_t *sh, *sym;
+    int nb_alloc = 0;
+    TCGProfileSymbol *syms = NULL;
+    int nb_syms = 0;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        return -1;
+    }
+    if (fseek(f, 0, SEEK_END) < 0 || (len = ftell(f)) < 0) {
+        goto fail;
+    }
+    rewind(f);
+    buf = g_malloc(len + 1);
+    if (fread(buf, 1, len, f) != len || len < sizeof(Elf32_Ehdr) ||
+        memcmp(buf, ELFMAG, SELFMAG) != 0) {
+        goto fail;
+    }
+#ifdef HOST_WORDS_BIGENDIAN
+    swap = buf[EI_DATA] != ELFDATA2MSB;
+#else
+    swap = buf[EI_DATA] != ELFDATA2LSB;
+#endif
+    is64 = buf[EI_CLASS] == ELFCLASS64;
+    if (is64 && len < sizeof(Elf64_Ehdr)) {
+        goto fail;
+    }
+
+    if (is64) {
+        shoff = ELF_GET(buf, Elf64_Ehdr, e_shoff);
+        shnum = ELF_GET(buf, Elf64_Ehdr, e_shnum);
+        shentsize = ELF_GET(buf, Elf64_Ehdr, e_shentsize);
+    } else {
+        shoff = ELF_GET(buf, Elf32_Ehdr, e_shoff);
+        shnum = ELF_GET(buf, Elf32_Ehdr, e_shnum);
+        shentsize = ELF_GET(buf, Elf32_Ehdr, e_shentsize);
+    }
+    if (shoff > len || (uint64_t)shnum * shentsize > len - shoff ||
+        shentsize < (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr))) {
+        goto fail;
+    }
+
+    for (i = 0; i < shnum; i++) {
+        sh = buf + shoff + i * shentsize;
+        if (ELF_GET(sh, Elf32_Shdr, sh_type) == SHT_SYMTAB) {
+            break;
+        }
+    }
+    if (i == shnum) {
+        goto fail;
+    }
+    if (is64) {
+        symoff = ELF_GET(sh, Elf64_Shdr, sh_offset);
+        symsize = ELF_GET(sh, Elf64_Shdr, sh_size);
+        entsize = ELF_GET(sh, Elf64_Shdr, sh_entsize);
+        link = ELF_GET(sh, Elf64_Shdr, sh_link);
+    } else {
+        symoff = ELF_GET(sh, Elf32_Shdr, sh_offset);
+        symsize = ELF_GET(sh, Elf32_Shdr, sh_size);
+        entsize = ELF_GET(sh, Elf32_Shdr, sh_entsize);
+        link = ELF_GET(sh, Elf32_Shdr, sh_link);
+    }
+    if (link >= shnum) {
+        goto fail;
+    }
+    sh = buf + shoff + link * shentsize;
+    if (is64) {
+        stroff = ELF_GET(sh, Elf64_Shdr, sh_offset);
+        strsize = ELF_GET(sh, Elf64_Shdr, sh_size);
+    } else {
+        stroff = ELF_GET(sh, Elf32_Shdr, sh_offset);
+        strsize = ELF_GET(sh, Elf32_Shdr, sh_size);
+    }
+    if (symoff > len || symsize > len - symoff || stroff > len ||
+        strsize > len - stroff ||
+        entsize < (is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym))) {
+        goto fail;
+    }
+    buf[len] = 0;
+
+    for (sym = buf + symoff; sym + entsize <= buf + symoff + symsize;
+         sym += entsize) {
+        uint64_t name, value, size;
+        unsigned int info, shndx;
+        const char *str;
+
+        if (is64) {
+            name = ELF_GET(sym, Elf64_Sym, st_name);
+            value = ELF_GET(sym, Elf64_Sym, st_value);
+            size = ELF_GET(sym, Elf64_Sym, st_size);
+            info = ELF_GET(sym, Elf64_Sym, st_info);
+            shndx = ELF_GET(sym, Elf64_Sym, st_shndx);
+        } else {
+            name = ELF_GET(sym, Elf32_Sym, st_name);
+            value = ELF_GET(sym, Elf32_Sym, st_value);
+            size = ELF_GET(sym, Elf32_Sym, st_size);
+            info = ELF_GET(sym, Elf32_Sym, st_info);
+            shndx = ELF_GET(sym, Elf32_Sym, st_shndx);
+        }
+        if (name >= strsize || shndx == SHN_UNDEF || shndx >= SHN_LORESERVE) {
+            continue;
+        }
+        /* skip ARM mapping symbols ($a, $d, $t) and data */
+        str = (const char *)buf + stroff + name;
+        if (!str[0] || str[0] == '$' ||
+            (ELF_ST_TYPE(info) != STT_FUNC &&
+             ELF_ST_TYPE(info) != STT_NOTYPE)) {
+            continue;
+        }
+#ifdef TARGET_ARM
+        /* Thumb functions have the low bit set */
+        value &= ~(uint64_t)1;
+#endif
+        if (nb_syms == nb_alloc) {
+            nb_alloc = nb_alloc ? nb_alloc * 2 : 1024;
+            syms = g_renew(TCGProfileSymbol, syms, nb_alloc);
+        }
+        syms[nb_syms].addr = value;
+        syms[nb_syms].size = size;
+        syms[nb_syms].name = g_strdup(str);
+        nb_syms++;
+    }
+    fclose(f);
+    g_free(buf);
+
+    qsort(syms, nb_syms, sizeof(*syms), tcg_profile_sym_cmp);
+    /* assembler symbols often have no size: extend them to the next one */
+    for (i = 0; i + 1 < nb_syms; i++) {
+        if (!syms[i].size) {
+            syms[i].size = syms[i + 1].addr - syms[i].addr;
+        }
+    }
+
+    tcg_profile_free_symbols();
+    tcg_profile_syms = syms;
+    tcg_profile_nb_syms = nb_syms;
+    return 0;
+
+fail:
+    fclose(f);
+    g_free(buf);
+    return -1;
+}
+
+/* Return the name of the guest symbol covering 'pc', or NULL.  */
+static const char *tcg_profile_symbol(target_ulong pc, target_ulong *start)
+{
+    const char *name;
+    int lo = 0, hi = tcg_profile_nb_syms - 1, mid;
+
+    /* last symbol that starts at or before PC */
+    while (lo <= hi) {
+        mid = (lo + hi) / 2;
+        if (tcg_profile_syms[mid].addr <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    if (hi >= 0 && pc - tcg_profile_syms[hi].addr < tcg_profile_syms[hi].size) {
+        *start = tcg_profile_syms[hi].addr;
+        return tcg_profile_syms[hi].name;
+    }
+
+    /* symbols of an ELF image loaded with -kernel */
+    name = lookup_symbol(pc);
+    if (name[0]) {
+        *start = pc;
+        return name;
+    }
+    return NULL;
+}
+
+/* Reporting */
+
+static void tcg_profile_collect_one(gpointer key, gpointer value,
+                                    gpointer opaque)
+{
+    TCGProfileEntry *e = value;
+    TCGProfileReport *r = opaque;
+    TCGProfileLine line, *l;
+    target_ulong start = e->pc;
+    int i;
+
+    memset(&line, 0, sizeof(line));
+    line.cpu_index = e->cpu_index;
+    line.kind = e->kind;
+    line.samples = e->samples;
+    if (e->kind != TCG_PROFILE_KIND_QEMU) {
+        line.symbol = tcg_profile_symbol(e->pc, &start);
+        line.pc = start;
+        line.has_pc = true;
+    }
+
+    for (i = 0; i < r->nb_lines; i++) {
+        l = &r->lines[i];
+        if (l->cpu_index == line.cpu_index && l->kind == line.kind &&
+            l->has_pc == line.has_pc && l->pc == line.pc &&
+            (l->symbol != NULL) == (line.symbol != NULL)) {
+            l->samples += line.samples;
+            return;
+        }
+    }
+    if (r->nb_lines == r->nb_alloc) {
+        r->nb_alloc = r->nb_alloc ? r->nb_alloc * 2 : 64;
+        r->lines = g_renew(TCGProfileLine, r->lines, r->nb_alloc);
+    }
+    r->lines[r->nb_lines++] = line;
+}
+
+static int tcg_profile_line_cmp(const void *a, const void *b)
+{
+    const TCGProfileLine *la = a, *lb = b;
+
+    return la->samples > lb->samples ? -1 : la->samples < lb->samples;
+}
+
+/* Fill 'r' with the report lines, most samples first.  */
+static void tcg_profile_collect(TCGProfileReport *r)
+{
+    TCGProfileLine *l;
+    int i;
+
+    memset(r, 0, sizeof(*r));
+    tcg_profile_drain();
+    g_hash_table_foreach(tcg_profile_entries, tcg_profile_collect_one, r);
+    qsort(r->lines, r->nb_lines, sizeof(TCGProfileLine),
+          tcg_profile_line_cmp);
+
+    for (i = 0; i < r->nb_lines; i++) {
+        l = &r->lines[i];
+        if (l->kind == TCG_PROFILE_KIND_QEMU) {
+            l->symbol = "[qemu]";
+        } else if (!l->symbol) {
+            snprintf(l->buf, sizeof(l->buf), "0x" TARGET_FMT_lx, l->pc);
+            l->symbol = l->buf;
+        }
+    }
+}
+
+TcgProfileInfo *qmp_query_tcg_profile(bool has_limit, int64_t limit,
+                                      bool has_reset, bool reset,
+                                      Error **errp)
+{
+    TcgProfileInfo *info = g_malloc0(sizeof(*info));
+    TcgProfileCpuList *cpu, **cpu_tail = &info->cpus;
+    TcgProfileEntryList *entry, **entry_tail = &info->entries;
+    TCGProfileReport r;
+    TCGProfileLine *l;
+    int i;
+
+    if (!tcg_profile_entries) {
+        tcg_profile_reset();
+    }
+    tcg_profile_collect(&r);
+
+    info->enabled = tcg_profile_enabled;
+    info->period_ns = tcg_profile_period_ns;
+    info->samples = tcg_profile_samples;
+    info->dropped = tcg_profile_dropped;
+
+    for (i = 0; i < smp_cpus; i++) {
+        cpu = g_malloc0(sizeof(*cpu));
+        cpu->value = g_malloc0(sizeof(*cpu->value));
+        cpu->value->cpu = i;
+        cpu->value->samples = tcg_profile_cpu_samples[i];
+        cpu->value->time_ns = tcg_profile_cpu_samples[i] *
+                              tcg_profile_period_ns;
+        *cpu_tail = cpu;
+        cpu_tail = &cpu->next;
+    }
+
+    for (i = 0; i < r.nb_lines && (!has_limit || i < limit); i++) {
+        l = &r.lines[i];
+        entry = g_malloc0(sizeof(*entry));
+        entry->value = g_malloc0(sizeof(*entry->value));
+        entry->value->has_cpu = l->cpu_index >= 0;
+        entry->value->cpu = l->cpu_index;
+        entry->value->kind = l->kind;
+        entry->value->symbol = g_strdup(l->symbol);
+        entry->value->has_pc = l->has_pc;
+        entry->value->pc = l->pc;
+        entry->value->samples = l->samples;
+        entry->value->time_ns = l->samples * tcg_profile_period_ns;
+        *entry_tail = entry;
+        entry_tail = &entry->next;
+    }
+    g_free(r.lines);
+
+    if (has_reset && reset) {
+        tcg_profile_reset();
+    }
+    return info;
+}
+
+void qmp_tcg_profile_dump(const char *filename, Error **errp)
+{
+    TCGProfileReport r;
+    TCGProfileLine *l;
+    FILE *f;
+    int i;
+
+    f = fopen(filename, "w");
+    if (!f) {
+        error_set(errp, QERR_OPEN_FILE_FAILED, filename);
+        return;
+    }
+    if (!tcg_profile_entries) {
+        tcg_profile_reset();
+    }
+    tcg_profile_collect(&r);
+    for (i = 0; i < r.nb_lines; i++) {
+        l = &r.lines[i];
+        if (l->cpu_index >= 0) {
+            fprintf(f, "cpu%d;", l->cpu_index);
+        } else {
+            fprintf(f, "[none];");
+        }
+        fprintf(f, "%s%s %" PRIu64 "\n", l->symbol,
+                l->kind == TCG_PROFILE_KIND_HELPER ? ";[helper]" : "",
+                l->samples);
+    }
+    g_free(r.lines);
+    if (fclose(f) != 0) {
+        error_set(errp, QERR_IO_ERROR);
+    }
+}
+
+/* Control */
+
+void qmp_tcg_profile_start(bool has_hz, int64_t hz, bool has_symbols,
+                           const char *symbols, Error **errp)
+{
+#ifdef TCG_PROFILE_SUPPORTED
+    struct sigaction act;
+    struct sigevent ev;
+    struct itimerspec its;
+    clockid_t clock;
+
+    if (!tcg_enabled() || !first_cpu || !first_cpu->created) {
+        error_set(errp, QERR_UNSUPPORTED);
+        return;
+    }
+    if (!has_hz) {
+        hz = TCG_PROFILE_DEFAULT_HZ;
+    }
+    if (hz < 1 || hz > TCG_PROFILE_MAX_HZ) {
+        error_set(errp, QERR_INVALID_PARAMETER_VALUE, "hz",
+                  "a frequency between 1 and 100000");
+        return;
+    }
+    if (has_symbols && tcg_profile_load_symbols(symbols) < 0) {
+        error_set(errp, QERR_OPEN_FILE_FAILED, symbols);
+        return;
+    }
+
+    if (tcg_profile_enabled) {
+        qmp_tcg_profile_stop(NULL);
+    }
+    if (!tcg_profile_entries) {
+        tcg_profile_reset();
+    }
+
+    /* all vCPUs share one thread under TCG; sample its CPU time */
+    if (pthread_getcpuclockid(first_cpu->thread->thread, &clock) != 0) {
+        error_set(errp, QERR_UNSUPPORTED);
+        return;
+    }
+
+    memset(&act, 0, sizeof(act));
+    sigfillset(&act.sa_mask);
+    act.sa_flags = SA_SIGINFO | SA_RESTART;
+    act.sa_sigaction = tcg_profile_signal;
+    sigaction(SIGPROF, &act, NULL);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.sigev_notify = SIGEV_THREAD_ID;
+    ev._sigev_un._tid = first_cpu->thread_id;
+    ev.sigev_signo = SIGPROF;
+    if (timer_create(clock, &ev, &tcg_profile_timer) != 0) {
+        error_set(errp, QERR_UNSUPPORTED);
+        return;
+    }
+
+    tcg_profile_period_ns = 1000000000LL / hz;
+    its.it_interval.tv_sec = tcg_profile_period_ns / 1000000000LL;
+    its.it_interval.tv_nsec = tcg_profile_period_ns % 1000000000LL;
+    its.it_value = its.it_interval;
+    timer_settime(tcg_profile_timer, 0, &its, NULL);
+
+    if (!tcg_profile_drain_timer) {
+        tcg_profile_drain_timer = qemu_new_timer_ms(rt_clock,
+                                                    tcg_profile_drain_cb,
+                                                    NULL);
+    }
+    qemu_mod_timer(tcg_profile_drain_timer,
+                   qemu_get_clock_ms(rt_clock) + TCG_PROFILE_DRAIN_MS);
+    tcg_profile_enabled = true;
+#else
+    error_set(errp, QERR_UNSUPPORTED);
+#endif
+}
+
+void qmp_tcg_profile_stop(Error **errp)
+{
+#ifdef TCG_PROFILE_SUPPORTED
+    if (!tcg_profile_enabled) {
+        return;
+    }
+    timer_delete(tcg_profile_timer);
+    qemu_del_timer(tcg_profile_drain_timer);
+    tcg_profile_drain();
+    tcg_profile_enabled = false;
+#endif
+}
+
+/* -tcg-profile hz=N,symbols=FILE,dump=FILE */
+void tcg_profile_init(QemuOpts *opts)
+{
+    const char *symbols = qemu_opt_get(opts, "symbols");
+    const char *dump = qemu_opt_get(opts, "dump");
+    Error *err = NULL;
+
+    qmp_tcg_profile_start(qemu_opt_get(opts, "hz") != NULL,
+                          qemu_opt_get_number(opts, "hz", 0),
+                          symbols != NULL, symbols, &err);
+    if (err) {
+        fprintf(stderr, "-tcg-profile: %s\n", error_get_pretty(err));
+        error_free(err);
+        exit(1);
+    }
+    if (dump) {
+        tcg_profile_dump_file = g_strdup(dump);
+    }
+}
+
+/* Write the folded stacks requested with -tcg-profile dump=FILE.  */
+void tcg_profile_exit(void)
+{
+    Error *err = NULL;
+
+    if (!tcg_profile_dump_file) {
+        return;
+    }
+    qmp_tcg_profile_stop(NULL);
+    qmp_tcg_profile_dump(tcg_profile_dump_file, &err);
+    if (err) {
+        fprintf(stderr, "-tcg-profile: %s\n", error_get_pretty(err));
+        error_free(err);
+    }
+}
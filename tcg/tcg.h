@@ -145,6 +145,11 @@ typedef struct TCGPool {
 
 #define TCG_MAX_TEMPS 512
 
+#if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
+/* at most one qemu_ld/st slow path per op in a TB */
+#define TCG_MAX_QEMU_LDST 640
+#endif
+
 /* when the size of the arguments of a called function is smaller than
    this value, they are statically allocated in the TB stack frame */
 #define TCG_STATIC_CALL_ARGS_SIZE 128
@@ -333,6 +338,22 @@ typedef struct TCGHelperInfo {
     const char *name;
 } TCGHelperInfo;
 
+#if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
+/* TLB miss path of a qemu_ld/st op, emitted out of line at the end of
+   the TB so that the fast path is only the TLB compare and the access. */
+typedef struct TCGLabelQemuLdst {
+    int is_ld;              /* qemu_ld: 1, qemu_st: 0 */
+    int opc;
+    int addrlo_reg;         /* low word of the guest virtual address */
+    int addrhi_reg;         /* high word of the guest virtual address */
+    int datalo_reg;         /* low word of the data loaded or stored */
+    int datahi_reg;         /* high word of the data loaded or stored */
+    int mem_index;          /* softmmu memory index */
+    uint8_t *raddr;         /* return address in the fast path */
+    uint8_t *label_ptr[2];  /* TLB miss branches to be patched */
+} TCGLabelQemuLdst;
+#endif
+
 typedef struct TCGContext TCGContext;
 
 struct TCGContext {
@@ -373,6 +394,12 @@ struct TCGContext {
     int allocated_helpers;
     int helpers_sorted;
 
+#if defined(CONFIG_QEMU_LDST_OPTIMIZATION) && defined(CONFIG_SOFTMMU)
+    /* qemu_ld/st slow paths pending emission at the end of the TB */
+    TCGLabelQemuLdst qemu_ldst_labels[TCG_MAX_QEMU_LDST];
+    int nb_qemu_ldst_labels;
+#endif
+
 #ifdef CONFIG_PROFILER
     /* profiling info */
     int64_t tb_count1;
@@ -0,0 +1,103 @@
+/*
+ * cutils.c tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include <glib.h>
+#include "qemu-common.h"
+
+static const char *zero_impls[] = { "generic", "sse2", "avx2" };
+
+/*
+ * Check buffer_is_zero() with every implementation the host supports, for
+ * all small lengths and alignments and with a single non-zero byte at each
+ * position.
+ */
+static void test_buffer_is_zero(void)
+{
+    uint8_t *buf = g_malloc0(8192);
+    size_t len, off, i;
+    int impl;
+
+    for (impl = 0; impl < ARRAY_SIZE(zero_impls); impl++) {
+        if (!buffer_is_zero_select(zero_impls[impl])) {
+            continue;
+        }
+        for (off = 0; off < 64; off++) {
+            for (len = 0; len <= 320; len++) {
+                g_assert(buffer_is_zero(buf + off, len));
+                for (i = 0; i < len; i++) {
+                    buf[off + i] = 0x80;
+                    g_assert(!buffer_is_zero(buf + off, len));
+                    buf[off + i] = 0;
+                }
+            }
+            len = 4096 + off;
+            g_assert(buffer_is_zero(buf + off, len));
+            buf[off + len - 1] = 1;
+            g_assert(!buffer_is_zero(buf + off, len));
+            buf[off + len - 1] = 0;
+        }
+    }
+    g_free(buf);
+}
+
+static void test_iovec_is_zero(void)
+{
+    uint8_t buf[3][600] = { };
+    QEMUIOVector qiov;
+
+    qemu_iovec_init(&qiov, 3);
+    qemu_iovec_add(&qiov, buf[0], 512);
+    qemu_iovec_add(&qiov, buf[1] + 3, 7);
+    qemu_iovec_add(&qiov, buf[2] + 1, 599);
+    g_assert(qemu_iovec_is_zero(&qiov));
+    buf[1][9] = 1;
+    g_assert(!qemu_iovec_is_zero(&qiov));
+    buf[1][9] = 0;
+    buf[2][599] = 1;
+    g_assert(!qemu_iovec_is_zero(&qiov));
+    qemu_iovec_destroy(&qiov);
+}
+
+static void perf_buffer_is_zero(void)
+{
+    static const size_t sizes[] = { 4096, 65536, 2 * 1024 * 1024 };
+    size_t total = 256 * 1024 * 1024;
+    uint8_t *buf = qemu_memalign(64, sizes[ARRAY_SIZE(sizes) - 1]);
+    unsigned int i, n, iterations;
+    double duration;
+    int impl;
+
+    memset(buf, 0, sizes[ARRAY_SIZE(sizes) - 1]);
+    for (impl = 0; impl < ARRAY_SIZE(zero_impls); impl++) {
+        if (!buffer_is_zero_select(zero_impls[impl])) {
+            continue;
+        }
+        for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+            iterations = total / sizes[i];
+            g_test_timer_start();
+            for (n = 0; n < iterations; n++) {
+                g_assert(buffer_is_zero(buf, sizes[i]));
+            }
+            duration = g_test_timer_elapsed();
+            g_test_message("%s, %zu bytes: %.0f MB/s\n", zero_impls[impl],
+                           sizes[i], total / duration / 1e6);
+        }
+    }
+    qemu_vfree(buf);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/buffer_is_zero", test_buffer_is_zero);
+    g_test_add_func("/cutils/iovec_is_zero", test_iovec_is_zero);
+    if (g_test_perf()) {
+        g_test_add_func("/perf/buffer_is_zero", perf_buffer_is_zero);
+    }
+    return g_test_run();
+}
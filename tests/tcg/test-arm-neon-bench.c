@@ -0,0 +1,84 @@
+/*
+ * NEON micro-benchmark: time per instruction class of the Q forms of
+ * common integer ops.  Run it under two qemu-arm builds to compare
+ * their translation of these instructions.
+ *
+ *   ./qemu-arm -cpu cortex-a8 test-arm-neon-bench [iterations]
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/* Each loop iteration executes the instruction 8 times.  */
+#define BENCH(name, insn)                                               \
+static void bench_##name(unsigned long n)                               \
+{                                                                       \
+    __asm__ __volatile__(                                               \
+        "1:\n\t"                                                        \
+        insn "\n\t" insn "\n\t" insn "\n\t" insn "\n\t"                 \
+        insn "\n\t" insn "\n\t" insn "\n\t" insn "\n\t"                 \
+        "subs %0, %0, #1\n\t"                                           \
+        "bne 1b\n\t"                                                    \
+        : "+r" (n) : : "cc", "d0", "d1", "d2", "d3", "d4", "d5");       \
+}
+
+BENCH(vadd_i8, "vadd.i8 q0, q1, q2")
+BENCH(vadd_i16, "vadd.i16 q0, q1, q2")
+BENCH(vadd_i32, "vadd.i32 q0, q1, q2")
+BENCH(vsub_i8, "vsub.i8 q0, q1, q2")
+BENCH(vqadd_u8, "vqadd.u8 q0, q1, q2")
+BENCH(vqadd_s16, "vqadd.s16 q0, q1, q2")
+BENCH(vqsub_s8, "vqsub.s8 q0, q1, q2")
+BENCH(vmax_u8, "vmax.u8 q0, q1, q2")
+BENCH(vmin_s16, "vmin.s16 q0, q1, q2")
+BENCH(vabd_u8, "vabd.u8 q0, q1, q2")
+BENCH(vcgt_s32, "vcgt.s32 q0, q1, q2")
+BENCH(vceq_i8, "vceq.i8 q0, q1, q2")
+BENCH(vtst_16, "vtst.16 q0, q1, q2")
+
+static const struct {
+    const char *name;
+    void (*fn)(unsigned long n);
+} benches[] = {
+    { "vadd.i8", bench_vadd_i8 },
+    { "vadd.i16", bench_vadd_i16 },
+    { "vadd.i32", bench_vadd_i32 },
+    { "vsub.i8", bench_vsub_i8 },
+    { "vqadd.u8", bench_vqadd_u8 },
+    { "vqadd.s16", bench_vqadd_s16 },
+    { "vqsub.s8", bench_vqsub_s8 },
+    { "vmax.u8", bench_vmax_u8 },
+    { "vmin.s16", bench_vmin_s16 },
+    { "vabd.u8", bench_vabd_u8 },
+    { "vcgt.s32", bench_vcgt_s32 },
+    { "vceq.i8", bench_vceq_i8 },
+    { "vtst.16", bench_vtst_16 },
+};
+
+static double now(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long n = 1000000;
+    unsigned int i;
+    double t;
+
+    if (argc > 1) {
+        n = strtoul(argv[1], NULL, 0);
+    }
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        t = now();
+        benches[i].fn(n);
+        t = now() - t;
+        printf("%-12s %8.2f ns/insn\n", benches[i].name, t * 1e9 / (n * 8));
+    }
+    return 0;
+}
@@ -0,0 +1,290 @@
+/*
+ * Check the Q forms of the common NEON integer ops against a C model,
+ * lane by lane, on edge values: sign boundaries, saturation in both
+ * directions, all-ones and zero lanes.  The saturating ops must also
+ * set FPSCR.QC exactly when a lane saturates.  Each op is run both
+ * with a separate destination and with the destination aliasing the
+ * first source.
+ *
+ *   ./qemu-arm -cpu cortex-a8 test-arm-neon
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FPSCR_QC (1 << 27)
+
+enum {
+    OP_ADD, OP_SUB, OP_QADD, OP_QSUB, OP_MAX, OP_MIN, OP_ABD,
+    OP_CGT, OP_CGE, OP_CEQ, OP_TST,
+};
+
+static uint32_t get_fpscr(void)
+{
+    uint32_t val;
+
+    __asm__ __volatile__("vmrs %0, fpscr" : "=r" (val));
+    return val;
+}
+
+static void set_fpscr(uint32_t val)
+{
+    __asm__ __volatile__("vmsr fpscr, %0" : : "r" (val));
+}
+
+/* D = N op M, then N = N op M in place into D2.  */
+#define QOP(name, insn)                                                 \
+static void name(uint8_t *d, uint8_t *d2, const uint8_t *n,             \
+                 const uint8_t *m)                                      \
+{                                                                       \
+    __asm__ __volatile__(                                               \
+        "vld1.8 {d2, d3}, [%2]\n\t"                                     \
+        "vld1.8 {d4, d5}, [%3]\n\t"                                     \
+        insn " q0, q1, q2\n\t"                                          \
+        insn " q1, q1, q2\n\t"                                          \
+        "vst1.8 {d0, d1}, [%0]\n\t"                                     \
+        "vst1.8 {d2, d3}, [%1]\n\t"                                     \
+        : : "r" (d), "r" (d2), "r" (n), "r" (m)                         \
+        : "memory", "d0", "d1", "d2", "d3", "d4", "d5");                \
+}
+
+QOP(vadd_i8, "vadd.i8")
+QOP(vadd_i16, "vadd.i16")
+QOP(vadd_i32, "vadd.i32")
+QOP(vsub_i8, "vsub.i8")
+QOP(vsub_i16, "vsub.i16")
+QOP(vsub_i32, "vsub.i32")
+QOP(vqadd_s8, "vqadd.s8")
+QOP(vqadd_u8, "vqadd.u8")
+QOP(vqadd_s16, "vqadd.s16")
+QOP(vqadd_u16, "vqadd.u16")
+QOP(vqsub_s8, "vqsub.s8")
+QOP(vqsub_u8, "vqsub.u8")
+QOP(vqsub_s16, "vqsub.s16")
+QOP(vqsub_u16, "vqsub.u16")
+QOP(vmax_s8, "vmax.s8")
+QOP(vmax_u8, "vmax.u8")
+QOP(vmax_s16, "vmax.s16")
+QOP(vmax_u16, "vmax.u16")
+QOP(vmax_s32, "vmax.s32")
+QOP(vmax_u32, "vmax.u32")
+QOP(vmin_s8, "vmin.s8")
+QOP(vmin_u8, "vmin.u8")
+QOP(vmin_s16, "vmin.s16")
+QOP(vmin_u16, "vmin.u16")
+QOP(vmin_s32, "vmin.s32")
+QOP(vmin_u32, "vmin.u32")
+QOP(vabd_s8, "vabd.s8")
+QOP(vabd_u8, "vabd.u8")
+QOP(vabd_s16, "vabd.s16")
+QOP(vabd_u16, "vabd.u16")
+QOP(vabd_s32, "vabd.s32")
+QOP(vabd_u32, "vabd.u32")
+QOP(vcgt_s8, "vcgt.s8")
+QOP(vcgt_u8, "vcgt.u8")
+QOP(vcgt_s16, "vcgt.s16")
+QOP(vcgt_u16, "vcgt.u16")
+QOP(vcgt_s32, "vcgt.s32")
+QOP(vcgt_u32, "vcgt.u32")
+QOP(vcge_s8, "vcge.s8")
+QOP(vcge_u8, "vcge.u8")
+QOP(vcge_s16, "vcge.s16")
+QOP(vcge_u16, "vcge.u16")
+QOP(vcge_s32, "vcge.s32")
+QOP(vcge_u32, "vcge.u32")
+QOP(vceq_i8, "vceq.i8")
+QOP(vceq_i16, "vceq.i16")
+QOP(vceq_i32, "vceq.i32")
+QOP(vtst_8, "vtst.8")
+QOP(vtst_16, "vtst.16")
+QOP(vtst_32, "vtst.32")
+
+static const struct {
+    const char *name;
+    int op, size, u;
+    void (*fn)(uint8_t *d, uint8_t *d2, const uint8_t *n, const uint8_t *m);
+} tests[] = {
+    { "vadd.i8", OP_ADD, 0, 1, vadd_i8 },
+    { "vadd.i16", OP_ADD, 1, 1, vadd_i16 },
+    { "vadd.i32", OP_ADD, 2, 1, vadd_i32 },
+    { "vsub.i8", OP_SUB, 0, 1, vsub_i8 },
+    { "vsub.i16", OP_SUB, 1, 1, vsub_i16 },
+    { "vsub.i32", OP_SUB, 2, 1, vsub_i32 },
+    { "vqadd.s8", OP_QADD, 0, 0, vqadd_s8 },
+    { "vqadd.u8", OP_QADD, 0, 1, vqadd_u8 },
+    { "vqadd.s16", OP_QADD, 1, 0, vqadd_s16 },
+    { "vqadd.u16", OP_QADD, 1, 1, vqadd_u16 },
+    { "vqsub.s8", OP_QSUB, 0, 0, vqsub_s8 },
+    { "vqsub.u8", OP_QSUB, 0, 1, vqsub_u8 },
+    { "vqsub.s16", OP_QSUB, 1, 0, vqsub_s16 },
+    { "vqsub.u16", OP_QSUB, 1, 1, vqsub_u16 },
+    { "vmax.s8", OP_MAX, 0, 0, vmax_s8 },
+    { "vmax.u8", OP_MAX, 0, 1, vmax_u8 },
+    { "vmax.s16", OP_MAX, 1, 0, vmax_s16 },
+    { "vmax.u16", OP_MAX, 1, 1, vmax_u16 },
+    { "vmax.s32", OP_MAX, 2, 0, vmax_s32 },
+    { "vmax.u32", OP_MAX, 2, 1, vmax_u32 },
+    { "vmin.s8", OP_MIN, 0, 0, vmin_s8 },
+    { "vmin.u8", OP_MIN, 0, 1, vmin_u8 },
+    { "vmin.s16", OP_MIN, 1, 0, vmin_s16 },
+    { "vmin.u16", OP_MIN, 1, 1, vmin_u16 },
+    { "vmin.s32", OP_MIN, 2, 0, vmin_s32 },
+    { "vmin.u32", OP_MIN, 2, 1, vmin_u32 },
+    { "vabd.s8", OP_ABD, 0, 0, vabd_s8 },
+    { "vabd.u8", OP_ABD, 0, 1, vabd_u8 },
+    { "vabd.s16", OP_ABD, 1, 0, vabd_s16 },
+    { "vabd.u16", OP_ABD, 1, 1, vabd_u16 },
+    { "vabd.s32", OP_ABD, 2, 0, vabd_s32 },
+    { "vabd.u32", OP_ABD, 2, 1, vabd_u32 },
+    { "vcgt.s8", OP_CGT, 0, 0, vcgt_s8 },
+    { "vcgt.u8", OP_CGT, 0, 1, vcgt_u8 },
+    { "vcgt.s16", OP_CGT, 1, 0, vcgt_s16 },
+    { "vcgt.u16", OP_CGT, 1, 1, vcgt_u16 },
+    { "vcgt.s32", OP_CGT, 2, 0, vcgt_s32 },
+    { "vcgt.u32", OP_CGT, 2, 1, vcgt_u32 },
+    { "vcge.s8", OP_CGE, 0, 0, vcge_s8 },
+    { "vcge.u8", OP_CGE, 0, 1, vcge_u8 },
+    { "vcge.s16", OP_CGE, 1, 0, vcge_s16 },
+    { "vcge.u16", OP_CGE, 1, 1, vcge_u16 },
+    { "vcge.s32", OP_CGE, 2, 0, vcge_s32 },
+    { "vcge.u32", OP_CGE, 2, 1, vcge_u32 },
+    { "vceq.i8", OP_CEQ, 0, 1, vceq_i8 },
+    { "vceq.i16", OP_CEQ, 1, 1, vceq_i16 },
+    { "vceq.i32", OP_CEQ, 2, 1, vceq_i32 },
+    { "vtst.8", OP_TST, 0, 1, vtst_8 },
+    { "vtst.16", OP_TST, 1, 1, vtst_16 },
+    { "vtst.32", OP_TST, 2, 1, vtst_32 },
+};
+
+/* Every lane size sees its zero, one, minimum, maximum and all-ones
+   values in several lanes, against each of the others.  */
+static const uint32_t inputs[][4] = {
+    { 0x00000000, 0x00000001, 0x7fffffff, 0x80000000 },
+    { 0xffffffff, 0x7f7f7f7f, 0x80808080, 0x01ff7f80 },
+    { 0x7fff8000, 0xffff0001, 0x80007fff, 0x12345678 },
+    { 0xfedcba98, 0x00ff00ff, 0xff00ff00, 0x807f0180 },
+    { 0x80000000, 0xffffffff, 0x00000001, 0x7fffffff },
+};
+
+static uint32_t get_lane(const uint8_t *v, int size, int i)
+{
+    uint32_t val = 0;
+    int j;
+
+    for (j = (1 << size) - 1; j >= 0; j--) {
+        val = (val << 8) | v[(i << size) + j];
+    }
+    return val;
+}
+
+static int64_t lane_value(uint32_t val, int bits, int u)
+{
+    if (!u && (val & (1ULL << (bits - 1)))) {
+        return (int64_t)val - (1LL << bits);
+    }
+    return val;
+}
+
+/* Reference result of one lane; *sat is set if it saturated.  */
+static uint32_t ref_lane(int op, int size, int u, uint32_t a, uint32_t b,
+                         int *sat)
+{
+    int bits = 8 << size;
+    uint32_t mask = (uint32_t)((1ULL << bits) - 1);
+    int64_t sa = lane_value(a, bits, u);
+    int64_t sb = lane_value(b, bits, u);
+    int64_t res, lo, hi;
+
+    switch (op) {
+    case OP_ADD:
+        return (a + b) & mask;
+    case OP_SUB:
+        return (a - b) & mask;
+    case OP_MAX:
+        return sa > sb ? a : b;
+    case OP_MIN:
+        return sa < sb ? a : b;
+    case OP_ABD:
+        return (uint32_t)(sa > sb ? sa - sb : sb - sa) & mask;
+    case OP_CGT:
+        return sa > sb ? mask : 0;
+    case OP_CGE:
+        return sa >= sb ? mask : 0;
+    case OP_CEQ:
+        return a == b ? mask : 0;
+    case OP_TST:
+        return (a & b) ? mask : 0;
+    }
+
+    res = op == OP_QADD ? sa + sb : sa - sb;
+    lo = u ? 0 : -(1LL << (bits - 1));
+    hi = u ? (int64_t)mask : (1LL << (bits - 1)) - 1;
+    if (res < lo) {
+        res = lo;
+        *sat = 1;
+    } else if (res > hi) {
+        res = hi;
+        *sat = 1;
+    }
+    return (uint32_t)res & mask;
+}
+
+static int check(int t, const uint8_t *n, const uint8_t *m,
+                 const uint8_t *res, int qc, const char *form)
+{
+    int size = tests[t].size;
+    int i, sat = 0, errors = 0;
+    uint32_t a, b, expected, got;
+
+    for (i = 0; i < 16 >> size; i++) {
+        a = get_lane(n, size, i);
+        b = get_lane(m, size, i);
+        expected = ref_lane(tests[t].op, size, tests[t].u, a, b, &sat);
+        got = get_lane(res, size, i);
+        if (got != expected) {
+            printf("FAIL %s %s lane %d: %08x, %08x -> %08x, expected %08x\n",
+                   tests[t].name, form, i, a, b, got, expected);
+            errors++;
+        }
+    }
+    if ((tests[t].op == OP_QADD || tests[t].op == OP_QSUB) && qc != sat) {
+        printf("FAIL %s %s: QC %d, expected %d\n",
+               tests[t].name, form, qc, sat);
+        errors++;
+    }
+    return errors;
+}
+
+int main(void)
+{
+    unsigned int t, i, j;
+    uint8_t n[16], m[16], d[16], d2[16];
+    uint32_t fpscr;
+    unsigned int nb_inputs = sizeof(inputs) / sizeof(inputs[0]);
+    int errors = 0, qc;
+
+    for (t = 0; t < sizeof(tests) / sizeof(tests[0]); t++) {
+        for (i = 0; i < nb_inputs; i++) {
+            for (j = 0; j < nb_inputs; j++) {
+                memcpy(n, inputs[i], 16);
+                memcpy(m, inputs[j], 16);
+                fpscr = get_fpscr();
+                set_fpscr(fpscr & ~FPSCR_QC);
+                tests[t].fn(d, d2, n, m);
+                qc = (get_fpscr() & FPSCR_QC) != 0;
+                set_fpscr(fpscr);
+                /* both forms saturate the same lanes, so QC covers both */
+                errors += check(t, n, m, d, qc, "q0, q1, q2");
+                errors += check(t, n, m, d2, qc, "q1, q1, q2");
+            }
+        }
+    }
+    if (errors) {
+        printf("%d errors\n", errors);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -138,6 +138,9 @@ int main(int argc, char **argv)
 #include "cache-utils.h"
 #include "block.h"
 #include "blockdev.h"
+#ifndef _WIN32
+#include "block/raw-posix-aio.h"
+#endif
 #include "block-migration.h"
 #include "dma.h"
 #include "audio/audio.h"
@@ -164,6 +167,7 @@ int main(int argc, char **argv)
 #include "qemu-queue.h"
 #include "cpus.h"
 #include "arch_init.h"
+#include "replay.h"
 
 #include "ui/qemu-spice.h"
 
@@ -430,7 +434,12 @@ void qemu_get_timedate(struct tm *tm, int offset)
     time_t ti;
     struct tm *ret;
 
-    time(&ti);
+    if (replay_mode != REPLAY_MODE_NONE) {
+        ti = replay_start_time() +
+             qemu_get_clock_ns(vm_clock) / get_ticks_per_sec();
+    } else {
+        time(&ti);
+    }
     ti += offset;
     if (rtc_date_offset == -1) {
         if (rtc_utc)
@@ -511,6 +520,28 @@ static void configure_rtc_date_offset(const char *startdate, int legacy)
     }
 }
 
+static void configure_aio_threads(QemuOpts *opts)
+{
+#ifndef _WIN32
+    const char *value;
+    uint64_t max;
+
+    max = qemu_opt_get_number(opts, "max", 0);
+    if (max > INT_MAX) {
+        fprintf(stderr, "qemu: invalid number of I/O threads\n");
+        exit(1);
+    } else if (max) {
+        paio_set_max_threads(max);
+    }
+
+    value = qemu_opt_get(opts, "cpus");
+    if (value && paio_set_thread_affinity(value) < 0) {
+        fprintf(stderr, "qemu: invalid I/O thread cpus '%s'\n", value);
+        exit(1);
+    }
+#endif
+}
+
 static void configure_rtc(QemuOpts *opts)
 {
     const char *value;
@@ -3005,6 +3036,13 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_startdate:
                 configure_rtc_date_offset(optarg, 1);
                 break;
+            case QEMU_OPTION_aio_threads:
+                opts = qemu_opts_parse(qemu_find_opts("aio-threads"), optarg, 0);
+                if (!opts) {
+                    exit(1);
+                }
+                configure_aio_threads(opts);
+                break;
             case QEMU_OPTION_rtc:
                 opts = qemu_opts_parse(qemu_find_opts("rtc"), optarg, 0);
                 if (!opts) {
@@ -3018,9 +3056,29 @@ int main(int argc, char **argv, char **envp)
                     tcg_tb_size = 0;
                 }
                 break;
+            case QEMU_OPTION_tcg_profile:
+                if (!qemu_opts_parse(qemu_find_opts("tcg-profile"),
+                                     optarg, 0)) {
+                    exit(1);
+                }
+                break;
+            case QEMU_OPTION_tcg_slice:
+                set_tcg_slice(optarg);
+                break;
+            case QEMU_OPTION_tb_trace_threshold:
+                tb_trace_threshold = strtol(optarg, NULL, 0);
+                if (tb_trace_threshold < 0) {
+                    tb_trace_threshold = 0;
+                }
+                break;
             case QEMU_OPTION_icount:
                 icount_option = optarg;
                 break;
+            case QEMU_OPTION_replay:
+                if (!qemu_opts_parse(qemu_find_opts("replay"), optarg, 1)) {
+                    exit(1);
+                }
+                break;
             case QEMU_OPTION_incoming:
                 incoming = optarg;
                 break;
@@ -3216,6 +3274,17 @@ int main(int argc, char **argv, char **envp)
 
     socket_init();
 
+    /* before any chardev or net client is created */
+    opts = qemu_opts_find(qemu_find_opts("replay"), NULL);
+    if (opts) {
+        if (!icount_option || !strcmp(icount_option, "auto")) {
+            fprintf(stderr, "-replay requires a fixed -icount shift\n");
+            exit(1);
+        }
+        replay_configure(opts);
+        rtc_clock = vm_clock;
+    }
+
     if (qemu_opts_foreach(qemu_find_opts("chardev"), chardev_init_func, NULL, 1) != 0)
         exit(1);
 #ifdef CONFIG_VIRTFS
@@ -3407,6 +3476,11 @@ int main(int argc, char **argv, char **envp)
     if (qemu_opts_foreach(qemu_find_opts("device"), device_init_func, NULL, 1) != 0)
         exit(1);
 
+    opts = qemu_opts_find(qemu_find_opts("tcg-profile"), NULL);
+    if (opts) {
+        tcg_profile_init(opts);
+    }
+
     net_check_clients();
 
     /* just use the first displaystate for the moment */
@@ -3525,6 +3599,8 @@ int main(int argc, char **argv, char **envp)
     main_loop();
     bdrv_close_all();
     pause_all_vcpus();
+    tcg_profile_exit();
+    replay_finish();
     net_cleanup();
     res_free();
 